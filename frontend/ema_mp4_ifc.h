@@ -54,7 +54,11 @@
 #ifndef __EMA_MP4IFC_H__
 #define __EMA_MP4IFC_H__
 
-#include "mp4_ctrl.h"  /** mp4_ctrl_handle_t */
+#include "mp4_ctrl.h"         /** mp4_ctrl_handle_t */
+#include "mp4_parse_cache.h"  /** mp4_parse_cache_handle_t */
+#include "mp4_checkpoint.h"   /** mp4_checkpoint_handle_t */
+#include "io_digest.h"        /** digest_cb_t */
+#include "io_rope.h"          /** bbio_iovec_t, segment_cb_t */
 
 #define MAX_INPUT_ES_NUM  16  /** supports up to 16 elementary streams for now */
 #define CHK_ERR_RET(ret)  if ((ret) != EMA_MP4_MUXED_OK) return (ret);
@@ -78,6 +82,14 @@ struct ema_mp4_ctrl_t_
     /**** mux coresponding data sink, assume file only for now */
     bbio_handle_t mp4_sink;
     bbio_handle_t mp4_sink_el;
+    /**** the memory sink under mp4_sink for buffer output: owned by mp4_sink */
+    bbio_handle_t mp4_rope;
+    /**** the digests of what is written to mp4_sink go there, if set */
+    digest_cb_t digest_cb;
+    void *      digest_cb_instance;
+    /**** if set, the output files are written into memory and handed over to it when done */
+    segment_cb_t segment_cb;
+    void *       segment_cb_instance;
 
     /**** demux output base name */
     int8_t  * fn_out;
@@ -85,6 +97,15 @@ struct ema_mp4_ctrl_t_
 
     /**** mux coresponding data sources, assume file only for now */
     bbio_handle_t data_srcs[MAX_STREAMS];
+    /**** their parse cache sidecars, if one is used */
+    mp4_parse_cache_handle_t parse_caches[MAX_STREAMS];
+
+    /**** the checkpoint of the job, if kept, and how much of the output is complete */
+    mp4_checkpoint_handle_t checkpoint;
+    uint32_t frag_num;             /** fragments begun so far */
+    uint32_t resume_frag_num;      /** complete in the output a previous run left */
+    int64_t  resume_size;          /** bytes of the output file up to the end of them */
+    uint32_t resume_segment_num;   /** media segments complete, for a segmented output */
 
     /**** demux input */
     int8_t  *        fn_in;
@@ -163,16 +184,72 @@ uint32_t ema_mp4_mux_set_input(ema_mp4_ctrl_handle_t handle,
                           uint32_t chunk_span_size, 
                           uint32_t tid);
 
+/** \brief Makes the last input added by ema_mp4_mux_set_input() a nal length prefixed
+ *         H264/H265 stream instead of Annex B.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param fn: the file containing the avcC/hvcC (decoder configuration record, with or without
+ *        box header). It provides the nal length size and the parameter sets.
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_input_nal_config(ema_mp4_ctrl_handle_t handle, const int8_t *fn);
+
+/** \brief Makes the last input added by ema_mp4_mux_set_input() replace a track of the
+ *         file set by ema_mp4_mux_set_edit_file(). The new track gets its track ID.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param track_ID: the ID of the track replaced
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_input_replace(ema_mp4_ctrl_handle_t handle, uint32_t track_ID);
+
+/** \brief Adds the inputs as tracks to an existing, non fragmented mp4 file instead of
+ *         writing a new one. Only its 'moov' is rewritten: the samples are appended in a
+ *         new 'mdat', the media data already in the file is not touched.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param fn: the mp4 file edited
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_edit_file(ema_mp4_ctrl_handle_t handle, const int8_t *fn);
+
 /** \brief Defines the file name that contains the output mp4 file. The default name
  *         is test.mp4
  *
  * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
- * \param buf_out if none zero, provide a buffer interface output(TBD)
+ * \param buf_out if none zero, the mp4 file is written into memory instead of fn: see
+ *        ema_mp4_mux_get_output_iovec()
  * \param fn the file name
  * \return EMA_MP4_MUXED_...
  */
 uint32_t ema_mp4_mux_set_output(ema_mp4_ctrl_handle_t handle, int32_t buf_out, const int8_t  *fn);
 
+/** \brief Gets the counters of the muxing run: time per phase, I/O and memory
+ *
+ * They are kept all along, at the cost of a clock read on each side of what is timed.
+ * Best called once ema_mp4_mux_start() returned.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param metrics: filled with the counters
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_get_metrics(ema_mp4_ctrl_handle_t handle, mp4_metrics_t *metrics);
+
+/** \brief Gets the mp4 file written into memory (buffer output)
+ *
+ * The output is kept in fixed size blocks rather than in one buffer grown as it is
+ * written: there is no reallocation and no copy of what was written. The blocks are
+ * handed out as they are, to be written with writev() or uploaded.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param iov: filled with up to iov_num runs of bytes making up the mp4 file, in order. They
+ *        are valid until ema_mp4_mux_destroy()
+ * \param iov_num: number of entries of iov
+ * \return the number of runs making up the mp4 file: call again with a larger iov if more
+ *         than iov_num. 0 if no buffer output
+ */
+size_t ema_mp4_mux_get_output_iovec(ema_mp4_ctrl_handle_t handle, bbio_iovec_t *iov, size_t iov_num);
+
 /** \brief Sets the movie timescale
  *
  * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
@@ -264,6 +341,116 @@ uint32_t ema_mp4_mux_set_output_format(ema_mp4_ctrl_handle_t handle, const int8_
  */
 uint32_t ema_mp4_mux_set_max_duration(ema_mp4_ctrl_handle_t handle, uint32_t max_duration);
 
+/** \brief  Sets the number of threads H.264/HEVC elementary streams are parsed with
+ *
+ * The es is cut at IDR pictures and the pieces are parsed in parallel. Streams that
+ * can't be cut that way are parsed serially. The output is the same either way.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param thread_num: number of parsing threads. 0 or 1 for serial parsing (default).
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_parse_threads(ema_mp4_ctrl_handle_t handle, uint32_t thread_num);
+
+/** \brief  Sets the number of threads writing the 'mdat' payloads of a fragmented output
+ *
+ * The 'moof' boxes are written first, leaving room for the payloads at the offsets
+ * computed from the sample sizes; the payloads are then written there, each track on
+ * a thread of its own. Applies to a fragmented output to a single file with more than
+ * one track. The output is the same either way.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param thread_num: number of writing threads. 0 or 1 for serial writing (default).
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_write_threads(ema_mp4_ctrl_handle_t handle, uint32_t thread_num);
+
+/** \brief  Sets the directory parse cache sidecars are kept in
+ *
+ * The samples parsed from an es and the state they were muxed with are written to
+ * <dir>/<es file name>.pidx. When the same es is muxed again, the sidecar is used
+ * instead of parsing it. AC-3, E-AC-3, AC-4, AAC, H.264 and H.265 es are cached, except Dolby Vision
+ * es and AAC es changing their configuration. Any other es is parsed, with a warning.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param dir: an existing directory. NULL for no caching (default).
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_parse_cache(ema_mp4_ctrl_handle_t handle, const int8_t *dir);
+
+/** \brief  Sets if a checkpoint is kept, so that the job continues where it was interrupted
+ *
+ * As each fragment is complete, <output file>.ckpt records how many are and how far the
+ * output file is written. When the same job - same settings, same es files - is run again,
+ * the fragments the output holds already are regenerated but not written again, nor the
+ * media segments complete. The parse of each es is kept in <output file>.ckpt.<es index>.pidx
+ * as the 'moov' is output - in the parse cache directory instead, if one is set - so that the
+ * es are not parsed again but for those the parse cache doesn't take. The checkpoint and
+ * its .pidx files are removed once the job is done. For fragmented output to files only,
+ * with no digest or segment callback.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param enable: TRUE to keep a checkpoint. FALSE (default) not to.
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_checkpoint(ema_mp4_ctrl_handle_t handle, BOOL enable);
+
+/** \brief  Sets the time range of the es that is output
+ *
+ * Only the samples the range needs are output, with an edit list presenting each track from
+ * the exact start of the range. An avc or hevc es is parsed from the last IDR up to the start,
+ * found by a scan for start codes, and needs a constant frame rate; other es are parsed from
+ * their start, the samples before the range dropped. Not for dolby vision el es.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param start_ms: start of the range in ms, 0 (default) for the start of the es.
+ * \param end_ms: end of the range in ms, 0 (default) for the end of the es.
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_time_range(ema_mp4_ctrl_handle_t handle, uint32_t start_ms, uint32_t end_ms);
+
+/** \brief  Sets the allocator the muxer and the parsers of its es allocate from
+ *
+ * The parsers are created, run and destroyed with it, as are the muxer entries. A block
+ * is freed to the allocator it came from. Builds with ENABLE_MP4_ALLOC_HOOKS only.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param allocator: the alloc, realloc and free callbacks with their context, kept by
+ *        reference. NULL for libc (default).
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_allocator(ema_mp4_ctrl_handle_t handle, const mp4_allocator_t *allocator);
+
+/** \brief  Sets the callback getting the MD5 and SHA-256 digests of the output
+ *
+ * The output is hashed while it is written. The callback gets the digests of each output
+ * file when it is closed, and those of each fragment (a 'moof' with its 'mdat') of a
+ * fragmented output once its bytes are final. Not for tracks added to an existing file.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param cb: the callback. NULL for no digests (default).
+ * \param instance: handed to the callback
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_digest_callback(ema_mp4_ctrl_handle_t handle, digest_cb_t cb, void *instance);
+
+/** \brief  Sets the callback the output is handed over to instead of being written to files
+ *
+ * The output is written into memory, and each output file is handed over to the callback
+ * once complete, as the fixed size blocks it was written into: no copy, and no file to be
+ * read back to upload it. For DASH Live and HbbTV profiles, those are the initialization
+ * segment (number 0, the output file name) then each media segment with its 'styp', 'sidx',
+ * 'moof' and 'mdat' (number n, <name>_<n>.mp4). Otherwise it is the whole mp4 file. The
+ * last one is handed over before ema_mp4_mux_start() returns.
+ *
+ * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
+ * \param cb: the callback. It owns the blocks it gets, to be freed with sink_rope_free_iovec().
+ *        NULL to write files (default).
+ * \param instance: handed to the callback
+ * \return EMA_MP4_MUXED_...
+ */
+uint32_t ema_mp4_mux_set_segment_callback(ema_mp4_ctrl_handle_t handle, segment_cb_t cb, void *instance);
+
 /** \brief  Sets the video framerate value
  *
  * \param handle: the multiplexer handle returned by the ema_mp4_mux_create()
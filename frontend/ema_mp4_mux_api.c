@@ -29,10 +29,15 @@
 #include <time.h>
 #include "utils.h"
 #include "io_base.h"
+#include "io_resume.h"
+#include "io_splice.h"
 #include "registry.h"
 #include "dsi.h"
 #include "parser.h"
 #include "mp4_muxer.h"
+#include "mp4_demux.h"
+#include "parser_split.h"
+#include "mp4_trace.h"
 #include "ema_mp4_ifc.h" 
 
 
@@ -42,9 +47,79 @@ mux_data_sink_create(ema_mp4_ctrl_handle_t handle)
 {
     bbio_handle_t snk = NULL;
 
+    if ((handle->usr_cfg_mux.output_mode & EMA_MP4_IO_BUF) || handle->segment_cb)
+    {
+        const int8_t *name = handle->usr_cfg_mux.output_fn ? handle->usr_cfg_mux.output_fn : (const int8_t *)"buffer";
+
+        /** the segment names derive from the output file name */
+        if (handle->usr_cfg_mux.edit_mode ||
+            (handle->usr_cfg_mux.segment_output_flag && (!handle->segment_cb || !handle->usr_cfg_mux.output_fn)))
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Output to memory is a new file, or named segments handed to the segment callback.\n");
+            return EMA_MP4_MUXED_PARAM_ERR;
+        }
+        /** blocks rather than one buffer: no realloc and copy of all written as it grows */
+        snk = reg_bbio_get('c', 'w');
+        if (!snk)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+        if (handle->segment_cb)
+        {
+            sink_rope_deliver(snk, handle->segment_cb, handle->segment_cb_instance);
+        }
+        handle->mp4_rope = snk;
+        if (handle->digest_cb)
+        {
+            bbio_handle_t digest_snk = digest_sink_create(snk, handle->digest_cb, handle->digest_cb_instance);
+
+            if (!digest_snk)
+            {
+                snk->destroy(snk);
+                handle->mp4_rope = NULL;
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+            snk = digest_snk;
+        }
+        handle->mp4_sink = snk;
+        return snk->open(snk, name) ? EMA_MP4_MUXED_NO_MEM : EMA_MP4_MUXED_OK;
+    }
+
     if (handle->usr_cfg_mux.output_mode & EMA_MP4_IO_FILE)
     {
-        snk              = reg_bbio_get('f', 'w');
+        /** the output a previous run left is continued: not truncated */
+        snk = reg_bbio_get('f', (handle->usr_cfg_mux.edit_mode || handle->resume_size > 0) ? 'e' : 'w');
+        if (snk && handle->checkpoint)
+        {
+            bbio_handle_t resume_snk = resume_sink_create(snk);
+
+            if (!resume_snk)
+            {
+                snk->destroy(snk);
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+            snk = resume_snk;
+            if (handle->resume_segment_num)
+            {
+                /** the init segment is complete */
+                sink_resume_skip(snk, -1);
+            }
+            else
+            {
+                sink_resume_skip(snk, handle->resume_size);
+            }
+        }
+        if (snk && handle->digest_cb)
+        {
+            bbio_handle_t digest_snk = digest_sink_create(snk, handle->digest_cb, handle->digest_cb_instance);
+
+            if (!digest_snk)
+            {
+                snk->destroy(snk);
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+            snk = digest_snk;
+        }
         handle->mp4_sink = snk;                     /** keep it in handle to be freed by ema_mp4_mux_destroy() */
         if (snk->open(snk, handle->usr_cfg_mux.output_fn))
         {
@@ -53,12 +128,6 @@ mux_data_sink_create(ema_mp4_ctrl_handle_t handle)
         }
     }
 
-    if (handle->usr_cfg_mux.output_mode & EMA_MP4_IO_BUF)
-    {
-        msglog(NULL, MSGLOG_ERR, "ERROR! Can't support Buffer mode output %s .\n", handle->usr_cfg_mux.output_fn);
-        return EMA_MP4_MUXED_CLI_ERR;
-    }
-
     return EMA_MP4_MUXED_OK;
 }
 
@@ -87,7 +156,7 @@ mux_muxer_destroy(mp4_ctrl_handle_t muxer)
             {
                 if (track->parser)
                 {
-                    track->parser->destroy(track->parser);
+                    parser_call_destroy(track->parser);
                 }
             }
         }
@@ -147,6 +216,51 @@ mux_data_src_destroy(bbio_handle_t data_srcs[])
     }
 }
 
+/**
+ * feeds the avcC/hvcC read from file to the parser: es is nal length prefixed
+ */
+static int32_t
+mux_es_parser_set_nal_config(parser_handle_t parser, const int8_t *fn)
+{
+    bbio_handle_t src = reg_bbio_get('f', 'r');
+    uint8_t *     buf = NULL;
+    size_t        size;
+    int32_t       ret = EMA_MP4_MUXED_PARAM_ERR;
+
+    if (src->open(src, fn))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Can't open nal config file %s\n", fn);
+        src->destroy(src);
+        return EMA_MP4_MUXED_OPEN_FILE_ERR;
+    }
+
+    size = (size_t)src->size(src);
+    buf  = (uint8_t *)MALLOC_CHK(size ? size : 1);
+    if (!buf)
+    {
+        src->destroy(src);
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    size = src->read(src, buf, size);
+
+    if (parser->stream_id == STREAM_ID_H264)
+    {
+        ret = parser_avc_set_avcc(parser, buf, (uint32_t)size);
+    }
+    else if (parser->stream_id == STREAM_ID_HEVC)
+    {
+        ret = parser_hevc_set_hvcc(parser, buf, (uint32_t)size);
+    }
+    else
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! nal config %s given for %s stream\n", fn, parser->stream_name);
+    }
+
+    FREE_CHK(buf);
+    src->destroy(src);
+    return ret;
+}
+
 /**
  * find the right parser based on the input source file extension (currently, only support choosing parser from file name extension) 
  */
@@ -176,10 +290,10 @@ mux_es_parser_create(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, parser_handl
         return EMA_MP4_MUXED_CLI_ERR;
     }
 
-    /** get parser: dsi type is mp4 */
+    /** get parser: dsi type is mp4, allocating as the muxer does */
     if (es_type)
     {
-        parser = reg_parser_get(es_type, DSI_TYPE_MP4FF);
+        parser = reg_parser_get_ex(es_type, DSI_TYPE_MP4FF, handle->usr_cfg_mux.allocator);
     }
 
     if (!parser)
@@ -190,13 +304,32 @@ mux_es_parser_create(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, parser_handl
 
     *p_parser = parser;
 
+    if (usr_cfg_es->mp4_tid && parser->set_param)
+    {
+        /** mp4 file input: the track to take */
+        ret = parser->set_param(parser, STREAM_PARAM_ID_TRACK_ID, usr_cfg_es->mp4_tid);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+    }
+
+    if (usr_cfg_es->nal_cfg_fn)
+    {
+        MEM_ALLOC_SCOPE_CHK(parser->allocator, ret = mux_es_parser_set_nal_config(parser, usr_cfg_es->nal_cfg_fn));
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+    }
+
     if (dv_el_track_flag)
     {
         parser->dv_el_track_flag = 1;
     }
 
     msglog(NULL, MSGLOG_INFO, "Init %4s parser for stream %u\n", parser->stream_name, es_idx);
-    ret = parser->init(parser, &(handle->usr_cfg_mux.ext_timing_info), es_idx, handle->data_srcs[es_idx]);
+    ret = parser_call_init(parser, &(handle->usr_cfg_mux.ext_timing_info), es_idx, handle->data_srcs[es_idx]);
 
     if (handle->usr_cfg_mux.dv_bl_non_comp_flag)
     {
@@ -205,6 +338,292 @@ mux_es_parser_create(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, parser_handl
     return ret;
 }
 
+/** what the range parsing callbacks need */
+typedef struct mux_split_ctx_t_
+{
+    ema_mp4_ctrl_handle_t handle;
+    uint32_t              es_idx;
+    track_handle_t        track;
+} mux_split_ctx_t;
+
+static parser_handle_t
+mux_es_split_create(void *ctx)
+{
+    mux_split_ctx_t *split   = (mux_split_ctx_t *)ctx;
+    int8_t *         es_type = strrchr(split->handle->usr_cfg_ess[split->es_idx].input_fn, '.');
+
+    return es_type ? reg_parser_get_ex(es_type + 1, DSI_TYPE_MP4FF, split->handle->usr_cfg_mux.allocator) : NULL;
+}
+
+static int32_t
+mux_es_split_output(void *ctx, parser_handle_t parser, mp4_sample_handle_t sample)
+{
+    mux_split_ctx_t *split = (mux_split_ctx_t *)ctx;
+    track_handle_t   track = split->track;
+
+    if (track->parser != parser)
+    {
+        /** the parser of the first range takes over the track; the one it replaces
+         *  is still used by the range parsing and is destroyed after it */
+        track->parser = parser;
+    }
+    if (msglog_global_verbosity_get() == MSGLOG_DEBUG)
+    {
+        msglog(NULL, MSGLOG_INFO, "Add sample %d to stream %2d\n", track->sample_num, split->es_idx);
+    }
+    if (split->handle->parse_caches[split->es_idx])
+    {
+        mp4_parse_cache_add_sample(split->handle->parse_caches[split->es_idx], sample);
+    }
+    if (mp4_muxer_input_sample(track, sample))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Parsing ES Error! \n");
+        return EMA_MP4_MUXED_BUGGY;
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+/** the time range of an es which is output, if one is set */
+typedef struct mux_clip_t_
+{
+    BOOL     on;
+    uint32_t timescale;   /**< of the samples, 0 until known */
+    uint64_t start;       /**< in that timescale */
+    uint64_t end;         /**< 0 for up to the end of the es */
+    uint64_t base;        /**< the time of the first sample parsed: that of the sync point sought */
+    BOOL     parsed;      /**< a sample has been parsed */
+    uint64_t dts0;        /**< its dts */
+    BOOL     kept;        /**< a sample has been output */
+    uint64_t kept_t;      /**< the time of the first one */
+    uint64_t shift;       /**< taken off the dts and cts of those output */
+    BOOL     sync_seen;   /**< a sync sample has been parsed before the range */
+    uint64_t sync_t;      /**< the time of the last one */
+    BOOL     rewind;      /**< the range starts in a non sync sample: parse again up to sync_t */
+    BOOL     rewound;     /**< and output from sync_t on */
+    uint32_t sd_dropped;  /**< the samples before the first output one with SAMPLE_NEW_SD */
+} mux_clip_t;
+
+/** the timescale of the samples, as the muxer takes it for the media timescale */
+static uint32_t
+mux_es_timescale(parser_handle_t parser)
+{
+    if ((parser->stream_type == STREAM_TYPE_AUDIO) && (parser->stream_id != STREAM_ID_AC4))
+    {
+        return ((parser_audio_handle_t)parser)->sample_rate;
+    }
+    return parser->time_scale;
+}
+
+/** the time range in the timescale of the samples: it covers the one in ms */
+static void
+mux_clip_scale(ema_mp4_ctrl_handle_t handle, mux_clip_t *clip, parser_handle_t parser)
+{
+    clip->timescale = mux_es_timescale(parser);
+    clip->start     = (uint64_t)handle->usr_cfg_mux.range_start*clip->timescale/1000;
+    clip->end       = ((uint64_t)handle->usr_cfg_mux.range_end*clip->timescale + 999)/1000;
+}
+
+/** The first sample output starts the sample entry the last one dropped with SAMPLE_NEW_SD started:
+ *  the dsi of the ones before it are no sample entry's */
+static void
+mux_clip_carry_sd(mux_clip_t *clip, parser_handle_t parser, mp4_sample_handle_t sample)
+{
+    uint32_t unused = clip->sd_dropped;
+
+    if (!(sample->flags & SAMPLE_NEW_SD) && unused)
+    {
+        sample->flags |= SAMPLE_NEW_SD;
+        unused--;
+    }
+    while (unused-- && list_get_entry_num(parser->dsi_lst) > 1)
+    {
+        dsi_handle_t dsi = *(dsi_handle_t *)list_peek_first_entry(parser->dsi_lst);
+
+        list_delete_first_entry(parser->dsi_lst);
+        dsi->destroy(dsi);
+    }
+    clip->sd_dropped = 0;
+}
+
+/** TRUE if sample is output. Sets *done once past the end of the time range */
+static BOOL
+mux_clip_keep(ema_mp4_ctrl_handle_t handle, mux_clip_t *clip, parser_handle_t parser, mp4_sample_handle_t sample, BOOL *done)
+{
+    uint64_t t;
+
+    if (!clip->on)
+    {
+        return TRUE;
+    }
+    if (!clip->timescale)
+    {
+        mux_clip_scale(handle, clip, parser);
+    }
+    if (!clip->parsed)
+    {
+        clip->parsed = TRUE;
+        clip->dts0   = sample->dts;
+    }
+
+    t = sample->dts - clip->dts0 + clip->base;
+    if (clip->end && t >= clip->end)
+    {
+        *done = TRUE;
+        return FALSE;
+    }
+    /** video starts at the sync point sought. Other es start with the sync sample the range starts
+     *  in or, if that one is not, with the last one before */
+    if (!clip->kept && parser->stream_type != STREAM_TYPE_VIDEO)
+    {
+        BOOL drop = FALSE;
+
+        if (clip->rewound)
+        {
+            drop = (t < clip->sync_t);
+        }
+        else
+        {
+            if (sample->flags & SAMPLE_SYNC)
+            {
+                clip->sync_seen = TRUE;
+                clip->sync_t    = t;
+            }
+            if (t + sample->duration <= clip->start)
+            {
+                drop = TRUE;
+            }
+            else if (!(sample->flags & SAMPLE_SYNC))
+            {
+                clip->rewind = clip->sync_seen;
+                drop         = TRUE;
+            }
+        }
+        if (drop)
+        {
+            clip->sd_dropped += (sample->flags & SAMPLE_NEW_SD) ? 1 : 0;
+            return FALSE;
+        }
+    }
+    if (!clip->kept)
+    {
+        clip->kept   = TRUE;
+        clip->kept_t = t;
+        clip->shift  = sample->dts - clip->dts0;
+        mux_clip_carry_sd(clip, parser, sample);
+    }
+
+    return TRUE;
+}
+
+/** hands the track a new parser of its es, reading from where the data source of the es is now */
+static int32_t
+mux_es_parser_renew(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, track_handle_t track)
+{
+    parser_handle_t old = track->parser;
+    parser_handle_t parser;
+    mux_split_ctx_t split;
+    int32_t         ret;
+
+    split.handle = handle;
+    split.es_idx = es_idx;
+    split.track  = track;
+    parser = mux_es_split_create(&split);
+    if (!parser)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    /** as mp4_muxer_add_track() set up the one it replaces */
+    parser->sd                  = old->sd;
+    parser->sd_collision_flag   = 0;
+    parser->dv_bl_non_comp_flag = old->dv_bl_non_comp_flag;
+    FOURCC_ASSIGN(parser->dsi_name, old->dsi_name);
+
+    ret = parser_call_init(parser, &handle->usr_cfg_mux.ext_timing_info, es_idx, handle->data_srcs[es_idx]);
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        parser_call_destroy(parser);
+        return ret;
+    }
+    track->parser = parser;
+    parser_call_destroy(old);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/** parses the es again from its start */
+static int32_t
+mux_clip_rewind(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, track_handle_t track, mux_clip_t *clip)
+{
+    bbio_handle_t ds = handle->data_srcs[es_idx];
+
+    clip->rewind     = FALSE;
+    clip->rewound    = TRUE;
+    clip->parsed     = FALSE;
+    clip->sd_dropped = 0;
+    ds->seek(ds, 0, SEEK_SET);
+
+    return mux_es_parser_renew(handle, es_idx, track);
+}
+
+/** For an avc or hevc es, the parsing starts at the last IDR up to the start of the time range,
+ *  which a scan for start codes finds, with the parameter sets before it put in front. Its time
+ *  is that of the AUs before it: the frame duration is constant. If it can't be found, the es is
+ *  parsed from its start */
+static int32_t
+mux_clip_seek(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, track_handle_t track, mp4_sample_handle_t sample,
+              mux_clip_t *clip)
+{
+    parser_handle_t parser = track->parser;
+    bbio_handle_t   ds     = handle->data_srcs[es_idx];
+    parser_range_t  range;
+    uint8_t *       seed = NULL;
+    uint32_t        sync_idx;
+    int32_t         ret;
+
+    if ((parser->stream_id != STREAM_ID_H264 && parser->stream_id != STREAM_ID_HEVC) ||
+        !handle->usr_cfg_mux.range_start || handle->usr_cfg_ess[es_idx].nal_cfg_fn)
+    {
+        return EMA_MP4_MUXED_OK;
+    }
+
+    /** the first AU gives the frame duration */
+    while ((ret = parser_call_get_sample(parser, sample)) == EMA_MP4_MUXED_NO_CONFIG_ERR)
+    {
+    }
+    if (ret == EMA_MP4_MUXED_OK && sample->duration)
+    {
+        mux_clip_scale(handle, clip, parser);
+        ret = parser_split_find_sync(parser, (uint32_t)(clip->start/sample->duration), &range, &seed, &sync_idx);
+    }
+    else if (ret == EMA_MP4_MUXED_OK || ret == EMA_MP4_MUXED_EOES)
+    {
+        ret = EMA_MP4_MUXED_NO_SUPPORT;
+    }
+
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        msglog(NULL, MSGLOG_INFO, "Parsing stream %u from AU %u at %" PRIi64 "\n", es_idx, sync_idx, range.off);
+        clip->base = (uint64_t)sync_idx*sample->duration;
+        /** the data source of the es from then on */
+        handle->data_srcs[es_idx] = splice_src_create(ds, range.off, range.seed_pos, seed, range.seed_size);
+        if (!handle->data_srcs[es_idx])
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+    }
+    else if (ret == EMA_MP4_MUXED_NO_SUPPORT)
+    {
+        msglog(NULL, MSGLOG_INFO, "The sync points of stream %u can't be found: parsing it from its start\n", es_idx);
+        ds->seek(ds, 0, SEEK_SET);
+    }
+    else
+    {
+        return ret;
+    }
+
+    return mux_es_parser_renew(handle, es_idx, track);
+}
+
 /**
  * parses the ES, get the samples and send them to muxer
  */
@@ -216,7 +635,13 @@ mux_es_parsing(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, uint32_t dv_el_fla
     parser_handle_t     parser = NULL;
     mp4_sample_handle_t sample;
     progress_handle_t   prgh;
+    BOOL                serial = TRUE;
+    BOOL                cached = FALSE;
+    mp4_parse_cache_handle_t cache = NULL;
     int32_t                 ret = EMA_MP4_MUXED_OK;
+    uint64_t                parse_t, input_sample_ns;
+    mux_clip_t              clip;
+    BOOL                    clip_done = FALSE;
 
     track = mp4_muxer_get_track(handle->mp4_handle, handle->usr_cfg_ess[es_idx].track_ID);
     if (!track)
@@ -237,6 +662,21 @@ mux_es_parsing(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, uint32_t dv_el_fla
     {
         return EMA_MP4_MUXED_NO_MEM;
     }
+
+    memset(&clip, 0, sizeof(mux_clip_t));
+    clip.on = (handle->usr_cfg_mux.range_start || handle->usr_cfg_mux.range_end);
+    if (clip.on)
+    {
+        ret = mux_clip_seek(handle, es_idx, track, sample, &clip);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            sample->destroy(sample);
+            return ret;
+        }
+        ds     = handle->data_srcs[es_idx];
+        parser = track->parser;
+    }
+
     prgh = progress_create(parser->stream_name, ds->size(ds));
     if (!prgh)
     {
@@ -246,10 +686,82 @@ mux_es_parsing(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, uint32_t dv_el_fla
 
     /** just to be sure */
     src_byte_align(ds);
+
+    /** the time in mp4_muxer_input_sample() is the muxer's */
+    parse_t         = time_ns_monotonic();
+    input_sample_ns = handle->mp4_handle->metrics.input_sample_ns;
+    MP4_TRACE_BEGIN("mux_es_parsing", track->track_ID, 0);
+
+    if (handle->usr_cfg_mux.parse_cache_dir && !dv_el_flag && !clip.on)
+    {
+        cache = mp4_parse_cache_open(handle->usr_cfg_mux.parse_cache_dir, handle->usr_cfg_ess[es_idx].input_fn,
+                                     track, &cached);
+        handle->parse_caches[es_idx] = cache;
+    }
+    else if (handle->checkpoint && !dv_el_flag && !clip.on)
+    {
+        /** the parse kept with the checkpoint: a job run again need not parse the es */
+        cache = mp4_parse_cache_open_file(mp4_checkpoint_cache_fn(handle->checkpoint, es_idx),
+                                          handle->usr_cfg_ess[es_idx].input_fn, track, &cached);
+        handle->parse_caches[es_idx] = cache;
+    }
+    if (cached)
+    {
+        /** the sidecar has the samples: no parsing */
+        serial = FALSE;
+        while (!(ret = mp4_parse_cache_get_sample(cache, sample)))
+        {
+            if (mp4_muxer_input_sample(track, sample))
+            {
+                msglog(NULL, MSGLOG_ERR, "ERROR! Parsing ES Error! \n");
+                ret = EMA_MP4_MUXED_BUGGY;
+                break;
+            }
+        }
+        if (ret == EMA_MP4_MUXED_EOES)
+        {
+            ret = mp4_parse_cache_restore(cache);
+        }
+    }
+    else if (handle->usr_cfg_mux.parse_threads > 1 && !dv_el_flag && !handle->usr_cfg_ess[es_idx].nal_cfg_fn && !clip.on)
+    {
+        mux_split_ctx_t split;
+
+        split.handle = handle;
+        split.es_idx = es_idx;
+        split.track  = track;
+        ret = parser_split_parse(parser, handle->usr_cfg_mux.parse_threads,
+                                 mux_es_split_create, mux_es_split_output, &split);
+        if (track->parser != parser)
+        {
+            parser_call_destroy(parser);
+            parser = track->parser;
+        }
+        serial = (ret == EMA_MP4_MUXED_NO_SUPPORT);
+    }
     /** read sample one by one, add each sample to muxer */
-    while (!(ret = parser->get_sample(parser, sample)) || ret == EMA_MP4_MUXED_NO_CONFIG_ERR)
+    while (serial && (!(ret = parser_call_get_sample(parser, sample)) || ret == EMA_MP4_MUXED_NO_CONFIG_ERR))
     {
         /** Parsing was successful, add sample to muxer */
+        if (!ret && !mux_clip_keep(handle, &clip, parser, sample, &clip_done))
+        {
+            if (clip.rewind)
+            {
+                ret = mux_clip_rewind(handle, es_idx, track, &clip);
+                if (ret != EMA_MP4_MUXED_OK)
+                {
+                    break;
+                }
+                parser = track->parser;
+                continue;
+            }
+            if (clip_done)
+            {
+                ret = EMA_MP4_MUXED_EOES;
+                break;
+            }
+            continue;
+        }
         if (!ret)
         {
             /** REPORT_PARSING_PROGRESS */
@@ -266,14 +778,26 @@ mux_es_parsing(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, uint32_t dv_el_fla
                 }
             }
 
+            if (cache)
+            {
+                mp4_parse_cache_add_sample(cache, sample);
+            }
+            /** the dts of the next sample may carry on from this one's: shifted for the muxer only */
+            sample->dts -= clip.shift;
+            sample->cts -= clip.shift;
             if (mp4_muxer_input_sample(track, sample))
             {
                 msglog(NULL, MSGLOG_ERR, "ERROR! Parsing ES Error! \n");
                 ret = EMA_MP4_MUXED_BUGGY;
                 break;
             }
+            sample->dts += clip.shift;
+            sample->cts += clip.shift;
         }
     }
+    track->parse_ns += time_ns_monotonic() - parse_t - (handle->mp4_handle->metrics.input_sample_ns - input_sample_ns);
+    MP4_TRACE_END("mux_es_parsing", track->track_ID, ds->bytes_read);
+
     /** CLOSE_REPORT_PARSING_PROGRESS */
     if (msglog_global_verbosity_get() >= MSGLOG_INFO)
     {
@@ -291,6 +815,18 @@ mux_es_parsing(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, uint32_t dv_el_fla
     prgh->destroy(prgh);
     sample->destroy(sample);
 
+    if (clip.on && ret == EMA_MP4_MUXED_EOES)
+    {
+        if (!clip.kept)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Stream %u ends before the time range starts\n", es_idx);
+            return EMA_MP4_MUXED_EMPTY_ES;
+        }
+        /** presented from the exact start of the range on */
+        mp4_muxer_set_track_clip(track,
+                                 (clip.start > clip.kept_t) ? clip.start - clip.kept_t : 0,
+                                 clip.end ? clip.end - MAX2(clip.start, clip.kept_t) : 0);
+    }
     if (ret == EMA_MP4_MUXED_EOES)
     {
         return EMA_MP4_MUXED_OK;
@@ -301,41 +837,149 @@ mux_es_parsing(ema_mp4_ctrl_handle_t handle, uint32_t es_idx, uint32_t dv_el_fla
     }
 }
 
+/** The name of media segment seg_idx: the output file name up to its first '.', then _<seg_idx>.mp4 */
+static void
+mux_segment_name(ema_mp4_ctrl_handle_t handle, uint32_t seg_idx, int8_t *segment_name)
+{
+    const uint8_t *output_name = (const uint8_t *)(handle->usr_cfg_mux.output_fn);
+    int8_t *       seg_name    = segment_name;
+
+    while (*output_name != '.')
+    {
+        *seg_name++ = *output_name++;
+    }
+    sprintf(seg_name, "_%d.mp4", seg_idx);
+}
+
+/** Finds how much of the output a previous run of the job left complete, as its checkpoint has it */
+static void
+mux_resume_find(ema_mp4_ctrl_handle_t handle)
+{
+    const int8_t *output_fn = handle->usr_cfg_mux.output_fn;
+    int8_t        segment_name[256];
+    uint32_t      frag_num, moov_num, file_frag_num, seg_idx;
+    int64_t       size;
+    BOOL          complete;
+
+    if (!mp4_checkpoint_load(handle->checkpoint, &frag_num, &size) || !frag_num)
+    {
+        return;
+    }
+
+    if (handle->usr_cfg_mux.segment_output_flag)
+    {
+        /** the init segment, then one media segment per fragment */
+        complete = mp4_checkpoint_check_file(output_fn, -1, &moov_num, &file_frag_num) && moov_num;
+        for (seg_idx = 1; complete && seg_idx <= frag_num; seg_idx++)
+        {
+            mux_segment_name(handle, seg_idx, segment_name);
+            complete = mp4_checkpoint_check_file(segment_name, -1, &moov_num, &file_frag_num) && file_frag_num;
+        }
+    }
+    else
+    {
+        complete = mp4_checkpoint_check_file(output_fn, size, &moov_num, &file_frag_num) &&
+                   moov_num && file_frag_num == frag_num;
+    }
+    /** the boxes are whole: their bytes are those written */
+    complete = complete && mp4_checkpoint_verify(handle->checkpoint);
+
+    if (complete)
+    {
+        if (handle->usr_cfg_mux.segment_output_flag)
+        {
+            handle->resume_segment_num = frag_num;
+        }
+        else
+        {
+            handle->resume_size = size;
+        }
+        handle->resume_frag_num = frag_num;
+        msglog(NULL, MSGLOG_INFO, "Continuing %s after fragment %u\n", output_fn, frag_num);
+    }
+    else
+    {
+        msglog(NULL, MSGLOG_INFO, "%s is not as its checkpoint has it: starting over\n", output_fn);
+    }
+}
+
+/** Writes the parse caches of the es parsed. Their sample description entries must be built */
+static void
+mux_parse_caches_save(ema_mp4_ctrl_handle_t handle)
+{
+    uint32_t es_idx;
+
+    for (es_idx = 0; es_idx < handle->usr_cfg_mux.es_num; es_idx++)
+    {
+        if (handle->parse_caches[es_idx])
+        {
+            mp4_parse_cache_save(handle->parse_caches[es_idx]);
+        }
+    }
+}
+
 /**
- * callback function for creating multiple fragmented mp4 files
+ * callback function for creating multiple fragmented mp4 files, and for the checkpoint
  */
 static int32_t
 onWriteNextFrag(void *handle_in)
 {
     ema_mp4_ctrl_handle_t handle = (ema_mp4_ctrl_handle_t)handle_in;
     int8_t segment_name[256];
-    uint8_t *output_name;
-    int8_t *seg_name;
     uint32_t ret = 0;
 
+    if (handle->checkpoint && !handle->frag_num)
+    {
+        /** the 'moov' is out: the parse caches are complete before any fragment is */
+        mux_parse_caches_save(handle);
+    }
+
     if (!handle->usr_cfg_mux.segment_output_flag)
     {
-        return EMA_MP4_MUXED_PARAM_ERR;
+        /** the fragments so far are written through, fragment 0 being the 'ftyp' and 'moov':
+         *  the seek flushes them, for them to be read back for their digest */
+        if (handle->checkpoint && (!handle->resume_frag_num || handle->frag_num > handle->resume_frag_num))
+        {
+            int64_t pos = handle->mp4_sink->position(handle->mp4_sink);
+
+            handle->mp4_sink->seek(handle->mp4_sink, pos, SEEK_SET);
+            mp4_checkpoint_save(handle->checkpoint, handle->usr_cfg_mux.output_fn, handle->frag_num, pos);
+        }
+        handle->frag_num++;
+        return handle->checkpoint ? EMA_MP4_MUXED_OK : EMA_MP4_MUXED_PARAM_ERR;
     }
 
+    MP4_TRACE_BEGIN("onWriteNextFrag", 0, 0);
     handle->mp4_sink->close(handle->mp4_sink);
+    if (handle->checkpoint && (!handle->resume_frag_num || handle->frag_num > handle->resume_frag_num))
+    {
+        /** the file closed: the init segment, then media segment frag_num */
+        if (handle->frag_num)
+        {
+            mux_segment_name(handle, handle->frag_num, segment_name);
+        }
+        mp4_checkpoint_save(handle->checkpoint, handle->frag_num ? segment_name : handle->usr_cfg_mux.output_fn,
+                            handle->frag_num, -1);
+    }
+    handle->frag_num++;
 
-    output_name = (uint8_t *)(handle->usr_cfg_mux.output_fn);
-    seg_name = segment_name;
-    while (*output_name != '.')
+    if (handle->usr_cfg_mux.SegmentCounter <= handle->resume_segment_num)
     {
-        *seg_name++ = *output_name++;
+        /** complete already */
+        sink_resume_skip(handle->mp4_sink, -1);
     }
-    sprintf(seg_name, "_%d.mp4", handle->usr_cfg_mux.SegmentCounter++);
+    mux_segment_name(handle, handle->usr_cfg_mux.SegmentCounter++, segment_name);
 
     ret = handle->mp4_sink->open(handle->mp4_sink, (const int8_t *)segment_name);
     if (ret != 0)
     {
         msglog(NULL, MSGLOG_ERR, "ERROR! Can't open output container");
+        MP4_TRACE_END("onWriteNextFrag", 0, 0);
         return EMA_MP4_MUXED_PARAM_ERR;
     }
 
     ret = mp4_muxer_output_segment_hdrs(handle->mp4_handle);
+    MP4_TRACE_END("onWriteNextFrag", 0, 0);
 
     return ret;
 }
@@ -353,7 +997,6 @@ ema_mp4_mux_start(ema_mp4_ctrl_handle_t handle)
     int32_t      es_idx;
     int32_t      has_video = 0;
     int32_t      has_audio = 0;
-    usr_cfg_es_t *usr_cfg_es;
     time_t       ltime_s, ltime_e;
     int32_t      ret = EMA_MP4_MUXED_OK;
     usr_cfg_mux_t *   usr_cfg_mux_ptr;
@@ -457,11 +1100,86 @@ ema_mp4_mux_start(ema_mp4_ctrl_handle_t handle)
         usr_cfg_mux_ptr->SegmentCounter = 1;
     }
 
+    if (usr_cfg_mux_ptr->edit_mode && (usr_cfg_mux_ptr->output_mode & EMA_MP4_FRAG))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Tracks can be added to non fragmented mp4 files only. \n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+    if (usr_cfg_mux_ptr->edit_mode && handle->digest_cb)
+    {
+        /** the media data kept is not written */
+        msglog(NULL, MSGLOG_ERR, "ERROR! No digests for tracks added to an existing file. \n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    if ((usr_cfg_mux_ptr->range_start || usr_cfg_mux_ptr->range_end) &&
+        usr_cfg_mux_ptr->dv_track_mode == DUAL && usr_cfg_mux_ptr->dv_es_mode == SPLIT)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! No time range for a dolby vision el es. \n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    if (usr_cfg_mux_ptr->checkpoint)
+    {
+        if (!(usr_cfg_mux_ptr->output_mode & EMA_MP4_FRAG) || !(usr_cfg_mux_ptr->output_mode & EMA_MP4_IO_FILE) ||
+            (usr_cfg_mux_ptr->output_mode & EMA_MP4_IO_BUF) || handle->segment_cb || handle->digest_cb ||
+            usr_cfg_mux_ptr->output_file_num > 1)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Checkpoints are kept for fragmented output to files only, with no digests. \n");
+            return EMA_MP4_MUXED_PARAM_ERR;
+        }
+        handle->checkpoint = mp4_checkpoint_create(usr_cfg_mux_ptr, handle->usr_cfg_ess);
+        if (!handle->checkpoint)
+        {
+            return EMA_MP4_MUXED_OPEN_FILE_ERR;
+        }
+        mux_resume_find(handle);
+        /** called as each fragment begins: the previous ones are complete */
+        mp4_muxer_set_onwrite_next_frag_callback(handle->mp4_handle, onWriteNextFrag, (void *)(handle));
+    }
+
     /**** get muxer sink */
     ret = mux_data_sink_create(handle);
     CHK_ERR_RET(ret);
 
-    mp4_muxer_set_sink(handle->mp4_handle, handle->mp4_sink);
+    if (usr_cfg_mux_ptr->edit_mode)
+    {
+        mp4_ctrl_handle_t demuxer;
+
+        ret = mp4_muxer_set_edit_sink(handle->mp4_handle, handle->mp4_sink);
+        CHK_ERR_RET(ret);
+
+        /** the tracks kept count for the tkhd flags of the new ones */
+        demuxer = mp4_demux_create(handle->mp4_sink);
+        if (demuxer)
+        {
+            uint32_t u;
+
+            for (u = 0; u < demuxer->stream_num; u++)
+            {
+                stream_handle_t stream = demuxer->tracks[u];
+
+                for (es_idx = 0; es_idx < usr_cfg_mux_ptr->es_num; es_idx++)
+                {
+                    if (handle->usr_cfg_ess[es_idx].action == TRACK_EDIT_ACTION_REPLACE &&
+                        handle->usr_cfg_ess[es_idx].track_ID == stream->track_ID)
+                    {
+                        break;
+                    }
+                }
+                if (es_idx == usr_cfg_mux_ptr->es_num)
+                {
+                    has_video |= (stream->stream_type == STREAM_TYPE_VIDEO);
+                    has_audio |= (stream->stream_type == STREAM_TYPE_AUDIO);
+                }
+            }
+            mp4_demux_destroy(demuxer);
+        }
+    }
+    else
+    {
+        mp4_muxer_set_sink(handle->mp4_handle, handle->mp4_sink);
+    }
 
     /**** get data sources */
     if ((handle->usr_cfg_mux.dv_track_mode == DUAL) && (handle->usr_cfg_mux.dv_es_mode == COMB))
@@ -486,16 +1204,8 @@ ema_mp4_mux_start(ema_mp4_ctrl_handle_t handle)
     /** parsing all ES source */
     for (es_idx = 0; es_idx < handle->usr_cfg_mux.es_num; es_idx++)
     {
-        usr_cfg_es = &(handle->usr_cfg_ess[es_idx]);
         handle->mp4_handle->curr_usr_cfg_stream_index = es_idx;
 
-        /** check if track to add, delete, replace does even exist */
-        if (usr_cfg_es->mp4_tid > handle->usr_cfg_mux.es_num)
-        {
-            msglog(NULL, MSGLOG_ERR, "ERROR! Mp4 file does not contain track ID %i.\n", usr_cfg_es->mp4_tid);
-            return EMA_MP4_MUXED_UNKNOW_ES;
-        }
-
         {
             /** ES source */
             /** create parser */
@@ -508,7 +1218,7 @@ ema_mp4_mux_start(ema_mp4_ctrl_handle_t handle)
                 can never get freed as it is only present in local scope. So it must be done here. */
             if (ret != EMA_MP4_MUXED_OK && parser)
             {
-                parser->destroy(parser);
+                parser_call_destroy(parser);
             }
             CHK_ERR_CNT(ret);
 
@@ -544,6 +1254,8 @@ ema_mp4_mux_start(ema_mp4_ctrl_handle_t handle)
 
             ret = mux_es_parsing(handle, es_idx, 0);
             CHK_ERR_RET(ret);
+            /** parsing in ranges hands the track another parser */
+            parser = mp4_muxer_get_track(handle->mp4_handle, handle->usr_cfg_ess[es_idx].track_ID)->parser;
 
             time(&ltime_e);
             msglog(NULL, MSGLOG_INFO, "Time lapse %lds\n", ltime_e - ltime_s);
@@ -556,7 +1268,7 @@ ema_mp4_mux_start(ema_mp4_ctrl_handle_t handle)
                 ret = mux_es_parser_create(handle, es_idx, &parser, 1);
                 if (ret != EMA_MP4_MUXED_OK && parser)
                 {
-                    parser->destroy(parser);
+                    parser_call_destroy(parser);
                 }
                 CHK_ERR_CNT(ret);
                 /** add a track to muxer */
@@ -582,6 +1294,18 @@ ema_mp4_mux_start(ema_mp4_ctrl_handle_t handle)
     msglog(NULL, MSGLOG_INFO, "\nOutput tracks\n");
     ret = mp4_muxer_output_tracks(handle->mp4_handle);
     CHK_ERR_RET(ret);
+    if (handle->checkpoint)
+    {
+        mp4_checkpoint_done(handle->checkpoint);
+    }
+    if (handle->segment_cb)
+    {
+        /** the last segment is handed over now rather than by ema_mp4_mux_destroy() */
+        handle->mp4_sink->close(handle->mp4_sink);
+    }
+
+    /** the sample description entries are built by now: write the parse caches of the es parsed */
+    mux_parse_caches_save(handle);
 
     msglog(NULL,MSGLOG_INFO,"\n");
     return EMA_MP4_MUXED_OK;
@@ -615,10 +1339,14 @@ ema_mp4_mux_create(ema_mp4_ctrl_handle_t *handle)
     parser_ec3_reg();    /** register ec3 parser */
     parser_ac4_reg();    /** register ac4 parser */
 
+    /*** register the parser of tracks of mp4 files */
+    parser_mp4_reg();
+
     /** I/O */
     reg_bbio_init();
     bbio_file_reg();
     bbio_buf_reg();
+    bbio_rope_reg();
 
     /**** create and init ema_mp4_mux */
     handle_internal = (ema_mp4_ctrl_handle_t)MALLOC_CHK(sizeof(ema_mp4_ctrl_t));
@@ -684,6 +1412,7 @@ ema_mp4_mux_create(ema_mp4_ctrl_handle_t *handle)
 
     /**** init data sink to 0 */
     handle_internal->mp4_sink = 0;
+    handle_internal->mp4_rope = 0;
 
     /**** init data_scrs  to 0 */
     memset(handle_internal->data_srcs, 0, sizeof(handle_internal->data_srcs));
@@ -700,6 +1429,10 @@ ema_mp4_mux_destroy(ema_mp4_ctrl_handle_t handle)
     usr_cfg_mux_ptr = &(handle->usr_cfg_mux);
 
     mux_data_src_destroy(handle->data_srcs);
+    for (es_idx = 0; es_idx < MAX_STREAMS; es_idx++)
+    {
+        mp4_parse_cache_destroy(handle->parse_caches[es_idx]);
+    }
 
     if (handle->mp4_handle)
     {
@@ -711,13 +1444,17 @@ ema_mp4_mux_destroy(ema_mp4_ctrl_handle_t handle)
     {
         mux_data_sink_destroy(handle->mp4_sink);
         handle->mp4_sink = 0;
+        handle->mp4_rope = 0;
     }
+    /** the output is closed: the checkpoint goes if it is complete */
+    mp4_checkpoint_destroy(handle->checkpoint);
 
     for (es_idx = 0; es_idx < usr_cfg_mux_ptr->es_num; es_idx++)
     {
         usr_cfg_es_t *usr_cfg_es = &(handle->usr_cfg_ess[es_idx]);
         /**** free cfg space */
         FREE_CHK((int8_t *)usr_cfg_es->input_fn);
+        FREE_CHK((int8_t *)usr_cfg_es->nal_cfg_fn);
         FREE_CHK((int8_t *)usr_cfg_es->lang);
         FREE_CHK((int8_t *)usr_cfg_es->enc_name);
     }
@@ -726,6 +1463,7 @@ ema_mp4_mux_destroy(ema_mp4_ctrl_handle_t handle)
     FREE_CHK((int8_t *)usr_cfg_mux_ptr->output_fn_el);
     FREE_CHK((int8_t *)usr_cfg_mux_ptr->major_brand);
     FREE_CHK((int8_t *)usr_cfg_mux_ptr->compatible_brands);
+    FREE_CHK((int8_t *)usr_cfg_mux_ptr->parse_cache_dir);
 
     FREE_CHK(handle->fn_in);
     if ((handle->mp4_src) && (handle->demux_flag))
@@ -810,6 +1548,52 @@ ema_mp4_mux_set_input(ema_mp4_ctrl_handle_t handle,
     return EMA_MP4_MUXED_OK;
 }
 
+uint32_t
+ema_mp4_mux_set_input_nal_config(ema_mp4_ctrl_handle_t handle, const int8_t *fn)
+{
+    usr_cfg_es_t *usr_cfg_es;
+
+    if (!handle->usr_cfg_mux.es_num || !fn)
+    {
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    usr_cfg_es = &(handle->usr_cfg_ess[handle->usr_cfg_mux.es_num - 1]);
+    FREE_CHK((int8_t *)usr_cfg_es->nal_cfg_fn);
+    usr_cfg_es->nal_cfg_fn = STRDUP_CHK(fn);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_input_replace(ema_mp4_ctrl_handle_t handle, uint32_t track_ID)
+{
+    usr_cfg_es_t *usr_cfg_es;
+
+    if (!handle->usr_cfg_mux.es_num || !track_ID)
+    {
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    usr_cfg_es           = &(handle->usr_cfg_ess[handle->usr_cfg_mux.es_num - 1]);
+    usr_cfg_es->action   = TRACK_EDIT_ACTION_REPLACE;
+    usr_cfg_es->track_ID = track_ID;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_edit_file(ema_mp4_ctrl_handle_t handle, const int8_t *fn)
+{
+    uint32_t ret = ema_mp4_mux_set_output(handle, 0, fn);
+
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        handle->usr_cfg_mux.edit_mode = TRUE;
+    }
+    return ret;
+}
+
 uint32_t
 ema_mp4_mux_set_output(ema_mp4_ctrl_handle_t handle, int32_t buf_out, const int8_t *fn)
 {
@@ -830,6 +1614,7 @@ ema_mp4_mux_set_output(ema_mp4_ctrl_handle_t handle, int32_t buf_out, const int8
     if (handle->usr_cfg_mux.output_file_num == 1)
     {
         FREE_CHK((int8_t *)handle->usr_cfg_mux.output_fn_el);
+        handle->usr_cfg_mux.output_fn_el = NULL;
         handle->usr_cfg_mux.output_mode &= ~EMA_MP4_IO_FILE;
         if (fn)
         {
@@ -842,6 +1627,7 @@ ema_mp4_mux_set_output(ema_mp4_ctrl_handle_t handle, int32_t buf_out, const int8
     }
 
     FREE_CHK((int8_t *)handle->usr_cfg_mux.output_fn);
+    handle->usr_cfg_mux.output_fn = NULL;
     handle->usr_cfg_mux.output_mode &= ~EMA_MP4_IO_FILE;
     if (fn)
     {
@@ -853,6 +1639,33 @@ ema_mp4_mux_set_output(ema_mp4_ctrl_handle_t handle, int32_t buf_out, const int8
     return EMA_MP4_MUXED_OK;
 }
 
+uint32_t
+ema_mp4_mux_get_metrics(ema_mp4_ctrl_handle_t handle, mp4_metrics_t *metrics)
+{
+    uint32_t u;
+
+    if (!handle->mp4_handle)
+    {
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+    mp4_muxer_get_metrics(handle->mp4_handle, metrics);
+    for (u = 0; u < MAX_STREAMS; u++)
+    {
+        if (handle->data_srcs[u])
+        {
+            metrics->bytes_read += handle->data_srcs[u]->bytes_read;
+            metrics->seek_num   += handle->data_srcs[u]->seek_num;
+        }
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+size_t
+ema_mp4_mux_get_output_iovec(ema_mp4_ctrl_handle_t handle, bbio_iovec_t *iov, size_t iov_num)
+{
+    return sink_rope_iovec(handle->mp4_rope, iov, iov_num);
+}
+
 uint32_t
 ema_mp4_mux_set_moov_timescale(ema_mp4_ctrl_handle_t handle, uint32_t timescale)
 {
@@ -1019,6 +1832,88 @@ ema_mp4_mux_set_max_duration(ema_mp4_ctrl_handle_t handle, uint32_t max_duration
     return EMA_MP4_MUXED_OK;
 }
 
+uint32_t
+ema_mp4_mux_set_parse_threads(ema_mp4_ctrl_handle_t handle, uint32_t thread_num)
+{
+    handle->usr_cfg_mux.parse_threads = thread_num;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_write_threads(ema_mp4_ctrl_handle_t handle, uint32_t thread_num)
+{
+    handle->usr_cfg_mux.frag_write_threads = thread_num;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_parse_cache(ema_mp4_ctrl_handle_t handle, const int8_t *dir)
+{
+    FREE_CHK((int8_t *)handle->usr_cfg_mux.parse_cache_dir);
+    handle->usr_cfg_mux.parse_cache_dir = dir ? STRDUP_CHK(dir) : NULL;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_checkpoint(ema_mp4_ctrl_handle_t handle, BOOL enable)
+{
+    handle->usr_cfg_mux.checkpoint = enable;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_time_range(ema_mp4_ctrl_handle_t handle, uint32_t start_ms, uint32_t end_ms)
+{
+    if (end_ms && end_ms <= start_ms)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! The time range ends at %u ms, not after its start at %u ms\n", end_ms, start_ms);
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+    handle->usr_cfg_mux.range_start = start_ms;
+    handle->usr_cfg_mux.range_end   = end_ms;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_allocator(ema_mp4_ctrl_handle_t handle, const mp4_allocator_t *allocator)
+{
+#ifndef ENABLE_MP4_ALLOC_HOOKS
+    if (allocator)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! An allocator given, but built without ENABLE_MP4_ALLOC_HOOKS\n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+#endif
+    /** the muxer is created already: what it allocated goes back to libc as it is freed */
+    handle->usr_cfg_mux.allocator = allocator;
+    handle->mp4_handle->allocator = allocator;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_digest_callback(ema_mp4_ctrl_handle_t handle, digest_cb_t cb, void *instance)
+{
+    handle->digest_cb          = cb;
+    handle->digest_cb_instance = instance;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+uint32_t
+ema_mp4_mux_set_segment_callback(ema_mp4_ctrl_handle_t handle, segment_cb_t cb, void *instance)
+{
+    handle->segment_cb          = cb;
+    handle->segment_cb_instance = instance;
+
+    return EMA_MP4_MUXED_OK;
+}
+
 
 uint32_t
 ema_mp4_mux_set_video_framerate(ema_mp4_ctrl_handle_t handle, uint32_t nome, uint32_t deno)
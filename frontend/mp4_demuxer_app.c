@@ -0,0 +1,286 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file  mp4_demuxer_app.c
+    @brief Implements mp4demuxer application: extracts tracks of an mp4 file to elementary streams
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"          /** OSAL_xyz() */
+#include "registry.h"       /** reg_bbio_get() */
+#include "io_base.h"
+#include "mp4_demux.h"
+#include "mp4_extract.h"
+#include "mp4_stream.h"
+
+
+static void
+show_version(void)
+{
+    const mp4base_version_info* mp4base_version = mp4base_get_version();
+
+    msglog(NULL, MSGLOG_CRIT, "%s\n", "Copyright (c) 2008-2017 Dolby Laboratories, Inc. All Rights Reserved\n");
+    msglog(NULL, MSGLOG_CRIT, "MP4demuxer version: %s (build: %s)\n",
+           mp4base_version->text, __DATE__);
+}
+
+static void
+mp4demuxer_usage(void)
+{
+    msglog(NULL, MSGLOG_CRIT,
+                "Usage: mp4demuxer arg [options]\n\n");
+    msglog(NULL, MSGLOG_CRIT,
+                " Args:       [Options]              Descriptions: \n");
+    msglog(NULL, MSGLOG_CRIT,
+                " -----       --------------------   -------------------------------------------------------\n");
+    msglog(NULL, MSGLOG_CRIT,
+                " --help,-h                          = Shows the help information.\n"
+                " --version,-v                       = Shows the version information.\n"
+                " --input-file,-i <file.mp4>         = Sets the mp4 file to extract tracks of.\n"
+                " --output-file,-o <file>            = Sets the output file name. Without a track ID, each track is written\n"
+                "                                      to <file>_<track ID>.<ext>, ext telling the elementary stream (ES) type.\n"
+                " --track-id <ID>                    = Extracts track <ID> only, to the output file itself.\n"
+                " --list                             = Lists the tracks instead of extracting them.\n"
+                " --overwrite                        = Overwrites existing output files.\n"
+                "                                      H264/H265 tracks are written as Annex B ES, AAC tracks as ADTS,\n"
+                "                                      AC-3, E-AC-3 and AC-4 tracks as their frames.\n"
+                "\n\n");
+
+    msglog(NULL, MSGLOG_CRIT, "mp4demuxer usage examples: \n"
+           "---------------------------------------------------\n"
+           "To extract all tracks of input.mp4 to es_1.h264, es_2.ec3, ...:\n"
+           "   mp4demuxer -i input.mp4 -o es\n\n"
+           "To extract track 2 of input.mp4 only:\n"
+           "   mp4demuxer -i input.mp4 --track-id 2 -o audio.ec3\n\n"
+           );
+}
+
+static void
+list_tracks(mp4_ctrl_handle_t demuxer)
+{
+    uint32_t u;
+
+    for (u = 0; u < demuxer->stream_num; u++)
+    {
+        stream_handle_t stream = demuxer->tracks[u];
+        const int8_t *  es_ext = mp4_extract_get_es_ext(stream);
+
+        msglog(NULL, MSGLOG_CRIT, "track %u: '%s', %u samples, %s\n", stream->track_ID, stream->codingname,
+               stream->sample_num, (es_ext) ? es_ext : (const int8_t *)"can't be extracted");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const int8_t *    input_fn  = NULL;
+    const int8_t *    output_fn = NULL;
+    uint32_t          track_ID  = 0;
+    int32_t           list_flag = 0, overwrite_flag = 0;
+    bbio_handle_t     src       = NULL;
+    mp4_ctrl_handle_t demuxer   = NULL;
+    stream_handle_t   streams[MAX_STREAMS];
+    bbio_handle_t     snks[MAX_STREAMS];
+    uint32_t          stream_num = 0;
+    uint32_t          u;
+    int32_t           err = EMA_MP4_MUXED_OK;
+
+    /**** init system */
+    MEM_CHK_INIT();
+#ifdef DEBUG
+    msglog_global_verbosity_set(MSGLOG_WARNING);
+#else
+    msglog_global_verbosity_set(MSGLOG_ERR);
+#endif
+    reg_bbio_init();
+    bbio_file_reg();
+
+    /**** CLI parser */
+    for (--argc, ++argv; argc && err == EMA_MP4_MUXED_OK; argc--, argv++)
+    {
+        const int8_t *opt = *argv;
+
+        if (!OSAL_STRCASECMP(opt, "-h") || !OSAL_STRCASECMP(opt, "--help"))
+        {
+            mp4demuxer_usage();
+            return 0;
+        }
+        else if (!OSAL_STRCASECMP(opt, "-v") || !OSAL_STRCASECMP(opt, "--version"))
+        {
+            show_version();
+            return 0;
+        }
+        else if (!OSAL_STRCASECMP(opt, "--list"))
+        {
+            list_flag = 1;
+        }
+        else if (!OSAL_STRCASECMP(opt, "--overwrite"))
+        {
+            overwrite_flag = 1;
+        }
+        else if (argc < 2)
+        {
+            err = EMA_MP4_MUXED_PARAM_ERR;
+        }
+        else if (!OSAL_STRCASECMP(opt, "--input-file") || !OSAL_STRCASECMP(opt, "-i"))
+        {
+            input_fn = *++argv;
+            argc--;
+        }
+        else if (!OSAL_STRCASECMP(opt, "--output-file") || !OSAL_STRCASECMP(opt, "-o"))
+        {
+            output_fn = *++argv;
+            argc--;
+        }
+        else if (!OSAL_STRCASECMP(opt, "--track-id"))
+        {
+            OSAL_SSCANF(*++argv, "%u", &track_ID);
+            argc--;
+        }
+        else
+        {
+            err = EMA_MP4_MUXED_PARAM_ERR;
+        }
+        if (err != EMA_MP4_MUXED_OK)
+        {
+            msglog(NULL, MSGLOG_ERR, "Error parsing command line: Unknown option: %s \n\n", opt);
+        }
+    }
+    if (err == EMA_MP4_MUXED_OK && (!input_fn || (!output_fn && !list_flag)))
+    {
+        msglog(NULL, MSGLOG_ERR, "Error parsing command line, using '-h' for more info.\n");
+        err = EMA_MP4_MUXED_CLI_ERR;
+    }
+    if (err != EMA_MP4_MUXED_OK)
+    {
+        return 1;
+    }
+
+    src = reg_bbio_get('f', 'r');
+    if (src->open(src, input_fn))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Can't open input file: %s\n", input_fn);
+        src->destroy(src);
+        return 1;
+    }
+    demuxer = mp4_demux_create(src);
+    if (!demuxer)
+    {
+        src->destroy(src);
+        return 1;
+    }
+    if (list_flag)
+    {
+        list_tracks(demuxer);
+        mp4_demux_destroy(demuxer);
+        src->destroy(src);
+        return 0;
+    }
+
+    /**** the tracks and their output files */
+    for (u = 0; u < demuxer->stream_num && err == EMA_MP4_MUXED_OK; u++)
+    {
+        stream_handle_t stream = demuxer->tracks[u];
+        const int8_t *  es_ext = mp4_extract_get_es_ext(stream);
+        int8_t *        fn;
+        size_t          fn_size;
+        FILE *          test_output;
+
+        if (track_ID && stream->track_ID != track_ID)
+        {
+            continue;
+        }
+        if (!es_ext)
+        {
+            msglog(NULL, MSGLOG_WARNING, "Skipping track %u: '%s' can't be extracted\n",
+                   stream->track_ID, stream->codingname);
+            err = (track_ID) ? EMA_MP4_MUXED_NO_SUPPORT : EMA_MP4_MUXED_OK;
+            continue;
+        }
+
+        fn_size = strlen(output_fn) + 32;
+        fn      = (int8_t *)MALLOC_CHK(fn_size);
+        if (!fn)
+        {
+            err = EMA_MP4_MUXED_NO_MEM;
+            break;
+        }
+        if (track_ID)
+        {
+            OSAL_STRNCPY(fn, fn_size, output_fn, fn_size);
+        }
+        else
+        {
+            OSAL_SNPRINTF(fn, fn_size, "%s_%u.%s", output_fn, stream->track_ID, es_ext);
+        }
+        test_output = fopen(fn, "r");
+        if (test_output)
+        {
+            fclose(test_output);
+            if (!overwrite_flag)
+            {
+                msglog(NULL, MSGLOG_ERR,
+                       "Output file %s had been existed, please using '--overwrite' if you want to overwrite it\n", fn);
+                err = EMA_MP4_MUXED_PARAM_ERR;
+            }
+        }
+        if (err == EMA_MP4_MUXED_OK)
+        {
+            snks[stream_num] = reg_bbio_get('f', 'w');
+            if (snks[stream_num]->open(snks[stream_num], fn))
+            {
+                msglog(NULL, MSGLOG_ERR, "ERROR! Can't create output file: %s\n", fn);
+                snks[stream_num]->destroy(snks[stream_num]);
+                err = EMA_MP4_MUXED_OPEN_FILE_ERR;
+            }
+            else
+            {
+                streams[stream_num++] = stream;
+            }
+        }
+        FREE_CHK(fn);
+    }
+    if (err == EMA_MP4_MUXED_OK && !stream_num)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! No track to extract\n");
+        err = EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    /**** go */
+    if (err == EMA_MP4_MUXED_OK)
+    {
+        err = mp4_extract_es(stream_num, streams, snks);
+    }
+
+    for (u = 0; u < stream_num; u++)
+    {
+        snks[u]->destroy(snks[u]);
+    }
+    mp4_demux_destroy(demuxer);
+    src->destroy(src);
+
+    return (err != EMA_MP4_MUXED_OK) ? 1 : 0;
+}
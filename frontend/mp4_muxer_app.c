@@ -32,7 +32,90 @@
 #include "utils.h"          /** OSAL_xyz() */
 #include "mp4_muxer.h"      /** EMA_MP4_FRAG */
 #include "ema_mp4_ifc.h"    /** ema_mp4_ctrl_handle_t */
+#include "mp4_trace.h"      /** mp4_trace_set_file() */
 
+/** most threads --parse-threads and --write-threads take */
+#define CLI_THREAD_NUM_MAX 64
+
+/** where --digest-list writes the digests of the output */
+static FILE *digest_list = NULL;
+
+/** if --stats json is given */
+static BOOL stats_json = FALSE;
+
+/** writes a line "<sha256> <md5> <size> <file>[:<fragment>@<offset>]" */
+static void
+write_digest(void *instance, const digest_t *digest)
+{
+    FILE *   fp = (FILE *)instance;
+    uint32_t u;
+
+    for (u = 0; u < 32; u++)
+    {
+        fprintf(fp, "%02x", digest->sha256[u]);
+    }
+    fputc(' ', fp);
+    for (u = 0; u < 16; u++)
+    {
+        fprintf(fp, "%02x", digest->md5[u]);
+    }
+    fprintf(fp, " %" PRIu64 " %s", digest->size, digest->name);
+    if (digest->segment)
+    {
+        fprintf(fp, ":%u@%" PRIi64, digest->segment, digest->offset);
+    }
+    fputc('\n', fp);
+}
+
+/** writes the counters of the run as a JSON object */
+static void
+write_stats_json(ema_mp4_ctrl_handle_t handle, FILE *fp)
+{
+    mp4_metrics_t *m = (mp4_metrics_t *)MALLOC_CHK(sizeof(mp4_metrics_t));
+    uint32_t       u;
+
+    if (!m || ema_mp4_mux_get_metrics(handle, m) != EMA_MP4_MUXED_OK)
+    {
+        FREE_CHK(m);
+        return;
+    }
+
+    fprintf(fp, "{\n  \"tracks\": [");
+    for (u = 0; u < m->track_num; u++)
+    {
+        fprintf(fp, "%s\n    { \"track_ID\": %u, \"parse_ns\": %" PRIu64 " }", u ? "," : "", m->track_ID[u], m->parse_ns[u]);
+    }
+    fprintf(fp, "\n  ],\n");
+    fprintf(fp, "  \"input_sample_ns\": %" PRIu64 ",\n", m->input_sample_ns);
+    fprintf(fp, "  \"setup_ns\": %" PRIu64 ",\n", m->setup_ns);
+    fprintf(fp, "  \"moov_ns\": %" PRIu64 ",\n", m->moov_ns);
+    fprintf(fp, "  \"mdat_ns\": %" PRIu64 ",\n", m->mdat_ns);
+    fprintf(fp, "  \"frag_num\": %u,\n", m->frag_num);
+    fprintf(fp, "  \"frag_ns\": %" PRIu64 ",\n", m->frag_ns);
+    fprintf(fp, "  \"frag_ns_max\": %" PRIu64 ",\n", m->frag_ns_max);
+    fprintf(fp, "  \"bytes_read\": %" PRIu64 ",\n", m->bytes_read);
+    fprintf(fp, "  \"bytes_written\": %" PRIu64 ",\n", m->bytes_written);
+    fprintf(fp, "  \"seek_num\": %" PRIu64 ",\n", m->seek_num);
+    fprintf(fp, "  \"scratch_size_max\": %" PRIu64 ",\n", m->scratch_size_max);
+    fprintf(fp, "  \"temp_bytes\": %" PRIu64, m->temp_bytes);
+#ifdef ENABLE_MP4_MEMSTAT
+    {
+        mp4_mem_stats_t stats;
+
+        mp4_mem_stats_get(&stats);
+        fprintf(fp, ",\n  \"memory\": {\n    \"live\": %" PRIi64 ", \"peak\": %" PRIi64 ", \"alloc_num\": %" PRIi64 ",\n    \"tags\": [",
+                stats.live_total, stats.peak_total, stats.alloc_num);
+        for (u = 0; u < MP4_MEM_TAG_NUM; u++)
+        {
+            fprintf(fp, "%s\n      { \"tag\": \"%s\", \"live\": %" PRIi64 ", \"peak\": %" PRIi64 " }",
+                    u ? "," : "", mp4_mem_tag_name(u), stats.live[u], stats.peak[u]);
+        }
+        fprintf(fp, "\n    ]\n  }");
+    }
+#endif
+    fprintf(fp, "\n}\n");
+    FREE_CHK(m);
+}
 
 static void
 show_version(void)
@@ -59,11 +142,23 @@ mp4muxer_usage(void)
                 " --input-file,-i <file.ext> [--media-lang <language>] \n" 
                 "                            [--media-timescale <timescale>] \n"
                 "                            [--input-video-frame-rate <framerate>]\n"
+                "                            [--input-nal-config <avcC/hvcC file>]\n"
+                "                            [--input-track-id <track ID>]\n"
+                "                            [--replace-track <track ID>]\n"
                 "                                    = Adds elementary stream (ES) file.ext with\n"
                 "                                      media language, timescale, and framerate(only for video,such as 23.97 or 30000/1001).\n"
                 "                                      Supports H264, H265, AC3, EC3, and AC4.\n"
+                "                                      With a nal config, the H264/H265 ES is nal length prefixed instead of Annex B.\n"
+                "                                      An .mp4 file adds its audio or video track <track ID>, by default the first one,\n"
+                "                                      with its samples and sample entries as they are, e.g. to re-fragment it.\n"
+                "                                      Without 'sdtp', the sample dependencies are taken from the sync samples:\n"
+                "                                      whether a non sync sample is depended on is left unknown.\n"
+                "                                      With --edit-file, the ES replaces track <track ID> of that file.\n"
                 " --output-file, -o <file.mp4>       = Sets the output file name.\n"
-                " --overwrite                        = Overwrites the existing output .mp4 file if there is one.\n"
+                " --edit-file <file.mp4>             = Adds the ES to the existing non fragmented file.mp4 instead of writing\n"
+                "                                      a new one. Only its moov is rewritten, the media data in it is kept as is.\n"
+                " --overwrite                        = Overwrites the existing output .mp4 file if there is one.\n");
+    msglog(NULL, MSGLOG_CRIT,
                 " --mpeg4-timescale <arg>            = Overrides the timescale of the entire presentation.\n"
                 " --mpeg4-brand <arg>                = Specifies the ISO base media file format brand in the format.\n"
                 " --mpeg4-comp-brand <arg>           = Specifies the ISO base media file format compatible brand(s), \n" 
@@ -73,6 +168,25 @@ mp4muxer_usage(void)
                 "                                      'mp4' is the default value.\n"
                 " --mpeg4-max-frag-duration <arg>    = Sets the maximum fragment duration in milliseconds. \n" 
                 "                                      By default, the max duration is 2s.\n"
+                " --parse-threads <arg>              = Parses H264/H265 ES on up to <arg> threads, cutting it at IDR pictures.\n"
+                "                                      The output is the same as with serial parsing, the default.\n"
+                " --write-threads <arg>              = Writes the fragment payloads of a 'frag-mp4' output on up to <arg> threads,\n"
+                "                                      one track per thread. The output is the same as with serial writing, the default.\n"
+                " --digest-list <arg>                = Writes the SHA-256 and MD5 digests of each output file, and of each fragment\n"
+                "                                      of a fragmented one, to file <arg>. They are computed as the output is written.\n"
+                " --stats <arg>                      = Prints the time taken per phase, the I/O and the scratch memory of the run\n"
+                "                                      once done. Valid value: 'json'.\n"
+                " --trace <arg>                      = Writes the timeline of the run as Chrome trace event JSON to file <arg>.\n"
+                "                                      Needs a build with ENABLE_MP4_TRACE defined.\n"
+                " --parse-cache <arg>                = Keeps what parsing an AC-3/E-AC-3/AC-4/AAC/H.264/H.265 ES gave in a sidecar in\n"
+                "                                      directory <arg> and uses it instead of parsing when the same ES is muxed again.\n"
+                "                                      Dolby Vision ES and AAC ES changing their configuration are not cached.\n"
+                " --start-time <arg>                 = Outputs the ES from <arg> ms on, with an edit list for the exact start.\n"
+                " --end-time <arg>                   = Outputs the ES up to <arg> ms.\n"
+                " --checkpoint                       = Keeps a checkpoint of a fragmented output in <file.mp4>.ckpt, so that\n"
+                "                                      the same command run again after an interruption continues the output.\n"
+                "                                      The parse of the ES is kept along, for them not to be parsed again.\n");
+    msglog(NULL, MSGLOG_CRIT,
                 " --dv-profile <arg>                 = Sets the Dolby Vision profile. This option is MANDATORY for \n"
                 "                                      DoVi elementary stream: Valid profile values are:\n"
                 "                                      4 - dvhe.04, BL codec: HEVC10; EL codec: HEVC10; BL compatibility: SDR/HDR.   \n"
@@ -93,6 +207,8 @@ mp4muxer_usage(void)
            "   mp4muxer -o output.mp4 -i audio.ec3 --mpeg4-comp-brand mp42,iso6,isom,msdh,dby1\n\n"
            "To multiplex AC-4 audio and H.264 video:\n"
            "   mp4muxer -o output.mp4 -i audio.ac4 -i video.h264 --mpeg4-comp-brand mp42,iso6,isom,msdh,dby1\n\n"
+           "To add an EC-3 audio track to an existing .mp4 file:\n"
+           "   mp4muxer --edit-file video.mp4 -i audio.ec3\n\n"
            "To multiplex Dolby vision BL+EL+RPU into a .mp4 file :\n"
            "   mp4muxer -i ves_bl_el_rpu.264 -o single_track_output.mp4 --dv-profile 0 --mpeg4-comp-brand mp42,iso6,isom,msdh,dby1 --overwrite \n\n"
 
@@ -108,11 +224,28 @@ mp4muxer_usage(void)
            );
 }
 
+/** reads the number arg of option opt into *val: EMA_MP4_MUXED_PARAM_ERR if it is none or above max */
+static int32_t
+parse_uint(const int8_t *opt, const int8_t *arg, uint32_t max, uint32_t *val)
+{
+    uint32_t u;
+
+    if (OSAL_SSCANF(arg, "%u", &u) != 1 || u > max)
+    {
+        msglog(NULL, MSGLOG_ERR, "Error parsing command line: %s %s: a number up to %u expected\n", opt, arg, max);
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+    *val = u;
+
+    return EMA_MP4_MUXED_OK;
+}
+
 static int32_t
 parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
 {
     int32_t       ret = EMA_MP4_MUXED_OK;
-    int32_t       ua = 0, ub = 0, ts = 0;
+    int32_t       ua = 0, ts = 0;
+    uint32_t      ub = 0, uv = 0;
     int32_t       overwrite_flag = 0;
     int32_t       output_file_exist_flag = 0;
 
@@ -135,7 +268,7 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
     {
         const int8_t* opt = *argv;
         
-        if (OSAL_STRCASECMP(opt, "--overwrite"))
+        if (OSAL_STRCASECMP(opt, "--overwrite") && OSAL_STRCASECMP(opt, "--checkpoint"))
         {
             argv++;
             argc--;
@@ -157,6 +290,10 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
         {
             overwrite_flag = 1;
         }
+        else if (!OSAL_STRCASECMP(opt, "--checkpoint"))
+        {
+            ret = ema_mp4_mux_set_checkpoint(handle, TRUE);
+        }
         else if (!argc)
         {
             /** since we follow (opt, val) pair rule except for help, info and version */
@@ -166,7 +303,8 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
         } /** we have at least one opt value pair afterward */
         else if (!OSAL_STRCASECMP(opt, "--input-file") || !OSAL_STRCASECMP(opt, "-i"))
         {
-            int8_t *fn = *argv, *lang = NULL, *enc_name = NULL;
+            int8_t *fn = *argv, *lang = NULL, *enc_name = NULL, *nal_cfg_fn = NULL;
+            uint32_t replace_track_ID = 0;
             ua = 0;
             ub = 0;
             ts = 0;
@@ -181,12 +319,33 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
                     argc -= 2;
                     argv += 2;
                 }
+                else if (!OSAL_STRCASECMP(opt, "--input-nal-config"))
+                {
+                    nal_cfg_fn = argv[2];
+                    argc -= 2;
+                    argv += 2;
+                }
                 else if (!OSAL_STRCASECMP(opt, "--media-timescale"))
                 {
                     OSAL_SSCANF(argv[2], "%u", &ts);
                     argc -= 2;
                     argv += 2;
                 }
+                else if (!OSAL_STRCASECMP(opt, "--input-track-id"))
+                {
+                    if (parse_uint(opt, argv[2], 0xffffffff, &ub) != EMA_MP4_MUXED_OK)
+                    {
+                        return EMA_MP4_MUXED_PARAM_ERR;
+                    }
+                    argc -= 2;
+                    argv += 2;
+                }
+                else if (!OSAL_STRCASECMP(opt, "--replace-track"))
+                {
+                    OSAL_SSCANF(argv[2], "%u", &replace_track_ID);
+                    argc -= 2;
+                    argv += 2;
+                }
                 else if (!OSAL_STRCASECMP(opt, "--input-video-frame-rate"))
                 {
                     int8_t *fn = argv[2];
@@ -244,6 +403,14 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
                 }
             }
             ret = ema_mp4_mux_set_input(handle, fn, lang, enc_name, ts, ua, ub);
+            if (ret == EMA_MP4_MUXED_OK && nal_cfg_fn)
+            {
+                ret = ema_mp4_mux_set_input_nal_config(handle, nal_cfg_fn);
+            }
+            if (ret == EMA_MP4_MUXED_OK && replace_track_ID)
+            {
+                ret = ema_mp4_mux_set_input_replace(handle, replace_track_ID);
+            }
         }
         else if (!OSAL_STRCASECMP(opt, "--output-file") || !OSAL_STRCASECMP(opt, "-o"))
         {
@@ -263,6 +430,42 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
 
             ret = ema_mp4_mux_set_output(handle, 0, fn);
         }
+        else if (!OSAL_STRCASECMP(opt, "--edit-file"))
+        {
+            ret = ema_mp4_mux_set_edit_file(handle, *argv);
+        }
+        else if (!OSAL_STRCASECMP(opt, "--digest-list"))
+        {
+            if (digest_list)
+            {
+                fclose(digest_list);
+            }
+            digest_list = fopen(*argv, "w");
+            if (!digest_list)
+            {
+                msglog(NULL, MSGLOG_ERR, "Error: can't open %s\n", *argv);
+                return EMA_MP4_MUXED_OPEN_FILE_ERR;
+            }
+            ret = ema_mp4_mux_set_digest_callback(handle, write_digest, digest_list);
+        }
+        else if (!OSAL_STRCASECMP(opt, "--stats"))
+        {
+            if (OSAL_STRCASECMP(*argv, "json"))
+            {
+                msglog(NULL, MSGLOG_ERR, "Error: unknown --stats format %s\n", *argv);
+                return EMA_MP4_MUXED_PARAM_ERR;
+            }
+            stats_json = TRUE;
+        }
+        else if (!OSAL_STRCASECMP(opt, "--trace"))
+        {
+#ifdef ENABLE_MP4_TRACE
+            mp4_trace_set_file((const char *)*argv);
+#else
+            msglog(NULL, MSGLOG_ERR, "Error: --trace needs a build with ENABLE_MP4_TRACE defined\n");
+            return EMA_MP4_MUXED_PARAM_ERR;
+#endif
+        }
         else if (!OSAL_STRCASECMP(opt, "--mpeg4-timescale"))
         {
             OSAL_SSCANF(*argv, "%u", &ua);
@@ -289,6 +492,42 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
         {
             OSAL_SSCANF(*argv, "%u", &ua);
             ret = ema_mp4_mux_set_max_duration(handle, ua);
+        }
+        else if (!OSAL_STRCASECMP(opt, "--parse-threads"))
+        {
+            ret = parse_uint(opt, *argv, CLI_THREAD_NUM_MAX, &uv);
+            if (ret == EMA_MP4_MUXED_OK)
+            {
+                ret = ema_mp4_mux_set_parse_threads(handle, uv);
+            }
+        }
+        else if (!OSAL_STRCASECMP(opt, "--write-threads"))
+        {
+            ret = parse_uint(opt, *argv, CLI_THREAD_NUM_MAX, &uv);
+            if (ret == EMA_MP4_MUXED_OK)
+            {
+                ret = ema_mp4_mux_set_write_threads(handle, uv);
+            }
+        }
+        else if (!OSAL_STRCASECMP(opt, "--parse-cache"))
+        {
+            ret = ema_mp4_mux_set_parse_cache(handle, *argv);
+        }
+        else if (!OSAL_STRCASECMP(opt, "--start-time"))
+        {
+            ret = parse_uint(opt, *argv, 0xffffffff, &uv);
+            if (ret == EMA_MP4_MUXED_OK)
+            {
+                ret = ema_mp4_mux_set_time_range(handle, uv, handle->usr_cfg_mux.range_end);
+            }
+        }
+        else if (!OSAL_STRCASECMP(opt, "--end-time"))
+        {
+            ret = parse_uint(opt, *argv, 0xffffffff, &uv);
+            if (ret == EMA_MP4_MUXED_OK)
+            {
+                ret = ema_mp4_mux_set_time_range(handle, handle->usr_cfg_mux.range_start, uv);
+            }
         }
 		else if (!OSAL_STRCASECMP(opt, "--dv-profile"))
         {
@@ -330,7 +569,8 @@ parse_cli(ema_mp4_ctrl_handle_t handle, int32_t argc, int8_t **argv)
         /** output file overwrite check */
         /** if no "--overwrite" option, if the output file had been exist, return error and exit.*/
         /** if providing "--overwrite" option, always create output file */
-        if ((!overwrite_flag) && (output_file_exist_flag))
+        /** with "--checkpoint", the output an interrupted run left is continued */
+        if ((!overwrite_flag) && (output_file_exist_flag) && !handle->usr_cfg_mux.checkpoint)
         {
             msglog(NULL, MSGLOG_ERR,
                    "Output file had been existed, please using '--overwrite' if you want to overwrite it\n\n");
@@ -382,6 +622,11 @@ main(int argc, char **argv)
     /**** go */
     CHECK( ema_mp4_mux_start(ema_handle) );
 
+    if (stats_json)
+    {
+        write_stats_json(ema_handle, stdout);
+    }
+
 cleanup:
 	if (err != 0)
 	{
@@ -392,6 +637,11 @@ cleanup:
     {
         ema_mp4_mux_destroy(ema_handle);
     }
+    /** the digests of the output come in up to its close by ema_mp4_mux_destroy() */
+    if (digest_list)
+    {
+        fclose(digest_list);
+    }
 
     return err;
 }
@@ -93,6 +93,9 @@ typedef bbio_t *        bbio_handle_t;
     BOOL (*is_more_byte2)(bbio_handle_t bbio);                              \
     int32_t (*skip_bytes)(bbio_handle_t bbio, int64_t byte_num);            \
                                                                             \
+    /** counted by the device for metrics: skips count as seeks           */\
+    uint64_t bytes_read, bytes_written, seek_num;                           \
+                                                                            \
     /** internal use for bit operation                                    */\
     /* 'w' op:                                                            */\
     /* when cached_bit_num == 8, write to byte intf => cached_bit_num < 8 */\
@@ -108,6 +111,7 @@ struct bbio_t_
 
 void bbio_file_reg(void);
 void bbio_buf_reg(void);
+void bbio_rope_reg(void);
 
 /*
  * (some) alternatives to direct function pointer usage
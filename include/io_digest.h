@@ -0,0 +1,79 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_digest.h
+    @brief Defines a sink computing MD5 and SHA-256 digests of what is written through it
+*/
+
+#ifndef __IO_DIGEST_H__
+#define __IO_DIGEST_H__
+
+#include "io_base.h"  /** bbio_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The digests of a file written through a digest sink, or of a segment of it */
+typedef struct digest_t_
+{
+    const int8_t *name;        /**< the name the sink was opened with */
+    uint32_t      segment;     /**< 0: the whole file. Else the number of the segment in the file, from 1 */
+    int64_t       offset;      /**< where the bytes digested start in the file */
+    uint64_t      size;        /**< number of bytes digested */
+    uint8_t       md5[16];
+    uint8_t       sha256[32];
+} digest_t;
+
+/** Called with the digests of a segment once its bytes are final and those of a file when it's closed */
+typedef void (*digest_cb_t)(void *instance, const digest_t *digest);
+
+/** Creates a sink writing through to snk, which it owns from then on, and hashing the bytes
+ *  as they are written. Bytes written again later on (sizes, offsets known once what follows
+ *  is out) are to be held with sink_digest_hold(): the bytes from the lowest position held
+ *  on are kept until it is released. Beyond 64 MiB kept, they are dropped and read back from
+ *  the file, or from snk if it can be read, when it is closed. Returns NULL if out of memory */
+bbio_handle_t digest_sink_create(bbio_handle_t snk, digest_cb_t cb, void *instance);
+
+/** TRUE if sink is a digest sink */
+BOOL sink_is_digest(bbio_handle_t sink);
+
+/** The byte at pos is to be written again: nothing from pos on is hashed until it is released.
+ *  These are no-ops for sinks which are not digest sinks */
+void sink_digest_hold(bbio_handle_t sink, int64_t pos);
+void sink_digest_release(bbio_handle_t sink, int64_t pos);
+
+/** A segment of the file starts at the current position */
+void sink_digest_segment(bbio_handle_t sink);
+
+/** The digests of the size bytes of src from offset on: name and segment are not set.
+ *  EMA_MP4_MUXED_READ_ERR if src ends before */
+int32_t src_digest(bbio_handle_t src, int64_t offset, uint64_t size, digest_t *digest);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __IO_DIGEST_H__ */
@@ -0,0 +1,59 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_resume.h
+    @brief Defines a sink continuing the output an interrupted job left
+*/
+
+#ifndef __IO_RESUME_H__
+#define __IO_RESUME_H__
+
+#include "io_base.h"  /** bbio_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Creates a sink writing through to snk, which it owns from then on, but for the bytes the
+ *  files opened hold already, as set with sink_resume_skip(): the job run again writes them
+ *  again, and they are dropped. Returns NULL if out of memory */
+bbio_handle_t resume_sink_create(bbio_handle_t snk);
+
+/** The file opened next holds the first size bytes written to it already. They are dropped up
+ *  to the first write going past them, from which on all is written, earlier positions too.
+ *  size < 0: the file is complete. It is not opened, nothing is written to it.
+ *  No-op for sinks which are not resume sinks */
+void sink_resume_skip(bbio_handle_t sink, int64_t size);
+
+/** The number of bytes from the position on which the file open holds already: what is written
+ *  there is dropped, so they may as well be sought over. INT64_MAX if the file is complete,
+ *  0 for sinks which are not resume sinks */
+int64_t sink_resume_dropped(bbio_handle_t sink);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __IO_RESUME_H__ */
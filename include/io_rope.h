@@ -0,0 +1,69 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_rope.h
+    @brief Defines a memory sink made of fixed size blocks, handed out without copying them
+*/
+
+#ifndef __IO_ROPE_H__
+#define __IO_ROPE_H__
+
+#include "io_base.h"  /** bbio_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** A run of bytes held by a rope sink. Laid out as the POSIX struct iovec, for writev() */
+typedef struct bbio_iovec_t_
+{
+    void * base;
+    size_t len;
+} bbio_iovec_t;
+
+/** Fills iov with up to iov_num runs of the bytes written into the rope sink ('c'), in order.
+ *  Returns the number of runs there are: the ones past iov_num are not filled. Blocks don't
+ *  move once written into: the runs are valid until the sink is destroyed, reset by its
+ *  set_buffer() or emptied by its get_buffer(). Returns 0 for sinks which are not rope sinks */
+size_t sink_rope_iovec(bbio_handle_t sink, bbio_iovec_t *iov, size_t iov_num);
+
+/** Called with a file written into a rope sink when it is closed: name and number are those
+ *  of the file, numbered in the order opened from 0. The runs, iov_num of them, and iov are
+ *  the callback's from then on, to be freed with sink_rope_free_iovec(). iov is NULL if the
+ *  file is empty */
+typedef void (*segment_cb_t)(void *instance, const int8_t *name, uint32_t number, bbio_iovec_t *iov, size_t iov_num);
+
+/** Makes the rope sink hand each file written into it over to cb when it is closed, or when
+ *  the next one is opened or the sink destroyed. Files are not kept on then */
+void sink_rope_deliver(bbio_handle_t sink, segment_cb_t cb, void *instance);
+
+/** Frees the runs handed over to a segment_cb_t, and iov */
+void sink_rope_free_iovec(bbio_iovec_t *iov, size_t iov_num);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __IO_ROPE_H__ */
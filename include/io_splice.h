@@ -0,0 +1,48 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_splice.h
+    @brief Defines a source reading part of another with bytes put in
+*/
+
+#ifndef __IO_SPLICE_H__
+#define __IO_SPLICE_H__
+
+#include "io_base.h"  /** bbio_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Creates a source reading the bytes of src from off on, with the ins_size bytes of ins put in
+ *  ins_pos bytes after off: a part of an es with the parameter sets it needs, parsed as if it
+ *  were all of it. Owns src and ins from then on, also if it returns NULL for out of memory */
+bbio_handle_t splice_src_create(bbio_handle_t src, int64_t off, uint32_t ins_pos, uint8_t *ins, uint32_t ins_size);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __IO_SPLICE_H__ */
@@ -65,6 +65,16 @@ typedef it_list_t         *it_list_handle_t;
 list_handle_t list_create(size_t content_size);  /* create list stores content of content_size */
 void          list_destroy(list_handle_t lst);   /* destroy */
 
+/* create a run coded list: the contents that go on from the one before, field by field, by the
+ * same steps as it did are kept as one run, e.g. the (idx, dts) of constant duration samples.
+ * The entries got back are copies valid for the next few calls only: they can't be changed in
+ * the list, and list_remove_entry(), list_free_entry() and count_value_lst_update() are not for
+ * such lists */
+list_handle_t list_create_run(size_t content_size);
+
+/* the subsystem the entries allocated from now on are accounted to: a mp4_mem_tag_t, MP4_MEM_LIST by default */
+void list_set_mem_tag(list_handle_t lst, uint32_t mem_tag);
+
 void *list_alloc_entry(list_handle_t lst);      /* alloc memory of content_size */
 void  list_free_entry(void *p_content);         /* free */
 
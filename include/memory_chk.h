@@ -37,10 +37,57 @@ extern "C"
  /*
  * Memory (re)allocation, free and string duplication checking routines.
  *
+ * Built with the define ENABLE_MP4_MEMSTAT, e.g. make EXTRA_CFLAGS=-DENABLE_MP4_MEMSTAT, they account the
+ * bytes allocated by the subsystem the allocation is tagged with: the live bytes and their peak per tag.
+ * mp4_mem_stats_get() returns them and mp4_muxer_destroy() logs them.
+ * Built with the define ENABLE_MP4_ALLOC_HOOKS they allocate from the allocator of the host in scope on the
+ * thread: that of the muxer or parser whose entry is running (usr_cfg_mux_t::allocator, reg_parser_get_ex()),
+ * else libc. A block is given back to the allocator it came from, whoever frees it.
+ * With either define the memory of these routines must be freed with FREE_CHK() and no other memory may be.
+ * Without them they are the libc calls and the tags are ignored.
  */
     #include    <stdlib.h>
     #include    <string.h>
 
+    /** the subsystems the allocations are accounted to */
+    typedef enum mp4_mem_tag_t_
+    {
+        MP4_MEM_OTHER = 0,
+        MP4_MEM_LIST,       /**< list nodes, the lists and their iterators */
+        MP4_MEM_NAL,        /**< the NAL buffers of the AVC and HEVC parsers */
+        MP4_MEM_NAL_INDEX,  /**< the NAL index keeping the NALs of the samples: what was tmp_bbo */
+        MP4_MEM_SCRATCH,    /**< the scratch buffer of the muxer */
+        MP4_MEM_DSI,        /**< DSIs, parameter sets, codec configs and sample entries (stsd) */
+        MP4_MEM_FRAG,       /**< fragment index, tfra entries and the fragment write plan */
+        MP4_MEM_TAG_NUM
+    } mp4_mem_tag_t;
+
+    /** An allocator of the host, e.g. the arena of a job: ctx is handed to each call */
+    typedef struct mp4_allocator_t_
+    {
+        void *(*alloc)  (void *ctx, size_t size);
+        void *(*realloc)(void *ctx, void *ptr, size_t size);
+        void  (*free)   (void *ctx, void *ptr);
+        void  *ctx;
+    } mp4_allocator_t;
+
+#if defined(ENABLE_MP4_MEMSTAT) || defined(ENABLE_MP4_ALLOC_HOOKS)
+    #include    "c99_inttypes.h"
+
+    void *mp4_mem_alloc(uint32_t tag, size_t size);
+    /** tag: that of a new block. A block reallocated keeps its tag */
+    void *mp4_mem_realloc(uint32_t tag, void *ptr, size_t size);
+    void  mp4_mem_free(void *ptr);
+    char *mp4_mem_strdup(const char *str);
+
+    #define MEM_CHK_INIT()
+    #define STRDUP_CHK(ptr)                 mp4_mem_strdup(ptr)
+    #define MALLOC_CHK(size)                mp4_mem_alloc(MP4_MEM_OTHER, size)
+    #define MALLOC_TAG_CHK(tag, size)       mp4_mem_alloc(tag, size)
+    #define REALLOC_CHK(ptr, size)          mp4_mem_realloc(MP4_MEM_OTHER, ptr, size)
+    #define REALLOC_TAG_CHK(tag, ptr, size) mp4_mem_realloc(tag, ptr, size)
+    #define FREE_CHK(ptr)                   mp4_mem_free(ptr)
+#else
     #define MEM_CHK_INIT()
     #ifdef _MSC_VER
         #define STRDUP_CHK(ptr)     _strdup(ptr)
@@ -48,8 +95,61 @@ extern "C"
         #define STRDUP_CHK(ptr)     strdup(ptr)
     #endif
     #define MALLOC_CHK(size)        malloc(size)
+    #define MALLOC_TAG_CHK(tag, size)       malloc(size)
     #define REALLOC_CHK(ptr, size)  realloc(ptr, size)
+    #define REALLOC_TAG_CHK(tag, ptr, size) realloc(ptr, size)
     #define FREE_CHK(ptr)           if (ptr) free(ptr)
+#endif
+
+#ifdef ENABLE_MP4_ALLOC_HOOKS
+    /** Makes allocator that of the calling thread, NULL keeps the one there is. Returns the one to restore */
+    const mp4_allocator_t *mp4_mem_allocator_enter(const mp4_allocator_t *allocator);
+    void                   mp4_mem_allocator_leave(const mp4_allocator_t *prev);
+    /** The allocator of the calling thread, NULL for libc: for the threads it starts to enter */
+    const mp4_allocator_t *mp4_mem_allocator_get(void);
+
+    /** runs stmt with its allocations going to allocator: stmt must not return */
+    #define MEM_ALLOC_SCOPE_CHK(allocator, stmt)                                               \
+        do                                                                                     \
+        {                                                                                      \
+            const mp4_allocator_t *mem_alloc_prev_ = mp4_mem_allocator_enter(allocator);       \
+            stmt;                                                                              \
+            mp4_mem_allocator_leave(mem_alloc_prev_);                                          \
+        } while (0)
+    #define MEM_ALLOC_GET_CHK()     mp4_mem_allocator_get()
+#else
+    #define MEM_ALLOC_SCOPE_CHK(allocator, stmt)  do { stmt; } while (0)
+    #define MEM_ALLOC_GET_CHK()     NULL
+#endif  /* ENABLE_MP4_ALLOC_HOOKS */
+
+#ifdef ENABLE_MP4_MEMSTAT
+
+    typedef struct mp4_mem_stats_t_
+    {
+        int64_t live[MP4_MEM_TAG_NUM];  /**< bytes allocated now */
+        int64_t peak[MP4_MEM_TAG_NUM];  /**< the most bytes allocated at a time */
+        int64_t live_total;
+        int64_t peak_total;             /**< of all tags together */
+        int64_t alloc_num;              /**< allocations so far */
+    } mp4_mem_stats_t;
+
+    /** Accounts the block to tag from now on, e.g. a buffer taken over from a sink */
+    void  mp4_mem_tag(void *ptr, uint32_t tag);
+
+    /** Gets the statistics of all threads */
+    void        mp4_mem_stats_get(mp4_mem_stats_t *stats);
+    /** Resets the peaks to the live bytes, e.g. between jobs */
+    void        mp4_mem_stats_reset_peaks(void);
+    const char *mp4_mem_tag_name(uint32_t tag);
+    /** Logs the statistics at MSGLOG_WARNING */
+    void        mp4_mem_stats_log(void);
+
+    #define MEM_TAG_CHK(ptr, tag)           mp4_mem_tag(ptr, tag)
+    #define MEM_STATS_LOG_CHK()             mp4_mem_stats_log()
+#else
+    #define MEM_TAG_CHK(ptr, tag)
+    #define MEM_STATS_LOG_CHK()
+#endif  /* ENABLE_MP4_MEMSTAT */
 
     #define MEM_LEAK_CHK_MALLOC(ptr) 
     #define MEM_LEAK_CHK_FREE(ptr)  
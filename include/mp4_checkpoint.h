@@ -0,0 +1,89 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/**
+ *  @file  mp4_checkpoint.h
+ *  @brief Defines the checkpoint a fragmented output job continues from when run again
+ */
+
+#ifndef __MP4_CHECKPOINT_H__
+#define __MP4_CHECKPOINT_H__
+
+#include "mp4_ctrl.h"  /** usr_cfg_mux_t, usr_cfg_es_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The checkpoint <output file>.ckpt of a fragmented output to files records how much of the
+ *  output is complete: the number of fragments ('moof' and 'mdat') written, and the size of
+ *  the file up to the end of the last one - or, for a segmented output, the number of media
+ *  segments. For each fragment, fragment 0 being the 'ftyp' and 'moov' or the init segment,
+ *  it holds where its bytes are and their SHA-256 - up to a 'sidx' among them, which is
+ *  rewritten as the fragments after it complete and so written again. It is keyed by the output file name, the
+ *  settings the output depends on and the path, size and modification time of each es. It is
+ *  rewritten as each fragment completes. When the job is run again, the top level boxes of the
+ *  output it left are checked against it with mp4_checkpoint_check_file() and the bytes of
+ *  each fragment with mp4_checkpoint_verify(): what is complete need not be written again.
+ *  The parse of each es is kept aside as a parse cache, for the es not to be parsed again.
+ */
+typedef struct mp4_checkpoint_t_ mp4_checkpoint_t;
+typedef mp4_checkpoint_t *mp4_checkpoint_handle_t;
+
+/** Creates the checkpoint of the job p_usr_cfg_mux and its es describe. NULL if out of memory
+ *  or an es can't be found */
+mp4_checkpoint_handle_t mp4_checkpoint_create(const usr_cfg_mux_t *p_usr_cfg_mux, const usr_cfg_es_t *p_usr_cfg_ess);
+/** Removes the checkpoint file if mp4_checkpoint_done() was called */
+void                    mp4_checkpoint_destroy(mp4_checkpoint_handle_t checkpoint);
+
+/** Reads the checkpoint of the job, if there is one: TRUE if found, *frag_num fragments then
+ *  being complete and the output file *size bytes up to the end of the last one */
+BOOL    mp4_checkpoint_load(mp4_checkpoint_handle_t checkpoint, uint32_t *frag_num, int64_t *size);
+/** TRUE if the bytes of each fragment mp4_checkpoint_load() found have the digest recorded */
+BOOL    mp4_checkpoint_verify(mp4_checkpoint_handle_t checkpoint);
+
+/** Records that frag_num fragments are complete, the last one ending at size in file fn, or at
+ *  its end if size < 0. Its bytes are from the end of the fragment before, if that one is in
+ *  fn, else from the start of fn: they are read back for their digest. What was recorded of
+ *  fragment frag_num and later ones is replaced */
+int32_t mp4_checkpoint_save(mp4_checkpoint_handle_t checkpoint, const int8_t *fn, uint32_t frag_num, int64_t size);
+
+/** The job is done: the checkpoint file goes on mp4_checkpoint_destroy(), and so do the
+ *  parse caches named by mp4_checkpoint_cache_fn() */
+void    mp4_checkpoint_done(mp4_checkpoint_handle_t checkpoint);
+
+/** The parse cache sidecar of es es_idx kept with the checkpoint: <output file>.ckpt.<es_idx>.pidx.
+ *  Valid until the next call */
+const int8_t *mp4_checkpoint_cache_fn(mp4_checkpoint_handle_t checkpoint, uint32_t es_idx);
+
+/** TRUE if the top level boxes of file fn are complete up to size, one of them ending there.
+ *  size < 0: up to the end of the file. *moov_num gets the number of 'moov' boxes in there
+ *  and *frag_num that of fragments: 'mdat' boxes right after a 'moof' */
+BOOL    mp4_checkpoint_check_file(const int8_t *fn, int64_t size, uint32_t *moov_num, uint32_t *frag_num);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __MP4_CHECKPOINT_H__ */
@@ -156,6 +156,7 @@ typedef struct usr_cfg_es_t_
 {
     uint32_t input_mode;
     const int8_t * input_fn;                           /**< valid if has file input */
+    const int8_t * nal_cfg_fn;                         /**< avcC/hvcC file: input_fn is nal length prefixed */
     const int8_t * lang;
     const int8_t * enc_name;
     const int8_t * hdlr_name;
@@ -200,6 +201,14 @@ typedef struct usr_cfg_mux_t_
     uint32_t    sd;                        /**< 0: Only single sample description allowed. 1: Multiple sample descriptions allowed. */
     uint32_t    withopt;                   /**< additional options */
     uint32_t    max_pdu_size;              /**< max mtu size for network payload (hint track) */
+    uint32_t    parse_threads;             /**< >1: parse avc/hevc es in ranges on up to that many threads */
+    uint32_t    frag_write_threads;        /**< >1: write the fragment payloads of a file output on up to that many threads */
+    const int8_t *parse_cache_dir;         /**< directory of the parse cache sidecars, NULL for none */
+    BOOL        edit_mode;                 /**< output_fn is an existing mp4 file the tracks are added to */
+    BOOL        checkpoint;                /**< keep a checkpoint of the fragmented output to continue from */
+    uint32_t    range_start;               /**< start of the time range output, in ms */
+    uint32_t    range_end;                 /**< end of the time range output, in ms. 0: up to the end of the es */
+    const mp4_allocator_t *allocator;      /**< the muxer allocates from, NULL for libc. ENABLE_MP4_ALLOC_HOOKS builds only */
 
     int32_t es_num;
     enum OutputFormat output_format;            
@@ -242,6 +251,20 @@ typedef struct idx_dts_t_
     uint64_t dts;
 } idx_dts_t;
 
+/* bitrate_win_lst entry */
+typedef struct dts_size_t_
+{
+    uint64_t dts;
+    uint32_t size;
+} dts_size_t;
+
+/* bitrate_run_lst entry: the bitrates of the samples sharing one sample entry */
+typedef struct bitrate_run_t_
+{
+    uint32_t max_bitrate;                      /**< highest rate over the one second windows of the run */
+    uint32_t avg_bitrate;
+} bitrate_run_t;
+
 /* for stsd_lst entry */
 typedef struct idx_ptr_t_
 {
@@ -287,6 +310,9 @@ typedef struct track_t_
     uint64_t media_duration;                    /**< track duration in media timescale */
     uint64_t sum_track_edits;                   /**< track duration in movie timescale; i.e. duration of all the track edits, used as duration in 'tkhd' */
     uint32_t elst_version;
+    BOOL     clip;                              /**< presented from clip_skip after its first sample on only */
+    uint64_t clip_skip;                         /**< in the timescale of the samples input */
+    uint64_t clip_duration;                     /**< in that timescale, 0 for up to the end */
 
     uint16_t alternate_group;                   /**< alternate_group field in 'tkhd' */
 
@@ -307,7 +333,13 @@ typedef struct track_t_
                                                       this way it works only for the case were there is only a single sample entry per track. */
     int32_t      use_audio_channelcount;        /**< 1: Use actual number of main audio channels, 0: Always 2 like stated in the Dolby File Spec */
 
-    double   totalBitrate;
+    /* maxBitrate: sliding one second dts window, updated per sample */
+    list_handle_t bitrate_win_lst;              /**< (dts, size) of the samples in the window */
+    uint64_t      bitrate_win_size;             /**< bytes in the window */
+    uint64_t      bitrate_run_dts;              /**< dts of the first sample of the current run */
+    uint64_t      bitrate_run_size;             /**< bytes of the current run */
+    uint32_t      bitrate_run_max;              /**< highest window rate of the current run */
+    list_handle_t bitrate_run_lst;              /**< (max, avg) per closed run, one per 'stsd' entry */
 
     /**** raw info for generating mp4 file */
     uint32_t sample_num;
@@ -320,6 +352,7 @@ typedef struct track_t_
     /* timing */
     list_handle_t dts_lst;                      /**< (idx, dts) */
     list_handle_t cts_offset_lst;               /**< (idx, count, value) */
+    uint32_t *    cts_offsets;                  /**< the cts offset of each sample, if given instead of the parser's */
     list_handle_t sync_lst;                     /**< (idx, dts) */
     list_handle_t edt_lst;                      /**< (segment_duration, media_time, media_rate) */
     /* location */
@@ -327,6 +360,7 @@ typedef struct track_t_
     list_handle_t chunk_lst;                    /**< (idx, dts, offset, data_reference_index, sample_num, size, sample_description_index) */
     /* stsd */
     list_handle_t stsd_lst;                     /**< (idx, ptr) */
+    list_handle_t stsd_dsi_lst;                 /**< (entry, ptr): the dsi each stsd entry is built with, ptr size prefixed */
     list_handle_t sdtp_lst;                     /**< sample dependency information for 'sdtp' box */
     list_handle_t trik_lst;                     /**< sample dependency information for 'trik' box */
     list_handle_t frame_type_lst;               /**< sample frame type information; level for 'ssix' box*/
@@ -360,6 +394,7 @@ typedef struct track_t_
     struct mp4_ctrl_t_ *mp4_ctrl;               /**< to refer ready only cfg info, default fragment info */
     parser_handle_t     parser;                 /**< ref to parser to access info */
     uint32_t            es_idx;                 /**< the es index the track correponding to */
+    uint64_t            parse_ns;               /**< parsing its es, as mp4_metrics_t */
 
     /**** raw decoder specific config */
     uint32_t dsi_size;
@@ -462,6 +497,7 @@ typedef struct track_t_
     box_data_tbl_t stsc;
     box_data_tbl_t stsz;
     box_data_tbl_t stco;
+    box_data_tbl_t sdtp;                        /**< demux only: one byte per sample, no entry_count */
 
     /** derived value */
     uint32_t sample_max_size;
@@ -495,6 +531,26 @@ typedef void (*progress_callback_t)(const float progress, void *instance);
 /**** onwrite notifification callbacks */
 typedef int32_t (*onwrite_callback_t)(void *instance);
 
+/**** counters of a muxing run: times are in nanoseconds of a monotonic clock */
+typedef struct mp4_metrics_t_
+{
+    uint32_t track_num;
+    uint32_t track_ID[MAX_STREAMS];
+    uint64_t parse_ns[MAX_STREAMS];     /**< parsing the ES of each track, mp4_muxer_input_sample() left out */
+    uint64_t input_sample_ns;           /**< in mp4_muxer_input_sample() */
+    uint64_t setup_ns;                  /**< in setup_muxer() */
+    uint64_t moov_ns;                   /**< in write_moov_box() */
+    uint64_t mdat_ns;                   /**< in write_mdat_box() */
+    uint64_t frag_ns;                   /**< writing the fragments, their 'moof' and 'mdat' */
+    uint64_t frag_ns_max;               /**< the longest of them */
+    uint32_t frag_num;
+    uint64_t bytes_read;                /**< from the inputs */
+    uint64_t bytes_written;             /**< to the outputs, size fields patched later included */
+    uint64_t seek_num;                  /**< on the inputs and outputs */
+    uint64_t scratch_size_max;          /**< high-water mark of the scratch buffers */
+    uint64_t temp_bytes;                /**< written to temporary files */
+} mp4_metrics_t;
+
 struct mp4_ctrl_t_
 {
     /* Demux */
@@ -555,6 +611,12 @@ struct mp4_ctrl_t_
     uint64_t mdat_size;
     uint32_t moov_size_est;
 
+    /**** editing an existing file: see mp4_muxer_set_edit_sink() */
+    uint8_t *edit_moov;                 /**< payload of its 'moov' */
+    size_t   edit_moov_size;
+    int64_t  edit_moov_pos;             /**< position of its 'moov' box */
+    uint64_t edit_room;                 /**< size of its 'moov' box and the 'free' boxes right behind it */
+
     /**** OD profile level */
     uint8_t OD_profile_level;
 
@@ -586,6 +648,8 @@ struct mp4_ctrl_t_
     usr_cfg_es_t * usr_cfg_ess_ref;
     uint32_t       curr_usr_cfg_stream_index;
 
+    const mp4_allocator_t *allocator;   /**< the entries allocate from: usr_cfg_mux_t::allocator */
+
     /**** fragment */
     uint32_t      frag_ctrl_track_ID;   /**< whose rap starts a frag */
     uint32_t      frag_dts;             /**< the dts(in ms) cut off value for current moof */
@@ -622,6 +686,9 @@ struct mp4_ctrl_t_
     uint8_t        *scratchbuf;
     size_t         scratchsize;
 
+    /** what the run took: see mp4_muxer_get_metrics() */
+    mp4_metrics_t  metrics;
+
     int32_t demux_flag;
 
     void (*destroy)(struct mp4_ctrl_t_ *ctrl);
@@ -0,0 +1,69 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/**
+ *  @file  mp4_demux.h
+ *  @brief Defines the reading of the sample tables of an mp4 file
+ */
+
+#ifndef __MP4_DEMUX_H__
+#define __MP4_DEMUX_H__
+
+#include "io_base.h"
+#include "mp4_ctrl.h"  /** mp4_ctrl_handle_t, stream_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Reads the 'moov' box of the mp4 file src once. Each 'trak' becomes a stream of the
+ *  returned demuxer holding its sample tables as they are in the file, for the
+ *  stream_get_sample_...() accessors of mp4_stream.h. Nothing but 'moov' is read: the
+ *  samples are left in src, which the demuxer keeps a reference to.
+ *  Returns NULL if src is no mp4 file, a fragmented one or its tables are inconsistent */
+mp4_ctrl_handle_t mp4_demux_create(bbio_handle_t src);
+void              mp4_demux_destroy(mp4_ctrl_handle_t demuxer);
+
+/** The stream of track track_ID, or the first one for track_ID 0. NULL if there is none */
+stream_handle_t   mp4_demux_get_stream(mp4_ctrl_handle_t demuxer, uint32_t track_ID);
+
+/** The sample entry sd_idx (1-based, as in 'stsc') of the 'stsd' of stream and its size */
+const uint8_t *   mp4_demux_get_sample_entry(stream_handle_t stream, uint32_t sd_idx, uint32_t *size);
+
+/** Reads the payload of the top level 'moov' box of src into a buffer the caller frees.
+ *  *pos and *box_size locate the whole box in src. NULL if there is none */
+uint8_t *         mp4_demux_load_moov(bbio_handle_t src, int64_t *pos, uint64_t *box_size, size_t *payload_size);
+
+/** The next box in [*p, end): its type and payload; *p moves behind it. FALSE at the end or if the box is broken */
+BOOL              mp4_demux_next_box(const uint8_t **p, const uint8_t *end, const uint8_t **type,
+                                     const uint8_t **payload, size_t *payload_size);
+
+/** The payload of the first child box of type in the box payload [buf, buf + size). NULL if there is none */
+const uint8_t *   mp4_demux_find_box(const uint8_t *buf, size_t size, const int8_t *type, size_t *payload_size);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __MP4_DEMUX_H__ */
@@ -0,0 +1,56 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/**
+ *  @file  mp4_extract.h
+ *  @brief Defines the extraction of tracks of an mp4 file to elementary streams
+ */
+
+#ifndef __MP4_EXTRACT_H__
+#define __MP4_EXTRACT_H__
+
+#include "io_base.h"
+#include "mp4_ctrl.h"  /** stream_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The file extension of the elementary stream the track of stream is extracted to:
+ *  "h264", "h265", "ac3", "ec3", "ac4" or "aac". NULL if the track can't be extracted */
+const int8_t *mp4_extract_get_es_ext(stream_handle_t stream);
+
+/** Writes the samples of streams[i], all of the same demuxer, as an elementary stream to snks[i]:
+ *  Annex B with the parameter sets put at the start of each sync sample without them, after its
+ *  access unit delimiter, for H264/H265, ADTS frames for AAC,
+ *  sync frames for AC-4 and the samples as they are for AC-3/E-AC-3.
+ *  The mp4 file is read once, in file order: the reads are planned per chunk, adjacent chunks
+ *  of the streams read at once */
+int32_t mp4_extract_es(uint32_t stream_num, stream_handle_t *streams, bbio_handle_t *snks);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __MP4_EXTRACT_H__ */
@@ -160,6 +160,23 @@ mp4_muxer_set_sink (mp4_muxer_handle_t hmuxer   /** [in] The muxer instance hand
                    );
 
 
+/**
+ *  @brief Sets an existing, non fragmented mp4 file as sink, to add tracks to instead of writing a new file.
+ *
+ *  The sink must be opened for editing ('e'). Its 'moov' is read and its movie timescale and next track ID
+ *  are taken over, so it must be set before any track is added. A track added with a track ID the file
+ *  has already replaces that track.
+ *  mp4_muxer_output_tracks() then appends an 'mdat' with the samples added to the file and writes the
+ *  old 'moov' with the new tracks in, in place of the old one if that and the 'free' space behind it
+ *  is large enough, at the end of the file otherwise, the old one becoming 'free'.
+ *  The media data already in the file is not touched.
+ */
+int32_t         /** @return EMA_MP4_MUXED_OK on success, otherwise an error code. */
+mp4_muxer_set_edit_sink (mp4_muxer_handle_t hmuxer   /** [in] The muxer instance handle. */
+                        ,bbio_handle_t      hsink    /** [in] Handle to the mp4 file opened for editing. */
+                        );
+
+
 /**
  *  @brief Gets handle to data sink.
  *
@@ -263,6 +280,44 @@ mp4_muxer_add_to_track_edit_list (track_handle_t htrack     /** [in] The track i
                                  ,int64_t        media_time /** [in] Start time of playback. */
                                  );
 
+/**
+ *  @brief Sets the decoder specific info a sample description entry of specific track is built with.
+ *
+ *  The entry is built with it rather than with what the parser gives, e.g. for a parser state
+ *  restored instead of parsed. Entries built otherwise keep the dsi they got in the same way.
+ */
+int32_t
+mp4_muxer_set_track_dsi (track_handle_t  htrack     /** [in] The track instance handle. */
+                        ,uint32_t        entry      /** [in] Number of the entry in the stsd, from 0. */
+                        ,const uint8_t * dsi        /** [in] The decoder specific info. */
+                        ,uint32_t        dsi_size   /** [in] Its size. */
+                        );
+
+/**
+ *  @brief Sets the cts offset of each sample of specific track, taken instead of those of the parser.
+ *
+ *  To be called after the last sample has been input, with what get_cts_offset() of the parser
+ *  would give for each, e.g. for a parser state restored instead of parsed.
+ */
+int32_t
+mp4_muxer_set_track_cts_offsets (track_handle_t   htrack       /** [in] The track instance handle. */
+                                ,const uint32_t * cts_offsets  /** [in] The offset of each sample. */
+                                ,uint32_t         num          /** [in] The number of samples. */
+                                );
+
+/**
+ *  @brief Presents part of specific track only.
+ *
+ *  The track is presented from skip after the presentation time of its first sample on, for
+ *  duration. Both are in the timescale of the samples input. The edit list doing so is built
+ *  once the cts offset it also compensates for is known.
+ */
+void
+mp4_muxer_set_track_clip (track_handle_t htrack     /** [in] The track instance handle. */
+                         ,uint64_t       skip       /** [in] Presentation start after that of the first sample. */
+                         ,uint64_t       duration   /** [in] Duration of playback. 0: up to the end of the track. */
+                         );
+
 /**
  *  @brief Adds base media decode time to specific track
  *
@@ -386,6 +441,17 @@ mp4_muxer_set_onwrite_next_frag_callback(mp4_muxer_handle_t hmuxer     /** [in]
                                         ,void *p_instance              /** [in] User-defined data which is passed to the provided callback function. */
                                         );
 
+/**
+ *  @brief Gets the counters of the run so far.
+ *
+ *  The times are kept as the muxer goes, a clock read on each side of what is timed. The I/O
+ *  counters are those of the output sinks: the caller adds those of the sources it created.
+ */
+void
+mp4_muxer_get_metrics(mp4_muxer_handle_t hmuxer     /** [in] The muxer instance handle. */
+                     ,mp4_metrics_t     *p_metrics  /** [out] The counters. */
+                     );
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,78 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/**
+ *  @file  mp4_parse_cache.h
+ *  @brief Defines the sidecar caching the result of parsing an elementary stream
+ */
+
+#ifndef __MP4_PARSE_CACHE_H__
+#define __MP4_PARSE_CACHE_H__
+
+#include "mp4_ctrl.h"  /** track_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The sidecar <dir>/<es file name>.pidx holds the samples the parser of a track handed to
+ *  the muxer - timing, flags and where their bytes are in the es - together with the parser
+ *  state at the end of parsing and the dsi of each sample description entry. The entries
+ *  themselves are built by the muxer as from the parser, with the settings of each mux.
+ *  It is keyed by the es path, size, modification time and a hash over blocks spread over
+ *  the es, and by the parser settings, so a later mux of the unchanged es can skip parsing it.
+ *  Es which samples are byte ranges of the es qualify: ac-3, e-ac-3, ac-4 and aac. So do avc
+ *  and hevc, which samples are AUs of the nal index of the parser, NALs given as byte ranges
+ *  of the es: the sidecar holds those AUs and the cts offsets the parser fixes after parsing.
+ *  Dolby Vision es and aac es changing their configuration are parsed but not cached.
+ */
+typedef struct mp4_parse_cache_t_ mp4_parse_cache_t;
+typedef mp4_parse_cache_t *mp4_parse_cache_handle_t;
+
+/** Opens the sidecar of es_fn, the es track->parser was init()ed with. Returns NULL if the es
+ *  doesn't qualify. *hit is TRUE if the sidecar is valid for the es: the parser got the
+ *  state it had at the end of parsing and the samples are to be taken from
+ *  mp4_parse_cache_get_sample(). Else the samples the parser outputs are to be given
+ *  to mp4_parse_cache_add_sample() and mp4_parse_cache_save() writes the sidecar */
+mp4_parse_cache_handle_t mp4_parse_cache_open(const int8_t *dir, const int8_t *es_fn, track_handle_t track, BOOL *hit);
+/** As mp4_parse_cache_open(), the sidecar being file fn */
+mp4_parse_cache_handle_t mp4_parse_cache_open_file(const int8_t *fn, const int8_t *es_fn, track_handle_t track, BOOL *hit);
+void                     mp4_parse_cache_destroy(mp4_parse_cache_handle_t cache);
+
+/** hit: the next sample, its data read from the es. EMA_MP4_MUXED_EOES after the last one */
+int32_t mp4_parse_cache_get_sample(mp4_parse_cache_handle_t cache, mp4_sample_handle_t sample);
+/** hit: after the last sample, gives the track the dsi of its sample description entries
+ *  and the state parsing would have set */
+int32_t mp4_parse_cache_restore(mp4_parse_cache_handle_t cache);
+
+/** miss: notes a sample, as track->parser output it. Recording stops if its data isn't found in the es */
+void    mp4_parse_cache_add_sample(mp4_parse_cache_handle_t cache, mp4_sample_handle_t sample);
+/** miss: writes the sidecar, once. To be called after the 'moov' of the track has been output */
+int32_t mp4_parse_cache_save(mp4_parse_cache_handle_t cache);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __MP4_PARSE_CACHE_H__ */
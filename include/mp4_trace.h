@@ -0,0 +1,77 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4_trace.h
+    @brief Defines the timeline tracing of muxing runs
+
+    Tracing is compiled in with the define ENABLE_MP4_TRACE only, e.g. make EXTRA_CFLAGS=-DENABLE_MP4_TRACE.
+    Without it the MP4_TRACE_ macros expand to nothing.
+    The events go to a ring buffer of the thread recording them and mp4_muxer_destroy() writes them out
+    as Chrome trace event JSON, which chrome://tracing and ui.perfetto.dev load.
+*/
+
+#ifndef __MP4_TRACE_H__
+#define __MP4_TRACE_H__
+
+#include "c99_inttypes.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifdef ENABLE_MP4_TRACE
+
+/** events kept per thread: the oldest are overwritten */
+#define MP4_TRACE_RING_SIZE   0x10000
+/** threads recording events between two dumps */
+#define MP4_TRACE_THREAD_MAX  64
+
+/** Records an event. ph: 'B' begin or 'E' end. name must be a string literal */
+void mp4_trace_event(int8_t ph, const char *name, uint32_t track_ID, uint64_t bytes);
+
+/** Sets the file mp4_trace_dump() writes: "mp4_trace.json" by default */
+void mp4_trace_set_file(const char *file_name);
+
+/** Writes the events recorded so far and drops them. No event may be recorded meanwhile.
+ *  Returns: 0 if OK */
+int mp4_trace_dump(void);
+
+#define MP4_TRACE_BEGIN(name, track_ID, bytes)  mp4_trace_event('B', name, track_ID, bytes)
+#define MP4_TRACE_END(name, track_ID, bytes)    mp4_trace_event('E', name, track_ID, bytes)
+#define MP4_TRACE_DUMP()                        mp4_trace_dump()
+
+#else
+
+#define MP4_TRACE_BEGIN(name, track_ID, bytes)  do { /* no tracing */ } while(0)
+#define MP4_TRACE_END(name, track_ID, bytes)    do { /* no tracing */ } while(0)
+#define MP4_TRACE_DUMP()                        do { /* no tracing */ } while(0)
+
+#endif  /* ENABLE_MP4_TRACE */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __MP4_TRACE_H__ */
@@ -0,0 +1,88 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file nal_index.h
+    @brief Defines the chunked NAL location index used by the avc and hevc parsers
+*/
+
+#ifndef __NAL_INDEX_H__
+#define __NAL_INDEX_H__
+
+#include "c99_inttypes.h"  /* uint32_t     */
+#include "return_codes.h"  /* return codes */
+#include "io_base.h"       /* bbio_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The index keeps, per AU, the number of NALs and where each NAL lives in the es file
+ *  (or the NAL body itself if it is embedded). Records are varint coded, NAL offsets are
+ *  coded as delta to the end of the previous NAL, and the data goes into fixed size blocks
+ *  so that the index can grow without realloc and blocks can be released once written.
+ *  A position is the logical byte offset into the index, as the old tmp_bbo position was.
+ */
+#define NAL_INDEX_BLOCK_SIZE 0x10000
+
+typedef struct nal_index_t_  nal_index_t;
+typedef nal_index_t         *nal_index_handle_t;
+
+nal_index_handle_t nal_index_create(void);
+void               nal_index_destroy(nal_index_handle_t idx);
+
+/** write side: returns the position the next AU record starts at */
+int64_t nal_index_position(nal_index_handle_t idx);
+/** starts a new AU record of nal_num NALs */
+int32_t nal_index_add_au(nal_index_handle_t idx, uint32_t nal_num);
+/** off == -1: NAL body is embedded and taken from buf_emb */
+int32_t nal_index_add_nal(nal_index_handle_t idx, int64_t off, uint32_t size, uint8_t sc_size, const uint8_t *buf_emb);
+
+/** read side: pos == -1 continues after the last record read */
+int32_t nal_index_read_au(nal_index_handle_t idx, int64_t pos, uint32_t *nal_num);
+/** next NAL of the current AU. *off == -1: body is embedded, use nal_index_read_emb() to get it.
+ *  An embedded body not read is skipped by the next call */
+int32_t nal_index_read_nal(nal_index_handle_t idx, int64_t *off, uint32_t *size, uint8_t *sc_size);
+/** reads the embedded body of the NAL just read into data or, if data is NULL, into snk */
+int32_t nal_index_read_emb(nal_index_handle_t idx, uint8_t *data, bbio_handle_t snk);
+/** read position, after any pending embedded body */
+int64_t nal_index_tell(nal_index_handle_t idx);
+
+/** releases all blocks which hold only data before pos. Reading there afterwards fails. */
+void nal_index_release(nal_index_handle_t idx, int64_t pos);
+
+/** appends the AU record at pos of src to idx as it is, NAL offsets unchanged. Moves the read
+ *  position of src. *pos_out: the position of the AU in idx */
+int32_t nal_index_copy_au(nal_index_handle_t idx, nal_index_handle_t src, int64_t pos, int64_t *pos_out);
+/** writes the records of idx, none released, to snk: nal_index_position(idx) bytes */
+int32_t nal_index_save(nal_index_handle_t idx, bbio_handle_t snk);
+/** appends size bytes nal_index_save() wrote, read from src. The positions of their AUs
+ *  are shifted by nal_index_position(idx) before the call */
+int32_t nal_index_load(nal_index_handle_t idx, bbio_handle_t src, int64_t size);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __NAL_INDEX_H__ */
@@ -35,6 +35,8 @@
 #include "dsi.h"           /** dsi_handle_t  */
 #include "parser_defs.h"   /** SEsData_t     */
 #include "return_codes.h"  /** return codes  */
+#include "memory_chk.h"    /** mp4_allocator_t */
+#include "nal_index.h"     /** nal_index_handle_t */
 
 typedef int64_t offset_t;
 
@@ -210,15 +212,6 @@ do {                        \
 
 /** End of the profile and level values for Audio */
 
-/** AAC Max Bitrate 1 sec window length correction factors */
-#define AAC_1_SEC_WINDOW_DENOM  1024
-#define AAC_1_SEC_WINDOW_16000  1000
-#define AAC_1_SEC_WINDOW_22050  1002
-#define AAC_1_SEC_WINDOW_24000  1043
-#define AAC_1_SEC_WINDOW_32000  1032
-#define AAC_1_SEC_WINDOW_44100  1026
-#define AAC_1_SEC_WINDOW_48000  1021
-
 /** Audio object types */
 #define AOT_AAC_MAIN                    1
 #define AOT_AAC_LC                      2
@@ -432,6 +425,17 @@ typedef struct codec_config_t_
     size_t codec_config_size;
     void * codec_config_data; 
 } codec_config_t;
+
+/** a byte range of the es parsed on its own, see parser_split.h.
+ *  The range is read into a buffer with the parameter sets seen before the range
+ *  (seed_size bytes) put in at seed_pos, so positions in the part parser are buffer offsets */
+typedef struct parser_range_t_
+{
+    int64_t  off;
+    int64_t  size;
+    uint32_t seed_pos;
+    uint32_t seed_size;
+} parser_range_t;
   
 
 #define PARSER_BASE                                                                                                         \
@@ -485,6 +489,8 @@ typedef struct codec_config_t_
     uint32_t num_samples;                                                                                                   \
     /**** cross reference */                                                                                                \
     uint32_t es_idx;            /** the es index this parser correponding to */                                             \
+    /**** the allocator of its entries, NULL for the one in scope: set by reg_parser_get_ex() */                            \
+    const mp4_allocator_t *allocator;                                                                                       \
                                                                                                                             \
     /**** parser base method */                                                                                             \
     dsi_handle_t (*dsi_create)(uint32_t dsi_type); /** the companion dsi creator */                                         \
@@ -519,6 +525,15 @@ typedef struct codec_config_t_
     int32_t  (*parse_codec_config)(parser_handle_t parser, bbio_handle_t info_sink);                                        \
     BOOL (*is_valid_chunk)    (parser_handle_t parser, bbio_handle_t data, size_t size);                                    \
     int32_t  (*get_subsample)     (parser_handle_t parser, int64_t *pos, uint32_t subs_num_in, int32_t *more_subs_out, uint8_t *data, size_t *size); \
+    /** optional: sample info before pos is written out and no longer read */                                               \
+    void     (*release_subsample) (parser_handle_t parser, int64_t pos);                                                    \
+    /** optional: appends the samples a part parser got from range to parser, as if it had parsed them itself */           \
+    int32_t  (*merge_range)       (parser_handle_t parser, parser_handle_t part, const parser_range_t *range,               \
+                                   mp4_sample_handle_t samples, uint32_t sample_num);                                       \
+    /** optional: a copy of the sample entry behind the sd_idx-th SAMPLE_NEW_SD, for a stream with ready entries */         \
+    int32_t  (*get_sample_entry)  (parser_handle_t parser, uint32_t sd_idx, uint8_t **entry);                               \
+    /** optional: the index the pos of a sample is a position in, for a stream which samples are NALs of the es */         \
+    nal_index_handle_t (*get_nal_index)(parser_handle_t parser);                                                            \
                                                                                                                             \
     int8_t conformance_type[4];                                                                                             \
     int32_t (*post_validation)(parser_handle_t parser);                                                                     \
@@ -667,6 +682,7 @@ int32_t parser_set_conformance(parser_handle_t parser, const int8_t *type);
  * (some) alternatives to direct function pointer usage
  *
  * - function pointer access is sometimes not easily possible - e.g. from python scripts
+ * - they run the method with the allocator of the parser
  */
 int32_t  parser_call_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t es_idx, bbio_handle_t ds);
 void     parser_call_destroy(parser_handle_t parser);
@@ -681,6 +697,7 @@ void parser_aac_reg  (void);
 void parser_ac3_reg  (void);
 void parser_ec3_reg  (void);
 void parser_ac4_reg  (void);
+void parser_mp4_reg  (void);
 void parser_video_reg(void);
 void parser_audio_reg(void);
 
@@ -710,6 +727,10 @@ void    parser_aac_set_asc             (parser_handle_t parser, uint8_t *asc, ui
 void    parser_aac_set_config          (parser_handle_t parser, uint32_t frequency, BOOL has_sbr, BOOL has_ps, BOOL is_oversampled_sbr);
 uint8_t parser_aac_get_profile_level_id(parser_handle_t parser);
 
+/** interface to user parameters to avc and hevc parser: nal length prefixed input */
+int32_t parser_avc_set_avcc (parser_handle_t parser, const uint8_t *avcc, uint32_t size);
+int32_t parser_hevc_set_hvcc(parser_handle_t parser, const uint8_t *hvcc, uint32_t size);
+
 void parser_lrc_add_text_sample     (parser_handle_t parser, uint64_t cts, uint32_t duration, uint8_t *data, uint32_t data_size);
 void parser_lrc_set_dimensions      (parser_handle_t parser, uint16_t height, uint16_t width, uint16_t translation_y);
 void parser_lrc_set_foreground_color(parser_handle_t parser, uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha);
@@ -730,6 +751,7 @@ void parser_mlp_set_fixed_timing(parser_handle_t parser, int32_t enable);
 void parser_text_add_text_sample(parser_handle_t parser, uint64_t dts, uint64_t duration, const uint8_t *data, uint32_t data_size, const uint32_t *subsample_offsets, uint32_t num_subsamples);
 
 int32_t find_start_code_off(bbio_handle_t ds, uint64_t size, uint32_t start_code, uint32_t start_code_size, uint32_t mask);
+int32_t find_sc_off(uint8_t *buf, size_t buf_size, BOOL sc_next);
 
 
 #ifdef __cplusplus
@@ -48,6 +48,11 @@ struct parser_aac_t_
     uint32_t adts_buffer_fullness;
     uint32_t number_of_raw_data_blocks_in_frame;
 
+    /** the config bits of the last fully parsed adts header: while they repeat, only the
+     *  frame length is read */
+    uint8_t  hdr_fp[4];
+    BOOL     hdr_fp_valid;
+
     /** to handle number_of_raw_data_blocks_in_frame > 0 */
     uint16_t raw_data_block_position[4];
     uint32_t raw_data_block_idx;
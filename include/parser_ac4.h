@@ -153,6 +153,13 @@ struct parser_ac4_t_
     uint8_t n_fullband_upmix_signals_minus1[SUBSTREAM_GROUP][SUBSTREAM_COUNT];
 
     uint32_t bit_rate_mode;
+
+    /** the TOC bytes of the last full parse, the bits changing from frame to frame cleared */
+#define AC4_TOC_FP_SIZE 256
+    uint8_t  toc_fp[AC4_TOC_FP_SIZE];
+    uint32_t toc_fp_size;   /** 0: none kept */
+    uint32_t toc_seq_from;  /** bit offset of sequence_counter */
+    uint32_t toc_head_bits; /** bits up to b_iframe_global included */
 };
 typedef struct parser_ac4_t_ parser_ac4_t;
 typedef parser_ac4_t *parser_ac4_handle_t;
@@ -372,9 +372,29 @@ typedef struct avc_decode_t_
     uint8_t level_idc_sub;
 } avc_decode_t;
 
+/** bbio 'r' op on an escaped nal payload: emulation_prevention_three_byte is dropped
+ *  while reading, so parsing a header touches the header bytes only and needs no copy.
+ *  It lives on the stack: init with avc_rbsp_init(), no destroy needed */
+typedef struct avc_rbsp_t_
+{
+    BBIO;
+
+    const uint8_t *buf;           /** escaped payload */
+    size_t         buf_size;
+    size_t         esc_off;       /** next byte to read in buf */
+    int64_t        rbsp_pos;      /** rbsp bytes read so far */
+    uint32_t       zero_cnt;      /** 0x00 in a row before esc_off */
+
+    /** read status at last position(): src_peek_bits() seeks back to it */
+    size_t         mark_esc_off;
+    int64_t        mark_rbsp_pos;
+    uint32_t       mark_zero_cnt;
+} avc_rbsp_t;
+
 struct parser_t_;
 
 void     parser_avc_dec_init(avc_decode_t *dec);
+bbio_handle_t avc_rbsp_init(avc_rbsp_t *rbsp, const uint8_t *buf, size_t buf_size);
 uint32_t src_read_ue(bbio_handle_t bs); /** to export read_ue(); */
 void     parser_avc_remove_0x03(uint8_t *dst, size_t *dstlen, const uint8_t *src, const size_t srclen);
 BOOL     parser_avc_parse_nal_1(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *dec);
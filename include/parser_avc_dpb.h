@@ -44,6 +44,7 @@ void apoc_set_num_reorder_au(avc_apoc_t *p, int num_reorder_au);
 void apoc_set_max_ref_au    (avc_apoc_t *p, int num_ref_frames);
 void apoc_flush             (avc_apoc_t *p);
 void apoc_add               (avc_apoc_t *p, int poc, int is_idr);
+void apoc_append            (avc_apoc_t *p, avc_apoc_t *q);    /** q, starting with an idr, follows p */
 int32_t  apoc_reorder_num   (avc_apoc_t *p, int doc);              /** return -1 for unknown */
 int32_t  apoc_min_cts       (avc_apoc_t *p);                       /** in au count */
 BOOL apoc_need_adj_cts      (avc_apoc_t *p);                       /** always return true */
@@ -242,6 +242,16 @@ struct dd_substream_t_
     uint8_t addbsie;
     uint8_t addbsil;
     uint8_t addbsi[64];
+
+    /** the header bytes the last full parse of the substream read, with the per frame
+     *  compression gains cleared, and what it set beyond the substream: while the bytes
+     *  repeat, the parse is skipped */
+#define DD_HDR_FP_SIZE  64
+    uint8_t  hdr_fp[DD_HDR_FP_SIZE];
+    uint32_t hdr_fp_size;    /** 0: none yet */
+    uint32_t hdr_frame_size;
+    int32_t  hdr_sample_rate;
+    uint8_t  hdr_numblks;
 };
 typedef struct dd_substream_t_  dd_substream_t;
 
@@ -235,6 +235,9 @@ typedef enum stream_param_id_t_
     /** AAC specific, may be generalized and used in audio */
     STREAM_PARAM_ID_CHANNELCOUNT,
 
+    /** mp4 file input specific: ID of the track to read, 0 for the first one */
+    STREAM_PARAM_ID_TRACK_ID,
+
     STREAM_PARAM_ID_NUM
 } stream_param_id_t;
 
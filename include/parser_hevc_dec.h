@@ -39,8 +39,8 @@ extern "C"
 #define HEVC_MIN( a , b )       ( ( a ) < ( b ) ? ( a ) : ( b ) )
 #define HEVC_ABS(a)             ( ( a ) < 0 ? -( a ) : ( a ) )
 #define HEVC_CLIP(min,val,max)  ( HEVC_MIN( HEVC_MAX( ( min ), ( val ) ), ( max ) ) )
-#define HEVC_LIMIT_L(val)       ( ( val ) > gi_max_val_luma ? gi_max_val_luma : HEVC_MAX( 0, (val) ) )
-#define HEVC_LIMIT_C(val)       ( ( val ) > gi_max_val_chroma ? gi_max_val_chroma : HEVC_MAX( 0, (val) ) )
+#define HEVC_LIMIT_L(ctx, val)  ( ( val ) > (ctx)->i_max_val_luma ? (ctx)->i_max_val_luma : HEVC_MAX( 0, (val) ) )
+#define HEVC_LIMIT_C(ctx, val)  ( ( val ) > (ctx)->i_max_val_chroma ? (ctx)->i_max_val_chroma : HEVC_MAX( 0, (val) ) )
 #define HEVC_INT32_SIGN(val)    ((((int32_t)(val)) >> 31) | ((int32_t)( ((uint32_t) -((int32_t)(val))) >> 31)))
 
 #define Swap_t( a,b,type ) { type *p_tmp = a; a = b; b = p_tmp; }
@@ -291,6 +291,9 @@ typedef struct
 
     uint8_t *pui8_payload;
 
+    bool     b_rbsp;          /** payload is escaped: 0x03 dropped on word fetch */
+    uint32_t ui_zero_cnt;     /** 0x00 in a row before ui_byte_position */
+
 } bitstream_t;
 
 typedef enum nalu_type_t_
@@ -384,8 +387,6 @@ typedef struct
     uint32_t aui_bytes_removed_positions[4096];
 
     uint32_t read_nalu_consumed;
-#define RBSP_BYTE_NUM_MAX   1024
-    uint8_t rbsp_buff[RBSP_BYTE_NUM_MAX];
 
 } hevc_nalu_t;
 
@@ -965,6 +966,9 @@ typedef struct
     uint64_t poc_offset;
     uint32_t rpu_flag;
 
+    int32_t i_max_val_luma;   /** of the samples, as the active sps has it */
+    int32_t i_max_val_chroma;
+
     scaling_list_t as_pps_scaling_lists[ NUM_MAX_PIC_PARAM_SETS ];   /** pps scaling lists */
 
 } hevc_decode_t;
@@ -979,6 +983,7 @@ void decode_sei_nalu( hevc_decode_t *p_context, hevc_nalu_t *p_nalu );
 
 
 void bitstream_init( bitstream_t *bitstream );
+void bitstream_init_rbsp( bitstream_t *bitstream );
 uint32_t bitstream_read( bitstream_t *bitstream, uint32_t ui_num_bits );
 uint32_t read_input_nalu( bitstream_t *bitstream, hevc_nalu_t *p_nalu);
 
@@ -0,0 +1,85 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file parser_split.h
+    @brief Defines the driver parsing an avc or hevc es in ranges on several threads
+*/
+
+#ifndef __PARSER_SPLIT_H__
+#define __PARSER_SPLIT_H__
+
+#include "c99_inttypes.h"  /* uint32_t        */
+#include "parser.h"        /* parser_handle_t */
+#include "nal_index.h"     /* nal_index_handle_t */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The es is cut at IDR access units into ranges of several MB. Each range is parsed by a
+ *  parser of its own on a worker thread, from a buffer holding the range with the parameter
+ *  sets seen so far put in front of its first AU. The part parsers are then merged, in es
+ *  order, into the parser of the first range with its merge_range() method and the samples
+ *  are handed out as the serial get_sample() loop would have produced them.
+ *  Only an IDR resets both the POC and the reorder state, so CRA/BLA are not used as cut
+ *  points. An es with parameter sets appearing or changing after the first cut, layered
+ *  or dolby vision NALs, or a parser lacking merge_range() is left to the serial loop.
+ */
+
+/** returns a new parser of the same type as the one given, not yet init()ed */
+typedef parser_handle_t (*parser_split_create_fn)(void *ctx);
+/** takes sample. parser is the parser the sample and its data belongs to: it replaces the
+ *  one given to parser_split_parse() and is owned by the callee from its first call on.
+ *  The one given stays in use until parser_split_parse() returns */
+typedef int32_t (*parser_split_output_fn)(void *ctx, parser_handle_t parser, mp4_sample_handle_t sample);
+
+/** parses the es of parser, which init() was called for, with up to thread_num threads.
+ *  Returns EMA_MP4_MUXED_NO_SUPPORT, having consumed nothing, if the es does not qualify,
+ *  EMA_MP4_MUXED_OK if all the samples have been output, or an error */
+int32_t parser_split_parse(parser_handle_t parser, uint32_t thread_num,
+                           parser_split_create_fn create, parser_split_output_fn output, void *ctx);
+
+/** finds where to parse the es of parser from for its AUs from au_idx on: the last IDR AU up to
+ *  it, which a scan for start codes finds, as for cutting the es. *range gets the es from there on,
+ *  with the parameter sets seen before and not in that AU, *seed, to put in at seed_pos, and
+ *  *sync_idx the number of AUs before it. Returns EMA_MP4_MUXED_NO_SUPPORT if the es does not
+ *  qualify */
+int32_t  parser_split_find_sync(parser_handle_t parser, uint32_t au_idx, parser_range_t *range,
+                                uint8_t **seed, uint32_t *sync_idx);
+
+/** for merge_range(): appends the AU at pos of a part parser's index to idx, NAL offsets mapped
+ *  to the es. NALs of the seed are dropped and their bytes, nal_unit_len prefixed, added to *drop_size.
+ *  *pos_out: the position of the AU in idx */
+int32_t  parser_split_append_au(nal_index_handle_t idx, nal_index_handle_t part_idx, int64_t pos,
+                                const parser_range_t *range, uint32_t nal_unit_len,
+                                int64_t *pos_out, uint32_t *drop_size);
+/** for merge_range(): the number of NALs in the seed of range with (first header byte & mask) == val */
+uint32_t parser_split_seed_nal_num(parser_handle_t part, const parser_range_t *range, uint8_t mask, uint8_t val);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __PARSER_SPLIT_H__ */
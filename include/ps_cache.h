@@ -0,0 +1,70 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file ps_cache.h
+    @brief Defines the parameter set lookup table used by the avc and hevc parsers
+*/
+
+#ifndef __PS_CACHE_H__
+#define __PS_CACHE_H__
+
+#include "c99_inttypes.h"  /* uint32_t      */
+#include "boolean.h"       /* BOOL          */
+#include "list_itr.h"      /* buf_entry_t   */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** The dsi keeps its SPS/PPS/VPS in buf_entry_t lists; the lists stay what gets written.
+ *  The cache indexes the entries of a list by id, along with a hash of their content, so a
+ *  repeated parameter set is found without walking the list; the hash rules out a change
+ *  and a match is confirmed with a memcmp. A list is indexed on first use and reindexed
+ *  when its entry count no longer matches, e.g. entries added from a codec config.
+ *  Content changed in place must be reported with ps_cache_update(), a list destroyed or
+ *  created anew with ps_cache_forget().
+ */
+#define PS_CACHE_ID_MAX  256  /** ids are up to 8 bit */
+#define PS_CACHE_LST_MAX 8    /** lists indexed at a time: ps types of the base and el dsi */
+
+typedef struct ps_cache_t_  ps_cache_t;
+typedef ps_cache_t         *ps_cache_handle_t;
+
+ps_cache_handle_t ps_cache_create(void);
+void              ps_cache_destroy(ps_cache_handle_t cache);
+
+/** returns the entry of id in lst, the first one as a list walk finds it, or NULL.
+ *  *same: its content is data of size */
+buf_entry_t *ps_cache_lookup(ps_cache_handle_t cache, list_handle_t lst, uint32_t id, const uint8_t *data, size_t size, BOOL *same);
+/** entry was just added to lst or its content changed */
+void         ps_cache_update(ps_cache_handle_t cache, list_handle_t lst, buf_entry_t *entry);
+/** drops the index of lst, of all lists if lst is NULL */
+void         ps_cache_forget(ps_cache_handle_t cache, list_handle_t lst);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __PS_CACHE_H__ */
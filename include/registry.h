@@ -45,9 +45,13 @@ struct bbio_t_ *reg_bbio_get(int8_t  dev_type, int8_t  io_mode);
 
 /** parser */
 struct parser_t_;
+struct mp4_allocator_t_;
 void              reg_parser_init(void);
 void              reg_parser_set(int8_t  *parser_name, struct parser_t_ *(*parser_create)(uint32_t dsi_type));
 struct parser_t_ *reg_parser_get(const int8_t  *parser_name, uint32_t dsi_type);
+/** as reg_parser_get(), the parser allocating from allocator: NULL for the one in scope.
+ *  Builds without ENABLE_MP4_ALLOC_HOOKS return NULL for an allocator */
+struct parser_t_ *reg_parser_get_ex(const int8_t  *parser_name, uint32_t dsi_type, const struct mp4_allocator_t_ *allocator);
 
 #ifdef __cplusplus
 };
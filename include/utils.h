@@ -87,6 +87,9 @@ uint32_t get_GCD(uint32_t a, uint32_t b);
 /** seconds elapsed since 1970 in UTC time */
 int64_t utc_sec_since_1970(void);
 
+/** nanoseconds of a monotonic clock, from an arbitrary start: for durations only */
+uint64_t time_ns_monotonic(void);
+
 FILE* create_temp_file(void);
 int8_t *get_temp_path(void);
 
@@ -232,14 +235,42 @@ progress_handle_t progress_create(const int8_t *title, int64_t size_total);
 #endif
 /** End of file I/O */
 
+/** file status */
+#ifdef _MSC_VER
+    #include <sys/stat.h>
+    typedef struct _stat64                  osal_stat_t;
+    #define OSAL_STAT(fn, st)               _stat64(fn, st)
+#else
+    #include <sys/stat.h>
+    typedef struct stat                     osal_stat_t;
+    #define OSAL_STAT(fn, st)               stat(fn, st)
+#endif
+/** End of file status */
+
 /** thread, process */
 #ifdef _MSC_VER
     #include <process.h>
     #define OSAL_GETPID                             _getpid
+
+    /** the OSAL_THREAD_ macros need <windows.h> in the translation unit using them */
+    #define OSAL_THREAD_T                           HANDLE
+    #define OSAL_THREAD_RET_T                       unsigned __stdcall
+    #define OSAL_THREAD_RET_VAL                     0
+    /** 0 for OK */
+    #define OSAL_THREAD_CREATE(th, fn, arg)         (((th) = (HANDLE)_beginthreadex(NULL, 0, fn, arg, 0, NULL)) ? 0 : -1)
+    #define OSAL_THREAD_JOIN(th)                    (WaitForSingleObject(th, INFINITE), CloseHandle(th))
 #else
     #include <sys/types.h>
+    #include <pthread.h>
     /** #include <unistd.h> already included */
     #define OSAL_GETPID                             getpid
+
+    #define OSAL_THREAD_T                           pthread_t
+    #define OSAL_THREAD_RET_T                       void *
+    #define OSAL_THREAD_RET_VAL                     NULL
+    /** 0 for OK */
+    #define OSAL_THREAD_CREATE(th, fn, arg)         pthread_create(&(th), NULL, fn, arg)
+    #define OSAL_THREAD_JOIN(th)                    pthread_join(th, NULL)
 #endif
 /** End of thread, process */
 
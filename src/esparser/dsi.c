@@ -100,7 +100,7 @@ mp4_dsi_avc_create(void)
 {
     mp4_dsi_avc_handle_t dsi;
 
-    dsi = (mp4_dsi_avc_handle_t)MALLOC_CHK(sizeof(mp4_dsi_avc_t));
+    dsi = (mp4_dsi_avc_handle_t)MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(mp4_dsi_avc_t));
     if (dsi)
     {
         memset(dsi, 0, sizeof(mp4_dsi_avc_t));
@@ -179,7 +179,7 @@ mp4_dsi_hevc_create(void)
 {
     mp4_dsi_hevc_handle_t dsi;
 
-    dsi = (mp4_dsi_hevc_handle_t)MALLOC_CHK(sizeof(mp4_dsi_hevc_t));
+    dsi = (mp4_dsi_hevc_handle_t)MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(mp4_dsi_hevc_t));
     if (dsi)
     {
         memset(dsi, 0, sizeof(mp4_dsi_hevc_t));
@@ -214,7 +214,7 @@ mp4_dsi_aac_create(void)
 {
     mp4_dsi_aac_handle_t dsi;
 
-    dsi = (mp4_dsi_aac_handle_t)MALLOC_CHK(sizeof(mp4_dsi_aac_t));
+    dsi = (mp4_dsi_aac_handle_t)MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(mp4_dsi_aac_t));
     if (dsi)
     {
         memset(dsi, 0, sizeof(mp4_dsi_aac_t));
@@ -246,7 +246,7 @@ mp4_dsi_ac3_create(void)
 {
     mp4_dsi_ac3_handle_t dsi;
 
-    dsi = (mp4_dsi_ac3_handle_t)MALLOC_CHK(sizeof(mp4_dsi_ac3_t));
+    dsi = (mp4_dsi_ac3_handle_t)MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(mp4_dsi_ac3_t));
     if (dsi)
     {
         memset(dsi, 0, sizeof(mp4_dsi_ac3_t));
@@ -295,7 +295,7 @@ mp4_dsi_ec3_create(void)
 {
     mp4_dsi_ec3_handle_t dsi;
 
-    dsi = (mp4_dsi_ec3_handle_t)MALLOC_CHK(sizeof(mp4_dsi_ec3_t));
+    dsi = (mp4_dsi_ec3_handle_t)MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(mp4_dsi_ec3_t));
     if (dsi)
     {
         memset(dsi, 0, sizeof(mp4_dsi_ec3_t));
@@ -334,7 +334,7 @@ mp4_dsi_ac4_create(void)
 {
     mp4_dsi_ac4_handle_t dsi;
 
-    dsi = (mp4_dsi_ac4_handle_t)MALLOC_CHK(sizeof(mp4_dsi_ac4_t));
+    dsi = (mp4_dsi_ac4_handle_t)MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(mp4_dsi_ac4_t));
     if (dsi)
     {
         memset(dsi, 0, sizeof(mp4_dsi_ac4_t));
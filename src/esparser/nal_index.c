@@ -0,0 +1,466 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file nal_index.c
+    @brief Implements the chunked NAL location index
+*/
+
+#include <assert.h>      /** assert() */
+
+#include "nal_index.h"
+#include "msg_log.h"     /** msglog() */
+#include "memory_chk.h"  /** MALLOC_CHK() */
+
+#define NAL_INDEX_EMB_FLAG  0x08  /** in nal hdr: body embedded */
+#define NAL_INDEX_SC_MASK   0x07  /** in nal hdr: start code size */
+#define NAL_INDEX_HDR_SHIFT 4     /** in nal hdr: body size */
+
+struct nal_index_t_
+{
+    uint8_t  **blocks;       /**< block table. released blocks are NULL */
+    uint32_t   block_num;    /**< blocks in use */
+    uint32_t   block_cap;    /**< size of the block table */
+    uint32_t   block_rel;    /**< blocks before this one are released */
+
+    /** write status */
+    int64_t    wr_pos;       /**< data written so far */
+    int64_t    wr_expect;    /**< where the next NAL of the AU being written is expected in es */
+
+    /** read status */
+    int64_t    rd_pos;       /**< next byte to read */
+    int64_t    rd_expect;    /**< where the next NAL of the AU being read is expected in es */
+    uint32_t   rd_emb_left;  /**< size of the pending embedded body */
+};
+
+static int32_t
+put_bytes(nal_index_handle_t idx, const uint8_t *data, size_t size)
+{
+    while (size)
+    {
+        uint32_t blk = (uint32_t)(idx->wr_pos / NAL_INDEX_BLOCK_SIZE);
+        size_t   off = (size_t)(idx->wr_pos % NAL_INDEX_BLOCK_SIZE);
+        size_t   n   = NAL_INDEX_BLOCK_SIZE - off;
+
+        if (blk == idx->block_num)
+        {
+            if (idx->block_num == idx->block_cap)
+            {
+                /** only the block table is reallocated, never the data */
+                uint32_t  cap    = idx->block_cap ? 2*idx->block_cap : 64;
+                uint8_t **blocks = (uint8_t **)REALLOC_TAG_CHK(MP4_MEM_NAL_INDEX, idx->blocks, cap*sizeof(uint8_t *));
+                if (!blocks)
+                {
+                    return EMA_MP4_MUXED_NO_MEM;
+                }
+                idx->blocks    = blocks;
+                idx->block_cap = cap;
+            }
+            idx->blocks[blk] = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_NAL_INDEX, NAL_INDEX_BLOCK_SIZE);
+            if (!idx->blocks[blk])
+            {
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+            idx->block_num++;
+        }
+
+        if (n > size)
+        {
+            n = size;
+        }
+        memcpy(idx->blocks[blk] + off, data, n);
+        data        += n;
+        size        -= n;
+        idx->wr_pos += n;
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+put_varint(nal_index_handle_t idx, uint64_t val)
+{
+    uint8_t  buf[10];
+    uint32_t n = 0;
+
+    while (val >= 0x80)
+    {
+        buf[n++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    buf[n++] = (uint8_t)val;
+
+    return put_bytes(idx, buf, n);
+}
+
+/** data == NULL: skip */
+static int32_t
+get_bytes(nal_index_handle_t idx, uint8_t *data, size_t size)
+{
+    if (idx->rd_pos + (int64_t)size > idx->wr_pos)
+    {
+        return EMA_MP4_MUXED_READ_ERR;
+    }
+
+    while (size)
+    {
+        uint32_t blk = (uint32_t)(idx->rd_pos / NAL_INDEX_BLOCK_SIZE);
+        size_t   off = (size_t)(idx->rd_pos % NAL_INDEX_BLOCK_SIZE);
+        size_t   n   = NAL_INDEX_BLOCK_SIZE - off;
+
+        if (blk < idx->block_rel)
+        {
+            msglog(NULL, MSGLOG_ERR, "nal index: read from released block %u\n", blk);
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+        if (n > size)
+        {
+            n = size;
+        }
+        if (data)
+        {
+            memcpy(data, idx->blocks[blk] + off, n);
+            data += n;
+        }
+        size        -= n;
+        idx->rd_pos += n;
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+get_varint(nal_index_handle_t idx, uint64_t *val)
+{
+    uint32_t shift = 0;
+    uint8_t  u8;
+
+    *val = 0;
+    do
+    {
+        if (shift > 63 || get_bytes(idx, &u8, 1) != EMA_MP4_MUXED_OK)
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+        *val |= (uint64_t)(u8 & 0x7f) << shift;
+        shift += 7;
+    } while (u8 & 0x80);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static uint64_t
+zigzag_enc(int64_t val)
+{
+    return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+static int64_t
+zigzag_dec(uint64_t val)
+{
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+nal_index_handle_t
+nal_index_create(void)
+{
+    nal_index_handle_t idx = (nal_index_handle_t)MALLOC_CHK(sizeof(nal_index_t));
+
+    if (idx)
+    {
+        memset(idx, 0, sizeof(nal_index_t));
+    }
+    return idx;
+}
+
+void
+nal_index_destroy(nal_index_handle_t idx)
+{
+    uint32_t blk;
+
+    if (!idx)
+    {
+        return;
+    }
+    for (blk = idx->block_rel; blk < idx->block_num; blk++)
+    {
+        FREE_CHK(idx->blocks[blk]);
+    }
+    FREE_CHK(idx->blocks);
+    FREE_CHK(idx);
+}
+
+int64_t
+nal_index_position(nal_index_handle_t idx)
+{
+    return idx->wr_pos;
+}
+
+int32_t
+nal_index_add_au(nal_index_handle_t idx, uint32_t nal_num)
+{
+    /** the first NAL offset in an AU is coded absolute to allow random access by AU */
+    idx->wr_expect = 0;
+    return put_varint(idx, nal_num);
+}
+
+int32_t
+nal_index_add_nal(nal_index_handle_t idx, int64_t off, uint32_t size, uint8_t sc_size, const uint8_t *buf_emb)
+{
+    uint64_t hdr = ((uint64_t)size << NAL_INDEX_HDR_SHIFT) | (sc_size & NAL_INDEX_SC_MASK);
+    int32_t  ret;
+
+    assert(sc_size <= NAL_INDEX_SC_MASK);
+    if (off == -1)
+    {
+        hdr |= NAL_INDEX_EMB_FLAG;
+    }
+
+    ret = put_varint(idx, hdr);
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        return ret;
+    }
+
+    if (off == -1)
+    {
+        return put_bytes(idx, buf_emb, size);
+    }
+
+    /** usually the start code size of the next NAL: a single byte */
+    ret = put_varint(idx, zigzag_enc(off - idx->wr_expect));
+    idx->wr_expect = off + size;
+
+    return ret;
+}
+
+int32_t
+nal_index_read_au(nal_index_handle_t idx, int64_t pos, uint32_t *nal_num)
+{
+    uint64_t val;
+
+    if (pos != -1)
+    {
+        idx->rd_pos = pos;
+    }
+    else if (idx->rd_emb_left)
+    {
+        if (get_bytes(idx, NULL, idx->rd_emb_left) != EMA_MP4_MUXED_OK)
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+    }
+    idx->rd_emb_left = 0;
+    idx->rd_expect   = 0;
+
+    if (get_varint(idx, &val) != EMA_MP4_MUXED_OK)
+    {
+        return EMA_MP4_MUXED_READ_ERR;
+    }
+    *nal_num = (uint32_t)val;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+int32_t
+nal_index_read_nal(nal_index_handle_t idx, int64_t *off, uint32_t *size, uint8_t *sc_size)
+{
+    uint64_t hdr, delta;
+
+    if (idx->rd_emb_left)
+    {
+        if (get_bytes(idx, NULL, idx->rd_emb_left) != EMA_MP4_MUXED_OK)
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+        idx->rd_emb_left = 0;
+    }
+
+    if (get_varint(idx, &hdr) != EMA_MP4_MUXED_OK)
+    {
+        return EMA_MP4_MUXED_READ_ERR;
+    }
+    *size    = (uint32_t)(hdr >> NAL_INDEX_HDR_SHIFT);
+    *sc_size = (uint8_t)(hdr & NAL_INDEX_SC_MASK);
+
+    if (hdr & NAL_INDEX_EMB_FLAG)
+    {
+        *off             = -1;
+        idx->rd_emb_left = *size;
+        return EMA_MP4_MUXED_OK;
+    }
+
+    if (get_varint(idx, &delta) != EMA_MP4_MUXED_OK)
+    {
+        return EMA_MP4_MUXED_READ_ERR;
+    }
+    *off           = idx->rd_expect + zigzag_dec(delta);
+    idx->rd_expect = *off + *size;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+int32_t
+nal_index_read_emb(nal_index_handle_t idx, uint8_t *data, bbio_handle_t snk)
+{
+    uint8_t  buf[256];
+    uint32_t left = idx->rd_emb_left;
+
+    idx->rd_emb_left = 0;
+    if (data)
+    {
+        return get_bytes(idx, data, left);
+    }
+
+    while (left)
+    {
+        uint32_t n = (left < sizeof(buf)) ? left : sizeof(buf);
+
+        if (get_bytes(idx, buf, n) != EMA_MP4_MUXED_OK)
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+        snk->write(snk, buf, n);
+        left -= n;
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+int64_t
+nal_index_tell(nal_index_handle_t idx)
+{
+    return idx->rd_pos + idx->rd_emb_left;
+}
+
+void
+nal_index_release(nal_index_handle_t idx, int64_t pos)
+{
+    uint32_t blk_end = (uint32_t)(pos / NAL_INDEX_BLOCK_SIZE);
+
+    if (blk_end >= idx->block_num)
+    {
+        /** keep the block being written */
+        blk_end = idx->block_num ? idx->block_num - 1 : 0;
+    }
+
+    while (idx->block_rel < blk_end)
+    {
+        FREE_CHK(idx->blocks[idx->block_rel]);
+        idx->blocks[idx->block_rel] = NULL;
+        idx->block_rel++;
+    }
+}
+
+int32_t
+nal_index_copy_au(nal_index_handle_t idx, nal_index_handle_t src, int64_t pos, int64_t *pos_out)
+{
+    uint8_t  buf[256];
+    uint32_t nal_num, size;
+    uint8_t  sc_size;
+    int64_t  off, left;
+    int32_t  ret;
+
+    /** the record ends after its last NAL and any body of it */
+    ret = nal_index_read_au(src, pos, &nal_num);
+    while (ret == EMA_MP4_MUXED_OK && nal_num--)
+    {
+        ret = nal_index_read_nal(src, &off, &size, &sc_size);
+    }
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        return ret;
+    }
+    left = nal_index_tell(src) - pos;
+
+    /** the first NAL offset is absolute: the record is the same anywhere */
+    *pos_out         = idx->wr_pos;
+    src->rd_pos      = pos;
+    src->rd_emb_left = 0;
+    while (left)
+    {
+        uint32_t n = (left < (int64_t)sizeof(buf)) ? (uint32_t)left : (uint32_t)sizeof(buf);
+
+        ret = get_bytes(src, buf, n);
+        if (ret == EMA_MP4_MUXED_OK)
+        {
+            ret = put_bytes(idx, buf, n);
+        }
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+        left -= n;
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+int32_t
+nal_index_save(nal_index_handle_t idx, bbio_handle_t snk)
+{
+    uint32_t blk;
+    int64_t  left = idx->wr_pos;
+
+    if (idx->block_rel)
+    {
+        return EMA_MP4_MUXED_READ_ERR;
+    }
+    for (blk = 0; left; blk++)
+    {
+        size_t n = (left < NAL_INDEX_BLOCK_SIZE) ? (size_t)left : NAL_INDEX_BLOCK_SIZE;
+
+        if (snk->write(snk, idx->blocks[blk], n) != n)
+        {
+            return EMA_MP4_MUXED_WRITE_ERR;
+        }
+        left -= n;
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+int32_t
+nal_index_load(nal_index_handle_t idx, bbio_handle_t src, int64_t size)
+{
+    uint8_t buf[4096];
+
+    while (size)
+    {
+        size_t  n = (size < (int64_t)sizeof(buf)) ? (size_t)size : sizeof(buf);
+        int32_t ret;
+
+        if (src->read(src, buf, n) != n)
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+        ret = put_bytes(idx, buf, n);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+        size -= n;
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
@@ -37,17 +37,23 @@
  */
 int32_t parser_call_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t es_idx, bbio_handle_t ds)
 {
-    return parser->init(parser, ext_timing, es_idx, ds);
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(parser->allocator, ret = parser->init(parser, ext_timing, es_idx, ds));
+    return ret;
 }
 
 void parser_call_destroy(parser_handle_t parser)
 {
-    parser->destroy(parser);
+    MEM_ALLOC_SCOPE_CHK(parser->allocator, parser->destroy(parser));
 }
 
 int32_t parser_call_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
 {
-    return parser->get_sample(parser, sample);
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(parser->allocator, ret = parser->get_sample(parser, sample));
+    return ret;
 }
 
 void parser_call_sample_destroy(struct mp4_sample_t_ *sample)
@@ -117,6 +123,57 @@ find_start_code_off(bbio_handle_t ds, uint64_t size, uint32_t start_code, uint32
     return -1;
 }
 
+/* Returns the offset into buf where the NAL start code (00 00 01 or 00 00 00 01) is
+ * sc_next == TRUE: skip the starting sc
+ * return -1 for no sc found
+ */
+int32_t
+find_sc_off(uint8_t *buf, size_t buf_size, BOOL sc_next)
+{
+    uint32_t val;
+    uint8_t *buf0    = buf;
+    uint8_t *buf_top = buf + buf_size;
+
+    if (buf_size < 4)
+    {
+        /* 4: sc at least 3 bytes + 1 nal hdr */
+        return -1;
+    }
+
+    /** skip current start code if search for next sc */
+    if (sc_next)
+    {
+        if (*buf++ == 0 && *buf++ == 0 &&
+            (*buf == 1 || (*buf++ == 0 && *buf == 1)))
+        {
+            buf++;
+        }
+        else
+        {
+            msglog(NULL, MSGLOG_ERR, "sc miss-match\n");
+            buf = buf0;  /* to keep going */
+        }
+    }
+
+    /** get next current start code */
+    val = 0xffffffff;
+    while (buf < buf_top)
+    {
+        val <<= 8;
+        val |= *buf++;
+        if ((val & 0x00ffffff) == 0x000001)
+        {
+            if (val == 0x000001)
+            {
+                return (int32_t)((buf - buf0) - 4);
+            }
+            return (int32_t)((buf - buf0) - 3);
+        }
+    }
+
+    return -1;
+}
+
 void
 parser_set_frame_size(parser_handle_t parser, uint32_t frame_size)
 {
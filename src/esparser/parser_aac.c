@@ -52,7 +52,7 @@ static int /** @return -1: unsupported (multiple AAC frames), 0: no sync found,
 parser_aac_adts_hdr(parser_aac_handle_t parser_aac, bbio_handle_t bs)
 {
     uint32_t val;
-    offset_t pos_sync;
+    offset_t pos_sync, pos_sync_end;
     int32_t  len_remain;
 
     while (!bs->is_EOD(bs))
@@ -185,6 +185,14 @@ parser_aac_adts_hdr(parser_aac_handle_t parser_aac, bbio_handle_t bs)
             return -1;
         }
 
+        /* keep the config bits for parser_aac_adts_hdr_fast() */
+        pos_sync_end = bs->position(bs);
+        bs->seek(bs, pos_sync, SEEK_SET);
+        parser_aac->hdr_fp_valid = (bs->read(bs, parser_aac->hdr_fp, 4) == 4);
+        parser_aac->hdr_fp[2]   &= 0xFD; /* private_bit */
+        parser_aac->hdr_fp[3]   &= 0xC0; /* channel_configuration only */
+        bs->seek(bs, pos_sync_end, SEEK_SET);
+
         parser_aac->aac_frame_length_remain = len_remain;
         parser_aac->raw_data_block_idx      = 0;
         return 1;
@@ -193,6 +201,57 @@ parser_aac_adts_hdr(parser_aac_handle_t parser_aac, bbio_handle_t bs)
     return 0;
 }
 
+/* the usual case of an adts header with the config bits of the last one parsed:
+ * only the frame length is taken from it. The same sync double check is done
+ * @return 1: got it, 0: left to parser_aac_adts_hdr(), at the same position */
+static int
+parser_aac_adts_hdr_fast(parser_aac_handle_t parser_aac, bbio_handle_t bs)
+{
+    const offset_t pos_sync = bs->position(bs);
+    uint8_t        hdr[7];
+    int32_t        len_remain;
+
+    if (!parser_aac->hdr_fp_valid || bs->read(bs, hdr, 7) != 7 ||
+        hdr[0] != parser_aac->hdr_fp[0] || hdr[1] != parser_aac->hdr_fp[1] ||
+        (hdr[2] & 0xFD) != parser_aac->hdr_fp[2] || (hdr[3] & 0xC0) != parser_aac->hdr_fp[3] ||
+        (hdr[6] & 0x03)) /* number_of_raw_data_blocks_in_frame */
+    {
+        bs->seek(bs, pos_sync, SEEK_SET);
+        return 0;
+    }
+
+    len_remain = (((hdr[3] & 0x03) << 11) | (hdr[4] << 3) | (hdr[5] >> 5)) - 7;
+    if (!parser_aac->protection_absent)
+    {
+        bs->skip_bytes(bs, 2); /* the 2 bytes crc */
+        len_remain -= 2;
+    }
+    if (len_remain < 0)
+    {
+        bs->seek(bs, pos_sync, SEEK_SET);
+        return 0;
+    }
+
+    if (bs->size(bs) - bs->position(bs) != len_remain)
+    {
+        offset_t pos_raw = bs->position(bs);
+
+        bs->skip_bytes(bs, len_remain);
+        if (bs->read(bs, hdr, 2) != 2 || hdr[0] != 0xFF || (hdr[1] & 0xF0) != 0xF0)
+        {
+            bs->seek(bs, pos_sync, SEEK_SET);
+            return 0;
+        }
+        bs->seek(bs, pos_raw, SEEK_SET);
+    }
+
+    parser_aac->adts_buffer_fullness               = ((hdr[5] & 0x1F) << 6) | (hdr[6] >> 2);
+    parser_aac->number_of_raw_data_blocks_in_frame = 0;
+    parser_aac->aac_frame_length_remain            = len_remain;
+    parser_aac->raw_data_block_idx                 = 0;
+    return 1;
+}
+
 
 /* Fills dsi with properties in ADTS header */
 static void
@@ -317,6 +376,7 @@ parser_aac_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
     mp4_dsi_aac_handle_t curr_dsi   = (mp4_dsi_aac_handle_t)parser->curr_dsi;
     bbio_handle_t        ds         = parser->ds;
     int                  sync_frame;
+    BOOL                 hdr_same   = FALSE;
 
 #if PARSE_DURATION_TEST
     if (parser_aac->sample_num && sample->dts >= PARSE_DURATION_TEST*(uint64_t)parser->time_scale)
@@ -335,7 +395,8 @@ parser_aac_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
     if (!parser_aac->aac_frame_length_remain)
     {
         /* get a new adts frame */
-        sync_frame = parser_aac_adts_hdr(parser_aac, ds);
+        hdr_same   = parser_aac_adts_hdr_fast(parser_aac, ds);
+        sync_frame = hdr_same ? 1 : parser_aac_adts_hdr(parser_aac, ds);
         if (sync_frame < 0)
         {
             return EMA_MP4_MUXED_NO_SUPPORT;
@@ -348,10 +409,11 @@ parser_aac_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
     }
 
     /* Check for configuration changes */
-    if (curr_dsi->audioObjectType        != parser_aac->profile_ObjectType + 1   ||
-        curr_dsi->samplingFrequencyIndex != parser_aac->sampling_frequency_index ||
-        curr_dsi->channelConfiguration   != parser_aac->channel_configuration    ||
-        curr_dsi->esd.bufferSizeDB       != parser->buferSizeDB)
+    if (!hdr_same &&
+        (curr_dsi->audioObjectType        != parser_aac->profile_ObjectType + 1   ||
+         curr_dsi->samplingFrequencyIndex != parser_aac->sampling_frequency_index ||
+         curr_dsi->channelConfiguration   != parser_aac->channel_configuration    ||
+         curr_dsi->esd.bufferSizeDB       != parser->buferSizeDB))
     {
         dsi_handle_t  new_dsi;
         dsi_handle_t* p_new_dsi;
@@ -786,7 +848,7 @@ parser_aac_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
             {
                 FREE_CHK(dsi->lfe_element_tag_select);
             }
-            dsi->lfe_element_tag_select = MALLOC_CHK(sizeof(uint8_t) * dsi->num_lfe_channel_elements);
+            dsi->lfe_element_tag_select = MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(uint8_t) * dsi->num_lfe_channel_elements);
         }
 
         for (i = 0; i < dsi->num_lfe_channel_elements; i++)
@@ -800,7 +862,7 @@ parser_aac_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
             {
                 FREE_CHK(dsi->assoc_data_element_tag_select);
             }
-            dsi->assoc_data_element_tag_select = MALLOC_CHK(sizeof(uint8_t) * dsi->num_assoc_data_elements);
+            dsi->assoc_data_element_tag_select = MALLOC_TAG_CHK(MP4_MEM_DSI, sizeof(uint8_t) * dsi->num_assoc_data_elements);
         }
 
         for (i = 0; i < dsi->num_assoc_data_elements; i++)
@@ -818,7 +880,7 @@ parser_aac_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
         dsi->comment_field_bytes = (uint8_t)src_read_bits(src, 8);
         if (dsi->comment_field_bytes > 0)
         {
-            dsi->comment_field_data = MALLOC_CHK(dsi->comment_field_bytes * sizeof(uint8_t));
+            dsi->comment_field_data = MALLOC_TAG_CHK(MP4_MEM_DSI, dsi->comment_field_bytes * sizeof(uint8_t));
         }
         if (dsi->comment_field_bytes > 0)
         {
@@ -1223,7 +1285,7 @@ parser_aac_set_asc(parser_handle_t parser, unsigned char *asc, uint32_t size)
     /* Create new entry for codec config list */
     parser->curr_codec_config = (codec_config_t*)list_alloc_entry(parser->codec_config_lst);
 
-    parser->curr_codec_config->codec_config_data = MALLOC_CHK(size);
+    parser->curr_codec_config->codec_config_data = MALLOC_TAG_CHK(MP4_MEM_DSI, size);
     memcpy(parser->curr_codec_config->codec_config_data, asc, size);
     parser->curr_codec_config->codec_config_size = size;
     list_add_entry(parser->codec_config_lst, parser->curr_codec_config);
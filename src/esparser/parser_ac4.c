@@ -1539,23 +1539,47 @@ get_time_scale(parser_ac4_handle_t parser_ac4)
     }
 }
 
-/* Parsing toc as: ETSI TS 103 190-2 V 1.1.1 part 6.2.1 */
-static int32_t 
-parser_ac4_toc(parser_ac4_handle_t parser_ac4)
+/* bits of the TOC read so far, the TOC starting byte aligned at toc_pos */
+static uint32_t
+toc_bits_read(bbio_handle_t ds, int64_t toc_pos)
+{
+    return (uint32_t)(((ds->position(ds) - toc_pos) << 3) - src_bits_cached(ds));
+}
+
+static void
+toc_clear_bits(uint8_t *buf, uint32_t from, uint32_t bit_num)
+{
+    for (; bit_num; from++, bit_num--)
+    {
+        buf[from >> 3] &= (uint8_t)~(0x80 >> (from & 7));
+    }
+}
+
+/* clears the TOC bits that change from frame to frame without changing its structure:
+ * sequence_counter, the wait_frames fields and b_iframe_global */
+static void
+toc_fp_mask(const parser_ac4_handle_t parser_ac4, uint8_t *buf)
+{
+    const uint32_t fs_from = parser_ac4->toc_head_bits - 6; /* fs_index, frame_rate_index, b_iframe_global */
+
+    toc_clear_bits(buf, parser_ac4->toc_seq_from, fs_from - parser_ac4->toc_seq_from);
+    toc_clear_bits(buf, parser_ac4->toc_head_bits - 1, 1);
+}
+
+/* reads the TOC up to b_iframe_global, returns the bit offset of sequence_counter */
+static uint32_t
+ac4_toc_head(parser_ac4_handle_t parser_ac4, int64_t toc_pos)
 {
     bbio_handle_t       ds         = parser_ac4->ds;
-    uint32_t tmp, payload_base, i,j;
-    uint32_t ret = 0;
+    uint32_t tmp, seq_from;
 
-    src_byte_align(ds);
-    parser_ac4->total_n_substream_groups = 0;
-    memset(parser_ac4->group_index, -1, sizeof(parser_ac4->group_index));
     parser_ac4->bitstream_version = (uint8_t)src_read_bits(ds, 2);
     if (parser_ac4->bitstream_version == 3) 
     {
         parser_ac4->bitstream_version += (uint8_t)variable_bits(2, ds);
     }
 
+    seq_from = toc_bits_read(ds, toc_pos);
     parser_ac4->sequence_counter = (uint8_t)src_read_bits(ds, 10);    /* sequence_counter, 10 bit*/
 
     tmp = (uint8_t)src_read_bits(ds, 1);    /*skip b_wait_frames, 1 bit*/
@@ -1585,6 +1609,87 @@ parser_ac4_toc(parser_ac4_handle_t parser_ac4)
     parser_ac4->frame_rate_index = (uint8_t)src_read_bits(ds, 4);
     parser_ac4->b_iframe_global = (uint8_t)src_read_bits(ds, 1);
 
+    return seq_from;
+}
+
+/* TRUE if the TOC at toc_pos, of the same head layout as the one kept, is the same once masked */
+static BOOL
+toc_fp_match(parser_ac4_handle_t parser_ac4, int64_t toc_pos, uint32_t seq_from, uint32_t head_bits)
+{
+    bbio_handle_t ds = parser_ac4->ds;
+    uint8_t       fp[AC4_TOC_FP_SIZE];
+    const uint32_t size = parser_ac4->toc_fp_size;
+
+    if (!size || seq_from != parser_ac4->toc_seq_from || head_bits != parser_ac4->toc_head_bits)
+    {
+        return FALSE;
+    }
+    ds->seek(ds, toc_pos, SEEK_SET);
+    src_byte_align(ds);
+    if (ds->read(ds, fp, size) != size)
+    {
+        return FALSE;
+    }
+    toc_fp_mask(parser_ac4, fp);
+    return !memcmp(fp, parser_ac4->toc_fp, size);
+}
+
+/* keeps, after a full parse of the TOC at toc_pos, the bytes it read */
+static void
+toc_fp_save(parser_ac4_handle_t parser_ac4, int64_t toc_pos, uint32_t seq_from, uint32_t head_bits)
+{
+    bbio_handle_t  ds   = parser_ac4->ds;
+    const uint32_t size = (toc_bits_read(ds, toc_pos) + 7) >> 3;
+
+    parser_ac4->toc_fp_size = 0;
+    if (size > AC4_TOC_FP_SIZE)
+    {
+        return;
+    }
+    ds->seek(ds, toc_pos, SEEK_SET);
+    src_byte_align(ds);
+    if (ds->read(ds, parser_ac4->toc_fp, size) != size)
+    {
+        return;
+    }
+    parser_ac4->toc_seq_from  = seq_from;
+    parser_ac4->toc_head_bits = head_bits;
+    toc_fp_mask(parser_ac4, parser_ac4->toc_fp);
+    parser_ac4->toc_fp_size = size;
+}
+
+/* Parsing toc as: ETSI TS 103 190-2 V 1.1.1 part 6.2.1 */
+/* parses the TOC; only its head when the rest is the same as the one before.
+ * The caller seeks to the frame data after it */
+static int32_t 
+parser_ac4_toc(parser_ac4_handle_t parser_ac4)
+{
+    bbio_handle_t       ds         = parser_ac4->ds;
+    uint32_t tmp, payload_base, i,j;
+    uint32_t ret = 0;
+    int64_t  toc_pos;
+    uint32_t seq_from, head_bits;
+
+    src_byte_align(ds);
+    toc_pos   = ds->position(ds);
+    seq_from  = ac4_toc_head(parser_ac4, toc_pos);
+    head_bits = toc_bits_read(ds, toc_pos);
+    if (toc_fp_match(parser_ac4, toc_pos, seq_from, head_bits))
+    {
+        /* presentations and substream groups as parsed before */
+        return 0;
+    }
+    if (parser_ac4->toc_fp_size)
+    {
+        ds->seek(ds, toc_pos, SEEK_SET);
+        src_byte_align(ds);
+        src_skip_bits(ds, head_bits);
+        parser_ac4->toc_fp_size = 0;
+    }
+
+    parser_ac4->total_n_substream_groups = 0;
+    memset(parser_ac4->group_index, -1, sizeof(parser_ac4->group_index));
+
     tmp = (uint8_t)src_read_bits(ds, 1); /* b_single_presentation 1 bit */
     if (tmp) {
         parser_ac4->n_presentations = 1;
@@ -1637,6 +1742,7 @@ parser_ac4_toc(parser_ac4_handle_t parser_ac4)
             parser_ac4->pres_ch_mode[i] = (uint8_t)generate_presentation_ch_mode(parser_ac4, i);
         }
     }
+    toc_fp_save(parser_ac4, toc_pos, seq_from, head_bits);
 
     return 0;
     /* ac4 dsi don't need info from the following table, just skip it */
@@ -35,6 +35,9 @@
 #include "parser.h"
 #include "parser_avc_dec.h"
 #include "parser_avc_dpb.h"
+#include "nal_index.h"
+#include "ps_cache.h"
+#include "parser_split.h"
 
 #include <stdarg.h>
 
@@ -81,6 +84,14 @@ typedef struct nal_t_
     size_t    sc_size;
     BOOL      nal_complete;  /* if get a complete nal */
 
+    /* nal length prefixed input, set up by parser_avc_set_avcc() */
+    uint32_t  nal_len_size;  /* 1, 2 or 4; 0: annex b */
+    uint8_t  *cfg_buf;       /* out of band ps, 16 bit length prefixed: handed out before the es */
+    size_t    cfg_size;
+    size_t    cfg_off;
+    size_t    len_left;      /* nal bytes left in file not loaded into buffer */
+    BOOL      nal_emb;       /* nal from cfg_buf: not in file */
+
     /** to aid parsing */
     uint8_t       *tmp_buf;
     uint32_t       tmp_buf_size;
@@ -100,8 +111,8 @@ struct parser_avc_t_
 
     nal_t         nal;         /* nal buf and current nal info */
     au_nals_t     au_nals;     /* the composing nals of au */
-    bbio_handle_t tmp_bbo;     /* the output handle of file */
-    bbio_handle_t tmp_bbi;     /* the input handle of file */
+    nal_index_handle_t nal_index; /* where the nals of each au are */
+    ps_cache_handle_t  ps_cache;  /* sps/pps/vps of the dsi lists by id */
 
     avc_decode_t dec;          /* current decoder status */
     avc_decode_t dec_el;       /* dolby vision el decoder status */
@@ -220,59 +231,15 @@ dump_binhex(bbio_handle_t sink, char* tag, char *pStr)
     dump_info(sink, "</%s>\n", tag);
 }
 
-/* nal info file format:
- *   # of entry
+/* nal info format (see nal_index.h):
+ *   # of nal in au
  *   entries ...
  *
  *   entry:
- *       nal offset at es file, nal size, sc_size, embedded data if nal offset == -1
+ *       nal size, sc_size, embedded flag; nal offset at es file or embedded data
  * NOTE: here nal means that after sc
 */
 
-/* MACRO for debug nal info file */
-#define ADD_NAL_INFO_FILE_DEBUG_INFO    0
-#if ADD_NAL_INFO_FILE_DEBUG_INFO
-static
-int32_t wr_prfix(bbio_handle_t snk)
-{
-    static uint32_t wr_id = 0;
-
-    sink_write_u32(snk, wr_id);
-    wr_id++;
-
-    return 0;
-}
-
-static
-int32_t rd_prfix(bbio_handle_t src)
-{
-    static uint32_t rd_id = 0;
-    uint32_t        rd;
-
-    if (src_rd_u32(src, &rd) != 0)
-    {
-        return 1;
-    }
-
-    if (rd != rd_id)
-    {
-        msglog(NULL, MSGLOG_ERR, "Parser avc: ERR: rd %u != should be %u\n", rd, rd_id);
-    }
-    rd_id++;
-
-    return 0;
-}
-
-#define WR_PREFIX(snk) wr_prfix(snk)
-#define RD_PREFIX(src) rd_prfix(src)
-
-#else
-
-#define WR_PREFIX(snk) 0
-#define RD_PREFIX(src) 0
-
-#endif
-
 #define CHK_NAL_INFO_FILE_OFFSET    0
 #if CHK_NAL_INFO_FILE_OFFSET
 static
@@ -318,55 +285,85 @@ int32_t chk_file_offset(nal_handle_t nal)
 #endif
 
 
-/* Returns the offset into buf where the sc is
- * sc_next == TRUE: skip the starting sc
- * return -1 for no sc found
+/* Loads the next nal of a nal length prefixed input. The length field is replaced
+ * by a 4 byte sc so nal is parsed as from annex b; off_file is where the sc would be.
+ * Only the buffer size is loaded: skip_the_nal() seeks over the rest
  */
-static int32_t
-find_sc_off(uint8_t *buf, size_t buf_size, BOOL sc_next)
+static BOOL
+get_a_nal_len(nal_handle_t nal)
 {
-    uint32_t val;
-    uint8_t *buf0    = buf;
-    uint8_t *buf_top = buf + buf_size;
+    uint8_t  len_buf[4];
+    uint32_t body_size, j;
+    size_t   to_load;
 
-    if (buf_size < 4)
-    {
-        /* 4: sc at least 3 bytes + 1 nal hdr */
-        return -1;
-    }
-
-    /** skip current start code if search for next sc */
-    if (sc_next)
+    do
     {
-        if (*buf++ == 0 && *buf++ == 0 &&
-            (*buf == 1 || (*buf++ == 0 && *buf == 1)))
+        body_size    = 0;
+        nal->nal_emb = (nal->cfg_off + 2 <= nal->cfg_size);
+        if (nal->nal_emb)
         {
-            buf++;
+            /* out of band parameter sets go first */
+            body_size     = (nal->cfg_buf[nal->cfg_off] << 8) | nal->cfg_buf[nal->cfg_off + 1];
+            nal->cfg_off += 2;
+            body_size     = (uint32_t)MIN2(body_size, nal->cfg_size - nal->cfg_off);
         }
         else
         {
-            msglog(NULL, MSGLOG_ERR, "sc miss-match\n");
-            buf = buf0;  /* to keep going */
+            if (nal->ds->read(nal->ds, len_buf, nal->nal_len_size) != nal->nal_len_size)
+            {
+                nal->data_size    = 0;
+                nal->nal_complete = TRUE;
+                return FALSE;
+            }
+            for (j = 0; j < nal->nal_len_size; j++)
+            {
+                body_size = (body_size << 8) | len_buf[j];
+            }
+            nal->off_file = nal->ds->position(nal->ds) - 4;
+            if (body_size > nal->ds->size(nal->ds) - nal->ds->position(nal->ds))
+            {
+                msglog(NULL, MSGLOG_WARNING, "nal length %u beyond end of file, truncated\n", body_size);
+                body_size = (uint32_t)(nal->ds->size(nal->ds) - nal->ds->position(nal->ds));
+            }
         }
     }
+    while (!body_size);  /* empty nal: skip */
 
-    /** get next current start code */
-    val = 0xffffffff;
-    while (buf < buf_top)
+    if (nal->nal_emb && body_size + 4 > nal->buf_size)
     {
-        val <<= 8;
-        val |= *buf++;
-        if ((val & 0x00ffffff) == AVC_START_CODE)
+        /* ps are kept whole in the dsi */
+        uint8_t *buffer = REALLOC_CHK(nal->buffer, body_size + 4);
+        if (!buffer)
         {
-            if (val == AVC_START_CODE)
-            {
-                return (int32_t)((buf - buf0) - 4);
-            }
-            return (int32_t)((buf - buf0) - 3);
+            return FALSE;
         }
+        nal->buffer   = buffer;
+        nal->buf_size = body_size + 4;
     }
 
-    return -1;
+    to_load = MIN2(body_size, nal->buf_size - 4);
+    if (nal->nal_emb)
+    {
+        memcpy(nal->buffer + 4, nal->cfg_buf + nal->cfg_off, to_load);
+        nal->cfg_off += body_size;
+    }
+    else
+    {
+        to_load = nal->ds->read(nal->ds, nal->buffer + 4, to_load);
+    }
+    nal->buffer[0] = 0;
+    nal->buffer[1] = 0;
+    nal->buffer[2] = 0;
+    nal->buffer[3] = 1;
+
+    nal->len_left     = body_size - to_load;
+    nal->nal_buf      = nal->buffer;
+    nal->sc_size      = 4;
+    nal->data_size    = 4 + to_load;
+    nal->nal_size     = nal->data_size;
+    nal->nal_complete = (nal->len_left == 0);
+
+    return TRUE;
 }
 
 /* assuming sc_off_next point to next(now of interest) nal */
@@ -376,6 +373,11 @@ get_a_nal(nal_handle_t nal)
     int32_t sc_off_next, off0;
     size_t bytes_read, bytes_avail;
 
+    if (nal->nal_len_size)
+    {
+        return get_a_nal_len(nal);
+    }
+
     /** next nal starts at where last one end */
     nal->sc_off = nal->sc_off_next;
     nal->off_file += nal->nal_size;
@@ -492,6 +494,16 @@ skip_the_nal(nal_handle_t nal)
         return FALSE;  /* already done */
     }
 
+    if (nal->nal_len_size)
+    {
+        /* size known: no need to read the nal body */
+        nal->ds->seek(nal->ds, nal->len_left, SEEK_CUR);
+        nal->nal_size    += nal->len_left;
+        nal->len_left     = 0;
+        nal->nal_complete = TRUE;
+        return TRUE;
+    }
+
     assert(nal->nal_size >= 2048);
     do {
         /* keep the last three byte and load more data */
@@ -524,11 +536,11 @@ skip_the_nal(nal_handle_t nal)
 /** Returns true if new SPS or PPS inside nal will trigger writing of new sample description box
     because there is already a SPS or PPS with same id but different content in plist. */
 static BOOL
-ps_list_is_there_collision(list_handle_t *plist, uint8_t id, nal_handle_t nal)
+ps_list_is_there_collision(parser_avc_handle_t parser, list_handle_t *plist, uint8_t id, nal_handle_t nal)
 {
-    it_list_handle_t it = NULL;
-    buf_entry_t *    entry = NULL;
-    BOOL             ret = FALSE;
+    buf_entry_t *entry = NULL;
+    BOOL         same  = FALSE;
+    BOOL         ret   = FALSE;
 
     if (!*plist)
     {
@@ -536,16 +548,12 @@ ps_list_is_there_collision(list_handle_t *plist, uint8_t id, nal_handle_t nal)
         return FALSE;
     }
 
-    it = it_create();
-    it_init(it, *plist);
-    while ((entry = it_get_entry(it)) && entry->id != id)
-        continue;
+    entry = ps_cache_lookup(parser->ps_cache, *plist, id, nal->nal_buf + nal->sc_size, nal->nal_size - nal->sc_size, &same);
 
     if (entry)
     {
         /* Do existing and new entry have the same content? */
-        if (entry->size == nal->nal_size - nal->sc_size &&
-           !memcmp(entry->data, nal->nal_buf + nal->sc_size, entry->size))
+        if (same)
         {
             /* we get here if the NALs are identical */
             ret = FALSE;
@@ -557,7 +565,6 @@ ps_list_is_there_collision(list_handle_t *plist, uint8_t id, nal_handle_t nal)
         }
     }
 
-    it_destroy(it);
     return ret;
 }
 
@@ -565,26 +572,22 @@ ps_list_is_there_collision(list_handle_t *plist, uint8_t id, nal_handle_t nal)
 static BOOL
 ps_list_update(parser_avc_handle_t parser, list_handle_t *plist, uint8_t id, nal_handle_t nal, uint32_t *sample_flag)
 {
-    it_list_handle_t it = it_create();
-    buf_entry_t *    entry;
-    BOOL             ret = TRUE;
+    buf_entry_t *entry;
+    BOOL         same = FALSE;
+    BOOL         ret  = TRUE;
 
     if (!*plist)
     {
         *plist = list_create(sizeof(buf_entry_t));
+        ps_cache_forget(parser->ps_cache, *plist);  /* a new list may reuse an indexed one's address */
     }
 
-    it_init(it, *plist);
-    while ((entry = it_get_entry(it)) && entry->id != id)
-    {
-        continue;
-    }
+    entry = ps_cache_lookup(parser->ps_cache, *plist, id, nal->nal_buf + nal->sc_size, nal->nal_size - nal->sc_size, &same);
 
     if (entry)
     {
         /* Do existing and new entry have the same content? */
-        if (entry->size == nal->nal_size - nal->sc_size &&
-           !memcmp(entry->data, nal->nal_buf + nal->sc_size, entry->size))
+        if (same)
         {
             /* we get here if the NALs are identical */
             if (parser->keep_all_nalus)
@@ -605,9 +608,10 @@ ps_list_update(parser_avc_handle_t parser, list_handle_t *plist, uint8_t id, nal
                 /* we don't have enough space in this entry */
                 FREE_CHK(entry->data);
                 entry->size = (size_t)(nal->nal_size - nal->sc_size);
-                entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+                entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             }
             memcpy(entry->data, nal->nal_buf + nal->sc_size, entry->size);
+            ps_cache_update(parser->ps_cache, *plist, entry);
             if (parser->keep_all_nalus)
             {
                 ret = TRUE;
@@ -635,10 +639,11 @@ ps_list_update(parser_avc_handle_t parser, list_handle_t *plist, uint8_t id, nal
         entry       = list_alloc_entry(*plist);
         entry->id   = id;
         entry->size = nal->nal_size - nal->sc_size;
-        entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+        entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
         memcpy(entry->data, nal->nal_buf + nal->sc_size, entry->size);
 
         list_add_entry(*plist, entry);
+        ps_cache_update(parser->ps_cache, *plist, entry);
 
         if (sample_flag)
         {
@@ -655,7 +660,6 @@ ps_list_update(parser_avc_handle_t parser, list_handle_t *plist, uint8_t id, nal
         }
     }
 
-    it_destroy(it);
     return ret;
 }
 
@@ -778,7 +782,7 @@ parse_sei_messages(avc_decode_t *dec, nal_handle_t nal, BOOL keep_all)
     if (nal->tmp_buf_size < nal_size_no_tz)
     {
         FREE_CHK(nal->tmp_buf);
-        nal->tmp_buf = MALLOC_CHK(nal_size_no_tz);
+        nal->tmp_buf = MALLOC_TAG_CHK(MP4_MEM_NAL, nal_size_no_tz);
         if (!nal->tmp_buf)
         {
             msglog(NULL, MSGLOG_ERR, "ERR: malloc fail\n");
@@ -1149,11 +1153,12 @@ timing_info_update(parser_avc_handle_t parser_avc, sps_t *p_sps)
 }
 
 static int
-save_au_nals_info(au_nals_t *au_nals, mp4_sample_handle_t sample, bbio_handle_t snk)
+save_au_nals_info(au_nals_t *au_nals, mp4_sample_handle_t sample, nal_index_handle_t nal_index)
 {
     nal_loc_t *nal_loc, *nal_loc_end;
+    int32_t    ret;
 
-    sample->pos = snk->position(snk);  /* into the nal info file */
+    sample->pos = nal_index_position(nal_index);  /* into the nal info */
     if (sample->data)
     {
         /* data=0 for nal info type sample data */
@@ -1163,24 +1168,19 @@ save_au_nals_info(au_nals_t *au_nals, mp4_sample_handle_t sample, bbio_handle_t
 
     assert(au_nals->nal_idx);
     /* save sample's au structure and location at es file */
-    if (WR_PREFIX(snk) != 0)
-    {
-        return EMA_MP4_MUXED_WRITE_ERR;
-    }
-
-    sink_write_u32(snk, au_nals->nal_idx);  /* # of nal in au */
+    ret = nal_index_add_au(nal_index, au_nals->nal_idx);
 
     nal_loc = au_nals->nal_locs;
     nal_loc_end = nal_loc + au_nals->nal_idx;
     while (nal_loc < nal_loc_end)
     {
-        sink_write_u64(snk, nal_loc->off);                  /* nal body at es file. -1 embedded */
-        sink_write_u32(snk, (uint32_t)nal_loc->size);       /* nal body size */
-        sink_write_u8(snk,  (uint8_t)nal_loc->sc_size);     /* nal sc size */
+        if (ret == EMA_MP4_MUXED_OK)
+        {
+            /* nal body at es file. -1 embedded: save nal body only */
+            ret = nal_index_add_nal(nal_index, nal_loc->off, (uint32_t)nal_loc->size, (uint8_t)nal_loc->sc_size, nal_loc->buf_emb);
+        }
         if (nal_loc->buf_emb)
         {
-            /* save nal body only */
-            snk->write(snk, nal_loc->buf_emb, nal_loc->size);
             FREE_CHK(nal_loc->buf_emb);
             nal_loc->buf_emb = 0;
         }
@@ -1188,7 +1188,7 @@ save_au_nals_info(au_nals_t *au_nals, mp4_sample_handle_t sample, bbio_handle_t
     }
     au_nals->nal_idx = 0;
 
-    return EMA_MP4_MUXED_OK;
+    return ret;
 }
 
 #if TEST_DTS
@@ -1331,7 +1331,7 @@ add_AUD(au_nals_t *au_nals, BOOL keep_scp)
         nal_loc->sc_size = 4;
     }
 
-    nal_loc->buf_emb = (uint8_t *)MALLOC_CHK(nal_loc->size);
+    nal_loc->buf_emb = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_NAL, nal_loc->size);
     if (keep_scp)
     {
         nal_loc->buf_emb[0] = 0;
@@ -1366,7 +1366,7 @@ add_end_of_stram(au_nals_t *au_nals, BOOL keep_scp)
         nal_loc->sc_size = 3;
     }
 
-    nal_loc->buf_emb = (uint8_t *)MALLOC_CHK(nal_loc->size);
+    nal_loc->buf_emb = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_NAL, nal_loc->size);
     if (keep_scp)
     {
         nal_loc->buf_emb[0] = 0;
@@ -1451,7 +1451,7 @@ parser_avc_clone_dsi(parser_handle_t parser)
             }
             new_entry->id   = entry->id;
             new_entry->size = entry->size;
-            new_entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+            new_entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             if (!new_entry->data)
             {
                 list_free_entry(new_entry);
@@ -1488,7 +1488,7 @@ parser_avc_clone_dsi(parser_handle_t parser)
             }
             new_entry->id   = entry->id;
             new_entry->size = entry->size;
-            new_entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+            new_entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             if (!new_entry->data)
             {
                 list_free_entry(new_entry);
@@ -1525,7 +1525,7 @@ parser_avc_clone_dsi(parser_handle_t parser)
             }
             new_entry->id   = entry->id;
             new_entry->size = entry->size;
-            new_entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+            new_entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             if (!new_entry->data)
             {
                 list_free_entry(new_entry);
@@ -1550,6 +1550,8 @@ parser_avc_clone_dsi(parser_handle_t parser)
     /* Switch to new entry in stsd list */
     list_add_entry(parser->dsi_lst, p_new_dsi);
     parser->curr_dsi = new_dsi;
+    /* ps now go to the lists of the new dsi */
+    ps_cache_forget(((parser_avc_handle_t)parser)->ps_cache, NULL);
 
     it_destroy(it);
 
@@ -1669,7 +1671,7 @@ parser_avc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
             if (parser->dsi_type == DSI_TYPE_MP4FF)
             {
                 /* Check if new sample description is necessary */
-                if (ps_list_is_there_collision(&(mp4ff_dsi->sps_lst), dec->sps_id, nal) &&
+                if (ps_list_is_there_collision(parser_avc, &(mp4ff_dsi->sps_lst), dec->sps_id, nal) &&
                     !(sample->flags & SAMPLE_NEW_SD))   /* Don't create new dsi list entry if
                                                            new sample entry was already triggered */
                 {
@@ -1706,7 +1708,7 @@ parser_avc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
             if (parser->dsi_type == DSI_TYPE_MP4FF)
             {
                 /* Check if new sample description is necessary */
-                if (ps_list_is_there_collision(&(mp4ff_dsi->pps_lst), dec->pps_id, nal) &&
+                if (ps_list_is_there_collision(parser_avc, &(mp4ff_dsi->pps_lst), dec->pps_id, nal) &&
                     !(sample->flags & SAMPLE_NEW_SD))   /* Don't create new dsi list entry if
                                                            new sample entry was already triggered */
                 {
@@ -1749,7 +1751,7 @@ parser_avc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
             if (parser->dsi_type == DSI_TYPE_MP4FF)
             {
                 /* Check if new sample description is necessary */
-                if (ps_list_is_there_collision(&(mp4ff_dsi->sps_ext_lst), dec->sps_id, nal) &&
+                if (ps_list_is_there_collision(parser_avc, &(mp4ff_dsi->sps_ext_lst), dec->sps_id, nal) &&
                     !(sample->flags & SAMPLE_NEW_SD))   /* Don't create new dsi list entry if
                                                            new sample entry was already triggered */
                 {
@@ -1858,6 +1860,11 @@ parser_avc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
 
         /* to get nal_size and sc_off_next if havn't, reach next sc */
         skip_the_nal(nal);
+        if (nal->nal_emb)
+        {
+            /* out of band ps only go to the sample entry: mdat gets what the es carries */
+            keep_nal = FALSE;
+        }
         msglog(NULL, MSGLOG_DEBUG, "Nal size %" PRIz "\n", nal->nal_size);
 
         /******* book keep the nal */
@@ -2121,7 +2128,10 @@ parser_avc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
            sample->dependency_level,
            sample->pic_type);
 
-    save_au_nals_info(au_nals, sample, parser_avc->tmp_bbo);
+    if (save_au_nals_info(au_nals, sample, parser_avc->nal_index) != EMA_MP4_MUXED_OK)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
 
     msglog(NULL, MSGLOG_DEBUG, "Get frame %d: %" PRIz " bytes, dts %" PRIu64 ", cts %" PRIu64 ", dur %u, IDR %d\n",
            parser_avc->au_num, sample->size, sample->dts, sample->cts, sample->duration, dec->IDR_pic);
@@ -2341,7 +2351,7 @@ build_sample(parser_avc_handle_t parser_avc, mp4_sample_handle_t sample)
     sample->size = parser_avc->sample_size;
 
 
-    /* save_au_nals_info(&(parser_avc->au_nals), sample, parser_avc->tmp_bbo); */
+    /* save_au_nals_info(&(parser_avc->au_nals), sample, parser_avc->nal_index); */
     parser_avc->au_nals.nal_idx = 0;  /* push in case: no input file */
 
     msglog(NULL, MSGLOG_DEBUG, "\nAu %d end: %" PRIz " bytes, dts %" PRIu64 ", cts %" PRIu64 ", dur %u, IDR %d\n",
@@ -2564,7 +2574,7 @@ parser_avc_get_sample_push(parser_handle_t parser, SEsData_t *asEsd, SSs_t *psNa
             nal_loc->off  = -1;
             nal_loc->size = sei_size2keep - sc_size;
 
-            nal_loc->buf_emb = (uint8_t *)MALLOC_CHK(nal_loc->size);
+            nal_loc->buf_emb = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_NAL, nal_loc->size);
             memcpy(nal_loc->buf_emb, nal->nal_buf + sc_size, nal_loc->size);
         }
         sei_size2keep = 0;
@@ -2590,36 +2600,14 @@ parser_avc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_num
     int32_t  nals_left;
     uint8_t  sc_size;
     int64_t  off;
-    static int32_t sample_count = 0;
 
     parser_avc_handle_t parser_avc   = (parser_avc_handle_t)parser;
-    bbio_handle_t       src          = parser_avc->tmp_bbi, ds = parser->ds;
+    nal_index_handle_t  src          = parser_avc->nal_index;
+    bbio_handle_t       ds           = parser->ds;
     const uint32_t      nal_unit_len = ((dsi_avc_handle_t)parser->curr_dsi)->NALUnitLength;
     const size_t        bufsize      = *bufsize_ptr;
 
-    if (!src)
-    {
-        uint8_t* buffer;
-        size_t   data_size, buf_size;
-        /* give the output buffer to the input buffer */
-        assert(parser_avc->tmp_bbo);
-        src    = reg_bbio_get('b', 'r');
-        buffer = parser_avc->tmp_bbo->get_buffer(parser_avc->tmp_bbo, &data_size, &buf_size);
-        src->set_buffer(src, buffer, data_size, TRUE);
-        parser_avc->tmp_bbi = src;
-    }
-
-    if (pos && *pos != -1)
-    {
-        src->seek(src, *pos, SEEK_SET);
-    }
-
-    if (RD_PREFIX(src) != 0)
-    {
-        return EMA_MP4_MUXED_READ_ERR;
-    }
-
-    if (src_rd_u32(src, &nal_num) != 0)   /* # of nal in au */
+    if (nal_index_read_au(src, pos ? *pos : -1, &nal_num) != EMA_MP4_MUXED_OK)   /* # of nal in au */
     {
         return EMA_MP4_MUXED_READ_ERR;
     }
@@ -2640,17 +2628,7 @@ parser_avc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_num
 
     do
     {
-        uint64_t u;
-        if (src_rd_u64(src, &u) != 0) 
-        {
-            return EMA_MP4_MUXED_READ_ERR;
-        }
-        off = u;
-        if (src_rd_u32(src, &size) != 0)
-        {
-            return EMA_MP4_MUXED_READ_ERR;
-        }
-        if (src_rd_u8(src, &sc_size) != 0)
+        if (nal_index_read_nal(src, &off, &size, &sc_size) != EMA_MP4_MUXED_OK)
         {
             return EMA_MP4_MUXED_READ_ERR;
         }
@@ -2660,7 +2638,7 @@ parser_avc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_num
     *bufsize_ptr = nal_unit_len + size;
     if (pos)
     {
-        *pos = src->position(src);
+        *pos = nal_index_tell(src);
     }
 
     if (data)
@@ -2688,10 +2666,9 @@ parser_avc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_num
         else
         {
             /* embedded: nal body right at current position */
-            src->read(src, data, size);
+            nal_index_read_emb(src, data, NULL);
         }
     }
-    sample_count++;
     return EMA_MP4_MUXED_OK;
 }
 
@@ -2702,7 +2679,7 @@ parser_avc_copy_sample(parser_handle_t parser, bbio_handle_t snk, int64_t pos)
     uint8_t             sc_size;
     int64_t             off;
     parser_avc_handle_t parser_avc   = (parser_avc_handle_t)parser;
-    bbio_handle_t       src          = parser_avc->tmp_bbi;
+    nal_index_handle_t  src          = parser_avc->nal_index;
     bbio_handle_t       ds           = parser->ds;
     const uint32_t      nal_unit_len = ((dsi_avc_handle_t)parser->curr_dsi)->NALUnitLength;
 
@@ -2721,45 +2698,13 @@ parser_avc_copy_sample(parser_handle_t parser, bbio_handle_t snk, int64_t pos)
     }
 #endif
 
-    if (!src)
-    {
-        uint8_t* buffer;
-        size_t data_size, buf_size;
-        /* give the output buffer to the input buffer */
-        assert(parser_avc->tmp_bbo);
-        src = reg_bbio_get('b', 'r');
-        buffer = parser_avc->tmp_bbo->get_buffer(parser_avc->tmp_bbo, &data_size, &buf_size);
-        src->set_buffer(src, buffer, data_size, TRUE);
-        parser_avc->tmp_bbi = src;
-    }
-
-    if (pos != -1)
-    {
-        src->seek(src, pos, SEEK_SET);
-    }
-
-    if (RD_PREFIX(src) != 0)
-    {
-        return EMA_MP4_MUXED_READ_ERR;
-    }
-
-    if (src_rd_u32(src, &nal_num) != 0) /* # of nal in au */
+    if (nal_index_read_au(src, pos, &nal_num) != EMA_MP4_MUXED_OK) /* # of nal in au */
     {
         return EMA_MP4_MUXED_READ_ERR;
     }
     while (nal_num--)
     {
-        uint64_t u;
-        if (src_rd_u64(src, &u) != 0) 
-        {
-            return EMA_MP4_MUXED_READ_ERR;
-        }
-        off = u;
-        if (src_rd_u32(src, &size) != 0)
-        {
-            return EMA_MP4_MUXED_READ_ERR;
-        }
-        if (src_rd_u8(src, &sc_size) != 0)
+        if (nal_index_read_nal(src, &off, &size, &sc_size) != EMA_MP4_MUXED_OK)
         {
             return EMA_MP4_MUXED_READ_ERR;
         }
@@ -2786,13 +2731,104 @@ parser_avc_copy_sample(parser_handle_t parser, bbio_handle_t snk, int64_t pos)
         else
         {
             /* embedded: nal body right at current position */
-            bbio_copy(snk, src, size);
+            nal_index_read_emb(src, NULL, snk);
         }
     }
 
     return EMA_MP4_MUXED_OK;
 }
 
+static void
+parser_avc_release_subsample(parser_handle_t parser, int64_t pos)
+{
+    parser_avc_handle_t parser_avc = (parser_avc_handle_t)parser;
+
+    nal_index_release(parser_avc->nal_index, pos);
+}
+
+static nal_index_handle_t
+parser_avc_get_nal_index(parser_handle_t parser)
+{
+    return ((parser_avc_handle_t)parser)->nal_index;
+}
+
+static int32_t
+parser_avc_merge_range(parser_handle_t parser, parser_handle_t part, const parser_range_t *range,
+                       mp4_sample_handle_t samples, uint32_t sample_num)
+{
+    parser_avc_handle_t parser_avc   = (parser_avc_handle_t)parser;
+    parser_avc_handle_t part_avc     = (parser_avc_handle_t)part;
+    const uint32_t      nal_unit_len = ((dsi_avc_handle_t)parser->curr_dsi)->NALUnitLength;
+    const uint64_t      dts_shift    = parser_avc->au_num*(uint64_t)parser_avc->au_ticks;
+    uint32_t            u, drop_size;
+    int64_t             pos;
+    int32_t             ret;
+
+    /* hrd timing carries over from the buffering periods before the part */
+    if (!parser_avc->dec.active_sps || !part_avc->dec.active_sps ||
+        parser_avc->dec.active_sps->UseSeiTiming || part_avc->dec.active_sps->UseSeiTiming ||
+        parser_avc->au_ticks != part_avc->au_ticks)
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    /* the caller may have swapped the es source */
+    parser_avc->nal.ds = parser->ds;
+
+    for (u = 0; u < sample_num; u++)
+    {
+        drop_size = 0;
+        ret = parser_split_append_au(parser_avc->nal_index, part_avc->nal_index, samples[u].pos,
+                                     range, nal_unit_len, &pos, &drop_size);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+        samples[u].pos    = pos;
+        samples[u].size  -= drop_size;
+        samples[u].dts   += dts_shift;
+        samples[u].cts   += dts_shift;
+        samples[u].flags &= ~SAMPLE_NEW_SD;
+    }
+    apoc_append(parser_avc->p_apoc, part_avc->p_apoc);
+
+    if ((part_avc->width > parser_avc->width) || (part_avc->height > parser_avc->height))
+    {
+        parser_avc->width    = part_avc->width;
+        parser_avc->height   = part_avc->height;
+        parser_avc->hSpacing = part_avc->hSpacing;
+        parser_avc->vSpacing = part_avc->vSpacing;
+    }
+
+    /* the part starts with an idr */
+    if (parser_avc->au_num > parser_avc->last_idr_pos &&
+        parser_avc->au_num - parser_avc->last_idr_pos > parser_avc->max_idr_dist)
+    {
+        parser_avc->max_idr_dist = parser_avc->au_num - parser_avc->last_idr_pos;
+    }
+    if (part_avc->max_idr_dist > parser_avc->max_idr_dist)
+    {
+        parser_avc->max_idr_dist = part_avc->max_idr_dist;
+    }
+    parser_avc->last_idr_pos = parser_avc->au_num + part_avc->last_idr_pos;
+#if TEST_DTS
+    if (part_avc->au_num > 1)
+    {
+        parser_avc->delta_dts = part_avc->delta_dts;
+    }
+    parser_avc->dts_pre = part_avc->dts_pre + dts_shift;
+#endif
+
+    parser_avc->au_num      += part_avc->au_num;
+    parser_avc->num_samples += part_avc->num_samples;
+    parser_avc->sei_num     += part_avc->sei_num;
+    parser_avc->sps_num     += part_avc->sps_num     - parser_split_seed_nal_num(part, range, 0x1f, 7);
+    parser_avc->pps_num     += part_avc->pps_num     - parser_split_seed_nal_num(part, range, 0x1f, 8);
+    parser_avc->sps_ext_num += part_avc->sps_ext_num - parser_split_seed_nal_num(part, range, 0x1f, 13);
+    parser_avc->validation_flags |= part_avc->validation_flags;
+
+    return EMA_MP4_MUXED_OK;
+}
+
 static BOOL
 parser_avc_need_fix_cts(parser_handle_t parser)
 {
@@ -3415,6 +3451,7 @@ avc_close(parser_handle_t parser)
     parser_avc_handle_t parser_avc = (parser_avc_handle_t)parser;
 
     FREE_CHK(parser_avc->nal.buffer);
+    FREE_CHK(parser_avc->nal.cfg_buf);
     FREE_CHK(parser_avc->nal.tmp_buf);
     if (parser_avc->nal.tmp_buf_bbi)
     {
@@ -3427,14 +3464,8 @@ avc_close(parser_handle_t parser)
     }
 
     /* release nal related stuff */
-    if (parser_avc->tmp_bbo)
-    {
-        parser_avc->tmp_bbo->destroy(parser_avc->tmp_bbo);
-    }
-    if (parser_avc->tmp_bbi)
-    {
-        parser_avc->tmp_bbi->destroy(parser_avc->tmp_bbi);
-    }
+    nal_index_destroy(parser_avc->nal_index);
+    ps_cache_destroy(parser_avc->ps_cache);
     if (parser_avc->au_nals.nal_idx)
     {
         au_nals_t *au_nals = &(parser_avc->au_nals);
@@ -3484,14 +3515,14 @@ parser_avc_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t
     /* nal parser buffer */
     nal->ds       = ds;
     nal->buf_size = 4096;
-    nal->buffer   = (uint8_t *)MALLOC_CHK(nal->buf_size);
+    nal->buffer   = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_NAL, nal->buf_size);
     if (!nal->buffer)
     {
         return EMA_MP4_MUXED_NO_MEM;
     }
 
     nal->tmp_buf_size = 4096;
-    nal->tmp_buf      = (uint8_t *)MALLOC_CHK(nal->tmp_buf_size);
+    nal->tmp_buf      = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_NAL, nal->tmp_buf_size);
     if (!nal->tmp_buf)
     {
         return EMA_MP4_MUXED_NO_MEM;
@@ -3507,9 +3538,13 @@ parser_avc_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t
         }
     }
 
-    /* create a memory buffer as file io can cause issues with system rights */
-    parser_avc->tmp_bbo = reg_bbio_get('b', 'w');
-    parser_avc->tmp_bbo->set_buffer(parser_avc->tmp_bbo, NULL, 0, TRUE);
+    /* kept in memory as file io can cause issues with system rights */
+    parser_avc->nal_index = nal_index_create();
+    parser_avc->ps_cache  = ps_cache_create();
+    if (!parser_avc->nal_index || !parser_avc->ps_cache)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
 
     parser_avc_dec_init(dec);
     parser_avc_dec_init(dec_el);
@@ -3576,6 +3611,7 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
     if (!dsi->sps_lst)
     {
         dsi->sps_lst = list_create(sizeof(buf_entry_t));
+        ps_cache_forget(parser_avc->ps_cache, dsi->sps_lst);
     }
     for (i = 0; i < num; i++)
     {
@@ -3583,7 +3619,7 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
         nalu       = list_alloc_entry(dsi->sps_lst);
         nalu->size = src_read_u16(pb);
         dump_info(info_sink, "<sequenceParameterSetLength>%" PRIz "</sequenceParameterSetLength>\n", nalu->size);
-        nalu->data = MALLOC_CHK(nalu->size * sizeof (uint8_t));
+        nalu->data = MALLOC_TAG_CHK(MP4_MEM_DSI, nalu->size * sizeof (uint8_t));
         curr_pos   = pb->position(pb);
         pb->read(pb, nalu->data, nalu->size);
         pNALStr    = MALLOC_CHK(nalu->size * sizeof (uint8_t) * 2 + 1);
@@ -3596,23 +3632,17 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
         list_add_entry(dsi->sps_lst, nalu);
         if (i == 0)
         {
-            uint8_t       rbsp_bytes[128];  
-            size_t        rbsp_size;
-            bbio_handle_t dsb = 0;
+            avc_rbsp_t    rbsp;
             int32_t           ret;
 
             /* Use SAR from the first SPS read since 'pasp' atoms don't exist for h.264 streams
-             * must remove the 0x03 nal protection byte if present
+             * the rbsp reader skips the 0x03 nal protection byte if present
              */
-            parser_avc_remove_0x03(rbsp_bytes, &rbsp_size, nalu->data+1, MIN2((nalu->size-1), 128));
-            dsb = reg_bbio_get('b', 'r');
-            dsb->set_buffer(dsb, rbsp_bytes, rbsp_size, 0);
-            ret = parse_sequence_parameter_set(&avc_decode, dsb);
+            ret = parse_sequence_parameter_set(&avc_decode, avc_rbsp_init(&rbsp, nalu->data+1, nalu->size-1));
             if (ret != EMA_MP4_MUXED_OK)
             {
                 return ret;
             }
-            dsb->destroy(dsb);
             parser_avc->vSpacing = avc_decode.active_sps->sar_height;
             parser_avc->hSpacing = avc_decode.active_sps->sar_width;
             pb->seek(pb, curr_pos + nalu->size, SEEK_SET);  /* Parse function goes beyond SPS! Reset. */
@@ -3626,6 +3656,7 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
     if (!dsi->pps_lst)
     {
         dsi->pps_lst = list_create(sizeof(buf_entry_t));
+        ps_cache_forget(parser_avc->ps_cache, dsi->pps_lst);
     }
     for (i = 0; i < num; i++)
     {
@@ -3633,7 +3664,7 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
         nalu       = list_alloc_entry(dsi->pps_lst);
         nalu->size = src_read_u16(pb);
         dump_info(info_sink, "<pictureParameterSetLength>%" PRIz "</pictureParameterSetLength>\n", nalu->size);
-        nalu->data = MALLOC_CHK(nalu->size * sizeof (uint8_t));
+        nalu->data = MALLOC_TAG_CHK(MP4_MEM_DSI, nalu->size * sizeof (uint8_t));
         pb->read(pb, nalu->data, nalu->size);
         pNALStr = MALLOC_CHK(nalu->size * sizeof (uint8_t) * 2 + 1);
         if (pNALStr)
@@ -3668,6 +3699,7 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
         if (!dsi->sps_ext_lst)
         {
             dsi->sps_ext_lst = list_create(sizeof(buf_entry_t));
+            ps_cache_forget(parser_avc->ps_cache, dsi->sps_ext_lst);
         }
         for (i = 0; i < num; i++)
         {
@@ -3675,7 +3707,7 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
             nalu       = list_alloc_entry(dsi->sps_ext_lst);
             nalu->size = src_read_u16(pb);
             dump_info(info_sink, "<sequenceParameterSetExtLength>%" PRIz "</sequenceParameterSetExtLength>\n", nalu->size);
-            nalu->data = MALLOC_CHK(nalu->size * sizeof (uint8_t));
+            nalu->data = MALLOC_TAG_CHK(MP4_MEM_DSI, nalu->size * sizeof (uint8_t));
             pb->read(pb, nalu->data, nalu->size);
             pNALStr = MALLOC_CHK(nalu->size * sizeof (uint8_t) * 2 + 1);
             if (pNALStr)
@@ -3703,6 +3735,73 @@ parser_avc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
     return EMA_MP4_MUXED_OK;
 }
 
+/**
+ * @brief Switches to nal length prefixed input: no start code scanning
+ *
+ * avcc is an AVCDecoderConfigurationRecord, box header optional. It gives the length field
+ * size; its SPS and PPS go before the es nals as if in band. To be called before init()
+ */
+int32_t
+parser_avc_set_avcc(parser_handle_t parser, const uint8_t *avcc, uint32_t size)
+{
+    nal_handle_t   nal = &((parser_avc_handle_t)parser)->nal;
+    const uint8_t *ps, *end;
+    uint32_t       num, nal_size;
+    int32_t        lst;
+
+    if (size >= 8 && IS_FOURCC_EQUAL(avcc + 4, "avcC"))
+    {
+        avcc += 8;
+        size -= 8;
+    }
+    if (parser->dsi_type != DSI_TYPE_MP4FF || size < 6 || avcc[0] != 1)
+    {
+        msglog(NULL, MSGLOG_ERR, "parser_avc_set_avcc: invalid avcC\n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+    if ((avcc[4] & 0x3) == 2)
+    {
+        /* lengthSizeMinusOne 2 is reserved: only 1, 2 and 4 byte lengths are allowed */
+        msglog(NULL, MSGLOG_ERR, "parser_avc_set_avcc: 3 byte nal length not supported\n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    FREE_CHK(nal->cfg_buf);
+    nal->cfg_buf = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, size);
+    if (!nal->cfg_buf)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    nal->cfg_size     = 0;
+    nal->cfg_off      = 0;
+    nal->nal_len_size = 1 + (avcc[4] & 0x3);
+
+    /* SPS list, then PPS list: both already 16 bit length prefixed */
+    ps  = avcc + 5;
+    end = avcc + size;
+    num = *ps++ & 0x1f;
+    for (lst = 0; lst < 2; lst++)
+    {
+        while (num--)
+        {
+            if (ps + 2 > end || ps + 2 + ((ps[0] << 8) | ps[1]) > end)
+            {
+                msglog(NULL, MSGLOG_ERR, "parser_avc_set_avcc: avcC truncated\n");
+                return EMA_MP4_MUXED_PARAM_ERR;
+            }
+            nal_size = 2 + ((ps[0] << 8) | ps[1]);
+            memcpy(nal->cfg_buf + nal->cfg_size, ps, nal_size);
+            nal->cfg_size += nal_size;
+            ps            += nal_size;
+        }
+        num = (ps < end) ? *ps++ : 0;
+    }
+
+    msglog(NULL, MSGLOG_INFO, "avc input: %u byte nal length, %" PRIz " bytes of ps from avcC\n",
+           nal->nal_len_size, nal->cfg_size);
+    return EMA_MP4_MUXED_OK;
+}
+
 /* Creates and builds interface, base */
 static parser_handle_t
 parser_avc_create(uint32_t dsi_type)
@@ -3734,6 +3833,9 @@ parser_avc_create(uint32_t dsi_type)
 #endif
     parser->get_subsample   = parser_avc_get_subsample;
     parser->copy_sample     = parser_avc_copy_sample;
+    parser->release_subsample = parser_avc_release_subsample;
+    parser->merge_range     = parser_avc_merge_range;
+    parser->get_nal_index   = parser_avc_get_nal_index;
     if (dsi_type == DSI_TYPE_MP4FF)
     {
         parser->get_cfg = parser_avc_get_mp4_cfg;
@@ -284,6 +284,187 @@ parser_avc_remove_0x03(uint8_t *dst, size_t *dstlen, const uint8_t *src, const s
     *dstlen = (int) (dst - dst_sav);
 }
 
+/**** avc_rbsp_t: reads rbsp out of the escaped nal payload on the fly */
+
+/** size() counts the rbsp bytes exactly only once this few escaped bytes are left and
+ *  else returns the escaped size. At least two of three escaped bytes are rbsp, so it
+ *  is off only while more than 4 bytes are left: peek_bits() and is_more_byte*() can't tell */
+#define AVC_RBSP_SIZE_EXACT_LEFT    8
+
+static BOOL
+rbsp_next_byte(avc_rbsp_t *r, uint8_t *u8)
+{
+    if (r->zero_cnt >= 2 && r->esc_off < r->buf_size && r->buf[r->esc_off] == 0x03)
+    {
+        /* emulation_prevention_three_byte */
+        r->esc_off++;
+        r->zero_cnt = 0;
+    }
+    if (r->esc_off >= r->buf_size)
+    {
+        return FALSE;
+    }
+
+    *u8 = r->buf[r->esc_off++];
+    r->zero_cnt = (*u8) ? 0 : r->zero_cnt + 1;
+    r->rbsp_pos++;
+
+    return TRUE;
+}
+
+static size_t
+rbsp_read(bbio_handle_t src, uint8_t *buf, size_t size)
+{
+    avc_rbsp_t *r = (avc_rbsp_t *)src;
+    size_t      n = 0;
+
+    if (!buf)
+    {
+        return 0;
+    }
+    while (n < size && rbsp_next_byte(r, buf + n))
+    {
+        n++;
+    }
+    if (n < size)
+    {
+        msglog(NULL, MSGLOG_ERR, "avc rbsp: ERR: read beyond nal end requested\n");
+    }
+    return n;
+}
+
+static int64_t
+rbsp_position(bbio_handle_t bbio)
+{
+    avc_rbsp_t *r = (avc_rbsp_t *)bbio;
+
+    r->mark_esc_off  = r->esc_off;
+    r->mark_rbsp_pos = r->rbsp_pos;
+    r->mark_zero_cnt = r->zero_cnt;
+
+    return r->rbsp_pos;
+}
+
+static int64_t
+rbsp_size(bbio_handle_t bbio)
+{
+    avc_rbsp_t *r    = (avc_rbsp_t *)bbio;
+    size_t      left = r->buf_size - r->esc_off;
+    size_t      esc_off;
+    uint32_t    zero_cnt;
+
+    if (left > AVC_RBSP_SIZE_EXACT_LEFT)
+    {
+        return r->rbsp_pos + left;
+    }
+
+    for (esc_off = r->esc_off, zero_cnt = r->zero_cnt; esc_off < r->buf_size; esc_off++)
+    {
+        if (zero_cnt >= 2 && r->buf[esc_off] == 0x03)
+        {
+            left--;
+            zero_cnt = 0;
+            continue;
+        }
+        zero_cnt = r->buf[esc_off] ? 0 : zero_cnt + 1;
+    }
+    return r->rbsp_pos + left;
+}
+
+static int
+rbsp_seek(bbio_handle_t bbio, int64_t offset, int origin)
+{
+    avc_rbsp_t *r = (avc_rbsp_t *)bbio;
+    uint8_t     u8;
+
+    if (origin == SEEK_CUR)
+    {
+        offset += r->rbsp_pos;
+    }
+    else if (origin == SEEK_END)
+    {
+        offset += rbsp_size(bbio);
+    }
+
+    if (offset == r->mark_rbsp_pos)
+    {
+        r->esc_off  = r->mark_esc_off;
+        r->rbsp_pos = r->mark_rbsp_pos;
+        r->zero_cnt = r->mark_zero_cnt;
+        return 0;
+    }
+    if (offset < r->rbsp_pos)
+    {
+        /* rewind: rare, headers are read forward */
+        r->esc_off  = 0;
+        r->rbsp_pos = 0;
+        r->zero_cnt = 0;
+    }
+    while (r->rbsp_pos < offset)
+    {
+        if (!rbsp_next_byte(r, &u8))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static BOOL
+rbsp_is_more_byte(bbio_handle_t bbio)
+{
+    return rbsp_size(bbio) - ((avc_rbsp_t *)bbio)->rbsp_pos > 0;
+}
+
+static BOOL
+rbsp_is_more_byte2(bbio_handle_t bbio)
+{
+    return rbsp_size(bbio) - ((avc_rbsp_t *)bbio)->rbsp_pos > 1;
+}
+
+static BOOL
+rbsp_is_EOD(bbio_handle_t bbio)
+{
+    return !rbsp_is_more_byte(bbio);
+}
+
+static int
+rbsp_skip_bytes(bbio_handle_t bbio, int64_t byte_num)
+{
+    rbsp_seek(bbio, byte_num, SEEK_CUR);
+    return 0;
+}
+
+static void
+rbsp_destroy(bbio_handle_t bbio)
+{
+    (void)bbio;  /* on the stack */
+}
+
+bbio_handle_t
+avc_rbsp_init(avc_rbsp_t *rbsp, const uint8_t *buf, size_t buf_size)
+{
+    memset(rbsp, 0, sizeof(avc_rbsp_t));
+
+    rbsp->dev_type      = 'b';
+    rbsp->io_mode       = 'r';
+    rbsp->destroy       = rbsp_destroy;
+    rbsp->position      = rbsp_position;
+    rbsp->seek          = rbsp_seek;
+    rbsp->read          = rbsp_read;
+    rbsp->size          = rbsp_size;
+    rbsp->is_EOD        = rbsp_is_EOD;
+    rbsp->is_more_byte  = rbsp_is_more_byte;
+    rbsp->is_more_byte2 = rbsp_is_more_byte2;
+    rbsp->skip_bytes    = rbsp_skip_bytes;
+
+    rbsp->buf           = buf;
+    rbsp->buf_size      = buf_size;
+    rbsp->mark_rbsp_pos = -1;
+
+    return (bbio_handle_t)rbsp;
+}
+
 static void
 scaling_list(uint32_t ix, bbio_handle_t bs)
 {
@@ -1356,13 +1537,8 @@ is_first_slice(const avc_decode_t *dec)
 BOOL
 parser_avc_parse_nal_1(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *dec)
 {
-#define RBSP_BYTE_NUM_MAX   512
-    /* should be enough for nal data of interests
-    *  SPS worst 13 bytes and 496 se/ue in frext */
     uint32_t      hdr_size;
-    uint8_t       rbsp_bytes[RBSP_BYTE_NUM_MAX];
-    size_t        rbsp_size;
-    bbio_handle_t dsb = 0;
+    avc_rbsp_t    rbsp;
 
     hdr_size           = (nal_buf[2] == 1) ? 3 : 4;
     dec->nal_unit_type = nal_buf[hdr_size] & 0x1f;
@@ -1407,13 +1583,8 @@ parser_avc_parse_nal_1(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *de
     /****** VCL and 1,2,5: parsing to get the params, may check if start an au */
     if (nal_delimier_type_tbl[dec->nal_unit_type] ==  PD_NAL_TYPE_VCL)
     {
-        parser_avc_remove_0x03(rbsp_bytes, &rbsp_size, nal_buf + hdr_size, MIN2(nal_size-hdr_size, RBSP_BYTE_NUM_MAX));
-        dsb = reg_bbio_get('b', 'r');
-        dsb->set_buffer(dsb, rbsp_bytes, rbsp_size, 0);
-        parse_slice(dec, dsb);
-
         /* guarantee to be consistant within an au */
-        dsb->destroy(dsb);
+        parse_slice(dec, avc_rbsp_init(&rbsp, nal_buf + hdr_size, nal_size - hdr_size));
 
         /**** this is the first VCL but AU already started by non VCL */
         if (dec->pdNalType == PD_NAL_TYPE_NOT_VCL)
@@ -1460,12 +1631,8 @@ parser_avc_parse_nal_1(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *de
 int
 parser_avc_parse_nal_2(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *dec)
 {
-#define RBSP_BYTE_NUM_MAX   512
-    /* should be enough for nal data of interests
-    *  SPS worst 13 bytes and 496 se/ue in frext */
     uint32_t      hdr_size;
-    uint8_t       rbsp_bytes[RBSP_BYTE_NUM_MAX];
-    size_t        rbsp_size;
+    avc_rbsp_t    rbsp;
     bbio_handle_t dsb = 0;
     int           ret = EMA_MP4_MUXED_OK;
 
@@ -1507,9 +1674,7 @@ parser_avc_parse_nal_2(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *de
              dec->nal_unit_type == NAL_TYPE_SEQ_PARAM_EXT)
     {
         /* need futher parsing */
-        parser_avc_remove_0x03(rbsp_bytes, &rbsp_size, nal_buf + hdr_size, MIN2(nal_size-hdr_size, RBSP_BYTE_NUM_MAX));
-        dsb = reg_bbio_get('b', 'r');
-        dsb->set_buffer(dsb, rbsp_bytes, rbsp_size, 0);
+        dsb = avc_rbsp_init(&rbsp, nal_buf + hdr_size, nal_size - hdr_size);
 
         if (dec->nal_unit_type == NAL_TYPE_SEQ_PARAM ||
             dec->nal_unit_type == NAL_TYPE_SUBSET_SEQ_PARAM)
@@ -1615,11 +1780,7 @@ parser_avc_parse_nal_2(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *de
 int
 parser_avc_parse_el_nal(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *dec)
 {
-#define RBSP_BYTE_NUM_MAX   512
-    /* should be enough for nal data of interests
-    *  SPS worst 13 bytes and 496 se/ue in frext */
-    uint8_t       rbsp_bytes[RBSP_BYTE_NUM_MAX];
-    size_t        rbsp_size;
+    avc_rbsp_t    rbsp;
     bbio_handle_t dsb = 0;
     int           ret = EMA_MP4_MUXED_OK;
 
@@ -1631,9 +1792,7 @@ parser_avc_parse_el_nal(const uint8_t *nal_buf, size_t nal_size, avc_decode_t *d
              dec->nal_unit_type == NAL_TYPE_SEQ_PARAM_EXT)
     {
         /* need futher parsing */
-        parser_avc_remove_0x03(rbsp_bytes, &rbsp_size, nal_buf+1, MIN2(nal_size-1, RBSP_BYTE_NUM_MAX));
-        dsb = reg_bbio_get('b', 'r');
-        dsb->set_buffer(dsb, rbsp_bytes, rbsp_size, 0);
+        dsb = avc_rbsp_init(&rbsp, nal_buf + 1, nal_size - 1);
 
         if (dec->nal_unit_type == NAL_TYPE_SEQ_PARAM ||
             dec->nal_unit_type == NAL_TYPE_SUBSET_SEQ_PARAM)
@@ -114,6 +114,43 @@ apoc_set_max_ref_au(avc_apoc_t *p, int max_ref_au)
     p->ref_au_max = max_ref_au;
 }
 
+/** makes room in the map for doc */
+static void
+apoc_map_grow(avc_apoc_t *p, int doc)
+{
+    while (doc >= p->doc_poc_out_map_size) {
+#if !USE_MAP2
+        int i;
+        int inc = 1000 + (doc - p->doc_poc_out_map_size);
+
+        p->doc_poc_out_map_size += inc;
+        p->doc_poc_out_map = (int*)REALLOC_CHK(p->doc_poc_out_map, sizeof(int)*p->doc_poc_out_map_size );
+        for (i = p->doc_poc_out_map_size - inc; i <  p->doc_poc_out_map_size; i++)
+            p->doc_poc_out_map[i] = -1; /* To detect errors latter */
+#else
+        assert(p->map_sec_cnt < MAP_PRIM_SIZE);
+
+        p->doc_poc_out_map[p->map_sec_cnt] = MALLOC_CHK(sizeof(int)<<MAP_SEC_LOG2_SIZE);
+        memset(p->doc_poc_out_map[p->map_sec_cnt], 0xFF, sizeof(int)<<MAP_SEC_LOG2_SIZE);
+        p->map_sec_cnt++;
+        p->doc_poc_out_map_size += 1<<MAP_SEC_LOG2_SIZE;
+#endif
+    }
+}
+
+static void
+apoc_update_reorder_min_ready(avc_apoc_t *p)
+{
+    if (!p->reorder_min_ready) {
+      /* assume first ref_au_max + 1 AUs in decoding order resolve the reorder_min */
+      p->reorder_min_ready = p->ref_au_max;
+      while (p->reorder_min_ready >= 0 && DOC_2_POC_OUT(p->doc_poc_out_map, p->reorder_min_ready) >= 0) {
+        p->reorder_min_ready--;
+      }
+      p->reorder_min_ready = (p->reorder_min_ready >= 0) ? 0 : 1;
+    }
+}
+
 static void 
 apoc_update(avc_apoc_t *p, BOOL dpb_flush)
 {
@@ -148,23 +185,7 @@ apoc_update(avc_apoc_t *p, BOOL dpb_flush)
 #endif
 
     /** output docs[poc_min_idx], build the map (doc, out_poc) */
-    if (p_dpb->docs[poc_min_idx] >= p->doc_poc_out_map_size) {
-#if !USE_MAP2
-        int inc = 1000 + (p_dpb->docs[poc_min_idx]- p->doc_poc_out_map_size);
-
-        p->doc_poc_out_map_size += inc;
-        p->doc_poc_out_map = (int*)REALLOC_CHK(p->doc_poc_out_map, sizeof(int)*p->doc_poc_out_map_size );
-        for (i = p->doc_poc_out_map_size - inc; i <  p->doc_poc_out_map_size; i++)
-            p->doc_poc_out_map[i] = -1; /* To detect errors latter */
-#else
-        assert(p->map_sec_cnt < MAP_PRIM_SIZE);
-
-        p->doc_poc_out_map[p->map_sec_cnt] = MALLOC_CHK(sizeof(int)<<MAP_SEC_LOG2_SIZE);
-        memset(p->doc_poc_out_map[p->map_sec_cnt], 0xFF, sizeof(int)<<MAP_SEC_LOG2_SIZE);
-        p->map_sec_cnt++;
-        p->doc_poc_out_map_size += 1<<MAP_SEC_LOG2_SIZE;
-#endif
-    }
+    apoc_map_grow(p, p_dpb->docs[poc_min_idx]);
     i = p_dpb->docs[poc_min_idx];
     if (p->poc_out_next == 0) {
       p->doc_at_poc_min = i;
@@ -182,14 +203,7 @@ apoc_update(avc_apoc_t *p, BOOL dpb_flush)
         p_dpb->pocs[i] = p_dpb->pocs[i+1];
     }
 
-    if (!p->reorder_min_ready) {
-      /* assume first ref_au_max + 1 AUs in decoding order resolve the reorder_min */
-      p->reorder_min_ready = p->ref_au_max;
-      while (p->reorder_min_ready >= 0 && DOC_2_POC_OUT(p->doc_poc_out_map, p->reorder_min_ready) >= 0) {
-        p->reorder_min_ready--;
-      }
-      p->reorder_min_ready = (p->reorder_min_ready >= 0) ? 0 : 1;
-    }
+    apoc_update_reorder_min_ready(p);
 }
 
 void 
@@ -216,6 +230,30 @@ apoc_add(avc_apoc_t *p, int poc, int is_idr)
     apoc_update(p, FALSE);
 }
 
+void
+apoc_append(avc_apoc_t *p, avc_apoc_t *q)
+{
+    int doc, poc_out;
+
+    /** q starts with an idr: all of p is output before any of q */
+    apoc_flush(p);
+    apoc_flush(q);
+
+    for (doc = 0; doc < q->dpb.doc_next; doc++) {
+        poc_out = DOC_2_POC_OUT(q->doc_poc_out_map, doc);
+        apoc_map_grow(p, p->dpb.doc_next + doc);
+        DOC_2_POC_OUT(p->doc_poc_out_map, p->dpb.doc_next + doc) = (poc_out >= 0) ? p->poc_out_next + poc_out : -1;
+    }
+    p->dpb.doc_next   += q->dpb.doc_next;
+    p->dpb.dp_cnt_max  = q->dpb.dp_cnt_max;
+    p->poc_out_next   += q->poc_out_next;
+    p->ref_au_max      = q->ref_au_max;
+    if (p->reorder_min < q->reorder_min)
+        p->reorder_min = q->reorder_min;
+
+    apoc_update_reorder_min_ready(p);
+}
+
 int 
 apoc_reorder_num(avc_apoc_t *p, int doc)
 {
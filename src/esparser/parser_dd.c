@@ -146,6 +146,148 @@ get_dep_subs_num(parser_dd_handle_t parser_dd, uint32_t streamID)
     return u;
 }
 
+/* bits of the header buffer hdr from bit pos on, msb first */
+static uint32_t
+hdr_bits(const uint8_t *hdr, uint32_t pos, uint32_t bit_num)
+{
+    uint32_t val = 0;
+
+    for (; bit_num; bit_num--, pos++)
+    {
+        val = (val << 1) | ((hdr[pos >> 3] >> (7 - (pos & 0x7))) & 0x1);
+    }
+    return val;
+}
+
+static void
+hdr_clear_bits(uint8_t *hdr, uint32_t pos, uint32_t bit_num)
+{
+    for (; bit_num; bit_num--, pos++)
+    {
+        hdr[pos >> 3] &= ~(0x80 >> (pos & 0x7));
+    }
+}
+
+/* clears the compr and compr2 gains, which may change every frame, in a copy of an ec3 header */
+static void
+ec3_hdr_fp_mask(uint8_t *hdr, uint32_t size)
+{
+    const uint32_t bit_end = size << 3;
+    uint32_t       pos     = 34; /* compre: after strmtyp..bsid and dialnorm */
+
+    if (pos + 9 <= bit_end && hdr_bits(hdr, pos, 1))
+    {
+        hdr_clear_bits(hdr, pos + 1, 8);     /* compr */
+        pos += 8;
+    }
+    pos++;
+    if (!hdr_bits(hdr, 20, 3))
+    {
+        /* acmod 1+1: dialnorm2, compr2e, compr2 */
+        pos += 5;
+        if (pos + 9 <= bit_end && hdr_bits(hdr, pos, 1))
+        {
+            hdr_clear_bits(hdr, pos + 1, 8); /* compr2 */
+        }
+    }
+}
+
+/* clears what shares the last byte read with lfeon, i.e. dialnorm, compre and the compr gain that
+ * may change every frame, in a copy of an ac3 header from fscod on */
+static void
+ac3_hdr_fp_mask(uint8_t *hdr, uint32_t size)
+{
+    const uint32_t bit_end = size << 3;
+    uint32_t       pos     = 16; /* acmod: after fscod..bsmod */
+    uint32_t       acmod;
+
+    if (pos + 3 > bit_end)
+    {
+        return;
+    }
+    acmod = hdr_bits(hdr, pos, 3);
+    pos  += 3;
+    if ((acmod & 0x01) && acmod != 0x01)
+    {
+        pos += 2; /* cmixlev */
+    }
+    if (acmod & 0x04)
+    {
+        pos += 2; /* surmixlev */
+    }
+    if (acmod == 0x02)
+    {
+        pos += 2; /* dsurmod */
+    }
+    pos++;        /* lfeon */
+    if (pos < bit_end)
+    {
+        hdr_clear_bits(hdr, pos, bit_end - pos);
+    }
+}
+
+/* if the header bs is on has, from byte from on, the bytes of the last full parse of substrm */
+static BOOL
+hdr_fp_match(const dd_substream_t *substrm, bbio_handle_t bs, uint32_t from, BOOL is_ec3)
+{
+    const uint32_t size = substrm->hdr_fp_size;
+    uint8_t        fp[DD_HDR_FP_SIZE];
+    uint8_t       *hdr;
+    size_t         data_left;
+
+    hdr = bs->get_buffer(bs, &data_left, NULL);
+    if (!size || !hdr || from + size > bs->size(bs))
+    {
+        return FALSE;
+    }
+    memcpy(fp, hdr + from, size);
+    if (is_ec3)
+    {
+        ec3_hdr_fp_mask(fp, size);
+    }
+    else
+    {
+        ac3_hdr_fp_mask(fp, size);
+    }
+    return !memcmp(fp, substrm->hdr_fp, size);
+}
+
+/* keeps, after a full parse of substrm, the header bytes it read and what it set beyond the substream */
+static void
+hdr_fp_save(dd_substream_t *substrm, parser_dd_handle_t parser_dd, bbio_handle_t bs, uint32_t from, BOOL is_ec3)
+{
+    const int64_t bits_read = (bs->size(bs) << 3) - src_following_bit_num(bs);
+    uint8_t      *hdr;
+    size_t        data_left;
+    uint32_t      size;
+
+    substrm->hdr_fp_size = 0;
+    hdr = bs->get_buffer(bs, &data_left, NULL);
+    if (!hdr || bits_read > (bs->size(bs) << 3) || (uint32_t)((bits_read + 7) >> 3) <= from)
+    {
+        return;
+    }
+    size = (uint32_t)((bits_read + 7) >> 3) - from;
+    if (size > DD_HDR_FP_SIZE)
+    {
+        return;
+    }
+
+    memcpy(substrm->hdr_fp, hdr + from, size);
+    if (is_ec3)
+    {
+        ec3_hdr_fp_mask(substrm->hdr_fp, size);
+    }
+    else
+    {
+        ac3_hdr_fp_mask(substrm->hdr_fp, size);
+    }
+    substrm->hdr_fp_size     = size;
+    substrm->hdr_frame_size  = parser_dd->frame_size;
+    substrm->hdr_sample_rate = parser_dd->sample_rate;
+    substrm->hdr_numblks     = parser_dd->numblks;
+}
+
 static int
 parse_ac3_substream(bbio_handle_t bs, parser_dd_handle_t parser_dd)
 {
@@ -167,11 +309,20 @@ parse_ac3_substream(bbio_handle_t bs, parser_dd_handle_t parser_dd)
         return EMA_MP4_MUXED_OK;
     }
     substrm = &(parser_dd->subs_ind[AC3_SUBSTREAMID]);
-    substrm->ddt = DD_TYPE_AC3;
 
     parser_dd->ddt     = DD_TYPE_AC3;
     parser_dd->numblks = 6;
 
+    /* the bsi after crc1 as last parsed: nothing to update */
+    if (substrm->ddt == DD_TYPE_AC3 && hdr_fp_match(substrm, bs, 2, FALSE))
+    {
+        parser_dd->sample_rate = substrm->hdr_sample_rate;
+        parser_dd->frame_size  = substrm->hdr_frame_size;
+        parser_dd->channel_flags_prg[AC3_SUBSTREAMID] = substrm->channel_flags;
+        return EMA_MP4_MUXED_OK;
+    }
+    substrm->ddt = DD_TYPE_AC3;
+
     bs->skip_bytes(bs, 2);       /* crc1 */
 
     fscod      = (uint8_t)src_read_bits(bs, 2);
@@ -225,6 +376,8 @@ parse_ac3_substream(bbio_handle_t bs, parser_dd_handle_t parser_dd)
     }
     parser_dd->channel_flags_prg[AC3_SUBSTREAMID] = substrm->channel_flags;
 
+    hdr_fp_save(substrm, parser_dd, bs, 2, FALSE);
+
     return EMA_MP4_MUXED_OK;
 }
 
@@ -426,6 +579,16 @@ parse_ec3_substream(bbio_handle_t bs, parser_dd_handle_t parser_dd)
         return EMA_MP4_MUXED_SYNC_ERR;
     }
 
+    /* the bsi as last parsed: nothing to update, nothing to report */
+    if (substrm->ddt == DD_TYPE_EC3 && hdr_fp_match(substrm, bs, 0, TRUE))
+    {
+        parser_dd->ddt         = DD_TYPE_EC3;
+        parser_dd->frame_size  = substrm->hdr_frame_size;
+        parser_dd->sample_rate = substrm->hdr_sample_rate;
+        parser_dd->numblks     = substrm->hdr_numblks;
+        parser_dd->channel_flags_prg[parser_dd->last_indep] |= substrm->channel_flags;
+        return EMA_MP4_MUXED_OK;
+    }
     substrm->ddt = DD_TYPE_EC3;
 
     if (bCheckForChange && strmtyp != substrm->strmtyp)
@@ -638,6 +801,8 @@ parse_ec3_substream(bbio_handle_t bs, parser_dd_handle_t parser_dd)
         }
     }
 
+    hdr_fp_save(substrm, parser_dd, bs, 0, TRUE);
+
     return EMA_MP4_MUXED_OK;
 }
 
@@ -34,6 +34,9 @@
 #include "dsi.h"
 #include "parser.h"
 #include "parser_hevc_dec.h"
+#include "nal_index.h"
+#include "ps_cache.h"
+#include "parser_split.h"
 
 #include <stdarg.h>
 
@@ -79,6 +82,14 @@ typedef struct hevc_nal_t_
     size_t    sc_size;
     BOOL      nal_complete;  /** if get a complete nal */
 
+    /** nal length prefixed input, set up by parser_hevc_set_hvcc() */
+    uint32_t  nal_len_size;  /** 1, 2 or 4; 0: annex b */
+    uint8_t  *cfg_buf;       /** out of band ps, 16 bit length prefixed: handed out before the es */
+    size_t    cfg_size;
+    size_t    cfg_off;
+    size_t    len_left;      /** nal bytes left in file not loaded into buffer */
+    BOOL      nal_emb;       /** nal from cfg_buf: not in file */
+
     /** to aid parsing */
     uint8_t       *tmp_buf;
     uint32_t       tmp_buf_size;
@@ -99,8 +110,8 @@ struct parser_hevc_t_
     hevc_nal_t    nal;         /** nal buf and current nal info */
     hevc_au_nals_t  au_nals;   /** the composing nals of au */
     hevc_au_nals_t  dv_au_nals;/** dolby vision composing nals of au */
-    bbio_handle_t tmp_bbo;     /** the output handle of file */
-    bbio_handle_t tmp_bbi;     /** the input handle of file */
+    nal_index_handle_t nal_index; /** where the nals of each au are */
+    ps_cache_handle_t  ps_cache;  /** sps/pps/vps of the dsi lists by id */
 
     hevc_decode_t dec;         /** current decoder status */
     hevc_decode_t dec_el;      /** dolby vision el decoder status */
@@ -124,6 +135,7 @@ struct parser_hevc_t_
 #endif
 
     list_handle_t hevc_cts_offset_lst;
+    int32_t       ctts_offset;         /** the lowest cts offset, when get_cts_offset() is called for sample 0 */
 
     /** validation */
     uint32_t validation_flags;
@@ -153,56 +165,85 @@ update_idx_value_lst(list_handle_t lst,
     list_add_entry(lst, idx_value);
 }
 
-/**  return the offset into buf where the sc is
- *  sc_next == TRUE: skip the starting sc
- *  return -1 for no sc found
+/** loads the next nal of a nal length prefixed input. The length field is replaced
+ *  by a 4 byte sc so nal is parsed as from annex b; off_file is where the sc would be.
+ *  Only the buffer size is loaded: skip_the_nal() seeks over the rest
  */
-#define NAL_START_CODE              0x000001
-static int32_t
-find_sc_off(uint8_t *buf, size_t buf_size, BOOL sc_next)
+static BOOL
+get_a_nal_len(hevc_nal_handle_t nal)
 {
-    uint32_t val;
-    uint8_t *buf0    = buf;
-    uint8_t *buf_top = buf + buf_size;
+    uint8_t  len_buf[4];
+    uint32_t body_size, j;
+    size_t   to_load;
 
-    if (buf_size < 4)
-    {
-        /** 4: sc at least 3 bytes + 1 nal hdr */
-        return -1;
-    }
-
-    /** skip current start code if search for next sc */
-    if (sc_next)
+    do
     {
-        if (*buf++ == 0 && *buf++ == 0 &&
-            (*buf == 1 || (*buf++ == 0 && *buf == 1)))
+        body_size    = 0;
+        nal->nal_emb = (nal->cfg_off + 2 <= nal->cfg_size);
+        if (nal->nal_emb)
         {
-            buf++;
+            /** out of band parameter sets go first */
+            body_size     = (nal->cfg_buf[nal->cfg_off] << 8) | nal->cfg_buf[nal->cfg_off + 1];
+            nal->cfg_off += 2;
+            body_size     = (uint32_t)MIN2(body_size, nal->cfg_size - nal->cfg_off);
         }
         else
         {
-            msglog(NULL, MSGLOG_ERR, "sc miss-match\n");
-            buf = buf0;  /** to keep going */
+            if (nal->ds->read(nal->ds, len_buf, nal->nal_len_size) != nal->nal_len_size)
+            {
+                nal->data_size    = 0;
+                nal->nal_complete = TRUE;
+                return FALSE;
+            }
+            for (j = 0; j < nal->nal_len_size; j++)
+            {
+                body_size = (body_size << 8) | len_buf[j];
+            }
+            nal->off_file = nal->ds->position(nal->ds) - 4;
+            if (body_size > nal->ds->size(nal->ds) - nal->ds->position(nal->ds))
+            {
+                msglog(NULL, MSGLOG_WARNING, "nal length %u beyond end of file, truncated\n", body_size);
+                body_size = (uint32_t)(nal->ds->size(nal->ds) - nal->ds->position(nal->ds));
+            }
         }
     }
+    while (!body_size);  /** empty nal: skip */
 
-    /** get next current start code */
-    val = 0xffffffff;
-    while (buf < buf_top)
+    if (nal->nal_emb && body_size + 4 > nal->buf_size)
     {
-        val <<= 8;
-        val |= *buf++;
-        if ((val & 0x00ffffff) == NAL_START_CODE)
+        /** ps are kept whole in the dsi */
+        uint8_t *buffer = REALLOC_CHK(nal->buffer, body_size + 4);
+        if (!buffer)
         {
-            if (val == NAL_START_CODE)
-            {
-                return (int32_t)(buf - buf0 - 4);
-            }
-            return (int32_t)(buf - buf0 - 3);
+            return FALSE;
         }
+        nal->buffer   = buffer;
+        nal->buf_size = body_size + 4;
     }
 
-    return -1;
+    to_load = MIN2(body_size, nal->buf_size - 4);
+    if (nal->nal_emb)
+    {
+        memcpy(nal->buffer + 4, nal->cfg_buf + nal->cfg_off, to_load);
+        nal->cfg_off += body_size;
+    }
+    else
+    {
+        to_load = nal->ds->read(nal->ds, nal->buffer + 4, to_load);
+    }
+    nal->buffer[0] = 0;
+    nal->buffer[1] = 0;
+    nal->buffer[2] = 0;
+    nal->buffer[3] = 1;
+
+    nal->len_left     = body_size - to_load;
+    nal->nal_buf      = nal->buffer;
+    nal->sc_size      = 4;
+    nal->data_size    = 4 + to_load;
+    nal->nal_size     = nal->data_size;
+    nal->nal_complete = (nal->len_left == 0);
+
+    return TRUE;
 }
 
 /** assuming sc_off_next point to next(now of interest) nal */
@@ -212,6 +253,11 @@ get_a_nal(hevc_nal_handle_t nal)
     int32_t sc_off_next, off0;
     size_t bytes_read, bytes_avail;
 
+    if (nal->nal_len_size)
+    {
+        return get_a_nal_len(nal);
+    }
+
     /** next nal starts at where last one end */
     nal->sc_off = nal->sc_off_next;
     nal->off_file += nal->nal_size;
@@ -328,6 +374,16 @@ skip_the_nal(hevc_nal_handle_t nal)
         return FALSE;  /** already done */
     }
 
+    if (nal->nal_len_size)
+    {
+        /** size known: no need to read the nal body */
+        nal->ds->seek(nal->ds, nal->len_left, SEEK_CUR);
+        nal->nal_size    += nal->len_left;
+        nal->len_left     = 0;
+        nal->nal_complete = TRUE;
+        return TRUE;
+    }
+
     assert(nal->nal_size >= 2048);
     do {
         /** keep the last three byte and load more data */
@@ -360,11 +416,11 @@ skip_the_nal(hevc_nal_handle_t nal)
 /** Return true if new SPS or PPS inside nal will trigger writing of new sample description box
     because there is already a SPS or PPS with same id but different content in plist. */
 static BOOL
-ps_list_is_there_collision(list_handle_t *plist, uint8_t id, hevc_nal_handle_t nal)
+ps_list_is_there_collision(parser_hevc_handle_t parser, list_handle_t *plist, uint8_t id, hevc_nal_handle_t nal)
 {
-    it_list_handle_t it = NULL;
-    buf_entry_t *    entry = NULL;
-    BOOL             ret = FALSE;
+    buf_entry_t *entry = NULL;
+    BOOL         same  = FALSE;
+    BOOL         ret   = FALSE;
 
     if (!*plist)
     {
@@ -372,16 +428,12 @@ ps_list_is_there_collision(list_handle_t *plist, uint8_t id, hevc_nal_handle_t n
         return FALSE;
     }
 
-    it = it_create();
-    it_init(it, *plist);
-    while ((entry = it_get_entry(it)) && entry->id != id)
-        continue;
+    entry = ps_cache_lookup(parser->ps_cache, *plist, id, nal->nal_buf + nal->sc_size, nal->nal_size - nal->sc_size, &same);
 
     if (entry)
     {
         /** Do existing entries and the new one have the same content? */
-        if (entry->size == nal->nal_size - nal->sc_size &&
-           !memcmp(entry->data, nal->nal_buf + nal->sc_size, entry->size))
+        if (same)
         {
             /** we get here if the NALs are identical */
             ret = FALSE;
@@ -393,7 +445,6 @@ ps_list_is_there_collision(list_handle_t *plist, uint8_t id, hevc_nal_handle_t n
         }
     }
 
-    it_destroy(it);
     return ret;
 }
 
@@ -401,26 +452,22 @@ ps_list_is_there_collision(list_handle_t *plist, uint8_t id, hevc_nal_handle_t n
 static BOOL
 ps_list_update(parser_hevc_handle_t parser, list_handle_t *plist, uint8_t id, hevc_nal_handle_t nal, uint32_t *sample_flag, uint32_t dsi_in_mdat_flag)
 {
-    it_list_handle_t it = it_create();
-    buf_entry_t *    entry;
-    BOOL             ret = TRUE;
+    buf_entry_t *entry;
+    BOOL         same = FALSE;
+    BOOL         ret  = TRUE;
 
     if (!*plist)
     {
         *plist = list_create(sizeof(buf_entry_t));
+        ps_cache_forget(parser->ps_cache, *plist);  /** a new list may reuse an indexed one's address */
     }
 
-    it_init(it, *plist);
-    while ((entry = it_get_entry(it)) && entry->id != id)
-    {
-        continue;
-    }
+    entry = ps_cache_lookup(parser->ps_cache, *plist, id, nal->nal_buf + nal->sc_size, nal->nal_size - nal->sc_size, &same);
 
     if (entry)
     {
         /** Do existing and new entry have the same content? */
-        if (entry->size == nal->nal_size - nal->sc_size &&
-           !memcmp(entry->data, nal->nal_buf + nal->sc_size, entry->size))
+        if (same)
         {
             /** we get here if the NALs are identical */
             if (parser->keep_all_nalus)
@@ -441,9 +488,10 @@ ps_list_update(parser_hevc_handle_t parser, list_handle_t *plist, uint8_t id, he
                 /** we don't have enough space in this entry */
                 FREE_CHK(entry->data);
                 entry->size = (size_t)(nal->nal_size - nal->sc_size);
-                entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+                entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             }
             memcpy(entry->data, nal->nal_buf + nal->sc_size, entry->size);
+            ps_cache_update(parser->ps_cache, *plist, entry);
             if (parser->keep_all_nalus)
             {
                 ret = TRUE;
@@ -471,10 +519,11 @@ ps_list_update(parser_hevc_handle_t parser, list_handle_t *plist, uint8_t id, he
         entry       = list_alloc_entry(*plist);
         entry->id   = id;
         entry->size = nal->nal_size - nal->sc_size;
-        entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+        entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
         memcpy(entry->data, nal->nal_buf + nal->sc_size, entry->size);
 
         list_add_entry(*plist, entry);
+        ps_cache_update(parser->ps_cache, *plist, entry);
 
         if (sample_flag && !dsi_in_mdat_flag)
         {
@@ -491,7 +540,6 @@ ps_list_update(parser_hevc_handle_t parser, list_handle_t *plist, uint8_t id, he
         }
     }
 
-    it_destroy(it);
     return ret;
 }
 
@@ -649,15 +697,13 @@ timing_info_update(parser_hevc_handle_t parser_hevc, hevc_decode_t * context)
     }
 
 }
-#define WR_PREFIX(snk) 0
-#define RD_PREFIX(src) 0
-
 static int
-save_au_nals_info(hevc_au_nals_t *au_nals, mp4_sample_handle_t sample, bbio_handle_t snk)
+save_au_nals_info(hevc_au_nals_t *au_nals, mp4_sample_handle_t sample, nal_index_handle_t nal_index)
 {
     hevc_nal_loc_t *nal_loc, *nal_loc_end;
+    int32_t         ret;
 
-    sample->pos = snk->position(snk);  /** into the nal info file */
+    sample->pos = nal_index_position(nal_index);  /** into the nal info */
     if (sample->data)
     {
         /** data=0 for nal info type sample data */
@@ -667,24 +713,19 @@ save_au_nals_info(hevc_au_nals_t *au_nals, mp4_sample_handle_t sample, bbio_hand
 
     assert(au_nals->nal_idx);
     /** save sample's au structure and location at es file */
-    if (WR_PREFIX(snk) != 0)
-    {
-        return EMA_MP4_MUXED_WRITE_ERR;
-    }
-
-    sink_write_u32(snk, au_nals->nal_idx);  /** # of nal in au */
+    ret = nal_index_add_au(nal_index, au_nals->nal_idx);
 
     nal_loc = au_nals->nal_locs;
     nal_loc_end = nal_loc + au_nals->nal_idx;
     while (nal_loc < nal_loc_end)
     {
-        sink_write_u64(snk, nal_loc->off);                   /** nal body at es file. -1 embedded */
-        sink_write_u32(snk, (uint32_t)nal_loc->size);        /** nal body size */
-        sink_write_u8(snk,  (uint8_t)nal_loc->sc_size);      /** nal sc size */
+        if (ret == EMA_MP4_MUXED_OK)
+        {
+            /** nal body at es file. -1 embedded: save nal body only */
+            ret = nal_index_add_nal(nal_index, nal_loc->off, (uint32_t)nal_loc->size, (uint8_t)nal_loc->sc_size, nal_loc->buf_emb);
+        }
         if (nal_loc->buf_emb)
         {
-            /** save nal body only */
-            snk->write(snk, nal_loc->buf_emb, nal_loc->size);
             FREE_CHK(nal_loc->buf_emb);
             nal_loc->buf_emb = 0;
         }
@@ -692,7 +733,7 @@ save_au_nals_info(hevc_au_nals_t *au_nals, mp4_sample_handle_t sample, bbio_hand
     }
     au_nals->nal_idx = 0;
 
-    return EMA_MP4_MUXED_OK;
+    return ret;
 }
 
 
@@ -883,7 +924,7 @@ parser_hevc_clone_dsi(parser_handle_t parser)
             }
             new_entry->id   = entry->id;
             new_entry->size = entry->size;
-            new_entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+            new_entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             if (!new_entry->data)
             {
                 list_free_entry(new_entry);
@@ -923,7 +964,7 @@ parser_hevc_clone_dsi(parser_handle_t parser)
             }
             new_entry->id   = entry->id;
             new_entry->size = entry->size;
-            new_entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+            new_entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             if (!new_entry->data)
             {
                 list_free_entry(new_entry);
@@ -960,7 +1001,7 @@ parser_hevc_clone_dsi(parser_handle_t parser)
             }
             new_entry->id   = entry->id;
             new_entry->size = entry->size;
-            new_entry->data = (uint8_t *)MALLOC_CHK(entry->size);
+            new_entry->data = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, entry->size);
             if (!new_entry->data)
             {
                 list_free_entry(new_entry);
@@ -1000,6 +1041,8 @@ parser_hevc_clone_dsi(parser_handle_t parser)
     /** Switch to new entry in stsd list */
     list_add_entry(parser->dsi_lst, p_new_dsi);
     parser->curr_dsi = new_dsi;
+    /** ps now go to the lists of the new dsi */
+    ps_cache_forget(((parser_hevc_handle_t)parser)->ps_cache, NULL);
 
     it_destroy(it);
 
@@ -1118,7 +1161,7 @@ parser_hevc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
                 if (parser->dsi_type == DSI_TYPE_MP4FF)
                 {
                     /** Check if new sample description is necessary */
-                    if (ps_list_is_there_collision(&(mp4ff_dsi->vps_lst), 0, nal) &&
+                    if (ps_list_is_there_collision(parser_hevc, &(mp4ff_dsi->vps_lst), 0, nal) &&
                         !(sample->flags & SAMPLE_NEW_SD))   /** Don't create new dsi list entry if
                                                            new sample entry was already triggered */
                     {
@@ -1153,7 +1196,7 @@ parser_hevc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
                 if (parser->dsi_type == DSI_TYPE_MP4FF)
                 {
                     /** Check if new sample description is necessary */
-                    if (ps_list_is_there_collision(&(mp4ff_dsi->sps_lst), _context->i_curr_sps_idx, nal) &&
+                    if (ps_list_is_there_collision(parser_hevc, &(mp4ff_dsi->sps_lst), _context->i_curr_sps_idx, nal) &&
                         !(sample->flags & SAMPLE_NEW_SD))   /** Don't create new dsi list entry if
                                                            new sample entry was already triggered */
                     {
@@ -1186,7 +1229,7 @@ parser_hevc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
                 if (parser->dsi_type == DSI_TYPE_MP4FF)
                 {
                 /** Check if new sample description is necessary */
-                    if (ps_list_is_there_collision(&(mp4ff_dsi->pps_lst), _context->i_curr_pps_idx, nal) &&
+                    if (ps_list_is_there_collision(parser_hevc, &(mp4ff_dsi->pps_lst), _context->i_curr_pps_idx, nal) &&
                         !(sample->flags & SAMPLE_NEW_SD))   /** Don't create new dsi list entry if
                                                            new sample entry was already triggered */
                         {
@@ -1334,6 +1377,11 @@ parser_hevc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
 
         /** to get nal_size and sc_off_next if havn't, reach next sc */
         skip_the_nal(nal);
+        if (nal->nal_emb)
+        {
+            /** out of band ps only go to the sample entry: mdat gets what the es carries */
+            keep_nal = FALSE;
+        }
         
 
         /******* book keep the nal */
@@ -1560,7 +1608,10 @@ parser_hevc_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
     /**** data */
     sample->size = parser_hevc->sample_size;
 
-    save_au_nals_info(au_nals, sample, parser_hevc->tmp_bbo);
+    if (save_au_nals_info(au_nals, sample, parser_hevc->nal_index) != EMA_MP4_MUXED_OK)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
     
     if (_context->IDR_pic_flag)
     {
@@ -1587,34 +1638,13 @@ parser_hevc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_nu
     uint8_t  sc_size;
     int64_t  off;
 
-    parser_hevc_handle_t parser_hevc     = (parser_hevc_handle_t)parser;
-    bbio_handle_t        src          = parser_hevc->tmp_bbi, ds = parser->ds;
+    parser_hevc_handle_t parser_hevc  = (parser_hevc_handle_t)parser;
+    nal_index_handle_t   src          = parser_hevc->nal_index;
+    bbio_handle_t        ds           = parser->ds;
     const uint32_t        nal_unit_len = ((dsi_hevc_handle_t)parser->curr_dsi)->NALUnitLength;
     const size_t        bufsize      = *bufsize_ptr;
 
-    if (!src)
-    {
-        uint8_t* buffer;
-        size_t     data_size, buf_size;
-        /** give the output buffer to the input buffer */
-        assert(parser_hevc->tmp_bbo);
-        src    = reg_bbio_get('b', 'r');
-        buffer = parser_hevc->tmp_bbo->get_buffer(parser_hevc->tmp_bbo, &data_size, &buf_size);
-        src->set_buffer(src, buffer, data_size, TRUE);
-        parser_hevc->tmp_bbi = src;
-    }
-
-    if (pos && *pos != -1)
-    {
-        src->seek(src, *pos, SEEK_SET);
-    }
-
-    if (RD_PREFIX(src) != 0)
-    {
-        return EMA_MP4_MUXED_READ_ERR;
-    }
-
-    if (src_rd_u32(src, &nal_num) != 0)   /** # of nal in au */
+    if (nal_index_read_au(src, pos ? *pos : -1, &nal_num) != EMA_MP4_MUXED_OK)   /** # of nal in au */
     {
         return EMA_MP4_MUXED_READ_ERR;
     }
@@ -1635,17 +1665,7 @@ parser_hevc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_nu
 
     do
     {
-        uint64_t u;
-        if (src_rd_u64(src, &u) != 0) 
-        {
-            return EMA_MP4_MUXED_READ_ERR;
-        }
-        off = u;
-        if (src_rd_u32(src, &size) != 0)
-        {
-            return EMA_MP4_MUXED_READ_ERR;
-        }
-        if (src_rd_u8(src, &sc_size) != 0)
+        if (nal_index_read_nal(src, &off, &size, &sc_size) != EMA_MP4_MUXED_OK)
         {
             return EMA_MP4_MUXED_READ_ERR;
         }
@@ -1654,7 +1674,7 @@ parser_hevc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_nu
     *bufsize_ptr = nal_unit_len + size;
     if (pos)
     {
-        *pos = src->position(src);
+        *pos = nal_index_tell(src);
     }
 
     if (data)
@@ -1682,10 +1702,97 @@ parser_hevc_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_nu
         else
         {
             /** embedded: nal body right at current position */
-            src->read(src, data, size);
+            nal_index_read_emb(src, data, NULL);
+        }
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static void
+parser_hevc_release_subsample(parser_handle_t parser, int64_t pos)
+{
+    parser_hevc_handle_t parser_hevc = (parser_hevc_handle_t)parser;
+
+    nal_index_release(parser_hevc->nal_index, pos);
+}
+
+static nal_index_handle_t
+parser_hevc_get_nal_index(parser_handle_t parser)
+{
+    return ((parser_hevc_handle_t)parser)->nal_index;
+}
+
+static int32_t
+parser_hevc_merge_range(parser_handle_t parser, parser_handle_t part, const parser_range_t *range,
+                        mp4_sample_handle_t samples, uint32_t sample_num)
+{
+    parser_hevc_handle_t parser_hevc  = (parser_hevc_handle_t)parser;
+    parser_hevc_handle_t part_hevc    = (parser_hevc_handle_t)part;
+    const uint32_t       nal_unit_len = ((dsi_hevc_handle_t)parser->curr_dsi)->NALUnitLength;
+    const uint64_t       dts_shift    = parser_hevc->au_num*(uint64_t)parser_hevc->au_ticks;
+    it_list_handle_t     it;
+    idx_value_t *        cv;
+    uint32_t             u, drop_size;
+    int64_t              pos;
+    int32_t              ret;
+
+    if (parser_hevc->au_ticks != part_hevc->au_ticks)
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    /** the caller may have swapped the es source */
+    parser_hevc->nal.ds = parser->ds;
+
+    for (u = 0; u < sample_num; u++)
+    {
+        drop_size = 0;
+        ret = parser_split_append_au(parser_hevc->nal_index, part_hevc->nal_index, samples[u].pos,
+                                     range, nal_unit_len, &pos, &drop_size);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
         }
+        samples[u].pos    = pos;
+        samples[u].size  -= drop_size;
+        samples[u].dts   += dts_shift;
+        samples[u].cts   += dts_shift;
+        samples[u].flags &= ~SAMPLE_NEW_SD;
     }
 
+    /** cts - dts does not change with the shift */
+    it = it_create();
+    if (!it)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    it_init(it, part_hevc->hevc_cts_offset_lst);
+    while ((cv = (idx_value_t *)it_get_entry(it)))
+    {
+        update_idx_value_lst(parser_hevc->hevc_cts_offset_lst, parser_hevc->num_samples + cv->idx, cv->value);
+    }
+    it_destroy(it);
+
+    /** the part starts with an idr */
+    if (parser_hevc->au_num > parser_hevc->last_idr_pos &&
+        parser_hevc->au_num - parser_hevc->last_idr_pos > parser_hevc->max_idr_dist)
+    {
+        parser_hevc->max_idr_dist = parser_hevc->au_num - parser_hevc->last_idr_pos;
+    }
+    if (part_hevc->max_idr_dist > parser_hevc->max_idr_dist)
+    {
+        parser_hevc->max_idr_dist = part_hevc->max_idr_dist;
+    }
+    parser_hevc->last_idr_pos = parser_hevc->au_num + part_hevc->last_idr_pos;
+
+    parser_hevc->au_num      += part_hevc->au_num;
+    parser_hevc->num_samples += part_hevc->num_samples;
+    parser_hevc->sei_num     += part_hevc->sei_num;
+    parser_hevc->vps_num     += part_hevc->vps_num - parser_split_seed_nal_num(part, range, 0x7e, NAL_UNIT_VPS << 1);
+    parser_hevc->sps_num     += part_hevc->sps_num - parser_split_seed_nal_num(part, range, 0x7e, NAL_UNIT_SPS << 1);
+    parser_hevc->pps_num     += part_hevc->pps_num - parser_split_seed_nal_num(part, range, 0x7e, NAL_UNIT_PPS << 1);
+    parser_hevc->validation_flags |= part_hevc->validation_flags;
+
     return EMA_MP4_MUXED_OK;
 }
 
@@ -1712,7 +1819,6 @@ parser_hevc_get_cts_offset(parser_handle_t parser, uint32_t sample_idx)
 {
     idx_value_t *  cv;
     uint64_t ctts = 0;
-    static int32_t ctts_offset = 0;
 
     it_list_handle_t   it  = it_create();
     parser_hevc_handle_t parser_hevc = (parser_hevc_handle_t)parser;
@@ -1723,12 +1829,12 @@ parser_hevc_get_cts_offset(parser_handle_t parser, uint32_t sample_idx)
         it_init(it,parser_hevc->hevc_cts_offset_lst);
         while ((cv = (idx_value_t *)it_get_entry(it)))
         {
-            if((int32_t)cv->value < ctts_offset)
-                ctts_offset = (int32_t)cv->value;
+            if((int32_t)cv->value < parser_hevc->ctts_offset)
+                parser_hevc->ctts_offset = (int32_t)cv->value;
             
         }
         it_destroy(it);
-        return (-ctts_offset);
+        return (-parser_hevc->ctts_offset);
     }
     else
     {
@@ -1744,7 +1850,7 @@ parser_hevc_get_cts_offset(parser_handle_t parser, uint32_t sample_idx)
         it_destroy(it);
     }
 
-    return (int32_t)(ctts + (-ctts_offset));
+    return (int32_t)(ctts + (-parser_hevc->ctts_offset));
 }
 
 /** get dsi for hevc (HEVCDecoderConfigurationRecord) */
@@ -2115,6 +2221,7 @@ hevc_close(parser_handle_t parser)
 
     FREE_CHK(parser_hevc->nal.tmp_buf);
     FREE_CHK(parser_hevc->nal.buffer);
+    FREE_CHK(parser_hevc->nal.cfg_buf);
     if (parser_hevc->hevc_cts_offset_lst)
     {
         list_destroy(parser_hevc->hevc_cts_offset_lst);
@@ -2131,14 +2238,8 @@ hevc_close(parser_handle_t parser)
     }
 
     /** release nal related stuff */
-    if (parser_hevc->tmp_bbo)
-    {
-        parser_hevc->tmp_bbo->destroy(parser_hevc->tmp_bbo);
-    }
-    if (parser_hevc->tmp_bbi)
-    {
-        parser_hevc->tmp_bbi->destroy(parser_hevc->tmp_bbi);
-    }
+    nal_index_destroy(parser_hevc->nal_index);
+    ps_cache_destroy(parser_hevc->ps_cache);
     if (parser_hevc->au_nals.nal_idx)
     {
         hevc_au_nals_t *au_nals = &(parser_hevc->au_nals);
@@ -2178,7 +2279,7 @@ parser_hevc_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t
     /** nal parser buffer */
     nal->ds       = ds;
     nal->buf_size = 4096;
-    nal->buffer   = (uint8_t *) MALLOC_CHK(nal->buf_size);
+    nal->buffer   = (uint8_t *) MALLOC_TAG_CHK(MP4_MEM_NAL, nal->buf_size);
 
     if (!nal->buffer)
     {
@@ -2186,7 +2287,7 @@ parser_hevc_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t
     }
 
     nal->tmp_buf_size = 4096;
-    nal->tmp_buf      = (uint8_t *)MALLOC_CHK(nal->tmp_buf_size);
+    nal->tmp_buf      = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_NAL, nal->tmp_buf_size);
     if (!nal->tmp_buf)
     {
         return EMA_MP4_MUXED_NO_MEM;
@@ -2202,9 +2303,13 @@ parser_hevc_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t
         }
     }
 
-    /** create a memory buffer as file i/o can cause issues with system rights */
-    parser_hevc->tmp_bbo = reg_bbio_get('b', 'w');
-    parser_hevc->tmp_bbo->set_buffer(parser_hevc->tmp_bbo, NULL, 0, TRUE);
+    /** kept in memory as file i/o can cause issues with system rights */
+    parser_hevc->nal_index = nal_index_create();
+    parser_hevc->ps_cache  = ps_cache_create();
+    if (!parser_hevc->nal_index || !parser_hevc->ps_cache)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
 
     hevc_dec_init(dec);
 
@@ -2233,6 +2338,77 @@ parser_hevc_codec_config(parser_handle_t parser, bbio_handle_t info_sink)
     return 0;
 }
 
+/**
+ * @brief Switches to nal length prefixed input: no start code scanning
+ *
+ * hvcc is an HEVCDecoderConfigurationRecord, box header optional. It gives the length field
+ * size; its nal arrays(VPS, SPS, PPS, SEI) go before the es nals as if in band. To be called before init()
+ */
+int32_t
+parser_hevc_set_hvcc(parser_handle_t parser, const uint8_t *hvcc, uint32_t size)
+{
+    hevc_nal_handle_t nal = &((parser_hevc_handle_t)parser)->nal;
+    const uint8_t    *ps, *end;
+    uint32_t          num_arrays, num, nal_size;
+
+    if (size >= 8 && IS_FOURCC_EQUAL(hvcc + 4, "hvcC"))
+    {
+        hvcc += 8;
+        size -= 8;
+    }
+    if (parser->dsi_type != DSI_TYPE_MP4FF || size < 23 || hvcc[0] != 1)
+    {
+        msglog(NULL, MSGLOG_ERR, "parser_hevc_set_hvcc: invalid hvcC\n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+    if ((hvcc[21] & 0x3) == 2)
+    {
+        /** lengthSizeMinusOne 2 is reserved: only 1, 2 and 4 byte lengths are allowed */
+        msglog(NULL, MSGLOG_ERR, "parser_hevc_set_hvcc: 3 byte nal length not supported\n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    FREE_CHK(nal->cfg_buf);
+    nal->cfg_buf = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, size);
+    if (!nal->cfg_buf)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    nal->cfg_size     = 0;
+    nal->cfg_off      = 0;
+    nal->nal_len_size = 1 + (hvcc[21] & 0x3);
+
+    /** arrays of 16 bit length prefixed nals */
+    ps         = hvcc + 23;
+    end        = hvcc + size;
+    num_arrays = hvcc[22];
+    while (num_arrays--)
+    {
+        if (ps + 3 > end)
+        {
+            break;
+        }
+        num = (ps[1] << 8) | ps[2];
+        ps += 3;
+        while (num--)
+        {
+            if (ps + 2 > end || ps + 2 + ((ps[0] << 8) | ps[1]) > end)
+            {
+                msglog(NULL, MSGLOG_ERR, "parser_hevc_set_hvcc: hvcC truncated\n");
+                return EMA_MP4_MUXED_PARAM_ERR;
+            }
+            nal_size = 2 + ((ps[0] << 8) | ps[1]);
+            memcpy(nal->cfg_buf + nal->cfg_size, ps, nal_size);
+            nal->cfg_size += nal_size;
+            ps            += nal_size;
+        }
+    }
+
+    msglog(NULL, MSGLOG_INFO, "hevc input: %u byte nal length, %" PRIz " bytes of ps from hvcC\n",
+           nal->nal_len_size, nal->cfg_size);
+    return EMA_MP4_MUXED_OK;
+}
+
 /** Creates and build interface, base */
 static parser_handle_t
 parser_hevc_create(uint32_t dsi_type)
@@ -2265,6 +2441,9 @@ parser_hevc_create(uint32_t dsi_type)
 
     parser->get_subsample   = parser_hevc_get_subsample;
     parser->copy_sample     = parser_hevc_copy_sample;
+    parser->release_subsample = parser_hevc_release_subsample;
+    parser->merge_range     = parser_hevc_merge_range;
+    parser->get_nal_index   = parser_hevc_get_nal_index;
 
     OSAL_STRNCPY(parser->codec_name, 13, "\013HEVC Coding", 13);
 
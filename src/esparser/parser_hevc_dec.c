@@ -29,6 +29,7 @@
 #include "utils.h"
 #include "io_base.h"
 #include "parser_hevc_dec.h"
+#include "memory_chk.h"  /** MALLOC_CHK(), FREE_CHK() */
 #include <assert.h>
 #include <stdlib.h>
 
@@ -45,11 +46,6 @@
                          (((uint8_t *)&x)[2] << 8)   | \
                          (( uint8_t *)&x)[3])  
 
-int32_t gi_max_val_luma = 0;
-int32_t gi_max_val_chroma = 0;
-
-extern void parser_avc_remove_0x03(uint8_t *dst, size_t *dstlen, const uint8_t *src, const size_t srclen);
-
 void 
 hevcdec_create_context(hevc_decode_t *context)
 {
@@ -91,11 +87,60 @@ bitstream_init( bitstream_t *bitstream )
     bitstream->ui_bit_idx = 0;
     bitstream->ui32_bits_read = 0;
     bitstream->i64_bits_available = bitstream->ui_length << 3;
+    bitstream->b_rbsp = false;
+    bitstream->ui_zero_cnt = 0;
 
     bitstream->ui32_curr_bits = SWAP_ENDIAN32( bitstream->ui32_curr_bits );
     bitstream->ui32_next_bits = SWAP_ENDIAN32( bitstream->ui32_next_bits );
 }
 
+/** next 4 rbsp bytes of an escaped payload, 0 beyond its end. i64_bits_available drops
+ *  by the emulation prevention bytes fetched so far: it is exact whenever it matters,
+ *  as an unfetched byte is at least 32 bits ahead */
+static uint32_t
+bitstream_fetch_rbsp_word( bitstream_t *bitstream )
+{
+    uint32_t ui32_word = 0;
+    int32_t  i_jdx;
+
+    for( i_jdx=0; i_jdx<4; ++i_jdx )
+    {
+        uint8_t ui8_byte = 0;
+
+        if( bitstream->ui_zero_cnt >= 2 && bitstream->ui_byte_position < bitstream->ui_length &&
+            bitstream->pui8_payload[ bitstream->ui_byte_position ] == 0x03 )
+        {
+            /* emulation_prevention_three_byte */
+            bitstream->ui_byte_position++;
+            bitstream->ui_zero_cnt = 0;
+            bitstream->i64_bits_available -= 8;
+        }
+        if( bitstream->ui_byte_position < bitstream->ui_length )
+        {
+            ui8_byte = bitstream->pui8_payload[ bitstream->ui_byte_position++ ];
+            bitstream->ui_zero_cnt = ui8_byte ? 0 : bitstream->ui_zero_cnt + 1;
+        }
+        ui32_word = (ui32_word << 8) | ui8_byte;
+    }
+
+    return ui32_word;
+}
+
+/** reads the rbsp out of the escaped payload/ui_length in place, instead of unescaping a copy */
+void 
+bitstream_init_rbsp( bitstream_t *bitstream )
+{
+    bitstream->ui_byte_position = 0;
+    bitstream->ui_bit_idx = 0;
+    bitstream->ui32_bits_read = 0;
+    bitstream->i64_bits_available = bitstream->ui_length << 3;
+    bitstream->b_rbsp = true;
+    bitstream->ui_zero_cnt = 0;
+
+    bitstream->ui32_curr_bits = bitstream_fetch_rbsp_word( bitstream );
+    bitstream->ui32_next_bits = bitstream_fetch_rbsp_word( bitstream );
+}
+
 uint32_t 
 bitstream_read( bitstream_t *bitstream, uint32_t ui_num_bits )
 {
@@ -124,7 +169,13 @@ bitstream_read( bitstream_t *bitstream, uint32_t ui_num_bits )
     bitstream->ui32_bits_read += ui_num_bits;
     bitstream->i64_bits_available -= ui_num_bits;
 
-    if( bitstream->ui_bit_idx >= 32 )
+    if( bitstream->ui_bit_idx >= 32 && bitstream->b_rbsp )
+    {
+        bitstream->ui32_curr_bits = bitstream->ui32_next_bits;
+        bitstream->ui32_next_bits = bitstream_fetch_rbsp_word( bitstream );
+        bitstream->ui_bit_idx &= 31;
+    }
+    else if( bitstream->ui_bit_idx >= 32 )
     {
         if( bitstream->ui_byte_position + 4 >= bitstream->ui_length )
         {
@@ -160,7 +211,7 @@ bitstream_peek( bitstream_t *bitstream, uint32_t ui_num_bits )
 {
     uint32_t retVal = 0;
     
-    uint32_t saved0, saved1, saved2, saved3, saved4;
+    uint32_t saved0, saved1, saved2, saved3, saved4, saved6;
     int64_t saved5;
 
     saved0 = bitstream->ui_byte_position;
@@ -169,6 +220,7 @@ bitstream_peek( bitstream_t *bitstream, uint32_t ui_num_bits )
     saved3 = bitstream->ui32_next_bits;
     saved4 = bitstream->ui32_bits_read;
     saved5 = bitstream->i64_bits_available;
+    saved6 = bitstream->ui_zero_cnt;
 
     if( bitstream->i64_bits_available <= 0 ) return 0;
     retVal = bitstream_read( bitstream, ui_num_bits );
@@ -179,6 +231,7 @@ bitstream_peek( bitstream_t *bitstream, uint32_t ui_num_bits )
     bitstream->ui32_next_bits   = saved3;
     bitstream->ui32_bits_read   = saved4;
     bitstream->i64_bits_available = saved5;
+    bitstream->ui_zero_cnt      = saved6;
 
     return retVal;
 }
@@ -230,8 +283,6 @@ read_input_nalu( bitstream_t *bitstream, hevc_nalu_t *p_nalu)
     uint8_t *pui8_payload;
     uint32_t num_bytes, reserved_zero_6bits;
     uint32_t ui_consumed0 = bitstream->ui_byte_position - 4 + (bitstream->ui_bit_idx>>3);
-    uint8_t *rbsp_bytes = p_nalu->rbsp_buff;
-    size_t   rbsp_size = 0;
 
     p_nalu->b_incomplete = true;
 
@@ -268,11 +319,10 @@ read_input_nalu( bitstream_t *bitstream, hevc_nalu_t *p_nalu)
     p_nalu->ui_bytes_removed = 0;
     p_nalu->ui_num_bytes = num_bytes;
 
-    parser_avc_remove_0x03(rbsp_bytes,&rbsp_size,pui8_payload, MIN2(num_bytes, RBSP_BYTE_NUM_MAX));
-    /* for later parsing of RBSP */
-    p_nalu->bitstream.pui8_payload = rbsp_bytes;
-    p_nalu->bitstream.ui_length = (uint32_t)rbsp_size;
-    bitstream_init( &p_nalu->bitstream );
+    /* for later parsing of RBSP: unescaped while read */
+    p_nalu->bitstream.pui8_payload = pui8_payload;
+    p_nalu->bitstream.ui_length = num_bytes;
+    bitstream_init_rbsp( &p_nalu->bitstream );
 
     /* forbidden_zero_bit */
     ui_code = bitstream_read( &p_nalu->bitstream, 1 );
@@ -814,15 +864,15 @@ void sao_destroy_context( sao_context_t *p_sao )
 {
     if( !p_sao->pi_clip_luma ) return;
 
-    free( p_sao->pui16_top1 );
-    free( p_sao->pui16_top2 );
-    free( p_sao->pui16_left1 );
-    free( p_sao->pui16_left2 );
-    free( p_sao->pi_bo_luma );
-    free( p_sao->pi_bo_chroma );
-    free( p_sao->pi_clip_luma - (((1<<p_sao->i_bits_luma)-1)>>1) );
-    free( p_sao->pi_clip_chroma - (((1<<p_sao->i_bits_chroma)-1)>>1) );
-    free( p_sao->pi_bo_offsets );
+    FREE_CHK( p_sao->pui16_top1 );
+    FREE_CHK( p_sao->pui16_top2 );
+    FREE_CHK( p_sao->pui16_left1 );
+    FREE_CHK( p_sao->pui16_left2 );
+    FREE_CHK( p_sao->pi_bo_luma );
+    FREE_CHK( p_sao->pi_bo_chroma );
+    FREE_CHK( p_sao->pi_clip_luma - (((1<<p_sao->i_bits_luma)-1)>>1) );
+    FREE_CHK( p_sao->pi_clip_chroma - (((1<<p_sao->i_bits_chroma)-1)>>1) );
+    FREE_CHK( p_sao->pi_bo_offsets );
 
     hevcdecoder_free( p_sao->pui16_all_buffer );
 
@@ -845,30 +895,30 @@ void sao_create_context( sao_context_t *p_sao, int32_t i_bits_luma, int32_t i_bi
     p_sao->i_bit_increase_luma = p_sao->i_bits_luma - HEVC_MIN( p_sao->i_bits_luma, 10 );
     p_sao->i_bit_increase_chroma = p_sao->i_bits_chroma - HEVC_MIN( p_sao->i_bits_chroma, 10 );
 
-    p_sao->pi_bo_offsets = (int32_t *)malloc( (i_max_luma + ((i_max_luma>>1)<<1)) * sizeof(int32_t) );
+    p_sao->pi_bo_offsets = (int32_t *)MALLOC_CHK( (i_max_luma + ((i_max_luma>>1)<<1)) * sizeof(int32_t) );
     
-    p_sao->pi_bo_luma = (int32_t *)malloc( sizeof(int32_t) * ((1LL<<p_sao->i_bits_luma) + 1) );
+    p_sao->pi_bo_luma = (int32_t *)MALLOC_CHK( sizeof(int32_t) * ((1LL<<p_sao->i_bits_luma) + 1) );
     for( i_idx=0; i_idx < 1<<p_sao->i_bits_luma; i_idx++ )
         p_sao->pi_bo_luma[ i_idx ] = 1 + ( i_idx >> (p_sao->i_bits_luma - SAO_BO_BITS) );
 
-    p_sao->pi_bo_chroma = (int32_t *)malloc( sizeof(int32_t) * ((1LL<<p_sao->i_bits_chroma) + 1) );
+    p_sao->pi_bo_chroma = (int32_t *)MALLOC_CHK( sizeof(int32_t) * ((1LL<<p_sao->i_bits_chroma) + 1) );
     for( i_idx=0; i_idx < 1<<p_sao->i_bits_chroma; i_idx++ )
         p_sao->pi_bo_chroma[ i_idx ] = 1 + ( i_idx >> (p_sao->i_bits_chroma - SAO_BO_BITS) );
 
-    p_sao->pui16_left1 = (uint16_t *)malloc( 65 * sizeof(uint16_t) );
-    p_sao->pui16_left2 = (uint16_t *)malloc( 65 * sizeof(uint16_t) );
-    p_sao->pui16_top1 = (uint16_t *)malloc( i_picture_width * sizeof(uint16_t) );
-    p_sao->pui16_top2 = (uint16_t *)malloc( i_picture_width * sizeof(uint16_t) );
+    p_sao->pui16_left1 = (uint16_t *)MALLOC_CHK( 65 * sizeof(uint16_t) );
+    p_sao->pui16_left2 = (uint16_t *)MALLOC_CHK( 65 * sizeof(uint16_t) );
+    p_sao->pui16_top1 = (uint16_t *)MALLOC_CHK( i_picture_width * sizeof(uint16_t) );
+    p_sao->pui16_top2 = (uint16_t *)MALLOC_CHK( i_picture_width * sizeof(uint16_t) );
 
     i_idx = 0;
-    p_sao->pi_clip_luma = (int32_t *)malloc( (i_max_luma + ((i_max_luma>>1)<<1)) * sizeof(int32_t) );
+    p_sao->pi_clip_luma = (int32_t *)MALLOC_CHK( (i_max_luma + ((i_max_luma>>1)<<1)) * sizeof(int32_t) );
     for( ; i_idx<i_max_luma>>1; i_idx++)                    p_sao->pi_clip_luma[ i_idx ] = 0;
     for( ; i_idx<(i_max_luma + (i_max_luma>>1)); i_idx++ )  p_sao->pi_clip_luma[ i_idx ] = i_idx - ( i_max_luma>>1 );
     for( ; i_idx<i_max_luma+((i_max_luma>>1)<<1); i_idx++ ) p_sao->pi_clip_luma[ i_idx ] = i_max_luma;
     p_sao->pi_clip_luma += i_max_luma>>1;
 
     i_idx = 0;
-    p_sao->pi_clip_chroma = (int32_t *)malloc( (i_max_chroma + ((i_max_chroma>>1)<<1)) * sizeof(int32_t) );
+    p_sao->pi_clip_chroma = (int32_t *)MALLOC_CHK( (i_max_chroma + ((i_max_chroma>>1)<<1)) * sizeof(int32_t) );
     for( ; i_idx<i_max_chroma>>1; i_idx++)                    p_sao->pi_clip_chroma[ i_idx ] = 0;
     for( ; i_idx<(i_max_chroma + (i_max_chroma>>1)); i_idx++ )  p_sao->pi_clip_chroma[ i_idx ] = i_idx - ( i_max_chroma>>1 );
     for( ; i_idx<i_max_chroma+((i_max_chroma>>1)<<1); i_idx++ ) p_sao->pi_clip_chroma[ i_idx ] = i_max_chroma;
@@ -1104,7 +1154,7 @@ decode_sps( hevc_decode_t *context, hevc_nalu_t *p_nalu )
 
     if( sps->i_num_short_term_ref_pic_sets )
     {
-        sps->pps_rps_list = (reference_picture_set_t *)malloc( sizeof(reference_picture_set_t)*sps->i_num_short_term_ref_pic_sets );
+        sps->pps_rps_list = (reference_picture_set_t *)MALLOC_TAG_CHK( MP4_MEM_DSI, sizeof(reference_picture_set_t)*sps->i_num_short_term_ref_pic_sets );
         memset( sps->pps_rps_list, 0x0, sizeof(reference_picture_set_t)*sps->i_num_short_term_ref_pic_sets );
         for( i_idx = 0; i_idx < sps->i_num_short_term_ref_pic_sets; i_idx++ )
             decode_short_term_rps( &p_nalu->bitstream, i_idx, &sps->pps_rps_list[i_idx], sps->pps_rps_list, sps );
@@ -1138,8 +1188,8 @@ decode_sps( hevc_decode_t *context, hevc_nalu_t *p_nalu )
     }
 
 
-    gi_max_val_luma = ((1<<(sps->i_bit_depth_luma))-1);
-    gi_max_val_chroma = ((1<<(sps->i_bit_depth_chroma))-1);
+    context->i_max_val_luma = ((1<<(sps->i_bit_depth_luma))-1);
+    context->i_max_val_chroma = ((1<<(sps->i_bit_depth_chroma))-1);
 
     if( sps->b_sao )
     {
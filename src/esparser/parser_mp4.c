@@ -0,0 +1,516 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/**
+ *  @file  parser_mp4.c
+ *  @brief Implements a parser taking the samples of a track of an mp4 file from its sample tables
+ *
+ *  Nothing of the track is parsed but its 'moov': the samples are byte ranges of the file
+ *  found from 'stsc', 'stco' and 'stsz', their sample entries are copied as they are.
+ */
+
+#include "utils.h"
+#include "io_base.h"
+#include "registry.h"    /* reg_parser_set() */
+#include "parser.h"
+#include "mp4_demux.h"
+#include "mp4_stream.h"
+
+#define PARSER_MP4_READ_SIZE  (8 << 20)  /** bytes read at once: samples are copied from a window of the file */
+
+/** walks the chunks of the track in sample order */
+typedef struct sample_cursor_t_
+{
+    uint32_t sample_idx;  /** the sample the cursor is at */
+    uint32_t chunk_idx;   /** its chunk, 0-based */
+    uint32_t stsc_idx;    /** the 'stsc' entry of the chunk */
+    uint32_t left;        /** samples left in the chunk, the one at the cursor included */
+    uint32_t sd_idx;      /** sample_description_index of the chunk */
+    uint64_t offset;      /** of the sample in the file */
+} sample_cursor_t;
+
+typedef struct parser_mp4_t_
+{
+    /** the muxer takes the parser as a video or audio one, depending on the track */
+    union
+    {
+        parser_video_t video;
+        parser_audio_t audio;
+    } base;
+
+    uint32_t          track_ID;   /** the track to read, 0 for the first one */
+    mp4_ctrl_handle_t demuxer;
+    stream_handle_t   stream;
+    int64_t           cts_shift;  /** makes negative composition offsets of 'ctts' v1 positive */
+    uint8_t           redundancy; /** sample_has_redundancy without 'sdtp': 2 if the codec has no redundant pictures */
+
+    uint32_t          sample_idx; /** of the next get_sample() */
+    sample_cursor_t   sd_cursor;  /** for get_sample() */
+    uint32_t *        sd_idxs;    /** the sample_description_index behind each SAMPLE_NEW_SD */
+    uint32_t          sd_num, sd_max;
+
+    sample_cursor_t   cursor;     /** for get_subsample() */
+    uint8_t *         win;        /** the file from win_pos on */
+    size_t            win_size, win_len;
+    uint64_t          win_pos;
+} parser_mp4_t;
+typedef parser_mp4_t *parser_mp4_handle_t;
+
+/** the sample entries of which the muxer knows the codec */
+static const struct
+{
+    const int8_t *codingname;
+    uint32_t      stream_id;
+    int8_t *      dsi_FourCC;
+} entry_codecs[] = {
+    {"avc1", STREAM_ID_H264, "avcC"}, {"avc3", STREAM_ID_H264, "avcC"},
+    {"dva1", STREAM_ID_H264, "avcC"}, {"dvav", STREAM_ID_H264, "avcC"},
+    {"hvc1", STREAM_ID_HEVC, "hvcC"}, {"hev1", STREAM_ID_HEVC, "hvcC"},
+    {"dvh1", STREAM_ID_HEVC, "hvcC"}, {"dvhe", STREAM_ID_HEVC, "hvcC"},
+    {"ac-3", STREAM_ID_AC3,  "dac3"}, {"ec-3", STREAM_ID_EC3,  "dec3"},
+    {"ac-4", STREAM_ID_AC4,  "dac4"}, {"mp4a", STREAM_ID_AAC,  "esds"},
+    {"mp4v", STREAM_ID_MP4V, "esds"}
+};
+
+/** Sets the cursor to the first sample of its chunk_idx */
+static void
+cursor_enter_chunk(stream_handle_t stream, sample_cursor_t *cursor)
+{
+    box_data_tbl_t *stsc = &(stream->stsc);
+
+    /** first_chunk is 1-based */
+    while (cursor->stsc_idx + 1 < stsc->entry_count &&
+           get_BE_u32(stsc->data + 12*(cursor->stsc_idx + 1)) - 1 <= cursor->chunk_idx)
+    {
+        cursor->stsc_idx++;
+    }
+    cursor->left   = get_BE_u32(stsc->data + 12*cursor->stsc_idx + 4);
+    cursor->sd_idx = get_BE_u32(stsc->data + 12*cursor->stsc_idx + 8);
+    if (stream->stco.variant)
+    {
+        cursor->offset = get_BE_u64(stream->stco.data + 8*(size_t)cursor->chunk_idx);
+    }
+    else
+    {
+        cursor->offset = get_BE_u32(stream->stco.data + 4*(size_t)cursor->chunk_idx);
+    }
+}
+
+/** Moves the cursor to sample_idx: whole chunks are skipped, the samples of the last one summed up */
+static void
+cursor_seek(stream_handle_t stream, sample_cursor_t *cursor, uint32_t sample_idx)
+{
+    if (sample_idx < cursor->sample_idx || !cursor->left)
+    {
+        memset(cursor, 0, sizeof(sample_cursor_t));
+        cursor_enter_chunk(stream, cursor);
+    }
+    while (sample_idx - cursor->sample_idx >= cursor->left)
+    {
+        cursor->sample_idx += cursor->left;
+        cursor->chunk_idx++;
+        cursor_enter_chunk(stream, cursor);
+    }
+    for (; cursor->sample_idx < sample_idx; cursor->sample_idx++, cursor->left--)
+    {
+        cursor->offset += stream_get_sample_size(stream, cursor->sample_idx);
+    }
+}
+
+/** Copies size bytes at offset of the file to data, from the window or after reading the next one */
+static int32_t
+parser_mp4_read(parser_mp4_handle_t parser_mp4, uint64_t offset, uint8_t *data, size_t size)
+{
+    bbio_handle_t ds = parser_mp4->base.video.ds;
+
+    if (offset < parser_mp4->win_pos || offset + size > parser_mp4->win_pos + parser_mp4->win_len)
+    {
+        uint64_t left = (uint64_t)ds->size(ds) - offset;
+
+        parser_mp4->win_pos = offset;
+        parser_mp4->win_len = (left < parser_mp4->win_size) ? (size_t)left : parser_mp4->win_size;
+        if (ds->seek(ds, (int64_t)offset, SEEK_SET) ||
+            ds->read(ds, parser_mp4->win, parser_mp4->win_len) != parser_mp4->win_len ||
+            size > parser_mp4->win_len)
+        {
+            parser_mp4->win_len = 0;
+            msglog(NULL, MSGLOG_ERR, "ERROR! Can't read the sample at %" PRIu64 " of the mp4 file\n", offset);
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+    }
+    memcpy(data, parser_mp4->win + (offset - parser_mp4->win_pos), size);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+parser_mp4_init(parser_handle_t parser, ext_timing_info_t *ext_timing, uint32_t es_idx, bbio_handle_t ds)
+{
+    parser_mp4_handle_t parser_mp4 = (parser_mp4_handle_t)parser;
+    stream_handle_t     stream;
+    const uint8_t *     entry;
+    uint32_t            entry_size;
+    uint32_t            u;
+
+    parser->ext_timing = *ext_timing;
+    parser->es_idx     = es_idx;
+    parser->ds         = ds;
+
+    parser_mp4->demuxer = mp4_demux_create(ds);
+    if (!parser_mp4->demuxer)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    stream = parser_mp4->stream = mp4_demux_get_stream(parser_mp4->demuxer, parser_mp4->track_ID);
+    if (!stream)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Mp4 file does not contain track ID %u.\n", parser_mp4->track_ID);
+        return EMA_MP4_MUXED_UNKNOW_ES;
+    }
+    if (!stream->sample_num)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Track %u of the mp4 file has no samples\n", stream->track_ID);
+        return EMA_MP4_MUXED_EMPTY_ES;
+    }
+    entry = mp4_demux_get_sample_entry(stream, 1, &entry_size);
+    if (!entry || entry_size < 36)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    if (stream->stream_type != STREAM_TYPE_VIDEO && stream->stream_type != STREAM_TYPE_AUDIO)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Track %u of the mp4 file: only video and audio tracks are supported\n",
+               stream->track_ID);
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    if (IS_FOURCC_EQUAL(stream->codingname, "encv") || IS_FOURCC_EQUAL(stream->codingname, "enca"))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Track %u of the mp4 file is encrypted\n", stream->track_ID);
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+
+    /**** what the muxer takes from the parser rather than from the sample entries */
+    FOURCC_ASSIGN(parser->dsi_name, stream->codingname);
+    parser->dsi_name[4] = '\0';
+    parser->stream_type = stream->stream_type;
+    parser->stream_id   = STREAM_ID_UNKNOWN;
+    parser->dsi_FourCC  = parser->dsi_name;
+    for (u = 0; u < sizeof(entry_codecs)/sizeof(entry_codecs[0]); u++)
+    {
+        if (IS_FOURCC_EQUAL(stream->codingname, entry_codecs[u].codingname))
+        {
+            parser->stream_id  = entry_codecs[u].stream_id;
+            parser->dsi_FourCC = entry_codecs[u].dsi_FourCC;
+            break;
+        }
+    }
+    parser->time_scale  = stream->media_timescale;
+    parser->num_samples = stream->sample_num;
+    if (parser->stream_type == STREAM_TYPE_VIDEO)
+    {
+        /** the size in 'tkhd' is presentation size: kept as it is */
+        parser_mp4->base.video.width  = (stream->visual_width)  ? stream->visual_width  : get_BE_u16(entry + 32);
+        parser_mp4->base.video.height = (stream->visual_height) ? stream->visual_height : get_BE_u16(entry + 34);
+        parser_mp4->base.video.depth  = 0x18;
+    }
+    else
+    {
+        /** the muxer takes the sample rate as media timescale */
+        parser_mp4->base.audio.channelcount = get_BE_u16(entry + 24);
+        parser_mp4->base.audio.samplesize   = get_BE_u16(entry + 26);
+        parser_mp4->base.audio.sample_rate  = (int32_t)stream->media_timescale;
+    }
+
+    /** redundant coded pictures are H264 Baseline and Extended profile only, and not in a stream
+     *  which obeys the Main profile constraints too (constraint_set1_flag) */
+    if (parser->stream_id == STREAM_ID_HEVC)
+    {
+        parser_mp4->redundancy = 2;
+    }
+    else if (parser->stream_id == STREAM_ID_H264 && entry_size > 86)
+    {
+        size_t         avcC_size;
+        const uint8_t *avcC = mp4_demux_find_box(entry + 86, entry_size - 86, "avcC", &avcC_size);
+
+        if (avcC && avcC_size > 2 && ((avcC[1] != 66 && avcC[1] != 88) || (avcC[2] & 0x40)))
+        {
+            parser_mp4->redundancy = 2;
+        }
+    }
+
+    if (IS_VERSION_1((&(stream->ctts))))
+    {
+        for (u = 0; u < stream->ctts.entry_count; u++)
+        {
+            int32_t cts_offset = (int32_t)get_BE_u32(stream->ctts.data + 8*u + 4);
+
+            if (cts_offset < -parser_mp4->cts_shift)
+            {
+                parser_mp4->cts_shift = -(int64_t)cts_offset;
+            }
+        }
+    }
+
+    parser_mp4->win_size = MAX2(PARSER_MP4_READ_SIZE, stream->sample_max_size);
+    parser_mp4->win      = (uint8_t *)MALLOC_CHK(parser_mp4->win_size);
+    if (!parser_mp4->win)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+
+    msglog(NULL, MSGLOG_INFO, "Track %u of the mp4 file: '%s', %u samples\n",
+           stream->track_ID, parser->dsi_name, stream->sample_num);
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+parser_mp4_get_sample(parser_handle_t parser, mp4_sample_handle_t sample)
+{
+    parser_mp4_handle_t parser_mp4 = (parser_mp4_handle_t)parser;
+    stream_handle_t     stream     = parser_mp4->stream;
+    uint32_t            idx        = parser_mp4->sample_idx;
+    uint32_t            cts_offset = 0;
+
+    if (idx >= stream->sample_num)
+    {
+        return EMA_MP4_MUXED_EOES;
+    }
+
+    sample->flags    = 0;
+    sample->dts      = stream_get_sample_timing(stream, idx, &cts_offset);
+    sample->cts      = sample->dts + (int32_t)cts_offset + parser_mp4->cts_shift;
+    sample->duration = stream_get_sample_duration(stream, idx);
+    sample->size     = stream_get_sample_size(stream, idx);
+    /** the data stays in the file: get_subsample() finds it from the sample index */
+    sample->data     = NULL;
+    sample->pos      = idx;
+    if (stream_get_prev_sync_sample_idx(stream, idx) == idx)
+    {
+        sample->flags |= SAMPLE_SYNC;
+    }
+
+    cursor_seek(stream, &parser_mp4->sd_cursor, idx);
+    sample->sd_index = parser_mp4->sd_cursor.sd_idx;
+    if (!parser_mp4->sd_num || parser_mp4->sd_idxs[parser_mp4->sd_num - 1] != sample->sd_index)
+    {
+        if (parser_mp4->sd_num == parser_mp4->sd_max)
+        {
+            uint32_t *sd_idxs = (uint32_t *)REALLOC_CHK(parser_mp4->sd_idxs,
+                                                        (parser_mp4->sd_max + 4)*sizeof(uint32_t));
+            if (!sd_idxs)
+            {
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+            parser_mp4->sd_idxs = sd_idxs;
+            parser_mp4->sd_max += 4;
+        }
+        parser_mp4->sd_idxs[parser_mp4->sd_num++] = sample->sd_index;
+        sample->flags |= SAMPLE_NEW_SD;
+    }
+
+    if (idx < stream->sdtp.size)
+    {
+        uint8_t dep = stream->sdtp.data[idx];
+
+        sample->is_leading            = (dep >> 6) & 0x3;
+        sample->sample_depends_on     = (dep >> 4) & 0x3;
+        sample->sample_is_depended_on = (dep >> 2) & 0x3;
+        sample->sample_has_redundancy =  dep       & 0x3;
+    }
+    else if (parser->stream_type == STREAM_TYPE_VIDEO)
+    {
+        /** without 'sdtp', as far as the sync samples tell: a sync sample depends on no other, the
+         *  others do, and a sync sample the next one of which is not is depended on */
+        sample->sample_depends_on     = (sample->flags & SAMPLE_SYNC) ? 2 : 1;
+        sample->sample_is_depended_on = ((sample->flags & SAMPLE_SYNC) && idx + 1 < stream->sample_num &&
+                                         stream_get_prev_sync_sample_idx(stream, idx + 1) != idx + 1) ? 1 : 0;
+        sample->sample_has_redundancy = parser_mp4->redundancy;
+    }
+    else
+    {
+        sample->sample_depends_on = (sample->flags & SAMPLE_SYNC) ? 2 : 0;
+    }
+
+    parser_mp4->sample_idx++;
+    return EMA_MP4_MUXED_OK;
+}
+
+/** TRUE if the track has a 'ctts': the muxer then takes the cts offsets from get_cts_offset() */
+static BOOL
+parser_mp4_need_fix_cts(parser_handle_t parser)
+{
+    return ((parser_mp4_handle_t)parser)->stream->ctts.entry_count > 0;
+}
+
+/** The cts offset of the track, made positive as in get_sample(): the muxer compensates for that of
+ *  the first sample with an edit list, as it does for the es it parses */
+static int32_t
+parser_mp4_get_cts_offset(parser_handle_t parser, uint32_t sample_idx)
+{
+    parser_mp4_handle_t parser_mp4 = (parser_mp4_handle_t)parser;
+    uint32_t            cts_offset = 0;
+
+    stream_get_sample_timing(parser_mp4->stream, sample_idx, &cts_offset);
+    return (int32_t)((int32_t)cts_offset + parser_mp4->cts_shift);
+}
+
+/** pos is the sample index: the whole sample is the one subsample. data NULL: only its size */
+static int32_t
+parser_mp4_get_subsample(parser_handle_t parser, int64_t *pos, uint32_t subs_num_in, int32_t *more_subs_out,
+                         uint8_t *data, size_t *size)
+{
+    parser_mp4_handle_t parser_mp4 = (parser_mp4_handle_t)parser;
+    stream_handle_t     stream     = parser_mp4->stream;
+    uint32_t            idx        = (uint32_t)*pos;
+    uint32_t            sample_size;
+    int32_t             ret;
+
+    (void)subs_num_in;
+    if (*pos < 0 || idx >= stream->sample_num)
+    {
+        return EMA_MP4_MUXED_EOES;
+    }
+    sample_size = stream_get_sample_size(stream, idx);
+    if (data)
+    {
+        if (sample_size > *size)
+        {
+            return EMA_MP4_MUXED_BUGGY;
+        }
+
+        cursor_seek(stream, &parser_mp4->cursor, idx);
+        ret = parser_mp4_read(parser_mp4, parser_mp4->cursor.offset, data, sample_size);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+    }
+
+    *size          = sample_size;
+    *more_subs_out = 0;
+    *pos           = idx + 1;
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+parser_mp4_get_sample_entry(parser_handle_t parser, uint32_t sd_idx, uint8_t **entry)
+{
+    parser_mp4_handle_t parser_mp4 = (parser_mp4_handle_t)parser;
+    const uint8_t *     src;
+    uint32_t            size;
+
+    if (sd_idx >= parser_mp4->sd_num)
+    {
+        return EMA_MP4_MUXED_BUGGY;
+    }
+    src = mp4_demux_get_sample_entry(parser_mp4->stream, parser_mp4->sd_idxs[sd_idx], &size);
+    if (!src)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    *entry = (uint8_t *)MALLOC_CHK(size);
+    if (!*entry)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memcpy(*entry, src, size);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+parser_mp4_set_param(parser_handle_t parser, stream_param_id_t param_id, uint32_t param)
+{
+    if (param_id != STREAM_PARAM_ID_TRACK_ID)
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    ((parser_mp4_handle_t)parser)->track_ID = param;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static void
+parser_mp4_destroy(parser_handle_t parser)
+{
+    parser_mp4_handle_t parser_mp4 = (parser_mp4_handle_t)parser;
+
+    if (parser_mp4)
+    {
+        mp4_demux_destroy(parser_mp4->demuxer);
+        FREE_CHK(parser_mp4->sd_idxs);
+        FREE_CHK(parser_mp4->win);
+    }
+    parser_destroy(parser);
+}
+
+static parser_handle_t
+parser_mp4_create(uint32_t dsi_type)
+{
+    parser_mp4_handle_t parser_mp4;
+    parser_handle_t     parser;
+
+    assert(dsi_type == DSI_TYPE_MP4FF);
+    parser_mp4 = (parser_mp4_handle_t)MALLOC_CHK(sizeof(parser_mp4_t));
+    if (!parser_mp4)
+    {
+        return 0;
+    }
+    memset(parser_mp4, 0, sizeof(parser_mp4_t));
+    parser = (parser_handle_t)parser_mp4;
+
+    /**** build the interface, base for the instance: stream_type and stream_id come with the track */
+    parser->stream_type = STREAM_TYPE_UNKNOWN;
+    parser->stream_id   = STREAM_ID_UNKNOWN;
+    parser->stream_name = "mp4";
+
+    parser->dsi_type = dsi_type;
+
+    parser->init             = parser_mp4_init;
+    parser->destroy          = parser_mp4_destroy;
+    parser->get_sample       = parser_mp4_get_sample;
+    parser->get_subsample    = parser_mp4_get_subsample;
+    parser->get_sample_entry = parser_mp4_get_sample_entry;
+    parser->set_param        = parser_mp4_set_param;
+    parser->need_fix_cts     = parser_mp4_need_fix_cts;
+    parser->get_cts_offset   = parser_mp4_get_cts_offset;
+
+    /** no dsi: the sample entries are copied */
+    parser->dsi_lst = list_create(sizeof(dsi_handle_t));
+    if (!parser->dsi_lst)
+    {
+        parser->destroy(parser);
+        return 0;
+    }
+
+    /**** cast to base */
+    return parser;
+}
+
+void
+parser_mp4_reg(void)
+{
+    reg_parser_set("mp4", parser_mp4_create);
+    reg_parser_set("m4a", parser_mp4_create);
+    reg_parser_set("m4v", parser_mp4_create);
+}
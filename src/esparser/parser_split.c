@@ -0,0 +1,961 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file parser_split.c
+    @brief Implements the driver parsing an avc or hevc es in ranges on several threads
+*/
+
+#ifdef _MSC_VER
+#include <windows.h>       /** WaitForSingleObject() */
+#endif
+#include <string.h>        /** memcpy() */
+
+#include "parser_split.h"
+#include "utils.h"         /** OSAL_THREAD_CREATE() */
+#include "registry.h"      /** reg_bbio_get() */
+#include "io_splice.h"     /** splice_src_create() */
+#include "memory_chk.h"    /** MALLOC_CHK() */
+#include "msg_log.h"       /** msglog() */
+
+#define SPLIT_READ_SIZE     0x100000   /** pre-pass read size */
+#define SPLIT_RANGE_MIN     0x10000    /** smallest range worth a thread of its own */
+#define SPLIT_RANGE_MAX     0x4000000  /** the range buffers of a round are in memory at once */
+#define SPLIT_RANGE_PER_THR 4          /** ranges per thread, so that rounds even out */
+#define SPLIT_PS_SIZE_MAX   0x10000    /** a longer parameter set: no split */
+#define SPLIT_PS_NUM_MAX    64         /** more distinct parameter sets: no split */
+
+/** NAL classes as far as cutting is concerned */
+#define NAL_CLS_VCL         0x01
+#define NAL_CLS_FIRST       0x02       /** first slice of a picture */
+#define NAL_CLS_IDR         0x04
+#define NAL_CLS_AU_START    0x08       /** starts an AU if the current one has a VCL NAL */
+#define NAL_CLS_AUD         0x10
+#define NAL_CLS_PS          0x20
+#define NAL_CLS_NO_SPLIT    0x40       /** layered or dolby vision NALs */
+
+typedef struct split_ps_t_
+{
+    uint8_t *buf;                      /**< 4 byte start code and NAL */
+    uint32_t size;
+} split_ps_t;
+
+typedef struct split_plan_t_
+{
+    BOOL            is_hevc;
+    int64_t         range_size;        /**< minimum distance of two cuts */
+    parser_range_t *ranges;
+    uint32_t        range_num;
+    uint32_t        range_max;
+    split_ps_t      ps[SPLIT_PS_NUM_MAX];
+    uint32_t        ps_num;
+    uint8_t        *seed;              /**< all of ps[], in es order */
+    uint32_t        seed_size;
+    BOOL            no_split;
+
+    /** the AU being scanned */
+    int64_t         au_off;            /**< where its first start code is, -1 for none yet */
+    uint32_t        au_nal_num;
+    uint32_t        au_seed_pos;       /**< after the AUD if it starts with one */
+    BOOL            au_aud;
+    BOOL            au_vcl;
+    BOOL            au_new_ps;         /**< a parameter set not seen before is in it */
+    uint32_t        au_ps_num;         /**< parameter sets seen before it */
+    uint64_t        au_ps_in;          /**< bit u: ps[u] is in it */
+    uint32_t        au_num;            /**< AUs begun so far */
+
+    /** finding the sync point of an AU rather than cutting */
+    BOOL            sync_find;
+    uint32_t        sync_au;           /**< the AU */
+    BOOL            sync_done;         /**< an AU after it has begun */
+    int64_t         sync_off;          /**< the last IDR AU up to it, -1 for none */
+    uint32_t        sync_seed_pos;
+    uint32_t        sync_au_idx;
+    uint32_t        sync_ps_num;       /**< parameter sets seen before that AU */
+    uint64_t        sync_ps_in;        /**< and those in it */
+} split_plan_t;
+
+typedef struct split_part_t_
+{
+    parser_handle_t       parser;
+    bbio_handle_t         ds;          /**< buffer with the range and seed */
+    const parser_range_t *range;
+    mp4_sample_t         *samples;
+    uint32_t              sample_num;
+    uint32_t              sample_max;
+    int32_t               ret;
+} split_part_t;
+
+static uint32_t
+split_nal_class(BOOL is_hevc, const uint8_t *hdr)
+{
+    uint32_t type;
+
+    if (!is_hevc)
+    {
+        type = hdr[0] & 0x1f;
+        if (type >= 1 && type <= 5)
+        {
+            /** first_mb_in_slice == 0 */
+            return NAL_CLS_VCL | ((hdr[1] & 0x80) ? NAL_CLS_FIRST : 0) | ((type == 5) ? NAL_CLS_IDR : 0);
+        }
+        switch (type)
+        {
+        case 9:
+            return NAL_CLS_AU_START | NAL_CLS_AUD;
+        case 7: case 8:
+            return NAL_CLS_AU_START | NAL_CLS_PS;
+        case 13:
+            return NAL_CLS_PS;
+        case 6: case 16: case 17: case 18:
+            return NAL_CLS_AU_START;
+        case 14: case 15: case 20: case 28: case 30:
+            return NAL_CLS_NO_SPLIT;
+        default:
+            return 0;
+        }
+    }
+
+    type = (hdr[0] >> 1) & 0x3f;
+    if ((hdr[0] & 0x01) || (hdr[1] & 0xf8) || type == 62 || type == 63)
+    {
+        /** nuh_layer_id != 0 or dolby vision */
+        return NAL_CLS_NO_SPLIT;
+    }
+    if (type < 32)
+    {
+        /** first_slice_segment_in_pic_flag */
+        return NAL_CLS_VCL | ((hdr[2] & 0x80) ? NAL_CLS_FIRST : 0) | ((type == 19 || type == 20) ? NAL_CLS_IDR : 0);
+    }
+    switch (type)
+    {
+    case 35:
+        return NAL_CLS_AU_START | NAL_CLS_AUD;
+    case 32: case 33: case 34:
+        return NAL_CLS_AU_START | NAL_CLS_PS;
+    case 39: case 41: case 42: case 43: case 44:
+    case 48: case 49: case 50: case 51: case 52: case 53: case 54: case 55:
+        return NAL_CLS_AU_START;
+    default:
+        return 0;
+    }
+}
+
+/** a parameter set NAL of size at hdr ends: keep it if not seen before */
+static int32_t
+split_plan_ps(split_plan_t *plan, const uint8_t *hdr, size_t size)
+{
+    split_ps_t *ps;
+    uint32_t    u;
+
+    for (u = 0; u < plan->ps_num; u++)
+    {
+        ps = &plan->ps[u];
+        if (ps->size == size + 4 && !memcmp(ps->buf + 4, hdr, size))
+        {
+            plan->au_ps_in |= (uint64_t)1 << u;
+            return EMA_MP4_MUXED_OK;
+        }
+    }
+
+    /** all parameter sets must be known by the end of the first range, so that
+     *  the dsi of the first part parser is the dsi of the stream */
+    if (plan->range_num > 1 || plan->ps_num == SPLIT_PS_NUM_MAX || size > SPLIT_PS_SIZE_MAX)
+    {
+        plan->no_split = TRUE;
+        return EMA_MP4_MUXED_OK;
+    }
+
+    ps       = &plan->ps[plan->ps_num];
+    ps->size = (uint32_t)size + 4;
+    ps->buf  = (uint8_t *)MALLOC_CHK(ps->size);
+    if (!ps->buf)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    ps->buf[0] = ps->buf[1] = ps->buf[2] = 0;
+    ps->buf[3] = 1;
+    memcpy(ps->buf + 4, hdr, size);
+    plan->au_ps_in |= (uint64_t)1 << plan->ps_num;
+    plan->ps_num++;
+    plan->au_new_ps = TRUE;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+split_plan_cut(split_plan_t *plan)
+{
+    parser_range_t *range;
+
+    if (plan->range_num == plan->range_max)
+    {
+        uint32_t        range_max = plan->range_max ? 2*plan->range_max : 64;
+        parser_range_t *ranges    = (parser_range_t *)REALLOC_CHK(plan->ranges, range_max*sizeof(parser_range_t));
+
+        if (!ranges)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+        plan->ranges    = ranges;
+        plan->range_max = range_max;
+    }
+
+    if (plan->range_num)
+    {
+        range       = &plan->ranges[plan->range_num - 1];
+        range->size = plan->au_off - range->off;
+    }
+    range            = &plan->ranges[plan->range_num++];
+    range->off       = plan->au_off;
+    range->size      = 0;
+    range->seed_pos  = plan->au_seed_pos;
+    range->seed_size = 0;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/** a NAL of class cls has its start code at sc_off */
+static int32_t
+split_plan_nal(split_plan_t *plan, int64_t sc_off, uint32_t cls)
+{
+    if (cls & NAL_CLS_NO_SPLIT)
+    {
+        plan->no_split = TRUE;
+        return EMA_MP4_MUXED_OK;
+    }
+
+    if (plan->au_off < 0 || (plan->au_vcl && (cls & (NAL_CLS_AU_START | NAL_CLS_FIRST))))
+    {
+        plan->au_off      = sc_off;
+        plan->au_nal_num  = 0;
+        plan->au_seed_pos = 0;
+        plan->au_aud      = (cls & NAL_CLS_AUD) ? TRUE : FALSE;
+        plan->au_vcl      = FALSE;
+        plan->au_new_ps   = FALSE;
+        plan->au_ps_num   = plan->ps_num;
+        plan->au_ps_in    = 0;
+        if (plan->sync_find && plan->au_num > plan->sync_au)
+        {
+            plan->sync_done = TRUE;
+            return EMA_MP4_MUXED_OK;
+        }
+        plan->au_num++;
+    }
+    if (plan->au_nal_num++ == 1 && plan->au_aud)
+    {
+        plan->au_seed_pos = (uint32_t)(sc_off - plan->au_off);
+    }
+
+    if ((cls & NAL_CLS_VCL) && !plan->au_vcl)
+    {
+        plan->au_vcl = TRUE;
+        if (plan->sync_find)
+        {
+            if (cls & NAL_CLS_IDR)
+            {
+                plan->sync_off      = plan->au_off;
+                plan->sync_seed_pos = plan->au_seed_pos;
+                plan->sync_au_idx   = plan->au_num - 1;
+                plan->sync_ps_num   = plan->au_ps_num;
+                plan->sync_ps_in    = plan->au_ps_in;
+            }
+            return EMA_MP4_MUXED_OK;
+        }
+        if ((cls & NAL_CLS_IDR) && !plan->au_new_ps &&
+            plan->au_off - plan->ranges[plan->range_num - 1].off >= plan->range_size)
+        {
+            return split_plan_cut(plan);
+        }
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+/** scans the es for start codes and cuts it into ranges */
+static int32_t
+split_plan_scan(split_plan_t *plan, bbio_handle_t ds)
+{
+    const size_t buf_max = SPLIT_READ_SIZE + SPLIT_PS_SIZE_MAX + 16;
+    uint8_t *buf;
+    size_t   len = 0, i = 0;
+    int64_t  buf_off = 0;  /** es offset of buf[0] */
+    int64_t  ps_at   = -1; /** where the pending parameter set starts in buf */
+    BOOL     eof     = FALSE;
+    int32_t  ret     = EMA_MP4_MUXED_OK;
+
+    buf = (uint8_t *)MALLOC_CHK(buf_max);
+    if (!buf)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+
+    plan->au_off = 0;
+    ret = split_plan_cut(plan);
+    plan->au_off = -1;
+
+    ds->seek(ds, 0, SEEK_SET);
+    while (ret == EMA_MP4_MUXED_OK && !plan->no_split && !plan->sync_done)
+    {
+        size_t sc;
+
+        if (!eof && len - i < 8)
+        {
+            /** 3 byte start code and 3 byte NAL header ahead. Keep the byte before
+             *  for a 4 byte start code and any parameter set not complete */
+            size_t keep = (ps_at >= 0 && (size_t)ps_at < i) ? (size_t)ps_at : i;
+            size_t want = SPLIT_READ_SIZE;
+            size_t n;
+
+            keep = keep ? keep - 1 : 0;
+            memmove(buf, buf + keep, len - keep);
+            buf_off += keep;
+            len     -= keep;
+            i       -= keep;
+            if (ps_at >= 0)
+            {
+                ps_at -= keep;
+            }
+            if (len > SPLIT_PS_SIZE_MAX)
+            {
+                plan->no_split = TRUE;
+                break;
+            }
+
+            /** no read past the end: a buffer source takes that for an error */
+            if ((int64_t)want > ds->size(ds) - ds->position(ds))
+            {
+                want = (size_t)(ds->size(ds) - ds->position(ds));
+            }
+            n = ds->read(ds, buf + len, want);
+            len += n;
+            if (n < SPLIT_READ_SIZE)
+            {
+                eof = TRUE;
+                memset(buf + len, 0, 8);
+            }
+            continue;
+        }
+        if (i + 3 > len)
+        {
+            break;
+        }
+
+        if (buf[i + 2] > 1)
+        {
+            i += 3;
+            continue;
+        }
+        if (buf[i] || buf[i + 1] || buf[i + 2] != 1)
+        {
+            i++;
+            continue;
+        }
+
+        sc = (i && !buf[i - 1]) ? i - 1 : i;
+        if (ps_at >= 0)
+        {
+            ret = split_plan_ps(plan, buf + ps_at, sc - (size_t)ps_at);
+            ps_at = -1;
+        }
+        if (ret == EMA_MP4_MUXED_OK)
+        {
+            uint32_t cls = split_nal_class(plan->is_hevc, buf + i + 3);
+
+            ret = split_plan_nal(plan, buf_off + sc, cls);
+            if (cls & NAL_CLS_PS)
+            {
+                ps_at = i + 3;
+            }
+        }
+        i += 3;
+    }
+    if (ret == EMA_MP4_MUXED_OK && !plan->no_split && ps_at >= 0)
+    {
+        ret = split_plan_ps(plan, buf + ps_at, len - (size_t)ps_at);
+    }
+    FREE_CHK(buf);
+
+    return ret;
+}
+
+static void
+split_plan_free(split_plan_t *plan)
+{
+    uint32_t u;
+
+    for (u = 0; u < plan->ps_num; u++)
+    {
+        FREE_CHK(plan->ps[u].buf);
+    }
+    FREE_CHK(plan->ranges);
+    FREE_CHK(plan->seed);
+}
+
+/** returns EMA_MP4_MUXED_NO_SUPPORT if there is less than two ranges */
+static int32_t
+split_plan_make(split_plan_t *plan, parser_handle_t parser, uint32_t thread_num)
+{
+    bbio_handle_t ds        = parser->ds;
+    int64_t       es_size   = ds->size(ds);
+    int32_t       ret;
+    uint32_t      u;
+
+    memset(plan, 0, sizeof(split_plan_t));
+    plan->is_hevc    = (parser->stream_id == STREAM_ID_HEVC);
+    plan->range_size = es_size/(thread_num*SPLIT_RANGE_PER_THR);
+    if (plan->range_size < SPLIT_RANGE_MIN)
+    {
+        plan->range_size = SPLIT_RANGE_MIN;
+    }
+    if (plan->range_size > SPLIT_RANGE_MAX)
+    {
+        plan->range_size = SPLIT_RANGE_MAX;
+    }
+
+    ret = split_plan_scan(plan, ds);
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        return ret;
+    }
+    if (plan->no_split || plan->range_num < 2)
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    plan->ranges[plan->range_num - 1].size = es_size - plan->ranges[plan->range_num - 1].off;
+
+    for (u = 0; u < plan->ps_num; u++)
+    {
+        plan->seed_size += plan->ps[u].size;
+    }
+    plan->seed = (uint8_t *)MALLOC_CHK(plan->seed_size ? plan->seed_size : 1);
+    if (!plan->seed)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    plan->seed_size = 0;
+    for (u = 0; u < plan->ps_num; u++)
+    {
+        memcpy(plan->seed + plan->seed_size, plan->ps[u].buf, plan->ps[u].size);
+        plan->seed_size += plan->ps[u].size;
+    }
+    for (u = 1; u < plan->range_num; u++)
+    {
+        plan->ranges[u].seed_size = plan->seed_size;
+    }
+    msglog(NULL, MSGLOG_INFO, "Parsing in %u ranges on %u threads\n", plan->range_num, thread_num);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static void
+split_part_free(split_part_t *part)
+{
+    if (part->parser)
+    {
+        part->parser->destroy(part->parser);
+    }
+    if (part->ds)
+    {
+        part->ds->destroy(part->ds);
+    }
+    FREE_CHK(part->samples);
+    memset(part, 0, sizeof(split_part_t));
+}
+
+/** reads the range and sets up a parser for it, reading it with its seed put in. The splice
+ *  source reads no further than the range: the parser reads until a read comes back short */
+static int32_t
+split_part_init(split_part_t *part, parser_handle_t parser, const split_plan_t *plan, const parser_range_t *range,
+                parser_split_create_fn create, void *ctx)
+{
+    bbio_handle_t ds = parser->ds;
+    bbio_handle_t src;
+    uint8_t      *buf, *seed;
+
+    memset(part, 0, sizeof(split_part_t));
+    part->range = range;
+
+    buf = (uint8_t *)MALLOC_CHK((size_t)range->size);
+    if (!buf)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    ds->seek(ds, range->off, SEEK_SET);
+    if (ds->read(ds, buf, (size_t)range->size) != (size_t)range->size)
+    {
+        FREE_CHK(buf);
+        return EMA_MP4_MUXED_READ_ERR;
+    }
+    seed = (uint8_t *)MALLOC_CHK(range->seed_size ? range->seed_size : 1);
+    src  = reg_bbio_get('b', 'r');
+    if (!seed || !src)
+    {
+        FREE_CHK(buf);
+        FREE_CHK(seed);
+        if (src)
+        {
+            src->destroy(src);
+        }
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memcpy(seed, plan->seed, range->seed_size);
+    src->set_buffer(src, buf, (size_t)range->size, TRUE);
+
+    part->ds = splice_src_create(src, 0, range->seed_pos, seed, range->seed_size);
+    if (!part->ds)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+
+    part->parser = create(ctx);
+    if (!part->parser)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    part->parser->allocator           = parser->allocator;
+    part->parser->sd                  = parser->sd;
+    part->parser->sd_collision_flag   = 0;
+    part->parser->dv_bl_non_comp_flag = parser->dv_bl_non_comp_flag;
+    FOURCC_ASSIGN(part->parser->dsi_name, parser->dsi_name);
+
+    /** init() reads the first NAL and sets up the decoder tables: done here, not on the thread */
+    return part->parser->init(part->parser, &parser->ext_timing, parser->es_idx, part->ds);
+}
+
+/** the get_sample() loop of the serial parsing */
+static void
+split_part_run(split_part_t *part)
+{
+    parser_handle_t     parser = part->parser;
+    mp4_sample_handle_t sample = sample_create();
+    int32_t             ret    = EMA_MP4_MUXED_NO_MEM;
+
+    while (sample &&
+           (!(ret = parser->get_sample(parser, sample)) || ret == EMA_MP4_MUXED_NO_CONFIG_ERR))
+    {
+        if (ret)
+        {
+            continue;
+        }
+        if (part->sample_num == part->sample_max)
+        {
+            uint32_t      sample_max = part->sample_max ? 2*part->sample_max : 256;
+            mp4_sample_t *samples    = (mp4_sample_t *)REALLOC_CHK(part->samples, sample_max*sizeof(mp4_sample_t));
+
+            if (!samples)
+            {
+                ret = EMA_MP4_MUXED_NO_MEM;
+                break;
+            }
+            part->samples    = samples;
+            part->sample_max = sample_max;
+        }
+        part->samples[part->sample_num] = *sample;
+        part->samples[part->sample_num].data = NULL;
+        part->sample_num++;
+    }
+    if (sample)
+    {
+        sample->destroy(sample);
+    }
+
+    part->ret = (ret == EMA_MP4_MUXED_EOES) ? EMA_MP4_MUXED_OK : ret;
+}
+
+/** thread entry: allocates from the allocator of the parser split */
+static OSAL_THREAD_RET_T
+split_part_parse(void *arg)
+{
+    split_part_t *part = (split_part_t *)arg;
+
+    MEM_ALLOC_SCOPE_CHK(part->parser->allocator, split_part_run(part));
+    return OSAL_THREAD_RET_VAL;
+}
+
+/** if the part parser got what the serial parsing would have */
+static BOOL
+split_part_check(const split_part_t *part, BOOL is_first)
+{
+    parser_handle_t parser = part->parser;
+    uint32_t        u;
+
+    if (part->ret != EMA_MP4_MUXED_OK || !part->sample_num ||
+        parser->sd_collision_flag || list_get_entry_num(parser->dsi_lst) != 1 ||
+        parser->dv_el_nal_flag || parser->dv_rpu_nal_flag)
+    {
+        return FALSE;
+    }
+    if (!is_first && !(part->samples[0].flags & SAMPLE_SYNC))
+    {
+        return FALSE;
+    }
+    for (u = 1; u < part->sample_num; u++)
+    {
+        if (part->samples[u].flags & SAMPLE_NEW_SD)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int32_t
+split_parse(parser_handle_t parser, uint32_t thread_num,
+            parser_split_create_fn create, parser_split_output_fn output, void *ctx)
+{
+    bbio_handle_t   ds = parser->ds;
+    int64_t         ds_pos;
+    split_plan_t    plan;
+    split_part_t   *parts;
+    OSAL_THREAD_T  *threads;
+    BOOL           *thread_ok;
+    parser_handle_t base = NULL;
+    uint32_t        first, n, u, v, bad = 0;
+    int32_t         ret;
+
+    if (thread_num < 2 || !parser->merge_range || !ds ||
+        (parser->stream_id != STREAM_ID_H264 && parser->stream_id != STREAM_ID_HEVC) ||
+        parser->conformance_type[0] || parser->dv_el_track_flag ||
+        parser->dv_el_nal_flag || parser->dv_rpu_nal_flag)
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+
+    ds_pos = ds->position(ds);
+    ret    = split_plan_make(&plan, parser, thread_num);
+    ds->seek(ds, ds_pos, SEEK_SET);
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        split_plan_free(&plan);
+        return ret;
+    }
+
+    parts     = (split_part_t *)MALLOC_CHK(thread_num*sizeof(split_part_t));
+    threads   = (OSAL_THREAD_T *)MALLOC_CHK(thread_num*sizeof(OSAL_THREAD_T));
+    thread_ok = (BOOL *)MALLOC_CHK(thread_num*sizeof(BOOL));
+    if (!parts || !threads || !thread_ok)
+    {
+        FREE_CHK(parts);
+        FREE_CHK(threads);
+        FREE_CHK(thread_ok);
+        split_plan_free(&plan);
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memset(parts, 0, thread_num*sizeof(split_part_t));
+
+    for (first = 0; first < plan.range_num && ret == EMA_MP4_MUXED_OK; first += n)
+    {
+        n = plan.range_num - first;
+        if (n > thread_num)
+        {
+            n = thread_num;
+        }
+
+        for (u = 0; u < n && ret == EMA_MP4_MUXED_OK; u++)
+        {
+            bad = first + u;
+            ret = split_part_init(&parts[u], parser, &plan, &plan.ranges[first + u], create, ctx);
+        }
+        if (ret == EMA_MP4_MUXED_OK)
+        {
+            for (u = 0; u < n; u++)
+            {
+                thread_ok[u] = !OSAL_THREAD_CREATE(threads[u], split_part_parse, &parts[u]);
+                if (!thread_ok[u])
+                {
+                    split_part_parse(&parts[u]);
+                }
+            }
+            for (u = 0; u < n; u++)
+            {
+                if (thread_ok[u])
+                {
+                    OSAL_THREAD_JOIN(threads[u]);
+                }
+            }
+        }
+
+        /** merge all parts of the round before any sample goes out: a failure in the
+         *  first round can still be left to the serial parsing */
+        for (u = 0; u < n && ret == EMA_MP4_MUXED_OK; u++)
+        {
+            split_part_t *part = &parts[u];
+
+            bad = first + u;
+            if (!split_part_check(part, first + u == 0))
+            {
+                ret = EMA_MP4_MUXED_NO_SUPPORT;
+                break;
+            }
+            if (!base)
+            {
+                /** the first range is at its es offsets */
+                base     = part->parser;
+                base->ds = ds;
+                part->parser = NULL;
+                continue;
+            }
+            ret = base->merge_range(base, part->parser, part->range, part->samples, part->sample_num);
+        }
+
+        if (ret == EMA_MP4_MUXED_OK)
+        {
+            for (u = 0; u < n && ret == EMA_MP4_MUXED_OK; u++)
+            {
+                bad = first + u;
+                for (v = 0; v < parts[u].sample_num && ret == EMA_MP4_MUXED_OK; v++)
+                {
+                    ret = output(ctx, base, &parts[u].samples[v]);
+                }
+            }
+        }
+        else if (first == 0 && ret != EMA_MP4_MUXED_NO_MEM)
+        {
+            msglog(NULL, MSGLOG_INFO, "Es can't be parsed in ranges: parsing it serially\n");
+            if (base)
+            {
+                base->destroy(base);
+            }
+            ret = EMA_MP4_MUXED_NO_SUPPORT;
+        }
+        else if (first != 0)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Parsing range %u of the es failed\n", bad);
+            ret = (ret == EMA_MP4_MUXED_NO_SUPPORT) ? EMA_MP4_MUXED_BUGGY : ret;
+        }
+
+        for (u = 0; u < n; u++)
+        {
+            split_part_free(&parts[u]);
+        }
+    }
+
+    if (ret == EMA_MP4_MUXED_NO_SUPPORT)
+    {
+        ds->seek(ds, ds_pos, SEEK_SET);
+    }
+
+    FREE_CHK(parts);
+    FREE_CHK(threads);
+    FREE_CHK(thread_ok);
+    split_plan_free(&plan);
+
+    return ret;
+}
+
+int32_t
+parser_split_parse(parser_handle_t parser, uint32_t thread_num,
+                   parser_split_create_fn create, parser_split_output_fn output, void *ctx)
+{
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(parser->allocator, ret = split_parse(parser, thread_num, create, output, ctx));
+    return ret;
+}
+
+static int32_t
+split_find_sync(parser_handle_t parser, uint32_t au_idx, parser_range_t *range, uint8_t **seed, uint32_t *sync_idx)
+{
+    bbio_handle_t ds = parser->ds;
+    int64_t       ds_pos;
+    split_plan_t  plan;
+    uint32_t      u;
+    int32_t       ret;
+
+    if (!ds || (parser->stream_id != STREAM_ID_H264 && parser->stream_id != STREAM_ID_HEVC) ||
+        parser->conformance_type[0] || parser->dv_el_track_flag ||
+        parser->dv_el_nal_flag || parser->dv_rpu_nal_flag)
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+
+    memset(&plan, 0, sizeof(split_plan_t));
+    plan.is_hevc   = (parser->stream_id == STREAM_ID_HEVC);
+    plan.sync_find = TRUE;
+    plan.sync_au   = au_idx;
+    plan.sync_off  = -1;
+
+    ds_pos = ds->position(ds);
+    ret    = split_plan_scan(&plan, ds);
+    ds->seek(ds, ds_pos, SEEK_SET);
+    if (ret == EMA_MP4_MUXED_OK && (plan.no_split || plan.sync_off < 0))
+    {
+        ret = EMA_MP4_MUXED_NO_SUPPORT;
+    }
+
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        range->off       = plan.sync_off;
+        range->size      = ds->size(ds) - plan.sync_off;
+        range->seed_pos  = plan.sync_seed_pos;
+        range->seed_size = 0;
+        /** the AU may carry them itself */
+        for (u = 0; u < plan.sync_ps_num; u++)
+        {
+            if (!(plan.sync_ps_in & ((uint64_t)1 << u)))
+            {
+                range->seed_size += plan.ps[u].size;
+            }
+        }
+        *seed = (uint8_t *)MALLOC_CHK(range->seed_size ? range->seed_size : 1);
+        if (!*seed)
+        {
+            ret = EMA_MP4_MUXED_NO_MEM;
+        }
+        else
+        {
+            range->seed_size = 0;
+            for (u = 0; u < plan.sync_ps_num; u++)
+            {
+                if (!(plan.sync_ps_in & ((uint64_t)1 << u)))
+                {
+                    memcpy(*seed + range->seed_size, plan.ps[u].buf, plan.ps[u].size);
+                    range->seed_size += plan.ps[u].size;
+                }
+            }
+            *sync_idx = plan.sync_au_idx;
+        }
+    }
+    split_plan_free(&plan);
+
+    return ret;
+}
+
+int32_t
+parser_split_find_sync(parser_handle_t parser, uint32_t au_idx, parser_range_t *range, uint8_t **seed, uint32_t *sync_idx)
+{
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(parser->allocator, ret = split_find_sync(parser, au_idx, range, seed, sync_idx));
+    return ret;
+}
+
+int32_t
+parser_split_append_au(nal_index_handle_t idx, nal_index_handle_t part_idx, int64_t pos,
+                       const parser_range_t *range, uint32_t nal_unit_len,
+                       int64_t *pos_out, uint32_t *drop_size)
+{
+    const int64_t seed_end = (int64_t)range->seed_pos + range->seed_size;
+    uint32_t nal_num, nal_kept = 0, size, u;
+    uint8_t  sc_size;
+    int64_t  off;
+    int32_t  ret;
+
+    /** count first: the record starts with the number of NALs */
+    ret = nal_index_read_au(part_idx, pos, &nal_num);
+    for (u = 0; u < nal_num && ret == EMA_MP4_MUXED_OK; u++)
+    {
+        ret = nal_index_read_nal(part_idx, &off, &size, &sc_size);
+        if (off == -1 || off < range->seed_pos || off >= seed_end)
+        {
+            nal_kept++;
+        }
+    }
+    if (ret != EMA_MP4_MUXED_OK || !nal_kept)
+    {
+        return EMA_MP4_MUXED_BUGGY;
+    }
+
+    *pos_out = nal_index_position(idx);
+    ret = nal_index_add_au(idx, nal_kept);
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        ret = nal_index_read_au(part_idx, pos, &nal_num);
+    }
+    for (u = 0; u < nal_num && ret == EMA_MP4_MUXED_OK; u++)
+    {
+        ret = nal_index_read_nal(part_idx, &off, &size, &sc_size);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            break;
+        }
+        if (off == -1)
+        {
+            uint8_t *emb = (uint8_t *)MALLOC_CHK(size ? size : 1);
+
+            if (!emb)
+            {
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+            ret = nal_index_read_emb(part_idx, emb, NULL);
+            if (ret == EMA_MP4_MUXED_OK)
+            {
+                ret = nal_index_add_nal(idx, -1, size, sc_size, emb);
+            }
+            FREE_CHK(emb);
+        }
+        else if (off < range->seed_pos)
+        {
+            ret = nal_index_add_nal(idx, range->off + off, size, sc_size, NULL);
+        }
+        else if (off >= seed_end)
+        {
+            ret = nal_index_add_nal(idx, range->off + off - range->seed_size, size, sc_size, NULL);
+        }
+        else
+        {
+            *drop_size += nal_unit_len + size;
+        }
+    }
+
+    return ret;
+}
+
+uint32_t
+parser_split_seed_nal_num(parser_handle_t part, const parser_range_t *range, uint8_t mask, uint8_t val)
+{
+    bbio_handle_t ds  = part->ds;
+    uint32_t      num = 0;
+    uint8_t      *buf;
+    int64_t       pos;
+    uint32_t      u;
+
+    if (!range->seed_size || !ds)
+    {
+        return 0;
+    }
+    buf = (uint8_t *)MALLOC_CHK(range->seed_size);
+    if (!buf)
+    {
+        return 0;
+    }
+
+    pos = ds->position(ds);
+    ds->seek(ds, range->seed_pos, SEEK_SET);
+    if (ds->read(ds, buf, range->seed_size) == range->seed_size)
+    {
+        /** the seed is 4 byte start codes and NALs only */
+        for (u = 0; u + 3 < range->seed_size; u++)
+        {
+            if (!buf[u] && !buf[u + 1] && buf[u + 2] == 1)
+            {
+                num += ((buf[u + 3] & mask) == val);
+                u   += 2;
+            }
+        }
+    }
+    ds->seek(ds, pos, SEEK_SET);
+    FREE_CHK(buf);
+
+    return num;
+}
@@ -0,0 +1,173 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file ps_cache.c
+    @brief Implements the parameter set lookup table
+*/
+
+#include <string.h>      /** memset(), memcmp() */
+
+#include "ps_cache.h"
+#include "memory_chk.h"  /** MALLOC_CHK() */
+
+typedef struct ps_table_t_
+{
+    list_handle_t lst;                         /**< list indexed, NULL for a free table */
+    uint32_t      entry_num;                   /**< its entry count when indexed */
+    void         *first;                       /**< and its first entry */
+    buf_entry_t  *entry[PS_CACHE_ID_MAX];      /**< first entry of each id */
+    uint64_t      hash[PS_CACHE_ID_MAX];       /**< hash of its content */
+} ps_table_t;
+
+struct ps_cache_t_
+{
+    ps_table_t tables[PS_CACHE_LST_MAX];
+    uint32_t   table_next;                     /**< table to reuse if all in use */
+};
+
+/** 64 bit FNV-1a */
+static uint64_t
+ps_hash(const uint8_t *data, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (size--)
+    {
+        h ^= *data++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void
+table_index(ps_table_t *tbl, list_handle_t lst)
+{
+    it_list_handle_t it = it_create_on(lst);
+    buf_entry_t *    entry;
+
+    memset(tbl, 0, sizeof(ps_table_t));
+    tbl->lst       = lst;
+    tbl->entry_num = list_get_entry_num(lst);
+    tbl->first     = list_peek_first_entry(lst);
+    while (it && (entry = it_get_entry(it)))
+    {
+        if (entry->id < PS_CACHE_ID_MAX && !tbl->entry[entry->id])
+        {
+            tbl->entry[entry->id] = entry;
+            tbl->hash[entry->id]  = ps_hash(entry->data, entry->size);
+        }
+    }
+    it_destroy(it);
+}
+
+static ps_table_t *
+table_get(ps_cache_handle_t cache, list_handle_t lst)
+{
+    ps_table_t *tbl = NULL;
+    uint32_t    i;
+
+    for (i = 0; i < PS_CACHE_LST_MAX; i++)
+    {
+        if (cache->tables[i].lst == lst)
+        {
+            tbl = cache->tables + i;
+            break;
+        }
+        if (!tbl && !cache->tables[i].lst)
+        {
+            tbl = cache->tables + i;  /* free one in case lst is new */
+        }
+    }
+    if (!tbl)
+    {
+        tbl = cache->tables + cache->table_next;
+        cache->table_next = (cache->table_next + 1) % PS_CACHE_LST_MAX;
+    }
+
+    /* entries added by others than ps_cache_update(), e.g. from a codec config */
+    if (tbl->lst != lst || tbl->entry_num != list_get_entry_num(lst) || tbl->first != list_peek_first_entry(lst))
+    {
+        table_index(tbl, lst);
+    }
+    return tbl;
+}
+
+ps_cache_handle_t
+ps_cache_create(void)
+{
+    ps_cache_handle_t cache = (ps_cache_handle_t)MALLOC_CHK(sizeof(ps_cache_t));
+
+    if (cache)
+    {
+        memset(cache, 0, sizeof(ps_cache_t));
+    }
+    return cache;
+}
+
+void
+ps_cache_destroy(ps_cache_handle_t cache)
+{
+    if (cache)
+    {
+        FREE_CHK(cache);
+    }
+}
+
+buf_entry_t *
+ps_cache_lookup(ps_cache_handle_t cache, list_handle_t lst, uint32_t id, const uint8_t *data, size_t size, BOOL *same)
+{
+    ps_table_t  *tbl   = table_get(cache, lst);
+    buf_entry_t *entry = (id < PS_CACHE_ID_MAX) ? tbl->entry[id] : NULL;
+
+    /* the hash only rules out a change: a match is confirmed on the bytes */
+    *same = (entry && entry->size == size && tbl->hash[id] == ps_hash(data, size) &&
+             !memcmp(entry->data, data, size));
+    return entry;
+}
+
+void
+ps_cache_update(ps_cache_handle_t cache, list_handle_t lst, buf_entry_t *entry)
+{
+    ps_table_t *tbl = table_get(cache, lst);
+
+    /* an added entry is already in: table_get() reindexed on the new count */
+    if (entry->id < PS_CACHE_ID_MAX && tbl->entry[entry->id] == entry)
+    {
+        tbl->hash[entry->id] = ps_hash(entry->data, entry->size);
+    }
+}
+
+void
+ps_cache_forget(ps_cache_handle_t cache, list_handle_t lst)
+{
+    uint32_t i;
+
+    for (i = 0; i < PS_CACHE_LST_MAX; i++)
+    {
+        if (!lst || cache->tables[i].lst == lst)
+        {
+            memset(cache->tables + i, 0, sizeof(ps_table_t));
+        }
+    }
+}
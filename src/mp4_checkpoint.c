@@ -0,0 +1,526 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4_checkpoint.c
+    @brief Implements the checkpoint a fragmented output job continues from when run again
+*/
+
+#include <stdio.h>         /** remove(), rename() */
+
+#include "utils.h"
+#include "registry.h"      /** reg_bbio_get() */
+#include "io_digest.h"     /** src_digest() */
+#include "mp4_checkpoint.h"
+
+#define CHECKPOINT_VERSION  2
+
+/** a fragment complete: where its bytes are and their digest */
+typedef struct checkpoint_frag_t_
+{
+    int8_t * fn;          /** the file it is in */
+    int64_t  offset;
+    uint64_t size;
+    uint8_t  sha256[32];
+} checkpoint_frag_t;
+
+struct mp4_checkpoint_t_
+{
+    int8_t * fn;          /** of the checkpoint */
+    int8_t * tmp_fn;      /** written aside and renamed */
+    int8_t * cache_fn;    /** the parse cache of an es */
+    uint32_t es_num;
+    uint8_t *key;         /** as the checkpoint starts */
+    size_t   key_size;
+    BOOL     done;
+
+    checkpoint_frag_t *frags;   /** fragment 0 is what comes before the first one */
+    uint32_t           frag_rec_num, frag_rec_max;
+};
+
+static void
+write_string(bbio_handle_t snk, const int8_t *str)
+{
+    uint16_t len = str ? (uint16_t)strlen(str) : 0;
+
+    sink_write_u16(snk, len);
+    snk->write(snk, (const uint8_t *)str, len);
+}
+
+/** NULL if out of memory or src ends */
+static int8_t *
+read_string(bbio_handle_t src)
+{
+    uint16_t len;
+    int8_t * str;
+
+    if (src_rd_u16(src, &len))
+    {
+        return NULL;
+    }
+    str = (int8_t *)MALLOC_CHK((size_t)len + 1);
+    if (str && src->read(src, (uint8_t *)str, len) != len)
+    {
+        FREE_CHK(str);
+        return NULL;
+    }
+    if (str)
+    {
+        str[len] = '\0';
+    }
+    return str;
+}
+
+/** forgets the fragments from frag_num on */
+static void
+frags_drop(mp4_checkpoint_handle_t checkpoint, uint32_t frag_num)
+{
+    while (checkpoint->frag_rec_num > frag_num)
+    {
+        checkpoint->frag_rec_num--;
+        FREE_CHK(checkpoint->frags[checkpoint->frag_rec_num].fn);
+    }
+}
+
+/** room for one more fragment: NULL if out of memory */
+static checkpoint_frag_t *
+frags_add(mp4_checkpoint_handle_t checkpoint)
+{
+    checkpoint_frag_t *frag;
+
+    if (checkpoint->frag_rec_num == checkpoint->frag_rec_max)
+    {
+        checkpoint_frag_t *frags = (checkpoint_frag_t *)REALLOC_CHK(checkpoint->frags,
+                                                                    (checkpoint->frag_rec_max + 64)*sizeof(checkpoint_frag_t));
+        if (!frags)
+        {
+            return NULL;
+        }
+        checkpoint->frags         = frags;
+        checkpoint->frag_rec_max += 64;
+    }
+    frag = &checkpoint->frags[checkpoint->frag_rec_num];
+    memset(frag, 0, sizeof(checkpoint_frag_t));
+
+    return frag;
+}
+
+/** the number of the size bytes from offset on before the first top level 'sidx' among them:
+ *  that one is rewritten as the fragments after it complete */
+static uint64_t
+settled_size(bbio_handle_t src, int64_t offset, uint64_t size)
+{
+    uint64_t pos = 0;
+    uint64_t box_size;
+    uint8_t  hdr[16];
+
+    while (pos + 8 <= size)
+    {
+        if (src->seek(src, offset + (int64_t)pos, SEEK_SET) || src->read(src, hdr, 8) != 8)
+        {
+            break;
+        }
+        if (IS_FOURCC_EQUAL(hdr + 4, "sidx"))
+        {
+            return pos;
+        }
+        box_size = get_BE_u32(hdr);
+        if (box_size == 1)
+        {
+            if (src->read(src, hdr + 8, 8) != 8)
+            {
+                break;
+            }
+            box_size = get_BE_u64(hdr + 8);
+        }
+        if (box_size < 8)
+        {
+            break;
+        }
+        pos += box_size;
+    }
+    return size;
+}
+
+/** the digest of the bytes of frag, but for a 'sidx' and what follows it */
+static int32_t
+frag_digest(const checkpoint_frag_t *frag, digest_t *digest)
+{
+    bbio_handle_t src = reg_bbio_get('f', 'r');
+    int32_t       ret;
+
+    if (!src)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    if (src->open(src, frag->fn))
+    {
+        src->destroy(src);
+        return EMA_MP4_MUXED_OPEN_FILE_ERR;
+    }
+    ret = src_digest(src, frag->offset, settled_size(src, frag->offset, frag->size), digest);
+    src->destroy(src);
+
+    return ret;
+}
+
+/** the job: what the output depends on */
+static int32_t
+write_key(bbio_handle_t snk, const usr_cfg_mux_t *p_usr_cfg_mux, const usr_cfg_es_t *p_usr_cfg_ess)
+{
+    osal_stat_t st;
+    int32_t     es_idx;
+
+    sink_write_4CC(snk, "ckpt");
+    sink_write_u32(snk, CHECKPOINT_VERSION);
+    write_string(snk, p_usr_cfg_mux->output_fn);
+    write_string(snk, p_usr_cfg_mux->major_brand);
+    write_string(snk, p_usr_cfg_mux->compatible_brands);
+    sink_write_u32(snk, p_usr_cfg_mux->output_format);
+    sink_write_u32(snk, p_usr_cfg_mux->dash_profile);
+    sink_write_u32(snk, p_usr_cfg_mux->timescale);
+    sink_write_u32(snk, p_usr_cfg_mux->mux_cfg_flags);
+    sink_write_u32(snk, p_usr_cfg_mux->frag_cfg_flags);
+    sink_write_u32(snk, p_usr_cfg_mux->frag_range_min);
+    sink_write_u32(snk, p_usr_cfg_mux->frag_range_max);
+    sink_write_u32(snk, p_usr_cfg_mux->chunk_span_time);
+    sink_write_u32(snk, p_usr_cfg_mux->ext_timing_info.override_timing);
+    sink_write_u32(snk, p_usr_cfg_mux->ext_timing_info.time_scale);
+    sink_write_u32(snk, p_usr_cfg_mux->ext_timing_info.num_units_in_tick);
+    sink_write_u32(snk, p_usr_cfg_mux->dv_track_mode);
+    sink_write_u32(snk, p_usr_cfg_mux->dv_es_mode);
+
+    sink_write_u32(snk, p_usr_cfg_mux->es_num);
+    for (es_idx = 0; es_idx < p_usr_cfg_mux->es_num; es_idx++)
+    {
+        const usr_cfg_es_t *p_usr_cfg_es = &p_usr_cfg_ess[es_idx];
+
+        if (!p_usr_cfg_es->input_fn || OSAL_STAT(p_usr_cfg_es->input_fn, &st))
+        {
+            msglog(NULL, MSGLOG_ERR, "Checkpoint: can't find es %s\n",
+                   p_usr_cfg_es->input_fn ? p_usr_cfg_es->input_fn : (const int8_t *)"");
+            return EMA_MP4_MUXED_OPEN_FILE_ERR;
+        }
+        write_string(snk, p_usr_cfg_es->input_fn);
+        write_string(snk, p_usr_cfg_es->nal_cfg_fn);
+        sink_write_u64(snk, (uint64_t)st.st_size);
+        sink_write_u64(snk, (uint64_t)st.st_mtime);
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+mp4_checkpoint_handle_t
+mp4_checkpoint_create(const usr_cfg_mux_t *p_usr_cfg_mux, const usr_cfg_es_t *p_usr_cfg_ess)
+{
+    mp4_checkpoint_handle_t checkpoint;
+    bbio_handle_t           snk;
+    int32_t                 ret;
+
+    checkpoint = (mp4_checkpoint_handle_t)MALLOC_CHK(sizeof(mp4_checkpoint_t));
+    if (!checkpoint)
+    {
+        return NULL;
+    }
+    memset(checkpoint, 0, sizeof(mp4_checkpoint_t));
+
+    checkpoint->fn     = (int8_t *)MALLOC_CHK(strlen(p_usr_cfg_mux->output_fn) + 6);
+    checkpoint->tmp_fn = (int8_t *)MALLOC_CHK(strlen(p_usr_cfg_mux->output_fn) + 10);
+    checkpoint->cache_fn = (int8_t *)MALLOC_CHK(strlen(p_usr_cfg_mux->output_fn) + 22);
+    snk                = reg_bbio_get('b', 'w');
+    if (!checkpoint->fn || !checkpoint->tmp_fn || !checkpoint->cache_fn || !snk)
+    {
+        if (snk)
+        {
+            snk->destroy(snk);
+        }
+        mp4_checkpoint_destroy(checkpoint);
+        return NULL;
+    }
+    sprintf(checkpoint->fn, "%s.ckpt", p_usr_cfg_mux->output_fn);
+    sprintf(checkpoint->tmp_fn, "%s.ckpt.tmp", p_usr_cfg_mux->output_fn);
+    checkpoint->es_num = p_usr_cfg_mux->es_num;
+
+    snk->set_buffer(snk, NULL, 256, 1);
+    ret             = write_key(snk, p_usr_cfg_mux, p_usr_cfg_ess);
+    checkpoint->key = snk->get_buffer(snk, &checkpoint->key_size, 0);
+    snk->destroy(snk);
+    if (ret || !checkpoint->key)
+    {
+        mp4_checkpoint_destroy(checkpoint);
+        return NULL;
+    }
+
+    return checkpoint;
+}
+
+void
+mp4_checkpoint_destroy(mp4_checkpoint_handle_t checkpoint)
+{
+    if (!checkpoint)
+    {
+        return;
+    }
+    if (checkpoint->done)
+    {
+        uint32_t es_idx;
+
+        remove(checkpoint->fn);
+        for (es_idx = 0; checkpoint->cache_fn && es_idx < checkpoint->es_num; es_idx++)
+        {
+            remove(mp4_checkpoint_cache_fn(checkpoint, es_idx));
+        }
+    }
+    frags_drop(checkpoint, 0);
+    FREE_CHK(checkpoint->frags);
+    FREE_CHK(checkpoint->key);
+    FREE_CHK(checkpoint->cache_fn);
+    FREE_CHK(checkpoint->tmp_fn);
+    FREE_CHK(checkpoint->fn);
+    FREE_CHK(checkpoint);
+}
+
+BOOL
+mp4_checkpoint_load(mp4_checkpoint_handle_t checkpoint, uint32_t *frag_num, int64_t *size)
+{
+    bbio_handle_t      src = reg_bbio_get('f', 'r');
+    uint8_t *          key = NULL;
+    uint64_t           u64 = 0;
+    BOOL               found = FALSE;
+    checkpoint_frag_t *frag;
+
+    *frag_num = 0;
+    *size     = 0;
+    frags_drop(checkpoint, 0);
+    if (!src)
+    {
+        return FALSE;
+    }
+    if (!src->open(src, checkpoint->fn))
+    {
+        key = (uint8_t *)MALLOC_CHK(checkpoint->key_size);
+        found = key && src->read(src, key, checkpoint->key_size) == checkpoint->key_size &&
+                !memcmp(key, checkpoint->key, checkpoint->key_size) &&
+                !src_rd_u32(src, frag_num) && !src_rd_u64(src, &u64) && (int64_t)u64 >= 0;
+        /** fragments 0 to frag_num */
+        while (found && checkpoint->frag_rec_num <= *frag_num)
+        {
+            frag  = frags_add(checkpoint);
+            found = frag && (frag->fn = read_string(src)) != NULL &&
+                    !src_rd_u64(src, (uint64_t *)&frag->offset) && !src_rd_u64(src, &frag->size) &&
+                    src->read(src, frag->sha256, 32) == 32;
+            if (frag && frag->fn)
+            {
+                checkpoint->frag_rec_num++;
+            }
+        }
+        if (!found)
+        {
+            msglog(NULL, MSGLOG_INFO, "Checkpoint %s is not one of this job\n", checkpoint->fn);
+            frags_drop(checkpoint, 0);
+            *frag_num = 0;
+            u64       = 0;
+        }
+        FREE_CHK(key);
+    }
+    src->destroy(src);
+    *size = (int64_t)u64;
+
+    return found;
+}
+
+BOOL
+mp4_checkpoint_verify(mp4_checkpoint_handle_t checkpoint)
+{
+    digest_t digest;
+    uint32_t u;
+
+    for (u = 0; u < checkpoint->frag_rec_num; u++)
+    {
+        const checkpoint_frag_t *frag = &checkpoint->frags[u];
+
+        if (frag_digest(frag, &digest) != EMA_MP4_MUXED_OK || memcmp(digest.sha256, frag->sha256, 32))
+        {
+            msglog(NULL, MSGLOG_INFO, "Checkpoint: fragment %u in %s is not as it was written\n", u, frag->fn);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+int32_t
+mp4_checkpoint_save(mp4_checkpoint_handle_t checkpoint, const int8_t *fn, uint32_t frag_num, int64_t size)
+{
+    checkpoint_frag_t *prev;
+    checkpoint_frag_t *frag;
+    bbio_handle_t      snk;
+    digest_t           digest;
+    osal_stat_t        st;
+    int32_t            ret;
+    uint32_t           u;
+
+    /** the ones before are recorded */
+    if (frag_num > checkpoint->frag_rec_num)
+    {
+        return EMA_MP4_MUXED_BUGGY;
+    }
+    frags_drop(checkpoint, frag_num);
+    prev = frag_num ? &checkpoint->frags[frag_num - 1] : NULL;
+    frag = frags_add(checkpoint);
+    if (!frag || !(frag->fn = STRDUP_CHK(fn)))
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    checkpoint->frag_rec_num++;
+    frag->offset = (prev && !strcmp(prev->fn, fn)) ? prev->offset + (int64_t)prev->size : 0;
+    if (size < 0)
+    {
+        size = OSAL_STAT(fn, &st) ? 0 : (int64_t)st.st_size;
+    }
+    frag->size = (size > frag->offset) ? (uint64_t)(size - frag->offset) : 0;
+    ret = frag_digest(frag, &digest);
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        msglog(NULL, MSGLOG_WARNING, "Can't read %s back for checkpoint %s\n", fn, checkpoint->fn);
+        frags_drop(checkpoint, frag_num);
+        return ret;
+    }
+    memcpy(frag->sha256, digest.sha256, 32);
+
+    snk = reg_bbio_get('f', 'w');
+    if (!snk)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    if (snk->open(snk, checkpoint->tmp_fn))
+    {
+        msglog(NULL, MSGLOG_WARNING, "Can't write checkpoint %s\n", checkpoint->tmp_fn);
+        snk->destroy(snk);
+        return EMA_MP4_MUXED_OPEN_FILE_ERR;
+    }
+    snk->write(snk, checkpoint->key, checkpoint->key_size);
+    sink_write_u32(snk, frag_num);
+    sink_write_u64(snk, (uint64_t)size);
+    for (u = 0; u <= frag_num; u++)
+    {
+        frag = &checkpoint->frags[u];
+        write_string(snk, frag->fn);
+        sink_write_u64(snk, (uint64_t)frag->offset);
+        sink_write_u64(snk, frag->size);
+        snk->write(snk, frag->sha256, 32);
+    }
+    snk->destroy(snk);
+
+    /** so that no partial checkpoint is ever seen */
+    remove(checkpoint->fn);
+    if (rename(checkpoint->tmp_fn, checkpoint->fn))
+    {
+        msglog(NULL, MSGLOG_WARNING, "Can't write checkpoint %s\n", checkpoint->fn);
+        remove(checkpoint->tmp_fn);
+        return EMA_MP4_MUXED_WRITE_ERR;
+    }
+    msglog(NULL, MSGLOG_DEBUG, "Checkpoint %s: %u fragments, %" PRIi64 " bytes\n", checkpoint->fn, frag_num, size);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+void
+mp4_checkpoint_done(mp4_checkpoint_handle_t checkpoint)
+{
+    checkpoint->done = TRUE;
+}
+
+const int8_t *
+mp4_checkpoint_cache_fn(mp4_checkpoint_handle_t checkpoint, uint32_t es_idx)
+{
+    /** cache_fn is the checkpoint fn, then ".<es_idx>.pidx" */
+    sprintf(checkpoint->cache_fn, "%s.%u.pidx", checkpoint->fn, es_idx);
+    return checkpoint->cache_fn;
+}
+
+BOOL
+mp4_checkpoint_check_file(const int8_t *fn, int64_t size, uint32_t *moov_num, uint32_t *frag_num)
+{
+    bbio_handle_t src = reg_bbio_get('f', 'r');
+    int64_t       src_size;
+    int64_t       pos = 0;
+    uint64_t      box_size;
+    uint8_t       hdr[16];
+    uint8_t       prev[4] = { 0, 0, 0, 0 };
+
+    *moov_num = 0;
+    *frag_num = 0;
+    if (!src)
+    {
+        return FALSE;
+    }
+    if (src->open(src, fn))
+    {
+        src->destroy(src);
+        return FALSE;
+    }
+    src_size = src->size(src);
+    if (size < 0)
+    {
+        size = src_size;
+    }
+
+    while (pos < size && size <= src_size)
+    {
+        uint32_t hdr_size = 8;
+
+        if (src->seek(src, pos, SEEK_SET) || src->read(src, hdr, 8) != 8)
+        {
+            break;
+        }
+        box_size = get_BE_u32(hdr);
+        if (box_size == 1)
+        {
+            if (src->read(src, hdr + 8, 8) != 8)
+            {
+                break;
+            }
+            box_size = get_BE_u64(hdr + 8);
+            hdr_size = 16;
+        }
+        /** 0: up to the end of the file, which can't be told complete */
+        if (box_size < hdr_size || box_size > (uint64_t)(size - pos))
+        {
+            break;
+        }
+
+        if (IS_FOURCC_EQUAL(hdr + 4, "moov"))
+        {
+            (*moov_num)++;
+        }
+        else if (IS_FOURCC_EQUAL(hdr + 4, "mdat") && IS_FOURCC_EQUAL(prev, "moof"))
+        {
+            (*frag_num)++;
+        }
+        memcpy(prev, hdr + 4, 4);
+        pos += (int64_t)box_size;
+    }
+    src->destroy(src);
+
+    return size > 0 && pos == size;
+}
@@ -0,0 +1,579 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4_demux.c
+    @brief Implements the reading of the sample tables of an mp4 file
+*/
+
+#include "utils.h"
+#include "mp4_demux.h"
+#include "mp4_stream.h"
+
+BOOL
+mp4_demux_next_box(const uint8_t **p, const uint8_t *end, const uint8_t **type, const uint8_t **payload, size_t *payload_size)
+{
+    const uint8_t *box  = *p;
+    uint64_t       size;
+    uint32_t       hdr_size = 8;
+
+    if (end - box < 8)
+    {
+        return FALSE;
+    }
+    size  = get_BE_u32(box);
+    *type = box + 4;
+    if (size == 1)
+    {
+        if (end - box < 16)
+        {
+            return FALSE;
+        }
+        size     = get_BE_u64(box + 8);
+        hdr_size = 16;
+    }
+    else if (size == 0)
+    {
+        /** up to the end of the parent */
+        size = (uint64_t)(end - box);
+    }
+    if (size < hdr_size || size > (uint64_t)(end - box))
+    {
+        return FALSE;
+    }
+
+    *payload      = box + hdr_size;
+    *payload_size = (size_t)size - hdr_size;
+    *p            = box + size;
+    return TRUE;
+}
+
+const uint8_t *
+mp4_demux_find_box(const uint8_t *buf, size_t size, const int8_t *type, size_t *payload_size)
+{
+    const uint8_t *p   = buf;
+    const uint8_t *end = buf + size;
+    const uint8_t *box_type;
+    const uint8_t *payload;
+
+    while (mp4_demux_next_box(&p, end, &box_type, &payload, payload_size))
+    {
+        if (IS_FOURCC_EQUAL(box_type, type))
+        {
+            return payload;
+        }
+    }
+    return NULL;
+}
+
+/** Copies size bytes of table data */
+static int32_t
+copy_tbl_data(box_data_tbl_t *tbl, const uint8_t *data, size_t size)
+{
+    tbl->size = size;
+    tbl->data = (uint8_t *)MALLOC_CHK(size + 1);
+    if (!tbl->data)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memcpy(tbl->data, data, size);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/** Copies a full box table: version_flag and entry_count ahead of entry_count entries of entry_size.
+ *  entry_size 0: the entries are boxes, kept as they are */
+static int32_t
+read_tbl(box_data_tbl_t *tbl, const uint8_t *payload, size_t size, uint32_t entry_size)
+{
+    if (size < 8)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    tbl->version_flag = get_BE_u32(payload);
+    tbl->entry_count  = get_BE_u32(payload + 4);
+    if (!entry_size)
+    {
+        return copy_tbl_data(tbl, payload + 8, size - 8);
+    }
+    if ((uint64_t)tbl->entry_count * entry_size > size - 8)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    return copy_tbl_data(tbl, payload + 8, (size_t)tbl->entry_count * entry_size);
+}
+
+/** 'stsz' or 'stz2' */
+static int32_t
+read_stsz(stream_handle_t stream, const uint8_t *payload, size_t size, BOOL compact)
+{
+    box_data_tbl_t *stsz = &(stream->stsz);
+    uint64_t        field_bits;
+
+    if (size < 12)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    stsz->version_flag = get_BE_u32(payload);
+    stsz->variant      = compact;
+    if (compact)
+    {
+        stsz->add_info = payload[7];  /** field_size */
+        if (stsz->add_info != 4 && stsz->add_info != 8 && stsz->add_info != 16)
+        {
+            return EMA_MP4_MUXED_MP4_ERR;
+        }
+    }
+    else
+    {
+        stsz->add_info = get_BE_u32(payload + 4);  /** sample_size: 0 if the sizes follow */
+    }
+    stream->sample_num = stsz->entry_count = get_BE_u32(payload + 8);
+
+    field_bits = (compact) ? stsz->add_info : ((stsz->add_info) ? 0 : 32);
+    if ((field_bits * stsz->entry_count + 7) >> 3 > size - 12)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    return copy_tbl_data(stsz, payload + 12, (size_t)((field_bits * stsz->entry_count + 7) >> 3));
+}
+
+/** Checks the tables are consistent so the accessors never run off them */
+static int32_t
+check_stream(stream_handle_t stream)
+{
+    box_data_tbl_t *stsc       = &(stream->stsc);
+    uint32_t        chunk_num  = stream->stco.entry_count;
+    uint64_t        sample_num = 0;
+    uint32_t        u;
+
+    if (!stream->sample_num)
+    {
+        return EMA_MP4_MUXED_OK;
+    }
+    if (!stream->stsd.entry_count || !stsc->entry_count || !stream->stts.entry_count)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    for (u = 0; u < stsc->entry_count; u++)
+    {
+        uint32_t first_chunk       = get_BE_u32(stsc->data + 12*u);
+        uint32_t samples_per_chunk = get_BE_u32(stsc->data + 12*u + 4);
+        uint32_t sd_idx            = get_BE_u32(stsc->data + 12*u + 8);
+        uint32_t first_chunk_next  = (u + 1 < stsc->entry_count) ? get_BE_u32(stsc->data + 12*(u + 1)) : chunk_num + 1;
+
+        if (!first_chunk || first_chunk_next <= first_chunk || first_chunk_next > chunk_num + 1 ||
+            !samples_per_chunk || !sd_idx || sd_idx > stream->stsd.entry_count)
+        {
+            return EMA_MP4_MUXED_MP4_ERR;
+        }
+        sample_num += (uint64_t)(first_chunk_next - first_chunk)*samples_per_chunk;
+    }
+    if (sample_num < stream->sample_num)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    for (u = 0; u < stream->sample_num; u++)
+    {
+        uint32_t size = stream_get_sample_size(stream, u);
+
+        if (stream->sample_max_size < size)
+        {
+            stream->sample_max_size = size;
+        }
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+/** 'stbl' */
+static int32_t
+read_stbl(stream_handle_t stream, const uint8_t *buf, size_t size)
+{
+    const uint8_t *p   = buf;
+    const uint8_t *end = buf + size;
+    const uint8_t *type;
+    const uint8_t *payload;
+    size_t         payload_size;
+    int32_t        ret = EMA_MP4_MUXED_OK;
+
+    while (ret == EMA_MP4_MUXED_OK && mp4_demux_next_box(&p, end, &type, &payload, &payload_size))
+    {
+        if (IS_FOURCC_EQUAL(type, "stsd"))
+        {
+            ret = read_tbl(&(stream->stsd), payload, payload_size, 0);
+            if (ret == EMA_MP4_MUXED_OK && stream->stsd.size >= 8)
+            {
+                FOURCC_ASSIGN(stream->codingname, stream->stsd.data + 4);
+            }
+        }
+        else if (IS_FOURCC_EQUAL(type, "stts"))
+        {
+            ret = read_tbl(&(stream->stts), payload, payload_size, 8);
+        }
+        else if (IS_FOURCC_EQUAL(type, "ctts"))
+        {
+            ret = read_tbl(&(stream->ctts), payload, payload_size, 8);
+        }
+        else if (IS_FOURCC_EQUAL(type, "stss"))
+        {
+            ret = read_tbl(&(stream->stss), payload, payload_size, 4);
+        }
+        else if (IS_FOURCC_EQUAL(type, "stsc"))
+        {
+            ret = read_tbl(&(stream->stsc), payload, payload_size, 12);
+        }
+        else if (IS_FOURCC_EQUAL(type, "stco"))
+        {
+            ret = read_tbl(&(stream->stco), payload, payload_size, 4);
+        }
+        else if (IS_FOURCC_EQUAL(type, "co64"))
+        {
+            ret = read_tbl(&(stream->stco), payload, payload_size, 8);
+            stream->stco.variant = TRUE;
+        }
+        else if (IS_FOURCC_EQUAL(type, "stsz") || IS_FOURCC_EQUAL(type, "stz2"))
+        {
+            ret = read_stsz(stream, payload, payload_size, IS_FOURCC_EQUAL(type, "stz2"));
+        }
+        else if (IS_FOURCC_EQUAL(type, "sdtp") && payload_size >= 4)
+        {
+            /** one byte per sample, no entry_count */
+            stream->sdtp.version_flag = get_BE_u32(payload);
+            ret = copy_tbl_data(&(stream->sdtp), payload + 4, payload_size - 4);
+        }
+    }
+
+    return (ret == EMA_MP4_MUXED_OK) ? check_stream(stream) : ret;
+}
+
+/** 'trak' */
+static int32_t
+read_trak(stream_handle_t stream, const uint8_t *buf, size_t size)
+{
+    const uint8_t *tkhd, *mdia, *mdhd, *hdlr, *minf, *stbl;
+    size_t         tkhd_size, mdia_size, mdhd_size, hdlr_size, minf_size, stbl_size;
+    uint32_t       handler_type;
+
+    tkhd = mp4_demux_find_box(buf, size, "tkhd", &tkhd_size);
+    mdia = mp4_demux_find_box(buf, size, "mdia", &mdia_size);
+    mdhd = (mdia) ? mp4_demux_find_box(mdia, mdia_size, "mdhd", &mdhd_size) : NULL;
+    hdlr = (mdia) ? mp4_demux_find_box(mdia, mdia_size, "hdlr", &hdlr_size) : NULL;
+    minf = (mdia) ? mp4_demux_find_box(mdia, mdia_size, "minf", &minf_size) : NULL;
+    stbl = (minf) ? mp4_demux_find_box(minf, minf_size, "stbl", &stbl_size) : NULL;
+    if (!tkhd || !mdhd || !hdlr || !stbl || hdlr_size < 12)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    /** tkhd: the fields behind duration are at the same place from there on */
+    stream->flags = get_BE_u32(tkhd) & 0xFFFFFF;
+    if (tkhd[0] == 1 && tkhd_size >= 96)
+    {
+        stream->track_ID = get_BE_u32(tkhd + 20);
+        tkhd += 12;
+    }
+    else if (tkhd[0] == 0 && tkhd_size >= 84)
+    {
+        stream->track_ID = get_BE_u32(tkhd + 12);
+    }
+    else
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    stream->alternate_group = (uint16_t)get_BE_u16(tkhd + 34);
+    stream->volume          = (int16_t)get_BE_u16(tkhd + 36);
+    stream->visual_width    = get_BE_u32(tkhd + 76) >> 16;
+    stream->visual_height   = get_BE_u32(tkhd + 80) >> 16;
+
+    /** mdhd */
+    if (mdhd[0] == 1 && mdhd_size >= 36)
+    {
+        stream->media_creation_time     = get_BE_u64(mdhd + 4);
+        stream->media_modification_time = get_BE_u64(mdhd + 12);
+        stream->media_timescale         = get_BE_u32(mdhd + 20);
+        stream->media_duration          = get_BE_u64(mdhd + 24);
+        mdhd += 12;
+    }
+    else if (mdhd[0] == 0 && mdhd_size >= 24)
+    {
+        stream->media_creation_time     = get_BE_u32(mdhd + 4);
+        stream->media_modification_time = get_BE_u32(mdhd + 8);
+        stream->media_timescale         = get_BE_u32(mdhd + 12);
+        stream->media_duration          = get_BE_u32(mdhd + 16);
+    }
+    else
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    {
+        /** packed ISO-639-2/T: three 5 bit letters */
+        uint32_t lang = get_BE_u16(mdhd + 20);
+
+        stream->language[0] = (int8_t)(((lang >> 10) & 0x1F) + 0x60);
+        stream->language[1] = (int8_t)(((lang >>  5) & 0x1F) + 0x60);
+        stream->language[2] = (int8_t)(( lang        & 0x1F) + 0x60);
+        stream->language[3] = '\0';
+    }
+    if (!stream->media_timescale)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    /** hdlr */
+    handler_type = get_BE_u32(hdlr + 8);
+    switch (handler_type)
+    {
+    case 0x76696465: stream->stream_type = STREAM_TYPE_VIDEO;    break;  /** vide */
+    case 0x736F756E: stream->stream_type = STREAM_TYPE_AUDIO;    break;  /** soun */
+    case 0x74657874: stream->stream_type = STREAM_TYPE_TEXT;     break;  /** text */
+    case 0x7362746C:                                                     /** sbtl */
+    case 0x73756274: stream->stream_type = STREAM_TYPE_SUBTITLE; break;  /** subt */
+    case 0x6D657461: stream->stream_type = STREAM_TYPE_META;     break;  /** meta */
+    case 0x68696E74: stream->stream_type = STREAM_TYPE_HINT;     break;  /** hint */
+    default:         stream->stream_type = STREAM_TYPE_UNKNOWN;  break;
+    }
+
+    return read_stbl(stream, stbl, stbl_size);
+}
+
+/** 'moov' */
+static int32_t
+read_moov(mp4_ctrl_handle_t demuxer, const uint8_t *buf, size_t size)
+{
+    const uint8_t *p   = buf;
+    const uint8_t *end = buf + size;
+    const uint8_t *type;
+    const uint8_t *payload;
+    size_t         payload_size;
+    int32_t        ret;
+
+    while (mp4_demux_next_box(&p, end, &type, &payload, &payload_size))
+    {
+        if (IS_FOURCC_EQUAL(type, "mvhd"))
+        {
+            if (payload[0] == 1 && payload_size >= 32)
+            {
+                demuxer->timescale = get_BE_u32(payload + 20);
+                demuxer->duration  = get_BE_u64(payload + 24);
+            }
+            else if (payload_size >= 20)
+            {
+                demuxer->timescale = get_BE_u32(payload + 12);
+                demuxer->duration  = get_BE_u32(payload + 16);
+            }
+        }
+        else if (IS_FOURCC_EQUAL(type, "mvex"))
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Fragmented mp4 file input is not supported\n");
+            return EMA_MP4_MUXED_NO_SUPPORT;
+        }
+        else if (IS_FOURCC_EQUAL(type, "trak"))
+        {
+            stream_handle_t stream;
+
+            if (demuxer->stream_num == MAX_STREAMS)
+            {
+                return EMA_MP4_MUXED_TOO_MANY_ES;
+            }
+            stream = (stream_handle_t)MALLOC_CHK(sizeof(stream_t));
+            if (!stream)
+            {
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+            memset(stream, 0, sizeof(stream_t));
+            stream->mp4_ctrl = demuxer;
+            stream->strm_idx = demuxer->stream_num;
+            demuxer->tracks[demuxer->stream_num++] = stream;
+
+            ret = read_trak(stream, payload, payload_size);
+            if (ret != EMA_MP4_MUXED_OK)
+            {
+                msglog(NULL, MSGLOG_ERR, "ERROR! Track %u of the mp4 file: broken or inconsistent sample tables\n",
+                       stream->track_ID);
+                return ret;
+            }
+        }
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/********************* demux API ****************************/
+uint8_t *
+mp4_demux_load_moov(bbio_handle_t src, int64_t *pos, uint64_t *box_size, size_t *payload_size)
+{
+    int64_t src_size = src->size(src);
+
+    /** top level: only 'moov' is read */
+    for (*pos = 0; *pos + 8 <= src_size; *pos += (int64_t)*box_size)
+    {
+        uint8_t  hdr[16];
+        uint8_t *moov;
+        uint32_t hdr_size = 8;
+
+        if (src->seek(src, *pos, SEEK_SET) || src->read(src, hdr, 8) != 8)
+        {
+            break;
+        }
+        *box_size = get_BE_u32(hdr);
+        if (*box_size == 1)
+        {
+            if (src->read(src, hdr + 8, 8) != 8)
+            {
+                break;
+            }
+            *box_size = get_BE_u64(hdr + 8);
+            hdr_size  = 16;
+        }
+        else if (*box_size == 0)
+        {
+            *box_size = (uint64_t)(src_size - *pos);
+        }
+        if (*box_size < hdr_size || *box_size > (uint64_t)(src_size - *pos))
+        {
+            break;
+        }
+
+        if (IS_FOURCC_EQUAL(hdr + 4, "moov"))
+        {
+            *payload_size = (size_t)(*box_size - hdr_size);
+            moov          = (uint8_t *)MALLOC_CHK(*payload_size + 1);
+            if (!moov)
+            {
+                msglog(NULL, MSGLOG_ERR, "ERROR: no memory\n");
+                return NULL;
+            }
+            if (src->read(src, moov, *payload_size) != *payload_size)
+            {
+                FREE_CHK(moov);
+                return NULL;
+            }
+            return moov;
+        }
+    }
+    return NULL;
+}
+
+mp4_ctrl_handle_t
+mp4_demux_create(bbio_handle_t src)
+{
+    mp4_ctrl_handle_t demuxer;
+    uint8_t *         moov;
+    size_t            moov_size;
+    int64_t           moov_pos;
+    uint64_t          moov_box_size;
+    int32_t           ret;
+
+    moov = mp4_demux_load_moov(src, &moov_pos, &moov_box_size, &moov_size);
+    if (!moov)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! No 'moov' box found in the mp4 file\n");
+        return NULL;
+    }
+
+    demuxer = (mp4_ctrl_handle_t)MALLOC_CHK(sizeof(mp4_ctrl_t));
+    if (!demuxer)
+    {
+        FREE_CHK(moov);
+        msglog(NULL, MSGLOG_ERR, "ERROR: no memory\n");
+        return NULL;
+    }
+    memset(demuxer, 0, sizeof(mp4_ctrl_t));
+    demuxer->destroy    = mp4_demux_destroy;
+    demuxer->demux_flag = 1;
+    demuxer->mp4_src    = src;
+
+    ret = read_moov(demuxer, moov, moov_size);
+    FREE_CHK(moov);
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        mp4_demux_destroy(demuxer);
+        return NULL;
+    }
+    demuxer->moov_parsed = TRUE;
+
+    return demuxer;
+}
+
+void
+mp4_demux_destroy(mp4_ctrl_handle_t demuxer)
+{
+    uint32_t u;
+
+    if (demuxer)
+    {
+        for (u = 0; u < demuxer->stream_num; u++)
+        {
+            stream_destroy(demuxer->tracks[u]);
+        }
+        FREE_CHK(demuxer);
+    }
+}
+
+stream_handle_t
+mp4_demux_get_stream(mp4_ctrl_handle_t demuxer, uint32_t track_ID)
+{
+    uint32_t u;
+
+    for (u = 0; u < demuxer->stream_num; u++)
+    {
+        if (!track_ID || demuxer->tracks[u]->track_ID == track_ID)
+        {
+            return demuxer->tracks[u];
+        }
+    }
+    return NULL;
+}
+
+const uint8_t *
+mp4_demux_get_sample_entry(stream_handle_t stream, uint32_t sd_idx, uint32_t *size)
+{
+    const uint8_t *entry = stream->stsd.data;
+    const uint8_t *end   = entry + stream->stsd.size;
+    uint32_t       u;
+
+    if (!sd_idx || sd_idx > stream->stsd.entry_count)
+    {
+        return NULL;
+    }
+    for (u = 1; ; u++)
+    {
+        if (end - entry < 8)
+        {
+            return NULL;
+        }
+        *size = get_BE_u32(entry);
+        if (*size < 8 || *size > (uint64_t)(end - entry))
+        {
+            return NULL;
+        }
+        if (u == sd_idx)
+        {
+            return entry;
+        }
+        entry += *size;
+    }
+}
@@ -0,0 +1,709 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4_extract.c
+    @brief Implements the extraction of tracks of an mp4 file to elementary streams
+*/
+
+#include "utils.h"
+#include "mp4_extract.h"
+#include "mp4_demux.h"
+#include "mp4_stream.h"
+
+#define EXTRACT_READ_SIZE  (8 << 20)    /** the most bytes read at once, unless a single sample is larger */
+#define EXTRACT_GAP_SIZE   (256 << 10)  /** the most bytes of other data a read goes through instead of seeking */
+
+/** the sample entries of which the elementary stream is known */
+static const struct
+{
+    const int8_t *codingname;
+    stream_id_t   stream_id;
+    const int8_t *es_ext;
+} extract_codecs[] = {
+    {"avc1", STREAM_ID_H264, "h264"}, {"avc3", STREAM_ID_H264, "h264"},
+    {"dva1", STREAM_ID_H264, "h264"}, {"dvav", STREAM_ID_H264, "h264"},
+    {"hvc1", STREAM_ID_HEVC, "h265"}, {"hev1", STREAM_ID_HEVC, "h265"},
+    {"dvh1", STREAM_ID_HEVC, "h265"}, {"dvhe", STREAM_ID_HEVC, "h265"},
+    {"ac-3", STREAM_ID_AC3,  "ac3"},  {"ec-3", STREAM_ID_EC3,  "ec3"},
+    {"ac-4", STREAM_ID_AC4,  "ac4"},  {"mp4a", STREAM_ID_AAC,  "aac"}
+};
+
+static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+typedef struct extract_track_t_
+{
+    stream_handle_t stream;
+    bbio_handle_t   snk;
+    stream_id_t     stream_id;
+    uint32_t        sd_idx;        /** of the sample entry below, 0 before the first sample */
+    uint32_t        nal_len_size;  /** H264/H265: size of the NAL unit length fields */
+    uint8_t *       ps;            /** H264/H265: the NAL units of the decoder config, Annex B */
+    size_t          ps_size, ps_max;
+    uint32_t        profile, sfi, chan;  /** AAC: the ADTS header fields the AudioSpecificConfig gives */
+} extract_track_t;
+
+/** samples of a chunk, read at once */
+typedef struct extract_piece_t_
+{
+    uint64_t offset;
+    uint64_t size;
+    uint32_t track_idx;
+    uint32_t sample_idx;  /** the first one */
+    uint32_t sample_num;
+    uint32_t sd_idx;
+} extract_piece_t;
+
+static stream_id_t
+get_codec(const int8_t *codingname, const int8_t **es_ext)
+{
+    uint32_t u;
+
+    for (u = 0; u < sizeof(extract_codecs)/sizeof(extract_codecs[0]); u++)
+    {
+        if (IS_FOURCC_EQUAL(codingname, extract_codecs[u].codingname))
+        {
+            if (es_ext)
+            {
+                *es_ext = extract_codecs[u].es_ext;
+            }
+            return extract_codecs[u].stream_id;
+        }
+    }
+    return STREAM_ID_UNKNOWN;
+}
+
+static uint32_t
+read_bits(const uint8_t *buf, size_t size, uint32_t *bit_pos, uint32_t bit_num)
+{
+    uint32_t val = 0;
+
+    for (; bit_num; bit_num--, (*bit_pos)++)
+    {
+        size_t byte = *bit_pos >> 3;
+
+        val = (val << 1) | ((byte < size) ? (buf[byte] >> (7 - (*bit_pos & 7))) & 1 : 0);
+    }
+    return val;
+}
+
+/** Reads the tag and size of the descriptor at *p and moves *p to its payload */
+static BOOL
+read_descr(const uint8_t **p, const uint8_t *end, uint8_t *tag, size_t *size)
+{
+    uint32_t u;
+
+    if (end - *p < 2)
+    {
+        return FALSE;
+    }
+    *tag  = *(*p)++;
+    *size = 0;
+    for (u = 0; u < 4 && *p < end; u++)
+    {
+        uint8_t byte = *(*p)++;
+
+        *size = (*size << 7) | (byte & 0x7F);
+        if (!(byte & 0x80))
+        {
+            return *size <= (size_t)(end - *p);
+        }
+    }
+    return FALSE;
+}
+
+/** Appends count NAL units, each behind a 16 bit size, at *p to the parameter sets */
+static int32_t
+add_ps(extract_track_t *track, const uint8_t **p, const uint8_t *end, uint32_t count)
+{
+    for (; count; count--)
+    {
+        size_t size;
+
+        if (end - *p < 2 || (size = get_BE_u16(*p)) > (size_t)(end - *p - 2))
+        {
+            return EMA_MP4_MUXED_MP4_ERR;
+        }
+        if (track->ps_size + sizeof(start_code) + size > track->ps_max)
+        {
+            track->ps_max = 2*(track->ps_size + sizeof(start_code) + size);
+            track->ps     = (uint8_t *)REALLOC_CHK(track->ps, track->ps_max);
+            if (!track->ps)
+            {
+                return EMA_MP4_MUXED_NO_MEM;
+            }
+        }
+        memcpy(track->ps + track->ps_size, start_code, sizeof(start_code));
+        memcpy(track->ps + track->ps_size + sizeof(start_code), *p + 2, size);
+        track->ps_size += sizeof(start_code) + size;
+        *p             += 2 + size;
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+/** The ADTS header fields from the 'esds' of an AAC sample entry */
+static int32_t
+load_esds(extract_track_t *track, const uint8_t *esds, size_t esds_size)
+{
+    const uint8_t *p   = esds + 4;  /** behind version and flags */
+    const uint8_t *end = esds + esds_size;
+    uint8_t        tag, flags;
+    size_t         size;
+    uint32_t       bit_pos = 0;
+    uint32_t       aot;
+
+    /** ES_Descriptor, DecoderConfigDescriptor, DecoderSpecificInfo */
+    if (esds_size < 4 || !read_descr(&p, end, &tag, &size) || tag != 0x03 || size < 3)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    end   = p + size;
+    flags = p[2];
+    p    += 3;
+    p    += (flags & 0x80) ? 2 : 0;                        /** dependsOn_ES_ID */
+    p    += (flags & 0x40 && p < end) ? 1 + p[0] : 0;      /** URL */
+    p    += (flags & 0x20) ? 2 : 0;                        /** OCR_ES_Id */
+    if (p > end || !read_descr(&p, end, &tag, &size) || tag != 0x04 || size < 13)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    if (p[0] != 0x40 && p[0] != 0x66 && p[0] != 0x67 && p[0] != 0x68)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! 'mp4a' track with objectTypeIndication 0x%02x is no AAC\n", p[0]);
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    end = p + size;
+    p  += 13;
+    if (!read_descr(&p, end, &tag, &size) || tag != 0x05 || size < 2)
+    {
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    /** AudioSpecificConfig: the core of explicitly signaled SBR/PS is what ADTS carries */
+    aot          = read_bits(p, size, &bit_pos, 5);
+    track->sfi   = read_bits(p, size, &bit_pos, 4);
+    track->chan  = read_bits(p, size, &bit_pos, 4);
+    if ((aot == 5 || aot == 29) && track->sfi != 0xF)
+    {
+        if (read_bits(p, size, &bit_pos, 4) == 0xF)
+        {
+            read_bits(p, size, &bit_pos, 24);
+        }
+        aot = read_bits(p, size, &bit_pos, 5);
+    }
+    if (aot < 1 || aot > 4 || track->sfi == 0xF || !track->chan || track->chan > 7)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! AAC config (object type %u, frequency index %u, channel config %u) "
+               "has no ADTS header\n", aot, track->sfi, track->chan);
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    track->profile = aot - 1;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/** Takes what the samples of sample entry sd_idx need ahead of them from the entry */
+static int32_t
+load_sample_entry(extract_track_t *track, uint32_t sd_idx)
+{
+    stream_handle_t stream = track->stream;
+    const uint8_t * entry;
+    const uint8_t * config;
+    const uint8_t * p;
+    const uint8_t * end;
+    uint32_t        entry_size;
+    uint32_t        hdr_size = (stream->stream_type == STREAM_TYPE_VIDEO) ? 86 : 36;
+    size_t          config_size;
+    uint32_t        u, n;
+    int32_t         ret = EMA_MP4_MUXED_OK;
+
+    entry = mp4_demux_get_sample_entry(stream, sd_idx, &entry_size);
+    if (!entry || entry_size < hdr_size || get_codec(entry + 4, NULL) != track->stream_id)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Track %u: sample entry %u is broken or of another codec\n",
+               stream->track_ID, sd_idx);
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    track->sd_idx  = sd_idx;
+    track->ps_size = 0;
+
+    switch (track->stream_id)
+    {
+    case STREAM_ID_H264:
+        config = mp4_demux_find_box(entry + hdr_size, entry_size - hdr_size, "avcC", &config_size);
+        if (!config || config_size < 7)
+        {
+            return EMA_MP4_MUXED_MP4_ERR;
+        }
+        track->nal_len_size = (config[4] & 0x3) + 1;
+        p   = config + 6;
+        end = config + config_size;
+        ret = add_ps(track, &p, end, config[5] & 0x1F);  /** SPS */
+        if (ret == EMA_MP4_MUXED_OK && p < end)
+        {
+            n   = *p++;
+            ret = add_ps(track, &p, end, n);  /** PPS */
+        }
+        else if (ret == EMA_MP4_MUXED_OK)
+        {
+            ret = EMA_MP4_MUXED_MP4_ERR;
+        }
+        break;
+
+    case STREAM_ID_HEVC:
+        config = mp4_demux_find_box(entry + hdr_size, entry_size - hdr_size, "hvcC", &config_size);
+        if (!config || config_size < 23)
+        {
+            return EMA_MP4_MUXED_MP4_ERR;
+        }
+        track->nal_len_size = (config[21] & 0x3) + 1;
+        p   = config + 23;
+        end = config + config_size;
+        n   = config[22];
+        for (u = 0; u < n && ret == EMA_MP4_MUXED_OK; u++)
+        {
+            if (end - p < 3)
+            {
+                return EMA_MP4_MUXED_MP4_ERR;
+            }
+            p  += 3;
+            ret = add_ps(track, &p, end, get_BE_u16(p - 2));
+        }
+        break;
+
+    case STREAM_ID_AAC:
+        config = mp4_demux_find_box(entry + hdr_size, entry_size - hdr_size, "esds", &config_size);
+        ret    = (config) ? load_esds(track, config, config_size) : EMA_MP4_MUXED_MP4_ERR;
+        break;
+
+    default:
+        break;
+    }
+
+    if (ret == EMA_MP4_MUXED_MP4_ERR)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Track %u: broken decoder config in sample entry %u\n",
+               stream->track_ID, sd_idx);
+    }
+    return ret;
+}
+
+/** Writes a H264/H265 sample as Annex B, its decoder config ahead, after an AUD, if it is a sync sample without one */
+static int32_t
+write_nal_sample(extract_track_t *track, uint32_t sample_idx, const uint8_t *data, uint32_t size)
+{
+    bbio_handle_t  snk     = track->snk;
+    const uint8_t *p;
+    const uint8_t *end     = data + size;
+    BOOL           has_sps = FALSE;
+    BOOL           ps_due;
+
+    for (p = data; p < end; )
+    {
+        uint32_t nal_size = 0;
+        uint32_t u;
+
+        if ((size_t)(end - p) < track->nal_len_size)
+        {
+            return EMA_MP4_MUXED_ES_ERR;
+        }
+        for (u = 0; u < track->nal_len_size; u++)
+        {
+            nal_size = (nal_size << 8) | *p++;
+        }
+        if (!nal_size || nal_size > (size_t)(end - p))
+        {
+            return EMA_MP4_MUXED_ES_ERR;
+        }
+        if (track->stream_id == STREAM_ID_H264)
+        {
+            has_sps |= (p[0] & 0x1F) == 7;
+        }
+        else
+        {
+            has_sps |= ((p[0] >> 1) & 0x3F) == 33;
+        }
+        p += nal_size;
+    }
+
+    /** the parameter sets go after an access unit delimiter, which is the first NAL unit of an AU */
+    ps_due = !has_sps && stream_get_prev_sync_sample_idx(track->stream, sample_idx) == sample_idx;
+    for (p = data; p < end; )
+    {
+        uint32_t nal_size = 0;
+        uint32_t u;
+        BOOL     aud;
+
+        for (u = 0; u < track->nal_len_size; u++)
+        {
+            nal_size = (nal_size << 8) | *p++;
+        }
+        aud = (track->stream_id == STREAM_ID_H264) ? (p[0] & 0x1F) == 9 : ((p[0] >> 1) & 0x3F) == 35;
+        if (ps_due && !aud)
+        {
+            if (snk->write(snk, track->ps, track->ps_size) != track->ps_size)
+            {
+                return EMA_MP4_MUXED_WRITE_ERR;
+            }
+            ps_due = FALSE;
+        }
+        if (snk->write(snk, start_code, sizeof(start_code)) != sizeof(start_code) ||
+            snk->write(snk, p, nal_size) != nal_size)
+        {
+            return EMA_MP4_MUXED_WRITE_ERR;
+        }
+        p += nal_size;
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+write_sample(extract_track_t *track, uint32_t sample_idx, const uint8_t *data, uint32_t size)
+{
+    bbio_handle_t snk = track->snk;
+    uint8_t       hdr[7];
+    size_t        hdr_size = 0;
+
+    switch (track->stream_id)
+    {
+    case STREAM_ID_H264:
+    case STREAM_ID_HEVC:
+        return write_nal_sample(track, sample_idx, data, size);
+
+    case STREAM_ID_AAC:
+        /** MPEG-4, no CRC, VBR, one raw_data_block */
+        if (size + 7 > 0x1FFF)
+        {
+            return EMA_MP4_MUXED_ES_ERR;
+        }
+        hdr[0]   = 0xFF;
+        hdr[1]   = 0xF1;
+        hdr[2]   = (uint8_t)((track->profile << 6) | (track->sfi << 2) | (track->chan >> 2));
+        hdr[3]   = (uint8_t)(((track->chan & 0x3) << 6) | ((size + 7) >> 11));
+        hdr[4]   = (uint8_t)((size + 7) >> 3);
+        hdr[5]   = (uint8_t)((((size + 7) & 0x7) << 5) | 0x1F);
+        hdr[6]   = 0xFC;
+        hdr_size = 7;
+        break;
+
+    case STREAM_ID_AC4:
+        /** ac4_syncframe without CRC */
+        hdr[0] = 0xAC;
+        hdr[1] = 0x40;
+        if (size < 0xFFFF)
+        {
+            hdr[2]   = (uint8_t)(size >> 8);
+            hdr[3]   = (uint8_t)size;
+            hdr_size = 4;
+        }
+        else if (size <= 0xFFFFFF)
+        {
+            hdr[2]   = 0xFF;
+            hdr[3]   = 0xFF;
+            hdr[4]   = (uint8_t)(size >> 16);
+            hdr[5]   = (uint8_t)(size >> 8);
+            hdr[6]   = (uint8_t)size;
+            hdr_size = 7;
+        }
+        else
+        {
+            return EMA_MP4_MUXED_ES_ERR;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if ((hdr_size && snk->write(snk, hdr, hdr_size) != hdr_size) || snk->write(snk, data, size) != size)
+    {
+        return EMA_MP4_MUXED_WRITE_ERR;
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+static int32_t
+add_piece(extract_piece_t **pieces, uint32_t *piece_num, uint32_t *piece_max, const extract_piece_t *piece)
+{
+    if (*piece_num == *piece_max)
+    {
+        *piece_max = (*piece_max) ? 2*(*piece_max) : 256;
+        *pieces    = (extract_piece_t *)REALLOC_CHK(*pieces, *piece_max*sizeof(extract_piece_t));
+        if (!*pieces)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+    }
+    (*pieces)[(*piece_num)++] = *piece;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/** One piece per chunk of the track, chunks over EXTRACT_READ_SIZE cut at sample boundaries */
+static int32_t
+plan_track(extract_piece_t **pieces, uint32_t *piece_num, uint32_t *piece_max, uint32_t track_idx,
+           stream_handle_t stream)
+{
+    box_data_tbl_t *stsc       = &(stream->stsc);
+    uint32_t        sample_idx = 0;
+    uint32_t        chunk_idx, stsc_idx = 0;
+    int32_t         ret;
+
+    for (chunk_idx = 0; sample_idx < stream->sample_num; chunk_idx++)
+    {
+        extract_piece_t piece;
+        uint32_t        left;
+
+        /** first_chunk is 1-based */
+        while (stsc_idx + 1 < stsc->entry_count && get_BE_u32(stsc->data + 12*(stsc_idx + 1)) - 1 <= chunk_idx)
+        {
+            stsc_idx++;
+        }
+        left = get_BE_u32(stsc->data + 12*stsc_idx + 4);
+        if (left > stream->sample_num - sample_idx)
+        {
+            left = stream->sample_num - sample_idx;
+        }
+
+        memset(&piece, 0, sizeof(piece));
+        piece.track_idx  = track_idx;
+        piece.sample_idx = sample_idx;
+        piece.sd_idx     = get_BE_u32(stsc->data + 12*stsc_idx + 8);
+        piece.offset     = (stream->stco.variant) ? get_BE_u64(stream->stco.data + 8*(size_t)chunk_idx)
+                                                  : get_BE_u32(stream->stco.data + 4*(size_t)chunk_idx);
+        for (; left; left--, sample_idx++)
+        {
+            uint32_t size = stream_get_sample_size(stream, sample_idx);
+
+            if (piece.sample_num && piece.size + size > EXTRACT_READ_SIZE)
+            {
+                ret = add_piece(pieces, piece_num, piece_max, &piece);
+                if (ret != EMA_MP4_MUXED_OK)
+                {
+                    return ret;
+                }
+                piece.offset    += piece.size;
+                piece.size       = 0;
+                piece.sample_idx = sample_idx;
+                piece.sample_num = 0;
+            }
+            piece.size += size;
+            piece.sample_num++;
+        }
+        ret = add_piece(pieces, piece_num, piece_max, &piece);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+static int
+cmp_piece_offset(const void *a, const void *b)
+{
+    const extract_piece_t *pa = (const extract_piece_t *)a;
+    const extract_piece_t *pb = (const extract_piece_t *)b;
+
+    if (pa->offset != pb->offset)
+    {
+        return (pa->offset < pb->offset) ? -1 : 1;
+    }
+    if (pa->track_idx != pb->track_idx)
+    {
+        return (pa->track_idx < pb->track_idx) ? -1 : 1;
+    }
+    return (pa->sample_idx < pb->sample_idx) ? -1 : (pa->sample_idx > pb->sample_idx);
+}
+
+static int
+cmp_piece_sample(const void *a, const void *b)
+{
+    const extract_piece_t *pa = (const extract_piece_t *)a;
+    const extract_piece_t *pb = (const extract_piece_t *)b;
+
+    if (pa->track_idx != pb->track_idx)
+    {
+        return (pa->track_idx < pb->track_idx) ? -1 : 1;
+    }
+    return (pa->sample_idx < pb->sample_idx) ? -1 : (pa->sample_idx > pb->sample_idx);
+}
+
+/** Orders the pieces by file offset, unless that would put the samples of a track out of order */
+static int32_t
+sort_pieces(extract_piece_t *pieces, uint32_t piece_num, uint32_t track_num)
+{
+    uint32_t *next_sample = (uint32_t *)MALLOC_CHK(track_num*sizeof(uint32_t));
+    uint32_t  u;
+
+    if (!next_sample)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memset(next_sample, 0, track_num*sizeof(uint32_t));
+
+    qsort(pieces, piece_num, sizeof(extract_piece_t), cmp_piece_offset);
+    for (u = 0; u < piece_num; u++)
+    {
+        if (pieces[u].sample_idx != next_sample[pieces[u].track_idx])
+        {
+            msglog(NULL, MSGLOG_INFO, "Chunks of track out of file order: reading the tracks one by one\n");
+            qsort(pieces, piece_num, sizeof(extract_piece_t), cmp_piece_sample);
+            break;
+        }
+        next_sample[pieces[u].track_idx] += pieces[u].sample_num;
+    }
+    FREE_CHK(next_sample);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/********************* extract API ****************************/
+const int8_t *
+mp4_extract_get_es_ext(stream_handle_t stream)
+{
+    const int8_t *es_ext = NULL;
+
+    get_codec(stream->codingname, &es_ext);
+    return es_ext;
+}
+
+int32_t
+mp4_extract_es(uint32_t stream_num, stream_handle_t *streams, bbio_handle_t *snks)
+{
+    bbio_handle_t     src;
+    extract_track_t * tracks;
+    extract_piece_t * pieces    = NULL;
+    uint32_t          piece_num = 0, piece_max = 0;
+    uint8_t *         buf       = NULL;
+    uint64_t          buf_size  = EXTRACT_READ_SIZE;
+    int64_t           pos       = -1;
+    uint32_t          u, i, j;
+    int32_t           ret = EMA_MP4_MUXED_OK;
+
+    if (!stream_num)
+    {
+        return EMA_MP4_MUXED_OK;
+    }
+    src    = streams[0]->mp4_ctrl->mp4_src;
+    tracks = (extract_track_t *)MALLOC_CHK(stream_num*sizeof(extract_track_t));
+    if (!tracks)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memset(tracks, 0, stream_num*sizeof(extract_track_t));
+
+    for (u = 0; u < stream_num && ret == EMA_MP4_MUXED_OK; u++)
+    {
+        tracks[u].stream    = streams[u];
+        tracks[u].snk       = snks[u];
+        tracks[u].stream_id = get_codec(streams[u]->codingname, NULL);
+        if (!mp4_extract_get_es_ext(streams[u]) || streams[u]->mp4_ctrl->mp4_src != src)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Track %u ('%s') can't be extracted\n",
+                   streams[u]->track_ID, streams[u]->codingname);
+            ret = EMA_MP4_MUXED_NO_SUPPORT;
+        }
+        else
+        {
+            ret = plan_track(&pieces, &piece_num, &piece_max, u, streams[u]);
+        }
+    }
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        ret = sort_pieces(pieces, piece_num, stream_num);
+    }
+    for (u = 0; u < piece_num; u++)
+    {
+        if (buf_size < pieces[u].size)
+        {
+            buf_size = pieces[u].size;
+        }
+    }
+    if (ret == EMA_MP4_MUXED_OK && piece_num)
+    {
+        buf = (buf_size <= (size_t)-1) ? (uint8_t *)MALLOC_CHK((size_t)buf_size) : NULL;
+        ret = (buf) ? EMA_MP4_MUXED_OK : EMA_MP4_MUXED_NO_MEM;
+    }
+
+    /** a read per run of pieces no further apart than EXTRACT_GAP_SIZE */
+    for (i = 0; ret == EMA_MP4_MUXED_OK && i < piece_num; i = j)
+    {
+        uint64_t run_offset = pieces[i].offset;
+        uint64_t run_end    = run_offset + pieces[i].size;
+
+        for (j = i + 1; j < piece_num; j++)
+        {
+            if (pieces[j].offset < run_end || pieces[j].offset - run_end > EXTRACT_GAP_SIZE ||
+                pieces[j].offset + pieces[j].size - run_offset > buf_size)
+            {
+                break;
+            }
+            run_end = pieces[j].offset + pieces[j].size;
+        }
+
+        if ((pos != (int64_t)run_offset && src->seek(src, (int64_t)run_offset, SEEK_SET)) ||
+            src->read(src, buf, (size_t)(run_end - run_offset)) != run_end - run_offset)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Can't read the samples at %" PRIu64 " of the mp4 file\n", run_offset);
+            ret = EMA_MP4_MUXED_READ_ERR;
+            break;
+        }
+        pos = (int64_t)run_end;
+
+        for (; i < j && ret == EMA_MP4_MUXED_OK; i++)
+        {
+            extract_track_t *track = tracks + pieces[i].track_idx;
+            const uint8_t *  data  = buf + (pieces[i].offset - run_offset);
+            uint32_t         sample_idx;
+
+            if (track->sd_idx != pieces[i].sd_idx)
+            {
+                ret = load_sample_entry(track, pieces[i].sd_idx);
+            }
+            for (sample_idx = pieces[i].sample_idx;
+                 ret == EMA_MP4_MUXED_OK && sample_idx < pieces[i].sample_idx + pieces[i].sample_num; sample_idx++)
+            {
+                uint32_t size = stream_get_sample_size(track->stream, sample_idx);
+
+                ret   = write_sample(track, sample_idx, data, size);
+                data += size;
+            }
+            if (ret == EMA_MP4_MUXED_ES_ERR)
+            {
+                msglog(NULL, MSGLOG_ERR, "ERROR! Track %u: broken sample in the chunk at %" PRIu64 "\n",
+                       track->stream->track_ID, pieces[i].offset);
+            }
+        }
+    }
+
+    for (u = 0; u < stream_num; u++)
+    {
+        FREE_CHK(tracks[u].ps);
+    }
+    FREE_CHK(tracks);
+    FREE_CHK(pieces);
+    FREE_CHK(buf);
+
+    return ret;
+}
@@ -33,12 +33,20 @@
 #include "mp4_isom.h"
 #include "mp4_muxer.h"
 #include "mp4_stream.h"
+#include "mp4_demux.h"
+#include "io_digest.h"
+#include "io_resume.h"
+#include "mp4_trace.h"
+#ifdef _MSC_VER
+#include <windows.h>       /** WaitForSingleObject() */
+#endif
 
 /** Macros to help write 32 bit size field
  *  when derive the size from position of the box in file
  */
 #define SKIP_SIZE_FIELD(snk)                   \
     offset_t pos_size__ = snk->position(snk);  \
+    sink_digest_hold(snk, pos_size__);         \
     sink_write_u32(snk, 0)
 
 #define CURRENT_BOX_OFFSET()        pos_size__
@@ -50,6 +58,14 @@
   }
 
 
+/** Adds the time statement takes to counter, one of the muxer metrics */
+#define METRICS_TIME(counter, statement)                     \
+    do {                                                     \
+        uint64_t metrics_t__ = time_ns_monotonic();          \
+        statement;                                           \
+        (counter) += time_ns_monotonic() - metrics_t__;      \
+    } while (0)
+
 /** Writes the common part of sample entry. note: size field is already skipped */
 #define MOV_WRITE_SAMPLE_ENTRY(snk, codingname, data_reference_index)   \
     snk->write(snk, codingname, 4);                                     \
@@ -69,6 +85,7 @@ write_size_field(bbio_handle_t snk, offset_t pos_size)
     snk->seek(snk, pos_size, SEEK_SET);
     sink_write_u32(snk, size);
     snk->seek(snk, pos_cur, SEEK_SET);
+    sink_digest_release(snk, pos_size);
 
     return size;
 }
@@ -136,6 +153,12 @@ get_codingname(parser_handle_t parser)
 {
     int8_t *codingname;
 
+    if (parser->get_sample_entry)
+    {
+        /** the sample entries are copied: so is their name */
+        return parser->dsi_name;
+    }
+
     switch (parser->stream_id)
     {
     case STREAM_ID_HEVC: codingname = "hvc1"; break; 
@@ -2226,6 +2249,11 @@ write_stco_box(bbio_handle_t snk, track_handle_t track)
     {
         it_list_handle_t it = it_create();
 
+        if (!track->stco_offset)
+        {
+            /** rewritten by modify_stco_boxes() */
+            sink_digest_hold(snk, CURRENT_BOX_OFFSET());
+        }
         num = list_get_entry_num(track->chunk_lst);
         sink_write_u32(snk, num);
         it_init(it, track->chunk_lst);
@@ -2921,7 +2949,8 @@ more_moof(mp4_ctrl_handle_t muxer)
 static uint64_t
 get_dts_from_idx(track_handle_t track, uint32_t idx)
 {
-    it_list_handle_t it = it_create();
+    it_list_handle_t it  = it_create();
+    uint64_t         dts = (uint64_t)-1;
     idx_dts_t *      id;
 
     it_init(it, track->dts_lst);
@@ -2929,13 +2958,13 @@ get_dts_from_idx(track_handle_t track, uint32_t idx)
     {
         if (id->idx == idx)
         {
-            it_destroy(it);
-            return id->dts;
+            dts = id->dts; /** the entry is a copy owned by the iterator */
+            break;
         }
     }
     it_destroy(it);
 
-    return (uint64_t)-1;
+    return dts;
 }
 
 /**
@@ -3912,6 +3941,7 @@ write_tfhd_box(bbio_handle_t snk, track_handle_t track)
          * use it to save position for modification */
         ptfhd->base_data_offset_pos = snk->position(snk);
         ptfhd->base_data_offset     = 0;                  /** reference is first data in mdat */
+        sink_digest_hold(snk, ptfhd->base_data_offset_pos);
         sink_write_u64(snk, ptfhd->base_data_offset_pos); /** position taker */
     }
     if (tf_flags & TF_FLAGS_SAMPLE_DESCRIPTION_INDEX)
@@ -4015,6 +4045,7 @@ write_trun_box(bbio_handle_t snk, track_handle_t track)
     if (tr_flags & TR_FLAGS_DATA_OFFSET)
     {
         ptrun->data_offset_pos = snk->position(snk);
+        sink_digest_hold(snk, ptrun->data_offset_pos);
         sink_write_u32(snk, ptrun->data_offset);
         msglog(NULL, MSGLOG_DEBUG, "      data_offset %u\n", ptrun->data_offset);
     }
@@ -4349,18 +4380,18 @@ write_moof_box(bbio_handle_t snk, mp4_ctrl_handle_t muxer, uint32_t track_ID_req
 #define MP4MUXER_SCRATCHBUF_GRAN 0x1000
 
 static int32_t
-realloc_scratch_buffer(mp4_ctrl_handle_t muxer, size_t size)
+realloc_scratch_buffer(uint8_t **scratchbuf, size_t *scratchsize, size_t size)
 {
-    if (size > muxer->scratchsize)
+    if (size > *scratchsize)
     {
         size += MP4MUXER_SCRATCHBUF_GRAN - (size % MP4MUXER_SCRATCHBUF_GRAN);
-        muxer->scratchbuf = REALLOC_CHK(muxer->scratchbuf, size);
-        if (!muxer->scratchbuf)
+        *scratchbuf = REALLOC_TAG_CHK(MP4_MEM_SCRATCH, *scratchbuf, size);
+        if (!*scratchbuf)
         {
-            muxer->scratchsize = 0;
+            *scratchsize = 0;
             return -1;
         }
-        muxer->scratchsize = size;
+        *scratchsize = size;
     }
     return 0;
 }
@@ -4378,7 +4409,9 @@ encrypt_subframe(track_handle_t track, uint8_t* buf, size_t size)
         uint32_t num_encr = enc_info_ptr->enc_info.num_encrypted_bytes;
         memcpy(encryptor->initial_value, enc_info_ptr->enc_info.initial_value, ENC_ID_SIZE);
         assert(num_clr+num_encr == size);
+        MP4_TRACE_BEGIN("encrypt_subframe", track->track_ID, 0);
         encryptor->encrypt(encryptor, buf+num_clr, buf+num_clr, num_encr, NULL);
+        MP4_TRACE_END("encrypt_subframe", track->track_ID, num_encr);
     }
 #ifdef NDEBUG
     (void)size;  /** avoid compiler warning */
@@ -4387,7 +4420,7 @@ encrypt_subframe(track_handle_t track, uint8_t* buf, size_t size)
 #endif
 
 static int32_t
-write_chunk(track_handle_t track, chunk_handle_t chunk, bbio_handle_t snk);
+write_chunk(track_handle_t track, chunk_handle_t chunk, bbio_handle_t snk, uint8_t **scratchbuf, size_t *scratchsize);
 
 /** Writes 'mdat' of 'moof', returns: error code */
 static int32_t
@@ -4418,7 +4451,7 @@ write_mdat_box_frag(bbio_handle_t      snk,
 
             /** record actual position */
             track->tfhd.base_data_offset = snk->position(snk);
-            r = write_chunk(track, &chunk, snk);
+            r = write_chunk(track, &chunk, snk, &muxer->scratchbuf, &muxer->scratchsize);
             if (r != EMA_MP4_MUXED_OK)
             {
                 ret = r;
@@ -4466,12 +4499,317 @@ modify_base_data_offset(bbio_handle_t snk, mp4_ctrl_handle_t muxer, uint32_t tra
                 sink_write_u32(snk, data_offset);
             }
         }
+        /** held by write_tfhd_box()/write_trun_box() */
+        if (track->tfhd.base_data_offset_pos)
+        {
+            sink_digest_release(snk, track->tfhd.base_data_offset_pos);
+        }
+        sink_digest_release(snk, track->trun.data_offset_pos);
     }
 
     snk->seek(snk, pos, SEEK_SET);
     return TRUE;
 }
 
+/**** fragment 'mdat' payloads written in parallel */
+
+/** The payload of a fragment 'mdat', left out when the 'moof's are written */
+typedef struct frag_payload_t_
+{
+    chunk_t  chunk;         /**< its samples: sample_num and offset into the sample source */
+    offset_t pos;           /**< where it goes in the output */
+    uint64_t size;
+} frag_payload_t;
+
+/** A thread writing the payloads of tracks first_track_idx, first_track_idx + writer_num, ... */
+typedef struct frag_writer_t_
+{
+    mp4_ctrl_handle_t muxer;
+    list_handle_t *   payload_lsts;     /**< per track: frag_payload_t in output order */
+    uint32_t          first_track_idx;
+    uint32_t          writer_num;
+    bbio_handle_t     snk;              /**< a handle of its own on the output file */
+    uint8_t *         scratchbuf;
+    size_t            scratchsize;
+    int32_t           ret;
+} frag_writer_t;
+
+typedef struct frag_write_plan_t_
+{
+    list_handle_t    payload_lsts[MAX_STREAMS];
+    it_list_handle_t size_its[MAX_STREAMS];   /**< the sizes of the samples laid out so far */
+    uint32_t         size_cnts[MAX_STREAMS];  /**< samples left in the size run of size_its[] */
+    uint32_t         sizes[MAX_STREAMS];
+    frag_writer_t *  writers;
+    uint32_t         writer_num;
+} frag_write_plan_t;
+typedef frag_write_plan_t *frag_write_plan_handle_t;
+
+static void
+frag_write_plan_destroy(frag_write_plan_handle_t plan)
+{
+    uint32_t u;
+
+    if (!plan)
+    {
+        return;
+    }
+    for (u = 0; u < MAX_STREAMS; u++)
+    {
+        if (plan->payload_lsts[u])
+        {
+            list_destroy(plan->payload_lsts[u]);
+        }
+        if (plan->size_its[u])
+        {
+            it_destroy(plan->size_its[u]);
+        }
+    }
+    for (u = 0; plan->writers && u < plan->writer_num; u++)
+    {
+        frag_writer_t *writer  = plan->writers + u;
+        mp4_metrics_t *metrics = &writer->muxer->metrics;
+
+        if (writer->snk)
+        {
+            /** counted with the output */
+            metrics->bytes_written += writer->snk->bytes_written;
+            metrics->seek_num      += writer->snk->seek_num;
+            writer->snk->destroy(writer->snk);
+        }
+        metrics->scratch_size_max = MAX2(metrics->scratch_size_max, writer->scratchsize);
+        FREE_CHK(writer->scratchbuf);
+    }
+    FREE_CHK(plan->writers);
+    FREE_CHK(plan);
+}
+
+/** A plan to write the fragment payloads on up to frag_write_threads threads, one track per thread.
+ *  NULL if it does not apply: the output is written serially then */
+static frag_write_plan_handle_t
+frag_write_plan_create(bbio_handle_t snk, mp4_ctrl_handle_t muxer)
+{
+    usr_cfg_mux_t *          usr_cfg_mux = muxer->usr_cfg_mux_ref;
+    frag_write_plan_handle_t plan;
+    uint32_t                 u;
+
+    /** the payloads of a track are read from its source in order: there is a thread per track at most.
+     *  The payloads are written apart into the output file: not through a digest sink, nor into memory */
+    if (usr_cfg_mux->frag_write_threads < 2 || sink_is_digest(snk) || muxer->stream_num < 2 ||
+        snk->dev_type != 'f' || !usr_cfg_mux->output_fn ||
+        usr_cfg_mux->output_file_num > 1 || muxer->onwrite_next_frag_cb)
+    {
+        return NULL;
+    }
+
+    plan = (frag_write_plan_handle_t)MALLOC_TAG_CHK(MP4_MEM_FRAG, sizeof(frag_write_plan_t));
+    if (!plan)
+    {
+        return NULL;
+    }
+    memset(plan, 0, sizeof(frag_write_plan_t));
+    plan->writer_num = MIN2(usr_cfg_mux->frag_write_threads, muxer->stream_num);
+    plan->writers    = (frag_writer_t *)MALLOC_TAG_CHK(MP4_MEM_FRAG, plan->writer_num*sizeof(frag_writer_t));
+    if (!plan->writers)
+    {
+        frag_write_plan_destroy(plan);
+        return NULL;
+    }
+    memset(plan->writers, 0, plan->writer_num*sizeof(frag_writer_t));
+
+    for (u = 0; u < muxer->stream_num; u++)
+    {
+        plan->payload_lsts[u] = list_create(sizeof(frag_payload_t));
+        list_set_mem_tag(plan->payload_lsts[u], MP4_MEM_FRAG);
+        plan->size_its[u]     = it_create();
+        if (!plan->payload_lsts[u] || !plan->size_its[u])
+        {
+            frag_write_plan_destroy(plan);
+            return NULL;
+        }
+        it_init(plan->size_its[u], muxer->tracks[u]->size_lst);
+    }
+
+    /** the output file is opened once per thread before any 'moof' is out: if it is not
+     *  shared that way, it is written serially */
+    for (u = 0; u < plan->writer_num; u++)
+    {
+        frag_writer_t *writer = &plan->writers[u];
+
+        writer->muxer           = muxer;
+        writer->payload_lsts    = plan->payload_lsts;
+        writer->first_track_idx = u;
+        writer->writer_num      = plan->writer_num;
+        writer->snk             = reg_bbio_get('f', 'e');
+        if (!writer->snk || writer->snk->open(writer->snk, usr_cfg_mux->output_fn))
+        {
+            msglog(NULL, MSGLOG_INFO, "output file can't be opened again: fragments written serially\n");
+            frag_write_plan_destroy(plan);
+            return NULL;
+        }
+    }
+
+    return plan;
+}
+
+/** Writes the header of the 'mdat' of the 'moof' just written and skips its payload, which
+ *  frag_write_plan_run() writes later on. Returns: error code */
+static int32_t
+plan_mdat_box_frag(bbio_handle_t            snk,
+                   frag_write_plan_handle_t plan,
+                   mp4_ctrl_handle_t        muxer,
+                   uint32_t                 track_idx,
+                   int32_t                 *bytes_written)
+{
+    track_handle_t  track      = muxer->tracks[track_idx];
+    uint32_t        sample_num = track->tfhd.sample_num;
+    uint64_t        size       = 0;
+    frag_payload_t *payload;
+
+    /** the payload size: the sizes of the fragment samples */
+    while (sample_num)
+    {
+        uint32_t n;
+
+        if (!plan->size_cnts[track_idx])
+        {
+            count_value_t *cv = (count_value_t *)it_get_entry(plan->size_its[track_idx]);
+            if (!cv)
+            {
+                return EMA_MP4_MUXED_WRITE_ERR;
+            }
+            plan->size_cnts[track_idx] = cv->count;
+            plan->sizes[track_idx]     = (uint32_t)cv->value;
+        }
+        n = MIN2(sample_num, plan->size_cnts[track_idx]);
+        size                       += (uint64_t)n*plan->sizes[track_idx];
+        plan->size_cnts[track_idx] -= n;
+        sample_num                 -= n;
+    }
+
+    sink_write_u32(snk, (uint32_t)(8 + size));
+    sink_write_4CC(snk, "mdat");
+    *bytes_written = (int32_t)(8 + size);
+    if (!track->tfhd.sample_num)
+    {
+        return EMA_MP4_MUXED_OK;
+    }
+
+    payload = (frag_payload_t *)list_alloc_entry(plan->payload_lsts[track_idx]);
+    if (!payload)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memset(payload, 0, sizeof(frag_payload_t));
+    payload->chunk.sample_num = track->tfhd.sample_num;
+    payload->chunk.offset     = track->trun.first_sample_pos;
+    payload->pos              = snk->position(snk);
+    payload->size             = size;
+    list_add_entry(plan->payload_lsts[track_idx], payload);
+
+    /** record actual position */
+    track->tfhd.base_data_offset = payload->pos;
+
+    return snk->seek(snk, (int64_t)size, SEEK_CUR) ? EMA_MP4_MUXED_WRITE_ERR : EMA_MP4_MUXED_OK;
+}
+
+/** writes the payloads of its tracks */
+static void
+frag_writer_write(frag_writer_t *writer)
+{
+    mp4_ctrl_handle_t muxer  = writer->muxer;
+    bbio_handle_t     snk    = writer->snk;
+    it_list_handle_t  it     = it_create();
+    uint32_t          track_idx;
+
+    writer->ret = (it) ? EMA_MP4_MUXED_OK : EMA_MP4_MUXED_NO_MEM;
+    for (track_idx = writer->first_track_idx;
+         writer->ret == EMA_MP4_MUXED_OK && track_idx < muxer->stream_num;
+         track_idx += writer->writer_num)
+    {
+        frag_payload_t *payload;
+
+        it_init(it, writer->payload_lsts[track_idx]);
+        while (writer->ret == EMA_MP4_MUXED_OK && (payload = (frag_payload_t *)it_get_entry(it)))
+        {
+            if (snk->seek(snk, payload->pos, SEEK_SET))
+            {
+                writer->ret = EMA_MP4_MUXED_WRITE_ERR;
+                break;
+            }
+            MP4_TRACE_BEGIN("write_mdat_payload", muxer->tracks[track_idx]->track_ID, 0);
+            writer->ret = write_chunk(muxer->tracks[track_idx], &payload->chunk, snk,
+                                      &writer->scratchbuf, &writer->scratchsize);
+            MP4_TRACE_END("write_mdat_payload", muxer->tracks[track_idx]->track_ID, payload->size);
+            if (writer->ret == EMA_MP4_MUXED_OK && (uint64_t)(snk->position(snk) - payload->pos) != payload->size)
+            {
+                msglog(NULL, MSGLOG_ERR, "ERROR: track %u: fragment payload size differs from its sample sizes\n",
+                       muxer->tracks[track_idx]->track_ID);
+                writer->ret = EMA_MP4_MUXED_WRITE_ERR;
+            }
+        }
+    }
+    if (it)
+    {
+        it_destroy(it);
+    }
+
+    /** flushed before the thread is joined */
+    snk->close(snk);
+}
+
+/** thread entry: allocates from the allocator of the muxer */
+static OSAL_THREAD_RET_T
+frag_writer_run(void *arg)
+{
+    frag_writer_t *writer = (frag_writer_t *)arg;
+
+    MEM_ALLOC_SCOPE_CHK(writer->muxer->allocator, frag_writer_write(writer));
+    return OSAL_THREAD_RET_VAL;
+}
+
+/** Writes the payloads left out by plan_mdat_box_frag(), the tracks on threads of their own */
+static int32_t
+frag_write_plan_run(frag_write_plan_handle_t plan)
+{
+    OSAL_THREAD_T *threads   = (OSAL_THREAD_T *)MALLOC_CHK(plan->writer_num*sizeof(OSAL_THREAD_T));
+    BOOL *         thread_ok = (BOOL *)MALLOC_CHK(plan->writer_num*sizeof(BOOL));
+    int32_t        ret       = EMA_MP4_MUXED_OK;
+    uint32_t       u;
+
+    if (!threads || !thread_ok)
+    {
+        FREE_CHK(threads);
+        FREE_CHK(thread_ok);
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+
+    msglog(NULL, MSGLOG_INFO, "Writing fragment payloads on %u threads\n", plan->writer_num);
+    for (u = 0; u < plan->writer_num; u++)
+    {
+        thread_ok[u] = !OSAL_THREAD_CREATE(threads[u], frag_writer_run, &plan->writers[u]);
+        if (!thread_ok[u])
+        {
+            frag_writer_run(&plan->writers[u]);
+        }
+    }
+    for (u = 0; u < plan->writer_num; u++)
+    {
+        if (thread_ok[u])
+        {
+            OSAL_THREAD_JOIN(threads[u]);
+        }
+        if (ret == EMA_MP4_MUXED_OK)
+        {
+            ret = plan->writers[u].ret;
+        }
+    }
+
+    FREE_CHK(threads);
+    FREE_CHK(thread_ok);
+    return ret;
+}
+
 static int32_t
 write_mfra_box(bbio_handle_t snk, mp4_ctrl_handle_t muxer)
 {
@@ -4787,15 +5125,93 @@ my_tmp_file_open(track_handle_t track)
     }
 }
 
+/** the dsi entry of stsd_dsi_lst, NULL if none */
+static idx_ptr_t *
+stsd_dsi_get(track_handle_t track, uint32_t entry)
+{
+    idx_ptr_t *ip = NULL;
+
+    if (track->stsd_dsi_lst)
+    {
+        list_it_init(track->stsd_dsi_lst);
+        while ((ip = list_it_get_entry(track->stsd_dsi_lst)) && ip->idx != entry)
+        {
+        }
+    }
+    return ip;
+}
+
+static int32_t
+stsd_dsi_set(track_handle_t track, uint32_t entry, const uint8_t *dsi, uint32_t dsi_size)
+{
+    idx_ptr_t *ip;
+    uint8_t *  ptr;
+
+    if (!track->stsd_dsi_lst)
+    {
+        track->stsd_dsi_lst = list_create(sizeof(idx_ptr_t));
+        if (!track->stsd_dsi_lst)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+    }
+    ptr = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, 4 + dsi_size);
+    if (!ptr)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    ptr[0] = (uint8_t)(dsi_size >> 24);
+    ptr[1] = (uint8_t)(dsi_size >> 16);
+    ptr[2] = (uint8_t)(dsi_size >> 8);
+    ptr[3] = (uint8_t)dsi_size;
+    if (dsi_size)
+    {
+        memcpy(ptr + 4, dsi, dsi_size);
+    }
+
+    ip = stsd_dsi_get(track, entry);
+    if (!ip)
+    {
+        ip = (idx_ptr_t *)list_alloc_entry(track->stsd_dsi_lst);
+        if (!ip)
+        {
+            FREE_CHK(ptr);
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+        ip->idx = entry;
+        ip->ptr = NULL;
+        list_add_entry(track->stsd_dsi_lst, ip);
+    }
+    FREE_CHK(ip->ptr);
+    ip->ptr = ptr;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/** builds the stsd entry with dsi, the size prefixed one given for the entry, or else that of the parser */
 static int32_t
-build_stsd_entry(track_handle_t track, uint8_t **pbuf)
+build_stsd_entry(track_handle_t track, const uint8_t *dsi, uint8_t **pbuf)
 {
     bbio_handle_t snk;
     size_t        data_size;
     int32_t ret = 0;
 
     /** update dsi */
-    if (track->parser->get_cfg)
+    if (dsi)
+    {
+        uint32_t size = get_BE_u32(dsi);
+        uint8_t *buf  = REALLOC_CHK(track->dsi_buf, size ? size : 1);
+
+        if (!buf)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+        memcpy(buf, dsi + 4, size);
+        MEM_TAG_CHK(buf, MP4_MEM_DSI);
+        track->dsi_buf  = buf;
+        track->dsi_size = size;
+    }
+    else if (track->parser->get_cfg)
     {
         size_t size = 0;
         ret = track->parser->get_cfg(track->parser, &track->dsi_buf, &size);
@@ -4803,6 +5219,7 @@ build_stsd_entry(track_handle_t track, uint8_t **pbuf)
         {
             return ret;
         }
+        MEM_TAG_CHK(track->dsi_buf, MP4_MEM_DSI);
         track->dsi_size = (uint32_t)size;
     }
 
@@ -4824,6 +5241,7 @@ build_stsd_entry(track_handle_t track, uint8_t **pbuf)
     sink_flush_bits(snk);
     *pbuf = snk->get_buffer(snk, &data_size, 0);
     snk->destroy(snk);
+    MEM_TAG_CHK(*pbuf, MP4_MEM_DSI);
 
     if (IS_FOURCC_EQUAL(track->codingname, "dvav") || IS_FOURCC_EQUAL(track->codingname, "dvhe"))
     {
@@ -4948,8 +5366,60 @@ chunk_update(track_handle_t track, mp4_sample_handle_t sample)
     return 0;
 }
 
+/** Moves the sample source and snk past the next sample of a chunk, which the output an
+ *  interrupted job left holds already: snk would drop it */
+static int32_t
+skip_chunk_sample(track_handle_t track, bbio_handle_t snk, int64_t *pos)
+{
+    parser_handle_t parser = track->parser;
+    int64_t         size   = track->size_4mdat;
+
+    if (track->file)
+    {
+        if (fseek(track->file, (long)size, SEEK_CUR))
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+    }
+    else if (parser->get_subsample)
+    {
+        /** only the sizes of the subsamples: their data is not read */
+        int32_t  subs_left = 1;
+        uint32_t subs_num  = 0;
+        int64_t  subs_pos  = 0;
+        int32_t  ret;
+
+        size = 0;
+        while (subs_left)
+        {
+            size_t subs_size = 0;
+
+            subs_pos = *pos;
+            ret = parser->get_subsample(parser, &subs_pos, subs_num++, &subs_left, NULL, &subs_size);
+            if (ret != EMA_MP4_MUXED_OK)
+            {
+                msglog(NULL, MSGLOG_ERR, "Not enough subsamples are available\n");
+                return ret;
+            }
+            size += subs_size;
+        }
+        *pos = subs_pos;
+    }
+    else
+    {
+        bbio_handle_t ds = (track->frag_snk_file) ? track->frag_snk_file : parser->ds;
+
+        if (ds->seek(ds, size, SEEK_CUR))
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+    }
+
+    return snk->seek(snk, size, SEEK_CUR) ? EMA_MP4_MUXED_WRITE_ERR : EMA_MP4_MUXED_OK;
+}
+
 static int32_t
-write_chunk(track_handle_t track, chunk_handle_t chunk, bbio_handle_t snk)
+write_chunk(track_handle_t track, chunk_handle_t chunk, bbio_handle_t snk, uint8_t **scratchbuf, size_t *scratchsize)
 {
     int32_t             ret        = EMA_MP4_MUXED_OK;
     uint8_t * buf;
@@ -4973,12 +5443,23 @@ write_chunk(track_handle_t track, chunk_handle_t chunk, bbio_handle_t snk)
         }
         track->size_cnt_4mdat--;
 
+        if (!track->encryptor && sink_resume_dropped(snk) >= (int64_t)track->size_4mdat)
+        {
+            ret = skip_chunk_sample(track, snk, &pos);
+            if (ret != EMA_MP4_MUXED_OK)
+            {
+                return ret;
+            }
+            calc_chunk_size += track->size_4mdat;
+            continue;
+        }
+
         /** even if only subsamples are transferred, sample size is a good approx. */
-        if (realloc_scratch_buffer(track->mp4_ctrl, track->size_4mdat))
+        if (realloc_scratch_buffer(scratchbuf, scratchsize, track->size_4mdat))
         {
             return EMA_MP4_MUXED_NO_MEM;
         }
-        buf = track->mp4_ctrl->scratchbuf;
+        buf = *scratchbuf;
 
         if (track->file)
         {
@@ -5008,7 +5489,7 @@ write_chunk(track_handle_t track, chunk_handle_t chunk, bbio_handle_t snk)
 
             while (subs_left)
             {
-                size_t subs_size = track->mp4_ctrl->scratchsize;
+                size_t subs_size = *scratchsize;
                 subs_pos = pos;
                 ret = parser->get_subsample(parser, &subs_pos, subs_num++, &subs_left, buf, &subs_size);
                 if (ret == EMA_MP4_MUXED_OK)
@@ -5061,6 +5542,13 @@ write_chunk(track_handle_t track, chunk_handle_t chunk, bbio_handle_t snk)
         calc_chunk_size += track->size_4mdat;
     }
 
+    if (ret == EMA_MP4_MUXED_OK && !track->file && !track->encryptor &&
+        parser->get_subsample && parser->release_subsample)
+    {
+        /** sample info of the chunk is not read again: let the parser drop it */
+        parser->release_subsample(parser, pos);
+    }
+
     return ret;
 }
 
@@ -5102,48 +5590,161 @@ mp4_muxer_get_track (mp4_ctrl_handle_t hmuxer
     return NULL;
 }
 
-/** Inputs samples to mp4muxer */
-int
-mp4_muxer_input_sample (track_handle_t      htrack
-                       ,mp4_sample_handle_t hsample
-                       )
+/**
+ * @brief Ends the bitrate run of the current sample entry
+ *
+ * Stores the run's bitrates in bitrate_run_lst and empties the window for the next run.
+ * Does nothing if no sample came since the last call.
+ */
+static int32_t
+close_bitrate_run(track_handle_t track, uint64_t end_dts)
 {
-    float           bitrate = 0.0f;
-    parser_handle_t parser  = htrack->parser;
-    mp4_sample_t    copied_sample;
+    bitrate_run_t *run;
 
-    if (!hsample->size)
+    if (!list_get_entry_num(track->bitrate_win_lst))
     {
-        return EMA_MP4_MUXED_OK;               /** discard 0 sized packets */
+        return EMA_MP4_MUXED_OK;
     }
-    if(!htrack->sample_num)
+
+    run = (bitrate_run_t *)list_alloc_entry(track->bitrate_run_lst);
+    if (!run)
     {
-        htrack->sample_duration = hsample->duration;
+        msglog(NULL, MSGLOG_ERR, "Not enough memory\n");
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    run->max_bitrate = track->bitrate_run_max;
+    run->avg_bitrate = 0;
+    if (end_dts > track->bitrate_run_dts)
+    {
+        run->avg_bitrate = 8 * (uint32_t)(track->bitrate_run_size * track->media_timescale / (end_dts - track->bitrate_run_dts));
     }
+    list_add_entry(track->bitrate_run_lst, run);
 
-    if (!htrack->media_timescale)
+    while (list_get_entry_num(track->bitrate_win_lst))
     {
-        if ((parser->stream_type == STREAM_TYPE_AUDIO) && (parser->stream_id != STREAM_ID_AC4))
-        {
-            htrack->media_timescale = ((parser_audio_handle_t)parser)->sample_rate;
-        }
-        else
-        {
-            htrack->media_timescale = parser->time_scale;
-        }
+        list_delete_first_entry(track->bitrate_win_lst);
+    }
+    track->bitrate_win_size = 0;
+    track->bitrate_run_size = 0;
+    track->bitrate_run_max  = 0;
 
-        if (!htrack->media_timescale) 
-        {
-            return EMA_MP4_MUXED_OK; /** parser should have the right value*/
-        }
+    return EMA_MP4_MUXED_OK;
+}
 
-        if (htrack->warp_media_timestamps)
-        {
-            htrack->warp_parser_timescale = htrack->media_timescale;
-            htrack->media_timescale       = htrack->warp_media_timescale;
-        }
+/**
+ * @brief Slides the one second maxBitrate window over a new sample
+ *
+ * The window holds the samples starting at most one second before the end of the new one.
+ * Each sample enters and leaves it once, so this is O(1) amortized per sample.
+ * Once the run is a second long, a window's rate is its bits over the time its samples span:
+ * a constant bitrate stream then gives its nominal bitrate whatever its frame duration.
+ * A new sample entry starts a new run, as its DSI carries its own bitrates.
+ */
+static int32_t
+update_bitrate(track_handle_t track, mp4_sample_handle_t sample)
+{
+    parser_handle_t parser  = track->parser;
+    uint64_t        win_end = sample->dts + sample->duration;
+    uint64_t        span;
+    uint32_t        bitrate;
+    dts_size_t     *entry;
+    int32_t         ret;
 
-        if (htrack->mp4_ctrl->usr_cfg_mux_ref->chunk_span_time) 
+    if (sample->flags & SAMPLE_NEW_SD)
+    {
+        ret = close_bitrate_run(track, sample->dts);
+        if (ret)
+        {
+            return ret;
+        }
+    }
+    if (!list_get_entry_num(track->bitrate_win_lst))
+    {
+        track->bitrate_run_dts = sample->dts;
+    }
+
+    entry = (dts_size_t *)list_alloc_entry(track->bitrate_win_lst);
+    if (!entry)
+    {
+        msglog(NULL, MSGLOG_ERR, "Not enough memory\n");
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    entry->dts  = sample->dts;
+    entry->size = (uint32_t)sample->size;
+    list_add_entry(track->bitrate_win_lst, entry);
+    track->bitrate_win_size += sample->size;
+    track->bitrate_run_size += sample->size;
+
+    /** drop what starts more than a second before the window end, but never the new sample */
+    entry = (dts_size_t *)list_peek_first_entry(track->bitrate_win_lst);
+    while (entry->dts < sample->dts && entry->dts + track->media_timescale < win_end)
+    {
+        track->bitrate_win_size -= entry->size;
+        list_delete_first_entry(track->bitrate_win_lst);
+        entry = (dts_size_t *)list_peek_first_entry(track->bitrate_win_lst);
+    }
+
+    span = win_end - entry->dts;
+    if (win_end - track->bitrate_run_dts < track->media_timescale)
+    {
+        /** less than a second so far: all of it falls in the first one second window */
+        span = track->media_timescale;
+    }
+    if (span)
+    {
+        bitrate = (uint32_t)(track->bitrate_win_size * 8 * track->media_timescale / span);
+        if (bitrate > track->bitrate_run_max)
+        {
+            track->bitrate_run_max = bitrate;
+        }
+        if (bitrate > parser->maxBitrate)
+        {
+            parser->maxBitrate = bitrate;
+        }
+    }
+    parser->bit_rate = mp4_muxer_get_track_bitrate(track);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static int
+input_sample(track_handle_t htrack, mp4_sample_handle_t hsample)
+{
+    parser_handle_t parser  = htrack->parser;
+    mp4_sample_t    copied_sample;
+
+    if (!hsample->size)
+    {
+        return EMA_MP4_MUXED_OK;               /** discard 0 sized packets */
+    }
+    if(!htrack->sample_num)
+    {
+        htrack->sample_duration = hsample->duration;
+    }
+
+    if (!htrack->media_timescale)
+    {
+        if ((parser->stream_type == STREAM_TYPE_AUDIO) && (parser->stream_id != STREAM_ID_AC4))
+        {
+            htrack->media_timescale = ((parser_audio_handle_t)parser)->sample_rate;
+        }
+        else
+        {
+            htrack->media_timescale = parser->time_scale;
+        }
+
+        if (!htrack->media_timescale) 
+        {
+            return EMA_MP4_MUXED_OK; /** parser should have the right value*/
+        }
+
+        if (htrack->warp_media_timestamps)
+        {
+            htrack->warp_parser_timescale = htrack->media_timescale;
+            htrack->media_timescale       = htrack->warp_media_timescale;
+        }
+
+        if (htrack->mp4_ctrl->usr_cfg_mux_ref->chunk_span_time) 
         {
             /** ms => media_timescale */
             htrack->chunk_span_time =
@@ -5179,6 +5780,7 @@ mp4_muxer_input_sample (track_handle_t      htrack
         /* tmp file for es is used  and mean to use it */
         hsample->pos = ftell(htrack->file); /* the actual sample position in tmp file */
         fwrite(hsample->data, hsample->size, 1, htrack->file);
+        htrack->mp4_ctrl->metrics.temp_bytes += hsample->size;
     }
     else
     {
@@ -5266,13 +5868,20 @@ mp4_muxer_input_sample (track_handle_t      htrack
 
     htrack->sample_num++;
 
-    bitrate = ((float)(hsample->size)*8.0f*(float)(htrack->media_timescale))/(float)(hsample->duration);
-    htrack->totalBitrate += bitrate;
+    return update_bitrate(htrack, hsample);
+}
 
-    parser->bit_rate   = (uint32_t)(htrack->totalBitrate / htrack->sample_num);
-    parser->maxBitrate = ((uint32_t)bitrate > parser->maxBitrate) ? (uint32_t)bitrate : parser->maxBitrate;
+/** Inputs samples to mp4muxer */
+int
+mp4_muxer_input_sample (track_handle_t      htrack
+                       ,mp4_sample_handle_t hsample
+                       )
+{
+    int ret;
 
-    return EMA_MP4_MUXED_OK;
+    MEM_ALLOC_SCOPE_CHK(htrack->mp4_ctrl->allocator,
+                        METRICS_TIME(htrack->mp4_ctrl->metrics.input_sample_ns, ret = input_sample(htrack, hsample)));
+    return ret;
 }
 
 static void
@@ -5286,7 +5895,7 @@ update_ctts(track_handle_t track, parser_handle_t parser)
 
     for (u = 0; u < track->sample_num; u++)
     {
-        cts_offset = parser->get_cts_offset(parser, u);
+        cts_offset = track->cts_offsets ? track->cts_offsets[u] : parser->get_cts_offset(parser, u);
 
         if (track->warp_media_timestamps)
         {
@@ -5308,6 +5917,7 @@ mp4_muxer_build_stsd_entries(track_handle_t track)
     uint32_t i = 0;
     uint32_t j = 0;
     int32_t ret = 0;
+    idx_ptr_t *given;
 
     /** init the it so we can go through them all one by one */
     list_it_init(track->stsd_lst);
@@ -5317,7 +5927,16 @@ mp4_muxer_build_stsd_entries(track_handle_t track)
         /** note: stsd_lst might already contain valid entries (ptr->ptr != NULL) set via the demuxer
          *       - in this case keep the entry
          */
-        if (ptr->ptr == NULL)
+        if (ptr->ptr == NULL && track->parser->get_sample_entry)
+        {
+            /** a stream with ready sample entries, e.g. a track of an mp4 file */
+            ret = track->parser->get_sample_entry(track->parser, i, &(ptr->ptr));
+            if (ret)
+            {
+                return ret;
+            }
+        }
+        else if (ptr->ptr == NULL)
         {
             /** Set current dsi to be used inside build_stsd_entry() */
             dsi_handle_t *   p_dsi = NULL;
@@ -5333,7 +5952,13 @@ mp4_muxer_build_stsd_entries(track_handle_t track)
             }
             it_destroy(it);
 
-            ret = build_stsd_entry(track, &(ptr->ptr));
+            /** a dsi given for the entry is built with, else the one built with is kept */
+            given = stsd_dsi_get(track, i);
+            ret   = build_stsd_entry(track, given ? given->ptr : NULL, &(ptr->ptr));
+            if (!ret && !given)
+            {
+                ret = stsd_dsi_set(track, i, track->dsi_buf, track->dsi_size);
+            }
             if (ret)
             {
                 return ret;
@@ -5347,242 +5972,55 @@ mp4_muxer_build_stsd_entries(track_handle_t track)
 }
 
 /**
- * @brief Finalizes bitrate calculation and stores avgBitrate and maxBitrate
+ * @brief Ends the last bitrate run and sets the track bitrates
  *
- * for AAC:  store avgBitrate and maxBitrate in DSI
- * for MP4V: store avgBitrate and maxBitrate in parser
+ * for AAC: store avgBitrate and maxBitrate of each run in the DSI of its sample entry
  */
-static void
-calculate_bitrate_finalize(parser_handle_t parser,
-                           uint32_t        media_timescale,
-                           uint32_t        max_frame_size_total,
-                           uint64_t        frame_size_sum,
-                           uint64_t        media_duration,
-                           dsi_handle_t *  p_dsi)
-{
-    uint32_t window_correction = 0;
-    uint32_t avg_bitrate       = 0;
-    uint32_t max_1sec_bitrate;
-
-    if (parser->stream_id == STREAM_ID_AAC)
-    {
-        switch (media_timescale)
-        {
-        case 16000: window_correction = AAC_1_SEC_WINDOW_16000; break;
-        case 22050: window_correction = AAC_1_SEC_WINDOW_22050; break;
-        case 24000: window_correction = AAC_1_SEC_WINDOW_24000; break;
-        case 32000: window_correction = AAC_1_SEC_WINDOW_32000; break;
-        case 44100: window_correction = AAC_1_SEC_WINDOW_44100; break;
-        case 48000: window_correction = AAC_1_SEC_WINDOW_48000; break;
-        default:    window_correction = 0;                      break;
-        }
-    }
-
-    /** Max Bitrate over 1 sec window */
-    if (window_correction)
-    {
-        max_1sec_bitrate = (uint32_t)(8 * (uint64_t)max_frame_size_total * (uint64_t)window_correction)/AAC_1_SEC_WINDOW_DENOM;
-    }
-    else
-    {
-        max_1sec_bitrate = 8 * max_frame_size_total;
-    }
-
-    /** average bitrate */
-    if (media_duration > 0)
-    {
-        avg_bitrate = 8 * (uint32_t)(frame_size_sum * (uint64_t)media_timescale / media_duration);
-    }
-
-    /** store bitrate in dsi */
-    if (parser->stream_id == STREAM_ID_AAC)
-    {
-        mp4_dsi_aac_handle_t aac_dsi = (mp4_dsi_aac_handle_t)(*p_dsi);
-
-        aac_dsi->esd.maxBitrate = max_1sec_bitrate;
-        aac_dsi->esd.avgBitrate = avg_bitrate;
-    }
-    else
-    {
-        /** parser->stream_id == STREAM_ID_MP4V */
-        parser->bit_rate   = avg_bitrate;
-        parser->maxBitrate = max_1sec_bitrate;
-    }
-}
-
-static uint64_t
-get_dts(list_handle_t dts_lst, uint32_t sample_idx)
-{
-    it_list_handle_t it;
-    idx_dts_t *      idx_dts;
-    uint64_t         dts = 0;
-
-    it = it_create();
-
-    it_init(it, dts_lst);
-    while ((idx_dts = it_get_entry(it)))
-    {
-        if (idx_dts->idx == sample_idx)
-        {
-            dts = idx_dts->dts;
-        }
-    }
-
-    it_destroy(it);
-
-    return dts;
-}
-
-static void
-calculate_bitrate(track_handle_t track)
+static int32_t
+finalize_bitrate(track_handle_t track)
 {
-#define MAX_BITRATE_FILTER_LEN 48
-
     parser_handle_t  parser = track->parser;
-    it_list_handle_t it_size;
-    it_list_handle_t it_stsd;
+    it_list_handle_t it_run;
     it_list_handle_t it_dsi;
-    uint32_t         u, i;
-    count_value_t *  cv;
-    idx_ptr_t     *  ptr;
+    bitrate_run_t *  run;
     dsi_handle_t  *  p_dsi;
-
-    uint32_t max_frame_size_total = 0;
-    uint32_t bitrate_filter[MAX_BITRATE_FILTER_LEN];
-    uint32_t frame_size_total     = 0;
-    uint32_t bitrate_filter_len   = 0;
-    uint32_t curr_sample;
-    uint32_t next_new_dsi_idx     = track->sample_num;
-    uint64_t frame_size_sum;
-    uint64_t media_duration;
-    uint64_t first_dts;
+    int32_t          ret;
 
     assert(parser != NULL);
 
-    if ((parser->stream_id != STREAM_ID_AAC && parser->stream_id != STREAM_ID_MP4V) || track->media_duration == 0)
+    if (!track->media_duration)
     {
-        return;
+        return EMA_MP4_MUXED_OK;
     }
 
-    memset(bitrate_filter, 0, sizeof(bitrate_filter));
-
-    /** for AAC content calculate the peak bitrate over 1 sec
-        with a moving average filter */
-
-    if (parser->stream_id == STREAM_ID_AAC)
-    {
-        /** calculates filter length for 1 second of audio 
-            calculations are based on core aac decoder with 1024 samples per frame */
-        bitrate_filter_len = (track->media_timescale + 1023) / 1024;
-    }
-    else if (parser->stream_id == STREAM_ID_MP4V)
-    {
-        bitrate_filter_len = (uint32_t)((track->media_timescale * track->sample_num + track->media_duration -1 ) / track->media_duration);
-    }
-    else
+    ret = close_bitrate_run(track, ((idx_dts_t*)list_peek_first_entry(track->dts_lst))->dts + track->media_duration);
+    if (ret)
     {
-        assert(0);
+        return ret;
     }
+    parser->bit_rate = mp4_muxer_get_track_bitrate(track);
 
-    if (bitrate_filter_len > MAX_BITRATE_FILTER_LEN)
+    if (parser->stream_id != STREAM_ID_AAC || parser->get_sample_entry)
     {
-        bitrate_filter_len = MAX_BITRATE_FILTER_LEN;
+        /** copied sample entries keep the bitrates they have */
+        return EMA_MP4_MUXED_OK;
     }
 
-    msglog(NULL, MSGLOG_INFO, "\nbitrateFilterLen: %u  Num frames:%u\n", bitrate_filter_len, track->sample_num);
-
-    it_size = it_create();
-    it_stsd = it_create();
-    it_dsi  = it_create();
-
-    it_init(it_size, track->size_lst);
-    it_init(it_stsd, track->stsd_lst);
-    it_init(it_dsi,  parser->dsi_lst);
-
-    curr_sample    = 0;
-    frame_size_sum = 0;
-    first_dts      = ((idx_dts_t*)list_peek_first_entry(track->dts_lst))->dts;
-    ptr            = (idx_ptr_t *)it_get_entry(it_stsd);
-    if (ptr)
+    /** Note: setting the DSI via parser_aac_set_asc() and having "multi-dsi" as ES input is not expected to work! */
+    it_run = it_create();
+    it_dsi = it_create();
+    it_init(it_run, track->bitrate_run_lst);
+    it_init(it_dsi, parser->dsi_lst);
+    while ((run = (bitrate_run_t *)it_get_entry(it_run)) && (p_dsi = (dsi_handle_t *)it_get_entry(it_dsi)))
     {
-        assert(ptr->idx == 0);  /** index in first entry is expected to be 0 */
-        ptr = (idx_ptr_t *)it_get_entry(it_stsd);
-        if (ptr && ptr->idx)
-        {
-            /** we have a second and non-zero entry */
-            /** Note: setting the DSI via parser_aac_set_asc() and having "multi-dsi" as ES input is not expected to work! */
-            next_new_dsi_idx = ptr->idx;
-        }
-    }
-    p_dsi = (dsi_handle_t*)it_get_entry(it_dsi);
-    while ((cv = it_get_entry(it_size)))
-    {
-        for (u = 0; u < cv->count; u++, curr_sample++)
-        {
-            /** check for dsi change */
-            if (curr_sample == next_new_dsi_idx)
-            {
-                uint64_t curr_dts;
-
-                /** finalize bitrate calculation and start a new one */
-                curr_dts       = get_dts(track->dts_lst, curr_sample);
-                media_duration = curr_dts - first_dts;
-                first_dts      = curr_dts;
-                calculate_bitrate_finalize(parser, track->media_timescale, max_frame_size_total, frame_size_sum, media_duration,
-                                           p_dsi);
-
-                /** advance in stsd list and dsi list */
-                ptr = (idx_ptr_t *)it_get_entry(it_stsd);
-                if (ptr)
-                {
-                    next_new_dsi_idx = ptr->idx;
-                }
-                else
-                {
-                    next_new_dsi_idx = parser->num_samples;
-                }
-                p_dsi = (dsi_handle_t*)it_get_entry(it_dsi);
-
-                /** clear bitrate_filter for new run */
-                memset(bitrate_filter, 0, sizeof(bitrate_filter));
-                max_frame_size_total = 0;
-                frame_size_sum       = 0;
-            }
-
-            /** maintain filter window of frame size values */
-            for (i = bitrate_filter_len - 1; i > 0; i--)
-            {
-                bitrate_filter[i] = bitrate_filter[i - 1];
-            }
-            /** add latest frame size value */
-            bitrate_filter[0] = (uint32_t)cv->value;
-
-            frame_size_sum += cv->value;
-
-            /** calculate sum over window (not the actual mean as we want to preserve fixed point accuracy) */
-            frame_size_total = 0;
-            for (i = 0; i < bitrate_filter_len; i++)
-            {
-                frame_size_total += bitrate_filter[i];
-            }
+        mp4_dsi_aac_handle_t aac_dsi = (mp4_dsi_aac_handle_t)(*p_dsi);
 
-            /** track max value */
-            if (frame_size_total > max_frame_size_total)
-            {
-                max_frame_size_total = frame_size_total;
-            }
-        }
+        aac_dsi->esd.maxBitrate = run->max_bitrate;
+        aac_dsi->esd.avgBitrate = run->avg_bitrate;
     }
-    it_destroy(it_size);
-    it_destroy(it_stsd);
+    it_destroy(it_run);
     it_destroy(it_dsi);
 
-    media_duration = track->media_duration + ((idx_dts_t*)list_peek_first_entry(track->dts_lst))->dts - first_dts;
-    calculate_bitrate_finalize(parser, track->media_timescale, max_frame_size_total, frame_size_sum, media_duration, p_dsi);
-
-    parser->bit_rate = mp4_muxer_get_track_bitrate(track);
-
-    if (parser->stream_id == STREAM_ID_AAC)
     {
         mp4_dsi_aac_handle_t  aac_dsi      = (mp4_dsi_aac_handle_t)parser->curr_dsi;
         parser_audio_handle_t parser_audio = (parser_audio_handle_t)parser;
@@ -5599,6 +6037,8 @@ calculate_bitrate(track_handle_t track)
             aac_dsi->samplingFrequency = parser_audio->sample_rate;
         }
     }
+
+    return EMA_MP4_MUXED_OK;
 }
 
 static int32_t
@@ -5621,7 +6061,11 @@ setup_muxer(mp4_ctrl_handle_t muxer)
         track = muxer->tracks[track_idx];
         track->parser->dsi_curr_index = 1;
 
-        calculate_bitrate(track);
+        ret = finalize_bitrate(track);
+        if (ret)
+        {
+            return ret;
+        }
 
         ret = mp4_muxer_build_stsd_entries(track);
         if (ret)
@@ -5672,7 +6116,7 @@ setup_muxer(mp4_ctrl_handle_t muxer)
         }
 
         /** fix CTS if supported (avc only and with reordering) */
-        if (parser->get_cts_offset && parser->need_fix_cts(parser))
+        if (track->cts_offsets || (parser->get_cts_offset && parser->need_fix_cts(parser)))
         {
             update_ctts(track, parser);
             msglog(NULL, MSGLOG_INFO, "  final table size: cts %d\n", list_get_entry_num(track->cts_offset_lst));
@@ -5695,7 +6139,7 @@ setup_muxer(mp4_ctrl_handle_t muxer)
                 return EMA_MP4_MUXED_READ_ERR;
             }
             list_destroy(track->sync_lst);
-            track->sync_lst = list_create(sizeof(idx_dts_t));
+            track->sync_lst = list_create_run(sizeof(idx_dts_t));
 
             list_it_init(((track_handle_t)(track->BL_track))->sync_lst);
             for(index = 0; index < count_bl; index++)
@@ -5716,7 +6160,32 @@ setup_muxer(mp4_ctrl_handle_t muxer)
 
 
         /** build edit list, if necessary */
-        if (!track->no_cts_offset && !list_get_entry_num(track->edt_lst) && list_get_entry_num(track->cts_offset_lst))
+        if (track->clip && !list_get_entry_num(track->edt_lst))
+        {
+            /** presented from within the samples, the cts offset compensated for as well */
+            uint32_t cts_offset = list_get_entry_num(track->cts_offset_lst) ?
+                (uint32_t)((count_value_t*)list_peek_first_entry(track->cts_offset_lst))->value : 0;
+            uint64_t skip       = track->clip_skip;
+            uint64_t duration   = track->clip_duration;
+
+            if (track->warp_media_timestamps)
+            {
+                skip     = rescale_u64(skip, track->warp_media_timescale, track->warp_parser_timescale);
+                duration = rescale_u64(duration, track->warp_media_timescale, track->warp_parser_timescale);
+            }
+            if (skip >= track->media_duration)
+            {
+                msglog(NULL, MSGLOG_ERR, "Stream %u ends before the time range starts\n", track->es_idx);
+                return EMA_MP4_MUXED_EMPTY_ES;
+            }
+            if (!duration || duration > track->media_duration - skip)
+            {
+                duration = track->media_duration - skip;
+            }
+            mp4_muxer_add_to_track_edit_list(track, duration, cts_offset + skip);
+            msglog(NULL, MSGLOG_INFO, "adding edit list to present the time range (%" PRIu64 ")\n", skip);
+        }
+        else if (!track->no_cts_offset && !list_get_entry_num(track->edt_lst) && list_get_entry_num(track->cts_offset_lst))
         {
             uint32_t cts_offset = (uint32_t)((count_value_t*)list_peek_first_entry(track->cts_offset_lst))->value;
             if (cts_offset)
@@ -5906,6 +6375,7 @@ setup_muxer(mp4_ctrl_handle_t muxer)
             /** in case input source is fragment, got to clear tfra_entry_lst */
             list_destroy(track->tfra_entry_lst);
             track->tfra_entry_lst = list_create(sizeof(tfra_entry_t));
+            list_set_mem_tag(track->tfra_entry_lst, MP4_MEM_FRAG);
 
             track->sample_num_to_fraged = 1;
         }
@@ -5999,6 +6469,7 @@ setup_muxer_short(mp4_ctrl_handle_t muxer, uint16_t *p_video_width, uint16_t *p_
             ip      = (idx_ptr_t *)list_alloc_entry(track->stsd_lst);
             ip->idx = 0;
             ip->ptr = snk->get_buffer(snk, &data_size, 0);
+            MEM_TAG_CHK(ip->ptr, MP4_MEM_DSI);
             list_add_entry(track->stsd_lst, ip);
             track->sample_descr_index++;
 
@@ -6020,6 +6491,7 @@ setup_muxer_short(mp4_ctrl_handle_t muxer, uint16_t *p_video_width, uint16_t *p_
     /** in case input source is fragment, got to clear tfra_entry_lst */
     list_destroy(track->tfra_entry_lst);
     track->tfra_entry_lst = list_create(sizeof(tfra_entry_t));
+    list_set_mem_tag(track->tfra_entry_lst, MP4_MEM_FRAG);
 
     track->sample_num_to_fraged = 1;
 
@@ -6145,7 +6617,7 @@ write_mdat_box(bbio_handle_t snk, mp4_ctrl_handle_t muxer)
                 }
             }
 
-            ret = write_chunk(track_out, chunk, snk);
+            ret = write_chunk(track_out, chunk, snk, &muxer->scratchbuf, &muxer->scratchsize);
             /** side effect: chunk offset id set to actual value */
             if (ret != EMA_MP4_MUXED_OK)
             {
@@ -6186,6 +6658,7 @@ modify_stco_boxes(bbio_handle_t snk, mp4_ctrl_handle_t muxer)
         {
             snk->seek(snk, track->stco_offset, SEEK_SET);
             write_stco_box(snk, track);
+            sink_digest_release(snk, track->stco_offset);
         }
     }
 }
@@ -6424,8 +6897,166 @@ write_ssix_box(bbio_handle_t snk, track_handle_t track)
     return ret;
 }
 
-int
-mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
+/** The 'mvhd' of the file edited with the modification time, duration and next track ID of the movie */
+static void
+write_edit_mvhd_box(bbio_handle_t snk, mp4_ctrl_handle_t muxer, const uint8_t *box, size_t box_size, const uint8_t *mvhd)
+{
+    const uint8_t *next_track_ID = mvhd + ((mvhd[0] == 1) ? 108 : 96);
+
+    snk->write(snk, box, (size_t)(mvhd - box) + 4);  /** header, version & flags */
+    if (mvhd[0] == 1)
+    {
+        snk->write(snk, mvhd + 4, 8);    /** creation_time */
+        sink_write_u64(snk, muxer->modification_time);
+        sink_write_u32(snk, muxer->timescale);
+        sink_write_u64(snk, muxer->duration);
+        snk->write(snk, mvhd + 32, (size_t)(next_track_ID - mvhd - 32));
+    }
+    else
+    {
+        snk->write(snk, mvhd + 4, 4);    /** creation_time */
+        sink_write_u32(snk, (uint32_t)muxer->modification_time);
+        sink_write_u32(snk, muxer->timescale);
+        /** all 1s: the duration can't be expressed in version 0 */
+        sink_write_u32(snk, (muxer->duration > 0xffffffff) ? 0xffffffff : (uint32_t)muxer->duration);
+        snk->write(snk, mvhd + 20, (size_t)(next_track_ID - mvhd - 20));
+    }
+    sink_write_u32(snk, muxer->next_track_ID);
+    snk->write(snk, next_track_ID + 4, (size_t)(box + box_size - next_track_ID - 4));
+}
+
+/** The 'moov' of the file edited: its boxes as they are but 'free' ones and the 'trak's of the tracks
+ *  replaced, plus the 'trak's of the tracks added */
+static offset_t
+write_edit_moov_box(bbio_handle_t snk, mp4_ctrl_handle_t muxer)
+{
+    const uint8_t *p   = muxer->edit_moov;
+    const uint8_t *end = p + muxer->edit_moov_size;
+    const uint8_t *box;
+    const uint8_t *type;
+    const uint8_t *payload;
+    size_t         payload_size;
+    uint32_t       track_idx;
+
+    SKIP_SIZE_FIELD(snk);
+    sink_write_4CC(snk, "moov");
+
+    for (box = p; mp4_demux_next_box(&p, end, &type, &payload, &payload_size); box = p)
+    {
+        if (IS_FOURCC_EQUAL(type, "mvhd"))
+        {
+            write_edit_mvhd_box(snk, muxer, box, (size_t)(p - box), payload);
+        }
+        else if (IS_FOURCC_EQUAL(type, "trak"))
+        {
+            const uint8_t *tkhd;
+            size_t         tkhd_size;
+            uint32_t       track_ID = 0;
+
+            tkhd = mp4_demux_find_box(payload, payload_size, "tkhd", &tkhd_size);
+            if (tkhd && tkhd_size >= 24)
+            {
+                track_ID = get_BE_u32(tkhd + ((tkhd[0] == 1) ? 20 : 12));
+            }
+            if (mp4_muxer_get_track(muxer, track_ID))
+            {
+                msglog(NULL, MSGLOG_INFO, "trak for track %u replaced\n", track_ID);
+                continue;
+            }
+            snk->write(snk, box, (size_t)(p - box));
+        }
+        else if (!IS_FOURCC_EQUAL(type, "free") && !IS_FOURCC_EQUAL(type, "skip"))
+        {
+            snk->write(snk, box, (size_t)(p - box));
+        }
+    }
+
+    for (track_idx = 0; track_idx < muxer->stream_num; track_idx++)
+    {
+        track_handle_t track = muxer->tracks[track_idx];
+
+        if (track->sample_num)
+        {
+            msglog(NULL, MSGLOG_INFO, "trak for track %d\n", track->track_ID);
+            write_trak_box(snk, track, 1, 0x7);
+        }
+    }
+
+    WRITE_SIZE_FIELD_RETURN(snk);
+}
+
+/** Adds the tracks to the file edited: their samples go into a new 'mdat' at its end, so the chunk
+ *  offsets are known before 'moov' is written. The new 'moov' takes the place of the old one if it fits
+ *  in there, with a 'free' box for what is left, or goes to the end with the old one turned 'free' */
+static int32_t
+output_edit_tracks(bbio_handle_t snk, mp4_ctrl_handle_t muxer)
+{
+    bbio_handle_t moov_snk;
+    uint8_t *     moov;
+    size_t        moov_size;
+    int32_t       ret;
+
+    snk->seek(snk, 0, SEEK_END);
+    if (!muxer->co64_mode && snk->position(snk) + (16 + muxer->mdat_size) > (uint32_t)(-1))
+    {
+        muxer->co64_mode = TRUE;
+    }
+    METRICS_TIME(muxer->metrics.mdat_ns, ret = write_mdat_box(snk, muxer));
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        return ret;
+    }
+
+    moov_snk = reg_bbio_get('b', 'w');
+    moov_snk->set_buffer(moov_snk, NULL, muxer->edit_moov_size + 4096, 1);  /** pre-alloc to avoid realloc */
+    write_edit_moov_box(moov_snk, muxer);
+    sink_flush_bits(moov_snk);
+    moov = moov_snk->get_buffer(moov_snk, &moov_size, 0);
+    moov_snk->destroy(moov_snk);
+    if (!moov)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: no memory\n");
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+
+    if (moov_size == muxer->edit_room ||
+        (moov_size + 8 <= muxer->edit_room && muxer->edit_room - moov_size <= (uint32_t)(-1)))
+    {
+        msglog(NULL, MSGLOG_INFO, "\nWriting moov in place @ offset %" PRIi64 "\n", muxer->edit_moov_pos);
+        snk->seek(snk, muxer->edit_moov_pos, SEEK_SET);
+        snk->write(snk, moov, moov_size);
+        if (moov_size < muxer->edit_room)
+        {
+            write_free_box(snk, (uint32_t)(muxer->edit_room - moov_size - 8));
+        }
+    }
+    else
+    {
+        /** the new 'moov' is complete before the old one is given up */
+        msglog(NULL, MSGLOG_INFO, "\nWriting moov @ offset %" PRIi64 "\n", snk->position(snk));
+        snk->write(snk, moov, moov_size);
+        snk->seek(snk, muxer->edit_moov_pos + 4, SEEK_SET);
+        sink_write_4CC(snk, "free");
+    }
+    FREE_CHK(moov);
+    sink_flush_bits(snk);
+
+    return EMA_MP4_MUXED_OK;
+}
+
+/** Counts a fragment, written since frag_t */
+static void
+metrics_add_frag(mp4_ctrl_handle_t muxer, uint64_t frag_t)
+{
+    uint64_t ns = time_ns_monotonic() - frag_t;
+
+    muxer->metrics.frag_ns    += ns;
+    muxer->metrics.frag_ns_max = MAX2(muxer->metrics.frag_ns_max, ns);
+    muxer->metrics.frag_num++;
+}
+
+static int
+output_tracks(mp4_ctrl_handle_t muxer)
 {
     int32_t           ret = EMA_MP4_MUXED_OK;
     bbio_handle_t snk = muxer->mp4_sink;
@@ -6436,17 +7067,24 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
 
     uint64_t data_written = 0ULL;  /** 'mdat' data written */
 
+    frag_write_plan_handle_t frag_plan = NULL;
+
     memset(sidx_pos, 0, sizeof(offset_t)*MAX_STREAMS);
     memset(sidx_size, 0, sizeof(offset_t)*MAX_STREAMS);
     memset(sidx_first_offset_written, 0, sizeof(int)*MAX_STREAMS);
 
     /** final preparation for write out 'moov' and 'mdat' */
-    ret = setup_muxer(muxer);
+    METRICS_TIME(muxer->metrics.setup_ns, ret = setup_muxer(muxer));
     if (ret != EMA_MP4_MUXED_OK)
     {
         return ret;
     }
 
+    if (muxer->edit_moov)
+    {
+        return output_edit_tracks(snk, muxer);
+    }
+
     /** [ISO] Section 8.1.3: Progressive Download Information */
     if (muxer->usr_cfg_mux_ref->mux_cfg_flags & ISOM_MUXCFG_WRITE_PDIN)
     {
@@ -6463,28 +7101,26 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
     /** Create fragment info if needed */
     if (muxer->usr_cfg_mux_ref->output_mode & EMA_MP4_FRAG)
     {
+        MP4_TRACE_BEGIN("create_fragment_lst", 0, 0);
         if ((muxer->usr_cfg_mux_ref->frag_cfg_flags & ISOM_FRAGCFG_FRAGSTYLE_MASK) != ISOM_FRAGCFG_FRAGSTYLE_CCFF)
         {
             ret = create_fragment_lst(muxer, 1);
-            if (ret != EMA_MP4_MUXED_OK)
-            {
-                return ret;
-            }
         }
         else
         {
             ret = create_fragment_lst(muxer, 0);
-            if (ret != EMA_MP4_MUXED_OK)
-            {
-                return ret;
-            }
+        }
+        MP4_TRACE_END("create_fragment_lst", 0, 0);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
         }
         /** reset stsd-lst */
         list_it_init(muxer->tracks[0]->stsd_lst);
     }
 
     /** write 'moov' */
-    write_moov_box(snk, muxer);
+    METRICS_TIME(muxer->metrics.moov_ns, write_moov_box(snk, muxer));
     msglog(NULL, MSGLOG_INFO, "moov end @ offset %" PRIi64 "\n", snk->position(snk)-1);
 
     /** [ISO] Section 8.16.3: Segment Index Box */
@@ -6501,6 +7137,8 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
             uint32_t size;
             /** remember the start position of sidx box */
             sidx_pos[track_idx] = snk->position(snk);
+            /** updated up to the last fragment */
+            sink_digest_hold(snk, sidx_pos[track_idx]);
             /** write sidx dummy box */
             ret = write_sidx_box(snk, muxer->tracks[track_idx], &size);
             sidx_size[track_idx] = size;
@@ -6527,7 +7165,7 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
         }
 
         /** write 'mdat' */
-        ret = write_mdat_box(snk, muxer);
+        METRICS_TIME(muxer->metrics.mdat_ns, ret = write_mdat_box(snk, muxer));
 
         /** rewrite chunk offsets */
         modify_stco_boxes(snk, muxer);
@@ -6546,16 +7184,23 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
             offset_t moof_offset;
             
             int32_t      bytes_written;
+            uint64_t     frag_t;
 
             if (muxer->onwrite_next_frag_cb != NULL)
             {
                 (*muxer->onwrite_next_frag_cb)(muxer->onwrite_next_frag_cb_instance);
             }
+            sink_digest_segment(snk);
 
+            frag_t          = time_ns_monotonic();
             moof_offset     = snk->position(snk);
+            MP4_TRACE_BEGIN("write_moof_box", track_ID, 0);
             referenced_size += write_moof_box(snk, muxer, track_ID);
+            MP4_TRACE_END("write_moof_box", track_ID, snk->position(snk) - moof_offset);
 
+            MP4_TRACE_BEGIN("write_mdat_box_frag", track_ID, 0);
             ret = write_mdat_box_frag(snk, muxer, track_ID, &bytes_written);
+            MP4_TRACE_END("write_mdat_box_frag", track_ID, bytes_written);
             if (ret != EMA_MP4_MUXED_OK)
             {
                 goto cleanup;
@@ -6583,6 +7228,7 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
                     muxer->tracks[0]->frag_num++;
                 }
             }
+            metrics_add_frag(muxer, frag_t);
 
             if (muxer->progress_cb != NULL)
             {
@@ -6641,6 +7287,9 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
                 }
             }
         }
+
+        /** all fragments are known: their payloads can be written apart from the 'moof's */
+        frag_plan = frag_write_plan_create(snk, muxer);
     
         while (fragment_number)
         {
@@ -6652,17 +7301,31 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
                     int32_t      referenced_size;
                     int32_t      bytes_written;
                     uint32_t  trackID;
+                    uint64_t  frag_t;
 
                     trackID = muxer->tracks[track_index]->track_ID;
                     if (muxer->onwrite_next_frag_cb != NULL)
                     {
                         (*muxer->onwrite_next_frag_cb)(muxer->onwrite_next_frag_cb_instance);
                     }
+                    sink_digest_segment(snk);
 
+                    frag_t          = time_ns_monotonic();
                     moof_offset     = snk->position(snk);
+                    MP4_TRACE_BEGIN("write_moof_box", trackID, 0);
                     referenced_size = write_moof_box(snk, muxer, trackID);
+                    MP4_TRACE_END("write_moof_box", trackID, snk->position(snk) - moof_offset);
 
-                    ret = write_mdat_box_frag(snk, muxer, trackID, &bytes_written);
+                    if (frag_plan)
+                    {
+                        ret = plan_mdat_box_frag(snk, frag_plan, muxer, track_index, &bytes_written);
+                    }
+                    else
+                    {
+                        MP4_TRACE_BEGIN("write_mdat_box_frag", trackID, 0);
+                        ret = write_mdat_box_frag(snk, muxer, trackID, &bytes_written);
+                        MP4_TRACE_END("write_mdat_box_frag", trackID, bytes_written);
+                    }
                     if (ret != EMA_MP4_MUXED_OK)
                     {
                         goto cleanup;
@@ -6683,6 +7346,7 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
                         }
                         update_sidx_box(snk, muxer->tracks[track_index], sidx_pos[track_index], sidx_size[track_index], referenced_size);       
                     }
+                    metrics_add_frag(muxer, frag_t);
 
                     if (muxer->progress_cb != NULL)
                     {
@@ -6704,6 +7368,12 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
             write_mfra_box(snk, muxer);
         }
 
+        if (frag_plan)
+        {
+            /** the payloads written apart add to the time of the fragments */
+            METRICS_TIME(muxer->metrics.frag_ns, ret = frag_write_plan_run(frag_plan));
+        }
+
 
     }
     else
@@ -6712,9 +7382,14 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
         ret = EMA_MP4_MUXED_PARAM_ERR;
     }
 
+    if (muxer->usr_cfg_mux_ref->frag_cfg_flags & ISOM_FRAGCFG_WRITE_SIDX)
+    {
+        sink_digest_release(snk, sidx_pos[0]);
+    }
     sink_flush_bits(snk);
 
  cleanup:
+    frag_write_plan_destroy(frag_plan);
 #ifdef _MSC_VER
     _rmtmp();
 #endif
@@ -6723,7 +7398,16 @@ mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
 }
 
 int
-mp4_muxer_output_init_segment(mp4_ctrl_handle_t muxer, uint16_t *p_video_width, uint16_t *p_video_height)
+mp4_muxer_output_tracks(mp4_ctrl_handle_t muxer)
+{
+    int ret;
+
+    MEM_ALLOC_SCOPE_CHK(muxer->allocator, ret = output_tracks(muxer));
+    return ret;
+}
+
+static int
+output_init_segment(mp4_ctrl_handle_t muxer, uint16_t *p_video_width, uint16_t *p_video_height)
 {
     int32_t           ret = EMA_MP4_MUXED_OK;
     bbio_handle_t snk = muxer->mp4_sink;
@@ -6747,7 +7431,7 @@ mp4_muxer_output_init_segment(mp4_ctrl_handle_t muxer, uint16_t *p_video_width,
     }
 
     /** write moov */
-    write_moov_box(snk, muxer);
+    METRICS_TIME(muxer->metrics.moov_ns, write_moov_box(snk, muxer));
     msglog(NULL, MSGLOG_INFO, "moov end @ offset %" PRIi64 "\n", snk->position(snk)-1);
 
     sink_flush_bits(snk);
@@ -6755,6 +7439,15 @@ mp4_muxer_output_init_segment(mp4_ctrl_handle_t muxer, uint16_t *p_video_width,
     return ret;
 }
 
+int
+mp4_muxer_output_init_segment(mp4_ctrl_handle_t muxer, uint16_t *p_video_width, uint16_t *p_video_height)
+{
+    int ret;
+
+    MEM_ALLOC_SCOPE_CHK(muxer->allocator, ret = output_init_segment(muxer, p_video_width, p_video_height));
+    return ret;
+}
+
 /** top level none media specific info, just ftyp for now */
 int
 mp4_muxer_output_hdrs (mp4_ctrl_handle_t hmuxer
@@ -6765,7 +7458,12 @@ mp4_muxer_output_hdrs (mp4_ctrl_handle_t hmuxer
         return EMA_MP4_MUXED_IO_ERR;
     }
 
-    hmuxer->moov_size_est = write_ftyp_box(hmuxer->mp4_sink, hmuxer); /** assuming the first box */
+    if (hmuxer->edit_moov)
+    {
+        return EMA_MP4_MUXED_OK;  /** the file edited has its 'ftyp' */
+    }
+
+    MEM_ALLOC_SCOPE_CHK(hmuxer->allocator, hmuxer->moov_size_est = write_ftyp_box(hmuxer->mp4_sink, hmuxer)); /** assuming the first box */
 
     return EMA_MP4_MUXED_OK;
 }
@@ -6778,7 +7476,7 @@ mp4_muxer_output_segment_hdrs(mp4_ctrl_handle_t hmuxer)
         return EMA_MP4_MUXED_IO_ERR;
     }
 
-    write_styp_box(hmuxer->mp4_sink, hmuxer);
+    MEM_ALLOC_SCOPE_CHK(hmuxer->allocator, write_styp_box(hmuxer->mp4_sink, hmuxer));
 
     return EMA_MP4_MUXED_OK;
 }
@@ -6795,6 +7493,8 @@ mp4_muxer_destroy (mp4_ctrl_handle_t hmuxer
     {
         return;
     }
+    /** the peaks of the run, and what is still held by the muxer and the parsers */
+    MEM_STATS_LOG_CHK();
 
     /** for mux */
 
@@ -6844,8 +7544,11 @@ mp4_muxer_destroy (mp4_ctrl_handle_t hmuxer
 
     FREE_CHK(hmuxer->major_brand);
     FREE_CHK(hmuxer->compatible_brands);
+    FREE_CHK(hmuxer->edit_moov);
 
     FREE_CHK(hmuxer);
+
+    MP4_TRACE_DUMP();
 }
 
 mp4_ctrl_handle_t
@@ -6860,8 +7563,15 @@ mp4_muxer_create (usr_cfg_mux_t *p_usr_cfg_mux
         msglog(NULL, MSGLOG_ERR, "ERROR: no muxer config given to mp4_muxer_create()\n");
         return NULL;
     }
+#ifndef ENABLE_MP4_ALLOC_HOOKS
+    if (p_usr_cfg_mux->allocator)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: allocator given, but built without ENABLE_MP4_ALLOC_HOOKS\n");
+        return NULL;
+    }
+#endif
 
-    muxer = (mp4_ctrl_handle_t)MALLOC_CHK(sizeof(mp4_ctrl_t));
+    MEM_ALLOC_SCOPE_CHK(p_usr_cfg_mux->allocator, muxer = (mp4_ctrl_handle_t)MALLOC_CHK(sizeof(mp4_ctrl_t)));
     if (!muxer)
     {
         msglog(NULL, MSGLOG_ERR, "ERROR: no memory\n");
@@ -6869,7 +7579,8 @@ mp4_muxer_create (usr_cfg_mux_t *p_usr_cfg_mux
     }
     memset(muxer, 0, sizeof(mp4_ctrl_t));
 
-    muxer->destroy = mp4_muxer_destroy;
+    muxer->destroy   = mp4_muxer_destroy;
+    muxer->allocator = p_usr_cfg_mux->allocator;
 
     muxer->timescale     = p_usr_cfg_mux->timescale;
     muxer->next_track_ID = 1;
@@ -6927,6 +7638,32 @@ mp4_muxer_set_onwrite_next_frag_callback(mp4_muxer_handle_t hmuxer
     hmuxer->onwrite_next_frag_cb_instance = p_instance;
 }
 
+void
+mp4_muxer_get_metrics(mp4_muxer_handle_t hmuxer
+                     ,mp4_metrics_t     *p_metrics
+                     )
+{
+    bbio_handle_t snk = hmuxer->mp4_sink;
+    uint32_t      u;
+
+    *p_metrics = hmuxer->metrics;
+
+    p_metrics->track_num = hmuxer->stream_num;
+    for (u = 0; u < hmuxer->stream_num; u++)
+    {
+        p_metrics->track_ID[u] = hmuxer->tracks[u]->track_ID;
+        p_metrics->parse_ns[u] = hmuxer->tracks[u]->parse_ns;
+    }
+    p_metrics->scratch_size_max = MAX2(p_metrics->scratch_size_max, hmuxer->scratchsize);
+
+    if (snk)
+    {
+        p_metrics->bytes_read    += snk->bytes_read;
+        p_metrics->bytes_written += snk->bytes_written;
+        p_metrics->seek_num      += snk->seek_num;
+    }
+}
+
 void
 mp4_muxer_set_sink (mp4_ctrl_handle_t hmuxer
                    ,bbio_handle_t     hsink
@@ -6936,6 +7673,91 @@ mp4_muxer_set_sink (mp4_ctrl_handle_t hmuxer
 }
 
 
+static int32_t
+set_edit_sink(mp4_ctrl_handle_t hmuxer, bbio_handle_t hsink)
+{
+    const uint8_t *mvhd;
+    size_t         mvhd_size;
+    size_t         size;
+    uint64_t       box_size;
+    int64_t        pos;
+    uint8_t        hdr[8];
+
+    if (hmuxer->stream_num)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: the file to edit must be set before tracks are added\n");
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+
+    hmuxer->edit_moov = mp4_demux_load_moov(hsink, &hmuxer->edit_moov_pos, &box_size, &hmuxer->edit_moov_size);
+    if (!hmuxer->edit_moov)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: no 'moov' box found in the file to edit\n");
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+    if (mp4_demux_find_box(hmuxer->edit_moov, hmuxer->edit_moov_size, "mvex", &size))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: fragmented mp4 files can't be edited\n");
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    mvhd = mp4_demux_find_box(hmuxer->edit_moov, hmuxer->edit_moov_size, "mvhd", &mvhd_size);
+    if (!mvhd || mvhd_size < ((mvhd[0] == 1) ? 112u : 100u))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: no valid 'mvhd' box found in the file to edit\n");
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    /** the movie goes on with its timescale, duration and track IDs */
+    if (mvhd[0] == 1)
+    {
+        hmuxer->timescale     = get_BE_u32(mvhd + 20);
+        hmuxer->duration      = get_BE_u64(mvhd + 24);
+        hmuxer->next_track_ID = get_BE_u32(mvhd + 108);
+    }
+    else
+    {
+        hmuxer->timescale     = get_BE_u32(mvhd + 12);
+        hmuxer->duration      = get_BE_u32(mvhd + 16);
+        hmuxer->next_track_ID = get_BE_u32(mvhd + 96);
+    }
+    if (!hmuxer->timescale)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: no movie timescale in the file to edit\n");
+        return EMA_MP4_MUXED_MP4_ERR;
+    }
+
+    /** the 'free' boxes right behind 'moov' are room for a larger one */
+    hmuxer->edit_room = box_size;
+    for (pos = hmuxer->edit_moov_pos + (int64_t)box_size; pos + 8 <= hsink->size(hsink); pos += (int64_t)box_size)
+    {
+        if (hsink->seek(hsink, pos, SEEK_SET) || hsink->read(hsink, hdr, 8) != 8)
+        {
+            break;
+        }
+        box_size = get_BE_u32(hdr);
+        if (box_size < 8 || box_size > (uint64_t)(hsink->size(hsink) - pos) ||
+            (!IS_FOURCC_EQUAL(hdr + 4, "free") && !IS_FOURCC_EQUAL(hdr + 4, "skip")))
+        {
+            break;
+        }
+        hmuxer->edit_room += box_size;
+    }
+
+    hmuxer->mp4_sink = hsink;
+    return EMA_MP4_MUXED_OK;
+}
+
+int32_t
+mp4_muxer_set_edit_sink (mp4_ctrl_handle_t hmuxer
+                        ,bbio_handle_t     hsink
+                        )
+{
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(hmuxer->allocator, ret = set_edit_sink(hmuxer, hsink));
+    return ret;
+}
+
 bbio_handle_t
 mp4_muxer_get_sink (mp4_ctrl_handle_t hmuxer
                    )
@@ -6943,12 +7765,8 @@ mp4_muxer_get_sink (mp4_ctrl_handle_t hmuxer
     return hmuxer->mp4_sink;
 }
 
-/** return track_ID */
-uint32_t
-mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
-                    ,parser_handle_t    hparser
-                    ,usr_cfg_es_t      *p_usr_cfg_es
-                    )
+static uint32_t
+add_track(mp4_ctrl_handle_t hmuxer, parser_handle_t hparser, usr_cfg_es_t *p_usr_cfg_es)
 {
     char           *codingname;
     track_handle_t  track;
@@ -7010,7 +7828,7 @@ mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
     track->flags = p_usr_cfg_es->force_tkhd_flags;
     FOURCC_ASSIGN(track->codingname, codingname);
 
-    if (IS_FOURCC_EQUAL(codingname,"hvc1")) 
+    if (IS_FOURCC_EQUAL(codingname,"hvc1") && !hparser->get_sample_entry) 
     {
         if (p_usr_cfg_es->sample_entry_name && IS_FOURCC_EQUAL(p_usr_cfg_es->sample_entry_name, "hvc1"))
         {
@@ -7025,7 +7843,7 @@ mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
     }
 
 
-    if (hmuxer->usr_cfg_mux_ref->dv_bl_non_comp_flag && hparser->stream_type == STREAM_TYPE_VIDEO)
+    if (hmuxer->usr_cfg_mux_ref->dv_bl_non_comp_flag && hparser->stream_type == STREAM_TYPE_VIDEO && !hparser->get_sample_entry)
     {
         if (IS_FOURCC_EQUAL(codingname,"avc1") || IS_FOURCC_EQUAL(codingname,"avc3"))
         {
@@ -7126,9 +7944,10 @@ mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
     track->sidx_reference_count = p_usr_cfg_es->force_sidx_ref_count;
 
     /** pre alloc lst */
-    track->dts_lst        = list_create(sizeof(idx_dts_t));
+    /** per sample lists: run coded, so that constant duration, all sync (audio) tracks keep a few runs */
+    track->dts_lst        = list_create_run(sizeof(idx_dts_t));
     track->cts_offset_lst = list_create(sizeof(count_value_t));
-    track->sync_lst       = list_create(sizeof(idx_dts_t));
+    track->sync_lst       = list_create_run(sizeof(idx_dts_t));
 
     track->edt_lst = list_create(sizeof(elst_entry_t));
 
@@ -7136,11 +7955,14 @@ mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
     track->chunk_lst = list_create(sizeof(chunk_t));
 
     track->stsd_lst = list_create(sizeof(idx_ptr_t));
-    track->sdtp_lst = list_create(sizeof(sample_sdtp_t));
+    track->sdtp_lst = list_create_run(sizeof(sample_sdtp_t));
     track->trik_lst = list_create(sizeof(sample_trik_t));
     track->frame_type_lst = list_create(sizeof(sample_frame_type_t));
     track->subs_lst = list_create(sizeof(sample_subs_t));
     track->segment_lst = list_create(sizeof(frag_index_t));
+    list_set_mem_tag(track->segment_lst, MP4_MEM_FRAG);
+    track->bitrate_win_lst = list_create(sizeof(dts_size_t));
+    track->bitrate_run_lst = list_create(sizeof(bitrate_run_t));
 
 #ifdef ENABLE_MP4_ENCRYPTION
     track->enc_info_lst     = list_create(sizeof(enc_subsample_info_t));
@@ -7165,9 +7987,10 @@ mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
     ptrun->tr_flags_override = p_usr_cfg_es->force_trun_flags;
 
     track->first_trun_in_traf = TRUE;
-    track->pos_lst            = list_create(sizeof(int64_t));       /** for no data tmp file case */
+    track->pos_lst            = list_create_run(sizeof(int64_t));   /** for no data tmp file case */
     track->size_it            = it_create();                        /** for tmp file case */
     track->tfra_entry_lst     = list_create(sizeof(tfra_entry_t));
+    list_set_mem_tag(track->tfra_entry_lst, MP4_MEM_FRAG);
     /** end of fragment */
 
     track->mp4_ctrl = hmuxer;
@@ -7185,13 +8008,22 @@ mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
     return track->track_ID;
 }
 
-int32_t
-mp4_muxer_add_moov_child_atom (mp4_muxer_handle_t  hmuxer
-                              ,const int8_t         *p_data
-                              ,      uint32_t      size
-                              ,      int8_t         *p_parent_box_type
-                              ,      uint32_t      track_ID
-                              )
+/** return track_ID */
+uint32_t
+mp4_muxer_add_track (mp4_ctrl_handle_t  hmuxer
+                    ,parser_handle_t    hparser
+                    ,usr_cfg_es_t      *p_usr_cfg_es
+                    )
+{
+    uint32_t track_ID;
+
+    MEM_ALLOC_SCOPE_CHK(hmuxer ? hmuxer->allocator : NULL, track_ID = add_track(hmuxer, hparser, p_usr_cfg_es));
+    return track_ID;
+}
+
+static int32_t
+add_moov_child_atom(mp4_muxer_handle_t hmuxer, const int8_t *p_data, uint32_t size, int8_t *p_parent_box_type,
+                    uint32_t track_ID)
 {
     atom_data_handle_t atom;
 
@@ -7223,6 +8055,20 @@ mp4_muxer_add_moov_child_atom (mp4_muxer_handle_t  hmuxer
     return EMA_MP4_MUXED_OK;
 }
 
+int32_t
+mp4_muxer_add_moov_child_atom (mp4_muxer_handle_t  hmuxer
+                              ,const int8_t         *p_data
+                              ,      uint32_t      size
+                              ,      int8_t         *p_parent_box_type
+                              ,      uint32_t      track_ID
+                              )
+{
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(hmuxer->allocator, ret = add_moov_child_atom(hmuxer, p_data, size, p_parent_box_type, track_ID));
+    return ret;
+}
+
 void
 mp4_muxer_add_moov_ainf_atom (mp4_ctrl_handle_t  hmuxer
                              ,const int8_t        *p_data
@@ -7279,11 +8125,8 @@ mp4_muxer_set_footer_meta_atom_data (mp4_muxer_handle_t   hmuxer
     hmuxer->num_footer_meta_items  = num_items;
 }
 
-int32_t
-mp4_muxer_add_udta_child_atom (mp4_muxer_handle_t  hmuxer
-                              ,const int8_t         *p_data
-                              ,      uint32_t      size
-                              )
+static int32_t
+add_udta_child_atom(mp4_muxer_handle_t hmuxer, const int8_t *p_data, uint32_t size)
 {
     atom_data_handle_t atom;
 
@@ -7309,6 +8152,18 @@ mp4_muxer_add_udta_child_atom (mp4_muxer_handle_t  hmuxer
     return EMA_MP4_MUXED_OK;
 }
 
+int32_t
+mp4_muxer_add_udta_child_atom (mp4_muxer_handle_t  hmuxer
+                              ,const int8_t         *p_data
+                              ,      uint32_t      size
+                              )
+{
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(hmuxer->allocator, ret = add_udta_child_atom(hmuxer, p_data, size));
+    return ret;
+}
+
 void
 mp4_muxer_set_OD_profile (mp4_ctrl_handle_t hmuxer
                          ,uint8_t           profile
@@ -7374,7 +8229,7 @@ mp4_muxer_add_to_track_edit_list (track_handle_t htrack
     uint64_t       duration_movie_ts = (uint32_t)rescale_u64(duration, movie_timescale, htrack->media_timescale);
     elst_entry_t * entry;
 
-    entry = (elst_entry_t *)list_alloc_entry(htrack->edt_lst);
+    MEM_ALLOC_SCOPE_CHK(htrack->mp4_ctrl->allocator, entry = (elst_entry_t *)list_alloc_entry(htrack->edt_lst));
     entry->segment_duration = duration_movie_ts; /** already converted to movie timescale */
     entry->media_time       = media_time;
     entry->media_rate       = 1;
@@ -7388,6 +8243,54 @@ mp4_muxer_add_to_track_edit_list (track_handle_t htrack
     }
 }
 
+int32_t
+mp4_muxer_set_track_dsi (track_handle_t  htrack
+                        ,uint32_t        entry
+                        ,const uint8_t * dsi
+                        ,uint32_t        dsi_size
+                        )
+{
+    int32_t ret;
+
+    MEM_ALLOC_SCOPE_CHK(htrack->mp4_ctrl->allocator, ret = stsd_dsi_set(htrack, entry, dsi, dsi_size));
+    return ret;
+}
+
+int32_t
+mp4_muxer_set_track_cts_offsets (track_handle_t   htrack
+                                ,const uint32_t * cts_offsets
+                                ,uint32_t         num
+                                )
+{
+    uint32_t *offsets;
+
+    if (num != htrack->sample_num)
+    {
+        return EMA_MP4_MUXED_PARAM_ERR;
+    }
+    MEM_ALLOC_SCOPE_CHK(htrack->mp4_ctrl->allocator, offsets = (uint32_t *)MALLOC_CHK((num ? num : 1)*sizeof(uint32_t)));
+    if (!offsets)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memcpy(offsets, cts_offsets, num*sizeof(uint32_t));
+    MEM_ALLOC_SCOPE_CHK(htrack->mp4_ctrl->allocator, FREE_CHK(htrack->cts_offsets));
+    htrack->cts_offsets = offsets;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+void
+mp4_muxer_set_track_clip (track_handle_t htrack
+                         ,uint64_t       skip
+                         ,uint64_t       duration
+                         )
+{
+    htrack->clip          = TRUE;
+    htrack->clip_skip     = skip;
+    htrack->clip_duration = duration;
+}
+
 void
 mp4_muxer_add_to_track_tfdt (track_handle_t  htrack
                              ,uint64_t       duration
@@ -7469,10 +8372,8 @@ update_enc_sample_info_video(track_handle_t track, uint32_t sample_size, int64_t
     return 0;
 }
 
-int
-mp4_muxer_encrypt_track (track_handle_t         htrack
-                        ,mp4_encryptor_handle_t hencryptor
-                        )
+static int
+encrypt_track(track_handle_t htrack, mp4_encryptor_handle_t hencryptor)
 {
     count_value_t *cv = NULL;
 
@@ -7507,6 +8408,17 @@ mp4_muxer_encrypt_track (track_handle_t         htrack
 
     return 0;
 }
+
+int
+mp4_muxer_encrypt_track (track_handle_t         htrack
+                        ,mp4_encryptor_handle_t hencryptor
+                        )
+{
+    int ret;
+
+    MEM_ALLOC_SCOPE_CHK(htrack->mp4_ctrl->allocator, ret = encrypt_track(htrack, hencryptor));
+    return ret;
+}
 #endif
 
 /** library version info */
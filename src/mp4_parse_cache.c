@@ -0,0 +1,987 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4_parse_cache.c
+    @brief Implements the sidecar caching the result of parsing an elementary stream
+*/
+
+#include <stddef.h>        /** offsetof() */
+#include <stdio.h>         /** remove(), rename() */
+
+#include "utils.h"
+#include "registry.h"      /** reg_bbio_get() */
+#include "parser.h"
+#include "mp4_muxer.h"     /** mp4_muxer_set_track_dsi() */
+#include "mp4_parse_cache.h"
+
+#define PARSE_CACHE_VERSION    3
+#define PARSE_CACHE_HASH_BLKS  16    /** number of es blocks hashed */
+#define PARSE_CACHE_HASH_BLK   4096  /** size of a hashed block */
+#define PARSE_CACHE_GAP        4096  /** max bytes between the data of two samples */
+
+typedef struct cache_sample_t_
+{
+    uint64_t dts;
+    uint64_t cts;
+    uint64_t pos;      /** of the data in the es, or of the AU in the nal index */
+    uint32_t duration;
+    uint32_t size;
+    uint32_t flags;
+    uint8_t  is_leading;
+    uint8_t  sample_depends_on;
+    uint8_t  sample_is_depended_on;
+    uint8_t  sample_has_redundancy;
+    uint8_t  pic_type;
+    uint8_t  frame_type;
+    uint8_t  dependency_level;
+} cache_sample_t;
+
+/** the parser members set while parsing */
+typedef struct parser_field_t_
+{
+    size_t offset;
+    size_t size;
+} parser_field_t;
+
+#define PARSER_FIELD(t, f)  { offsetof(t, f), sizeof(((t *)0)->f) }
+
+static const parser_field_t base_fields[] =
+{
+    PARSER_FIELD(parser_t, stream_id),
+    PARSER_FIELD(parser_t, codec_name),
+    PARSER_FIELD(parser_t, dsi_name),
+    PARSER_FIELD(parser_t, sd_collision_flag),
+    PARSER_FIELD(parser_t, ac4_bitstream_version),
+    PARSER_FIELD(parser_t, ac4_presentation_version),
+    PARSER_FIELD(parser_t, ac4_mdcompat),
+    PARSER_FIELD(parser_t, profile_levelID),
+    PARSER_FIELD(parser_t, num_units_in_tick),
+    PARSER_FIELD(parser_t, time_scale),
+    PARSER_FIELD(parser_t, bit_rate),
+    PARSER_FIELD(parser_t, buferSizeDB),
+    PARSER_FIELD(parser_t, minBitrate),
+    PARSER_FIELD(parser_t, maxBitrate),
+    PARSER_FIELD(parser_t, isJoC),
+    PARSER_FIELD(parser_t, isReferencedEs),
+    PARSER_FIELD(parser_t, frame_size),
+    PARSER_FIELD(parser_t, num_samples)
+};
+
+static const parser_field_t audio_fields[] =
+{
+    PARSER_FIELD(parser_audio_t, channelcount),
+    PARSER_FIELD(parser_audio_t, samplesize),
+    PARSER_FIELD(parser_audio_t, sample_rate),
+    PARSER_FIELD(parser_audio_t, qtflags),
+    PARSER_FIELD(parser_audio_t, wave_format)
+};
+
+static const parser_field_t video_fields[] =
+{
+    PARSER_FIELD(parser_video_t, width),
+    PARSER_FIELD(parser_video_t, height),
+    PARSER_FIELD(parser_video_t, depth),
+    PARSER_FIELD(parser_video_t, hSpacing),
+    PARSER_FIELD(parser_video_t, vSpacing),
+    PARSER_FIELD(parser_video_t, framerate),
+    PARSER_FIELD(parser_video_t, colour_primaries),
+    PARSER_FIELD(parser_video_t, transfer_characteristics),
+    PARSER_FIELD(parser_video_t, matrix_coefficients)
+};
+
+#define FIELD_NUM(a)  (sizeof(a) / sizeof((a)[0]))
+
+struct mp4_parse_cache_t_
+{
+    track_handle_t track;
+    bbio_handle_t  es;           /** a reader of the es of its own */
+    int8_t *       fn;           /** of the sidecar */
+
+    /** key */
+    int8_t *       es_path;
+    uint64_t       es_size;
+    uint64_t       es_mtime;
+    uint64_t       es_hash;
+    int8_t         dsi_name[4];  /** the settings the parser got before parsing */
+    ext_timing_info_t ext_timing;
+
+    BOOL           hit;
+    BOOL           recording;    /** miss: the data of all samples so far found in the es, not yet written */
+    BOOL           nals;         /** the samples are AUs of the nal index of the parser */
+
+    cache_sample_t *samples;
+    uint32_t       sample_num;
+    uint32_t       sample_max;
+    uint32_t       sample_idx;   /** hit: next sample to output */
+    size_t         data_size;    /** hit: size of the sample data buffer */
+
+    uint64_t       next_pos;     /** miss: where the data of the next sample is looked for */
+    uint8_t *      buf;
+    size_t         buf_size;
+
+    nal_index_handle_t idx;      /** miss: the AUs of the samples, copied from the parser */
+    int64_t        idx_base;     /** hit: where the AUs are in the nal index of the parser */
+    int64_t        idx_size;
+
+    /** hit: the state at the end of parsing */
+    union
+    {
+        parser_audio_t audio;
+        parser_video_t video;
+    } state;
+    uint32_t       audio_channel_count;
+    uint32_t       stsd_num;
+    idx_ptr_t *    stsd;         /** (idx, dsi): of each sample description entry, the dsi size prefixed */
+    uint32_t *     cts_offsets;  /** of each sample the muxer took, if the parser fixes them after parsing */
+    uint32_t       cts_offset_num;
+};
+
+static BOOL
+parser_qualifies(parser_handle_t parser)
+{
+    /** a track of an mp4 file isn't parsed in the first place */
+    if (parser->get_sample_entry)
+    {
+        return FALSE;
+    }
+    switch (parser->stream_id)
+    {
+    case STREAM_ID_AC3:
+    case STREAM_ID_EC3:
+    case STREAM_ID_AC4:
+    case STREAM_ID_AAC:
+        return TRUE;
+    case STREAM_ID_H264:
+    case STREAM_ID_HEVC:
+        return parser->get_nal_index != NULL;
+    default:
+        return FALSE;
+    }
+}
+
+/** the fields of the parser's stream type */
+static const parser_field_t *
+type_fields(parser_handle_t parser, uint32_t *num)
+{
+    if (parser->stream_type == STREAM_TYPE_VIDEO)
+    {
+        *num = FIELD_NUM(video_fields);
+        return video_fields;
+    }
+    *num = FIELD_NUM(audio_fields);
+    return audio_fields;
+}
+
+static int32_t
+buf_reserve(mp4_parse_cache_handle_t cache, size_t size)
+{
+    if (size > cache->buf_size)
+    {
+        uint8_t *buf = REALLOC_CHK(cache->buf, size);
+
+        if (!buf)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+        cache->buf      = buf;
+        cache->buf_size = size;
+    }
+    return EMA_MP4_MUXED_OK;
+}
+
+/** FNV-1a over the es size and PARSE_CACHE_HASH_BLKS blocks spread evenly over the es */
+static int32_t
+es_hash(mp4_parse_cache_handle_t cache)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t   blk  = (cache->es_size < PARSE_CACHE_HASH_BLK) ? (size_t)cache->es_size : PARSE_CACHE_HASH_BLK;
+    uint32_t b;
+    size_t   i;
+
+    if (buf_reserve(cache, PARSE_CACHE_HASH_BLK))
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    for (i = 0; i < 8; i++)
+    {
+        hash = (hash ^ ((cache->es_size >> (8 * i)) & 0xff)) * 0x100000001b3ULL;
+    }
+    for (b = 0; b < PARSE_CACHE_HASH_BLKS; b++)
+    {
+        int64_t pos = (int64_t)((cache->es_size - blk) * b / (PARSE_CACHE_HASH_BLKS - 1));
+
+        if (cache->es->seek(cache->es, pos, SEEK_SET) || cache->es->read(cache->es, cache->buf, blk) != blk)
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+        for (i = 0; i < blk; i++)
+        {
+            hash = (hash ^ cache->buf[i]) * 0x100000001b3ULL;
+        }
+    }
+    cache->es_hash = hash;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static void
+write_key(bbio_handle_t snk, mp4_parse_cache_handle_t cache)
+{
+    uint16_t len = (uint16_t)strlen(cache->es_path);
+
+    sink_write_4CC(snk, "pidx");
+    sink_write_u32(snk, PARSE_CACHE_VERSION);
+    sink_write_u16(snk, len);
+    snk->write(snk, (const uint8_t *)cache->es_path, len);
+    sink_write_u64(snk, cache->es_size);
+    sink_write_u64(snk, cache->es_mtime);
+    sink_write_u64(snk, cache->es_hash);
+    sink_write_u32(snk, cache->ext_timing.override_timing);
+    sink_write_u32(snk, cache->ext_timing.time_scale);
+    sink_write_u32(snk, cache->ext_timing.num_units_in_tick);
+    sink_write_u8(snk, cache->ext_timing.ext_dv_profile);
+    sink_write_u8(snk, cache->ext_timing.ext_dv_bl_compatible_id);
+    sink_write_u8(snk, cache->ext_timing.ps_present_flag);
+    sink_write_u32(snk, cache->ext_timing.ac4_bitrate);
+    sink_write_u32(snk, cache->ext_timing.ac4_bitrate_precision);
+    sink_write_u32(snk, cache->ext_timing.hls_flag);
+    /** e.g. avc3 and hev1 keep the parameter sets in the samples */
+    snk->write(snk, (const uint8_t *)cache->dsi_name, 4);
+}
+
+static void
+write_fields(bbio_handle_t snk, const uint8_t *p, const parser_field_t *fields, uint32_t num)
+{
+    uint32_t u, i;
+
+    for (i = 0; i < num; i++)
+    {
+        if (fields[i].size == 4)
+        {
+            memcpy(&u, p + fields[i].offset, 4);
+            sink_write_u32(snk, u);
+        }
+        else
+        {
+            snk->write(snk, p + fields[i].offset, fields[i].size);
+        }
+    }
+}
+
+static int32_t
+read_fields(bbio_handle_t src, uint8_t *p, const parser_field_t *fields, uint32_t num)
+{
+    uint32_t u, i;
+    int32_t  err = 0;
+
+    for (i = 0; i < num; i++)
+    {
+        if (fields[i].size == 4)
+        {
+            err |= src_rd_u32(src, &u);
+            memcpy(p + fields[i].offset, &u, 4);
+        }
+        else if (fields[i].size == 1)
+        {
+            err |= src_rd_u8(src, p + fields[i].offset);
+        }
+        else if (src->read(src, p + fields[i].offset, fields[i].size) != fields[i].size)
+        {
+            err = 1;
+        }
+    }
+    return err;
+}
+
+/** reads the sidecar written for what write_key() writes into the hit state */
+static int32_t
+read_sidecar(mp4_parse_cache_handle_t cache, bbio_handle_t src)
+{
+    parser_handle_t       parser = cache->track->parser;
+    const parser_field_t *fields;
+    bbio_handle_t         snk;
+    uint8_t *             key;
+    size_t                key_size;
+    uint64_t              idx_size;
+    uint32_t              u, i, num;
+    int32_t               err = 0;
+
+    /** the key must be what it would be written as now */
+    snk = reg_bbio_get('b', 'w');
+    snk->set_buffer(snk, NULL, 256, 1);
+    write_key(snk, cache);
+    key = snk->get_buffer(snk, &key_size, 0);
+    snk->destroy(snk);
+    if (buf_reserve(cache, key_size))
+    {
+        FREE_CHK(key);
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    if (src->read(src, cache->buf, key_size) != key_size || memcmp(cache->buf, key, key_size))
+    {
+        FREE_CHK(key);
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    FREE_CHK(key);
+
+    fields = type_fields(parser, &num);
+    err |= read_fields(src, (uint8_t *)&cache->state, base_fields, FIELD_NUM(base_fields));
+    err |= read_fields(src, (uint8_t *)&cache->state, fields, num);
+    err |= src_rd_u32(src, &cache->audio_channel_count);
+
+    err |= src_rd_u32(src, &cache->stsd_num);
+    if (err || !cache->stsd_num || cache->stsd_num > 0xFFFF)
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    cache->stsd = (idx_ptr_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, cache->stsd_num * sizeof(idx_ptr_t));
+    if (!cache->stsd)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    memset(cache->stsd, 0, cache->stsd_num * sizeof(idx_ptr_t));
+    for (i = 0; i < cache->stsd_num; i++)
+    {
+        idx_ptr_t *ip = &cache->stsd[i];
+
+        err |= src_rd_u32(src, &ip->idx);
+        err |= src_rd_u32(src, &u);
+        if (err || (int64_t)u > src->size(src))
+        {
+            return EMA_MP4_MUXED_NO_SUPPORT;
+        }
+        ip->ptr = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_DSI, 4 + u);
+        if (!ip->ptr)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+        ip->ptr[0] = (uint8_t)(u >> 24);
+        ip->ptr[1] = (uint8_t)(u >> 16);
+        ip->ptr[2] = (uint8_t)(u >> 8);
+        ip->ptr[3] = (uint8_t)u;
+        if (src->read(src, ip->ptr + 4, u) != u)
+        {
+            return EMA_MP4_MUXED_NO_SUPPORT;
+        }
+    }
+
+    err |= src_rd_u32(src, &cache->sample_num);
+    if (err || (int64_t)cache->sample_num * 40 > src->size(src))
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    cache->samples = (cache_sample_t *)MALLOC_CHK((cache->sample_num + 1) * sizeof(cache_sample_t));
+    if (!cache->samples)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    cache->sample_max = cache->sample_num + 1;
+    for (i = 0; i < cache->sample_num; i++)
+    {
+        cache_sample_t *cs = &cache->samples[i];
+
+        err |= src_rd_u64(src, &cs->dts);
+        err |= src_rd_u64(src, &cs->cts);
+        err |= src_rd_u64(src, &cs->pos);
+        err |= src_rd_u32(src, &cs->duration);
+        err |= src_rd_u32(src, &cs->size);
+        err |= src_rd_u32(src, &cs->flags);
+        err |= src_rd_u8(src, &cs->is_leading);
+        err |= src_rd_u8(src, &cs->sample_depends_on);
+        err |= src_rd_u8(src, &cs->sample_is_depended_on);
+        err |= src_rd_u8(src, &cs->sample_has_redundancy);
+        err |= src_rd_u8(src, &cs->pic_type);
+        err |= src_rd_u8(src, &cs->frame_type);
+        err |= src_rd_u8(src, &cs->dependency_level);
+        if (err || (!cache->nals && (cs->pos > cache->es_size || cs->size > cache->es_size - cs->pos)))
+        {
+            return EMA_MP4_MUXED_NO_SUPPORT;
+        }
+    }
+
+    err |= src_rd_u32(src, &cache->cts_offset_num);
+    if (err || (cache->cts_offset_num && cache->cts_offset_num > cache->sample_num))
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    cache->cts_offsets = (uint32_t *)MALLOC_CHK((cache->cts_offset_num + 1) * sizeof(uint32_t));
+    if (!cache->cts_offsets)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    for (i = 0; i < cache->cts_offset_num; i++)
+    {
+        err |= src_rd_u32(src, &cache->cts_offsets[i]);
+    }
+
+    /** the AUs go after any the parser has: the samples are checked to be in them first */
+    err |= src_rd_u64(src, &idx_size);
+    if (err || (int64_t)idx_size != src->size(src) - src->position(src) || (idx_size && !cache->nals))
+    {
+        return EMA_MP4_MUXED_NO_SUPPORT;
+    }
+    for (i = 0; i < cache->sample_num; i++)
+    {
+        if (cache->nals && cache->samples[i].pos >= idx_size)
+        {
+            return EMA_MP4_MUXED_NO_SUPPORT;
+        }
+    }
+    if (idx_size)
+    {
+        nal_index_handle_t idx = parser->get_nal_index(parser);
+
+        cache->idx_base = nal_index_position(idx);
+        cache->idx_size = (int64_t)idx_size;
+        if (nal_index_load(idx, src, cache->idx_size))
+        {
+            return EMA_MP4_MUXED_READ_ERR;
+        }
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static BOOL
+load_sidecar(mp4_parse_cache_handle_t cache)
+{
+    bbio_handle_t src = reg_bbio_get('f', 'r');
+    int32_t       ret = EMA_MP4_MUXED_OPEN_FILE_ERR;
+
+    if (!src->open(src, cache->fn))
+    {
+        ret = read_sidecar(cache, src);
+    }
+    src->destroy(src);
+
+    if (ret)
+    {
+        uint32_t i;
+
+        for (i = 0; cache->stsd && i < cache->stsd_num; i++)
+        {
+            FREE_CHK(cache->stsd[i].ptr);
+        }
+        FREE_CHK(cache->stsd);
+        FREE_CHK(cache->samples);
+        FREE_CHK(cache->cts_offsets);
+        cache->stsd           = NULL;
+        cache->stsd_num       = 0;
+        cache->samples        = NULL;
+        cache->sample_num     = 0;
+        cache->sample_max     = 0;
+        cache->cts_offsets    = NULL;
+        cache->cts_offset_num = 0;
+        if (ret != EMA_MP4_MUXED_OPEN_FILE_ERR)
+        {
+            msglog(NULL, MSGLOG_INFO, "Parse cache %s does not match the es\n", cache->fn);
+        }
+    }
+    return ret == EMA_MP4_MUXED_OK;
+}
+
+static void
+restore_fields(uint8_t *dst, const uint8_t *src, const parser_field_t *fields, uint32_t num)
+{
+    uint32_t i;
+
+    for (i = 0; i < num; i++)
+    {
+        memcpy(dst + fields[i].offset, src + fields[i].offset, fields[i].size);
+    }
+}
+
+static void
+restore_parser(mp4_parse_cache_handle_t cache)
+{
+    parser_handle_t       parser = cache->track->parser;
+    const parser_field_t *fields;
+    uint32_t              num;
+
+    fields = type_fields(parser, &num);
+    restore_fields((uint8_t *)parser, (uint8_t *)&cache->state, base_fields, FIELD_NUM(base_fields));
+    restore_fields((uint8_t *)parser, (uint8_t *)&cache->state, fields, num);
+}
+
+mp4_parse_cache_handle_t
+mp4_parse_cache_open(const int8_t *dir, const int8_t *es_fn, track_handle_t track, BOOL *hit)
+{
+    mp4_parse_cache_handle_t cache;
+    const int8_t *           name;
+    int8_t *                 fn;
+
+    *hit = FALSE;
+    name = strrchr(es_fn, PATH_DELIMITER);
+    name = name ? name + 1 : es_fn;
+    fn   = (int8_t *)MALLOC_CHK(strlen(dir) + strlen(name) + 7);
+    if (!fn)
+    {
+        return NULL;
+    }
+    sprintf(fn, "%s%c%s.pidx", dir, PATH_DELIMITER, name);
+    cache = mp4_parse_cache_open_file(fn, es_fn, track, hit);
+    FREE_CHK(fn);
+
+    return cache;
+}
+
+mp4_parse_cache_handle_t
+mp4_parse_cache_open_file(const int8_t *fn, const int8_t *es_fn, track_handle_t track, BOOL *hit)
+{
+    mp4_parse_cache_handle_t cache;
+    parser_handle_t          parser = track->parser;
+    const int8_t *           name;
+    const int8_t *           es_dir;
+    osal_stat_t              st;
+
+    *hit = FALSE;
+    if (!parser_qualifies(parser))
+    {
+        msglog(NULL, MSGLOG_WARNING, "Parse cache: %s es not supported, parsing it\n", parser->stream_name);
+        return NULL;
+    }
+
+    cache = (mp4_parse_cache_handle_t)MALLOC_CHK(sizeof(mp4_parse_cache_t));
+    if (!cache)
+    {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(mp4_parse_cache_t));
+    cache->track      = track;
+    cache->nals       = (parser->get_nal_index != NULL);
+    cache->ext_timing = parser->ext_timing;
+    FOURCC_ASSIGN(cache->dsi_name, parser->dsi_name);
+
+    name = strrchr(es_fn, PATH_DELIMITER);
+    name = name ? name + 1 : es_fn;
+    es_dir = parser->ds->get_path(parser->ds);
+    cache->fn      = STRDUP_CHK(fn);
+    cache->es_path = (int8_t *)MALLOC_CHK(strlen(es_dir) + strlen(name) + 1);
+    cache->es      = reg_bbio_get('f', 'r');
+    if (!cache->fn || !cache->es_path || cache->es->open(cache->es, es_fn) || OSAL_STAT(es_fn, &st))
+    {
+        mp4_parse_cache_destroy(cache);
+        return NULL;
+    }
+    sprintf(cache->es_path, "%s%s", es_dir, name);
+    cache->es_size  = (uint64_t)cache->es->size(cache->es);
+    cache->es_mtime = (uint64_t)st.st_mtime;
+    if (es_hash(cache))
+    {
+        mp4_parse_cache_destroy(cache);
+        return NULL;
+    }
+
+    if (load_sidecar(cache))
+    {
+        msglog(NULL, MSGLOG_INFO, "Parse cache %s: %u samples\n", cache->fn, cache->sample_num);
+        restore_parser(cache);
+        cache->hit = TRUE;
+    }
+    else
+    {
+        cache->recording = TRUE;
+        if (cache->nals)
+        {
+            cache->idx = nal_index_create();
+            if (!cache->idx)
+            {
+                mp4_parse_cache_destroy(cache);
+                return NULL;
+            }
+        }
+    }
+    *hit = cache->hit;
+
+    return cache;
+}
+
+void
+mp4_parse_cache_destroy(mp4_parse_cache_handle_t cache)
+{
+    uint32_t i;
+
+    if (!cache)
+    {
+        return;
+    }
+    if (cache->es)
+    {
+        cache->es->destroy(cache->es);
+    }
+    for (i = 0; i < cache->stsd_num; i++)
+    {
+        FREE_CHK(cache->stsd[i].ptr);
+    }
+    FREE_CHK(cache->stsd);
+    FREE_CHK(cache->samples);
+    FREE_CHK(cache->cts_offsets);
+    nal_index_destroy(cache->idx);
+    FREE_CHK(cache->buf);
+    FREE_CHK(cache->es_path);
+    FREE_CHK(cache->fn);
+    FREE_CHK(cache);
+}
+
+int32_t
+mp4_parse_cache_get_sample(mp4_parse_cache_handle_t cache, mp4_sample_handle_t sample)
+{
+    cache_sample_t *cs;
+
+    if (cache->sample_idx == cache->sample_num)
+    {
+        return EMA_MP4_MUXED_EOES;
+    }
+    cs = &cache->samples[cache->sample_idx++];
+
+    if (cache->nals)
+    {
+        /** the parser reads the AU when the muxer outputs it */
+        if (sample->data)
+        {
+            FREE_CHK(sample->data);
+            sample->data = NULL;
+        }
+        sample->pos = (offset_t)(cache->idx_base + (int64_t)cs->pos);
+    }
+    else if (cs->size > cache->data_size || !sample->data)
+    {
+        uint8_t *data = REALLOC_CHK(sample->data, cs->size ? cs->size : 1);
+
+        if (!data)
+        {
+            return EMA_MP4_MUXED_NO_MEM;
+        }
+        sample->data     = data;
+        cache->data_size = cs->size;
+    }
+    if (!cache->nals &&
+        (cache->es->seek(cache->es, (int64_t)cs->pos, SEEK_SET) ||
+         cache->es->read(cache->es, sample->data, cs->size) != cs->size))
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Can't read sample %u from the es\n", cache->sample_idx - 1);
+        return EMA_MP4_MUXED_READ_ERR;
+    }
+
+    sample->dts                   = cs->dts;
+    sample->cts                   = cs->cts;
+    sample->duration              = cs->duration;
+    sample->size                  = cs->size;
+    sample->flags                 = cs->flags;
+    sample->is_leading            = cs->is_leading;
+    sample->sample_depends_on     = cs->sample_depends_on;
+    sample->sample_is_depended_on = cs->sample_is_depended_on;
+    sample->sample_has_redundancy = cs->sample_has_redundancy;
+    sample->pic_type              = cs->pic_type;
+    sample->frame_type            = cs->frame_type;
+    sample->dependency_level      = cs->dependency_level;
+    sample->subsample_sizes       = NULL;
+    sample->num_subsamples        = 0;
+    if (!cache->nals)
+    {
+        sample->pos = (offset_t)cs->pos;
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+int32_t
+mp4_parse_cache_restore(mp4_parse_cache_handle_t cache)
+{
+    track_handle_t track = cache->track;
+    idx_ptr_t *    ip;
+    uint32_t       i;
+    int32_t        ret;
+
+    /** the muxer made the same sample description entries from the same samples */
+    if (list_get_entry_num(track->stsd_lst) != cache->stsd_num)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR! Parse cache %s: sample descriptions differ\n", cache->fn);
+        return EMA_MP4_MUXED_BUGGY;
+    }
+    list_it_init(track->stsd_lst);
+    for (i = 0; (ip = list_it_get_entry(track->stsd_lst)); i++)
+    {
+        if (ip->idx != cache->stsd[i].idx || ip->ptr)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Parse cache %s: sample descriptions differ\n", cache->fn);
+            return EMA_MP4_MUXED_BUGGY;
+        }
+    }
+    /** the entries are built as from the parser, with the settings of this mux */
+    for (i = 0; i < cache->stsd_num; i++)
+    {
+        ip  = &cache->stsd[i];
+        ret = mp4_muxer_set_track_dsi(track, i, ip->ptr + 4, get_BE_u32(ip->ptr));
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            return ret;
+        }
+    }
+    track->audio_channel_count = cache->audio_channel_count;
+    if (cache->cts_offset_num)
+    {
+        ret = mp4_muxer_set_track_cts_offsets(track, cache->cts_offsets, cache->cts_offset_num);
+        if (ret != EMA_MP4_MUXED_OK)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR! Parse cache %s: the samples differ\n", cache->fn);
+            return EMA_MP4_MUXED_BUGGY;
+        }
+    }
+
+    return EMA_MP4_MUXED_OK;
+}
+
+void
+mp4_parse_cache_add_sample(mp4_parse_cache_handle_t cache, mp4_sample_handle_t sample)
+{
+    cache_sample_t *cs;
+    uint64_t        pos = cache->next_pos;
+
+    if (!cache->recording)
+    {
+        return;
+    }
+    if (sample->num_subsamples || (sample->size && !sample->data == !cache->nals))
+    {
+        cache->recording = FALSE;
+    }
+    else if (cache->nals)
+    {
+        /** the parser taking over the track on split parsing has the AU */
+        parser_handle_t parser = cache->track->parser;
+        int64_t         au_pos;
+
+        if (nal_index_copy_au(cache->idx, parser->get_nal_index(parser), sample->pos, &au_pos))
+        {
+            cache->recording = FALSE;
+        }
+        pos = (uint64_t)au_pos;
+    }
+    else if (sample->size)
+    {
+        /** look for the data after that of the previous sample */
+        uint64_t left = cache->es_size - cache->next_pos;
+        size_t   win  = sample->size + PARSE_CACHE_GAP;
+        size_t   off;
+
+        if (win > left)
+        {
+            win = (size_t)left;
+        }
+        if (win < sample->size || buf_reserve(cache, win) ||
+            cache->es->seek(cache->es, (int64_t)cache->next_pos, SEEK_SET) ||
+            cache->es->read(cache->es, cache->buf, win) != win)
+        {
+            cache->recording = FALSE;
+        }
+        else
+        {
+            for (off = 0; off + sample->size <= win; off++)
+            {
+                if (cache->buf[off] == sample->data[0] && !memcmp(cache->buf + off, sample->data, sample->size))
+                {
+                    break;
+                }
+            }
+            if (off + sample->size > win)
+            {
+                cache->recording = FALSE;
+            }
+            pos += off;
+        }
+    }
+    if (!cache->recording)
+    {
+        msglog(NULL, MSGLOG_INFO, "Parse cache: sample %u is not a part of the es, not caching\n", cache->sample_num);
+        nal_index_destroy(cache->idx);
+        cache->idx = NULL;
+        return;
+    }
+
+    if (cache->sample_num == cache->sample_max)
+    {
+        uint32_t        max     = cache->sample_max ? 2 * cache->sample_max : 1024;
+        cache_sample_t *samples = REALLOC_CHK(cache->samples, max * sizeof(cache_sample_t));
+
+        if (!samples)
+        {
+            cache->recording = FALSE;
+            return;
+        }
+        cache->samples    = samples;
+        cache->sample_max = max;
+    }
+    cs = &cache->samples[cache->sample_num++];
+    cs->dts                   = sample->dts;
+    cs->cts                   = sample->cts;
+    cs->pos                   = pos;
+    cs->duration              = sample->duration;
+    cs->size                  = (uint32_t)sample->size;
+    cs->flags                 = sample->flags;
+    cs->is_leading            = sample->is_leading;
+    cs->sample_depends_on     = sample->sample_depends_on;
+    cs->sample_is_depended_on = sample->sample_is_depended_on;
+    cs->sample_has_redundancy = sample->sample_has_redundancy;
+    cs->pic_type              = sample->pic_type;
+    cs->frame_type            = sample->frame_type;
+    cs->dependency_level      = sample->dependency_level;
+    if (!cache->nals)
+    {
+        cache->next_pos = pos + sample->size;
+    }
+}
+
+int32_t
+mp4_parse_cache_save(mp4_parse_cache_handle_t cache)
+{
+    track_handle_t        track  = cache->track;
+    parser_handle_t       parser = track->parser;
+    const parser_field_t *fields;
+    bbio_handle_t         snk;
+    idx_ptr_t *           ip;
+    idx_ptr_t *           dsi;
+    int8_t *              tmp_fn;
+    uint32_t              u, i, num;
+    BOOL                  cts_fixed;
+    int32_t               ret = EMA_MP4_MUXED_OK;
+
+    if (cache->hit || !cache->recording)
+    {
+        return EMA_MP4_MUXED_OK;
+    }
+    /** restoring the state of the parser doesn't give those back */
+    if (parser->dv_rpu_nal_flag || parser->dv_el_nal_flag)
+    {
+        msglog(NULL, MSGLOG_INFO, "Parse cache: Dolby Vision es are not cached\n");
+        return EMA_MP4_MUXED_OK;
+    }
+    if (parser->stream_id == STREAM_ID_AAC && list_get_entry_num(parser->dsi_lst) > 1)
+    {
+        msglog(NULL, MSGLOG_INFO, "Parse cache: AAC es changing their configuration are not cached\n");
+        return EMA_MP4_MUXED_OK;
+    }
+    /** each entry built, with the dsi it got from the parser kept in the same order */
+    if (!track->stsd_dsi_lst || list_get_entry_num(track->stsd_dsi_lst) != list_get_entry_num(track->stsd_lst))
+    {
+        return EMA_MP4_MUXED_OK;
+    }
+    list_it_init(track->stsd_dsi_lst);
+    for (i = 0; (dsi = list_it_get_entry(track->stsd_dsi_lst)); i++)
+    {
+        if (dsi->idx != i)
+        {
+            return EMA_MP4_MUXED_OK;
+        }
+    }
+
+    /** written aside and renamed so that no partial sidecar is ever seen */
+    tmp_fn = (int8_t *)MALLOC_CHK(strlen(cache->fn) + 5);
+    if (!tmp_fn)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    sprintf(tmp_fn, "%s.tmp", cache->fn);
+    snk = reg_bbio_get('f', 'w');
+    if (snk->open(snk, tmp_fn))
+    {
+        msglog(NULL, MSGLOG_WARNING, "Can't write parse cache %s\n", tmp_fn);
+        snk->destroy(snk);
+        FREE_CHK(tmp_fn);
+        return EMA_MP4_MUXED_OPEN_FILE_ERR;
+    }
+
+    write_key(snk, cache);
+    fields = type_fields(parser, &num);
+    write_fields(snk, (const uint8_t *)parser, base_fields, FIELD_NUM(base_fields));
+    write_fields(snk, (const uint8_t *)parser, fields, num);
+    sink_write_u32(snk, track->audio_channel_count);
+
+    sink_write_u32(snk, list_get_entry_num(track->stsd_lst));
+    list_it_init(track->stsd_lst);
+    list_it_init(track->stsd_dsi_lst);
+    while ((ip = list_it_get_entry(track->stsd_lst)) && (dsi = list_it_get_entry(track->stsd_dsi_lst)))
+    {
+        sink_write_u32(snk, ip->idx);
+        snk->write(snk, dsi->ptr, 4 + get_BE_u32(dsi->ptr));
+    }
+
+    sink_write_u32(snk, cache->sample_num);
+    for (i = 0; i < cache->sample_num; i++)
+    {
+        cache_sample_t *cs = &cache->samples[i];
+
+        sink_write_u64(snk, cs->dts);
+        sink_write_u64(snk, cs->cts);
+        sink_write_u64(snk, cs->pos);
+        sink_write_u32(snk, cs->duration);
+        sink_write_u32(snk, cs->size);
+        sink_write_u32(snk, cs->flags);
+        sink_write_u8(snk, cs->is_leading);
+        sink_write_u8(snk, cs->sample_depends_on);
+        sink_write_u8(snk, cs->sample_is_depended_on);
+        sink_write_u8(snk, cs->sample_has_redundancy);
+        sink_write_u8(snk, cs->pic_type);
+        sink_write_u8(snk, cs->frame_type);
+        sink_write_u8(snk, cs->dependency_level);
+    }
+
+    /** the muxer took those the parser fixed after parsing */
+    cts_fixed = parser->get_cts_offset && parser->need_fix_cts(parser);
+    sink_write_u32(snk, cts_fixed ? track->sample_num : 0);
+    for (u = 0; cts_fixed && u < track->sample_num; u++)
+    {
+        sink_write_u32(snk, (uint32_t)parser->get_cts_offset(parser, u));
+    }
+
+    sink_write_u64(snk, cache->nals ? (uint64_t)nal_index_position(cache->idx) : 0);
+    if (cache->nals)
+    {
+        ret = nal_index_save(cache->idx, snk);
+    }
+    snk->destroy(snk);
+    if (ret != EMA_MP4_MUXED_OK)
+    {
+        msglog(NULL, MSGLOG_WARNING, "Can't write parse cache %s\n", tmp_fn);
+        remove(tmp_fn);
+        FREE_CHK(tmp_fn);
+        return ret;
+    }
+
+    remove(cache->fn);
+    if (rename(tmp_fn, cache->fn))
+    {
+        msglog(NULL, MSGLOG_WARNING, "Can't write parse cache %s\n", cache->fn);
+        remove(tmp_fn);
+        ret = EMA_MP4_MUXED_WRITE_ERR;
+    }
+    else
+    {
+        msglog(NULL, MSGLOG_INFO, "Parse cache %s written: %u samples\n", cache->fn, cache->sample_num);
+        cache->recording = FALSE;
+    }
+    FREE_CHK(tmp_fn);
+
+    return ret;
+}
@@ -644,11 +644,23 @@ stream_destroy (stream_handle_t stream)
             }
             list_destroy(stream->stsd_lst);
         }
+        if (stream->stsd_dsi_lst)
+        {
+            list_it_init(stream->stsd_dsi_lst);
+            while ((idx_ptr = list_it_get_entry(stream->stsd_dsi_lst)))
+            {
+                FREE_CHK(idx_ptr->ptr);
+            }
+            list_destroy(stream->stsd_dsi_lst);
+        }
+        FREE_CHK(stream->cts_offsets);
         list_destroy(stream->sdtp_lst);
         list_destroy(stream->trik_lst);
         list_destroy(stream->frame_type_lst);
         list_destroy(stream->subs_lst);
         list_destroy(stream->segment_lst);
+        list_destroy(stream->bitrate_win_lst);
+        list_destroy(stream->bitrate_run_lst);
 #ifdef ENABLE_MP4_ENCRYPTION
         list_destroy(stream->enc_info_lst);
         it_destroy(stream->enc_info_mdat_it);
@@ -685,6 +697,7 @@ stream_destroy (stream_handle_t stream)
         FREE_CHK(stream->stsz.data);
         FREE_CHK(stream->stss.data);
         FREE_CHK(stream->stsd.data);
+        FREE_CHK(stream->sdtp.data);
 
         /** fragment */
         if (stream->frag_snk_file)
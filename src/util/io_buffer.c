@@ -87,6 +87,7 @@ buf_seek(bbio_handle_t bbio, int64_t offset, int origin)
     }
     /** else offset is the one */
 
+    b->seek_num++;
     if (offset < 0 || offset > (int64_t)b->buf_size)
     {
         return -1;
@@ -212,7 +213,8 @@ buf_write(bbio_handle_t snk, const uint8_t *buf, size_t size)
     }
 
     memcpy(b->buf + b->op_offset, buf, size);
-    b->op_offset = offset_new;
+    b->op_offset      = offset_new;
+    b->bytes_written += size;
     if ((int64_t)b->data_size < b->op_offset)
     {
         b->data_size = (size_t)b->op_offset;
@@ -244,7 +246,8 @@ buf_read(bbio_handle_t src, uint8_t *buf, size_t size)
     }
 
     memcpy(buf, b->buf + b->op_offset, size2rd);
-    b->op_offset += size2rd;
+    b->op_offset  += size2rd;
+    b->bytes_read += size2rd;
 
     return size2rd;
 }
@@ -285,6 +288,7 @@ buf_skip_bytes(bbio_handle_t bbio, int64_t byte_num)
 {
     bbio_buf_handle_t b = (bbio_buf_handle_t)bbio;
 
+    b->seek_num++;
     b->op_offset += byte_num;
     if (b->op_offset > (int64_t)b->data_size)
     {
@@ -0,0 +1,772 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_digest.c
+    @brief Implements a sink computing MD5 and SHA-256 digests of what is written through it
+*/
+
+#include <stdio.h>       /** SEEK_SET */
+
+#include "io_digest.h"
+#include "registry.h"    /** reg_bbio_get() */
+#include "utils.h"       /** MIN2() */
+#include "msg_log.h"     /** msglog() */
+#include "memory_chk.h"  /** MALLOC_CHK() */
+
+#define DIGEST_FEED_SIZE  (64*1024)           /**< bytes kept before trying to hash them */
+#define DIGEST_KEEP_MAX   (64*1024*1024)      /**< bytes kept at most before reading them back at close */
+#define DIGEST_READ_SIZE  (1024*1024)
+
+/**** MD5 (RFC 1321) and SHA-256 (FIPS 180-4), both on 64 byte blocks */
+
+typedef struct hash_t_
+{
+    uint32_t md5[4];
+    uint32_t sha256[8];
+    uint64_t size;
+    uint8_t  blk[64];   /**< the bytes of the block started: size % 64 */
+} hash_t;
+
+static const uint32_t md5_k[64] =
+{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5_r[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+static const uint32_t sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTL32(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+md5_block(uint32_t *h, const uint8_t *p)
+{
+    uint32_t w[16];
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    uint32_t i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)p[4*i] | ((uint32_t)p[4*i + 1] << 8) | ((uint32_t)p[4*i + 2] << 16) | ((uint32_t)p[4*i + 3] << 24);
+    }
+    for (i = 0; i < 64; i++)
+    {
+        uint32_t f, g, t;
+
+        if (i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = (5*i + 1) & 15;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3*i + 5) & 15;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7*i) & 15;
+        }
+        t = d;
+        d = c;
+        c = b;
+        b = b + ROTL32(a + f + md5_k[i] + w[g], md5_r[((i >> 4) << 2) | (i & 3)]);
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+static void
+sha256_block(uint32_t *h, const uint8_t *p)
+{
+    uint32_t w[64];
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    uint32_t i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)p[4*i] << 24) | ((uint32_t)p[4*i + 1] << 16) | ((uint32_t)p[4*i + 2] << 8) | (uint32_t)p[4*i + 3];
+    }
+    for (i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    for (i = 0; i < 64; i++)
+    {
+        uint32_t t1 = k + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += k;
+}
+
+static void
+hash_init(hash_t *h)
+{
+    static const uint32_t md5_h0[4]    = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    static const uint32_t sha256_h0[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                           0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    memcpy(h->md5, md5_h0, sizeof(md5_h0));
+    memcpy(h->sha256, sha256_h0, sizeof(sha256_h0));
+    h->size = 0;
+}
+
+static void
+hash_update(hash_t *h, const uint8_t *p, size_t n)
+{
+    size_t blk_len = (size_t)(h->size & 63);
+
+    h->size += n;
+    if (blk_len)
+    {
+        size_t m = MIN2(n, 64 - blk_len);
+
+        memcpy(h->blk + blk_len, p, m);
+        p += m;
+        n -= m;
+        if (blk_len + m < 64)
+        {
+            return;
+        }
+        md5_block(h->md5, h->blk);
+        sha256_block(h->sha256, h->blk);
+    }
+    for (; n >= 64; p += 64, n -= 64)
+    {
+        md5_block(h->md5, p);
+        sha256_block(h->sha256, p);
+    }
+    memcpy(h->blk, p, n);
+}
+
+static void
+hash_final(const hash_t *h, digest_t *digest)
+{
+    uint64_t bits    = h->size << 3;
+    size_t   blk_len = (size_t)(h->size & 63);
+    uint8_t  tail[128];
+    size_t   tail_len = (blk_len < 56) ? 64 : 128;
+    uint32_t md5[4], sha256[8];
+    uint32_t i;
+
+    /** 0x80, zeros and the bit length: little endian for MD5, big endian for SHA-256 */
+    memcpy(tail, h->blk, blk_len);
+    tail[blk_len] = 0x80;
+    memset(tail + blk_len + 1, 0, tail_len - blk_len - 1);
+    memcpy(md5, h->md5, sizeof(md5));
+    memcpy(sha256, h->sha256, sizeof(sha256));
+
+    for (i = 0; i < 8; i++)
+    {
+        tail[tail_len - 8 + i] = (uint8_t)(bits >> (8*i));
+    }
+    md5_block(md5, tail);
+    if (tail_len == 128)
+    {
+        md5_block(md5, tail + 64);
+    }
+    for (i = 0; i < 8; i++)
+    {
+        tail[tail_len - 8 + i] = (uint8_t)(bits >> (56 - 8*i));
+    }
+    sha256_block(sha256, tail);
+    if (tail_len == 128)
+    {
+        sha256_block(sha256, tail + 64);
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        digest->md5[i] = (uint8_t)(md5[i >> 2] >> (8*(i & 3)));
+    }
+    for (i = 0; i < 32; i++)
+    {
+        digest->sha256[i] = (uint8_t)(sha256[i >> 2] >> (24 - 8*(i & 3)));
+    }
+    digest->size = h->size;
+}
+
+/**** the sink */
+
+typedef struct bbio_digest_t_
+{
+    BBIO;
+
+    bbio_handle_t snk;          /**< the sink written through */
+    digest_cb_t   cb;
+    void *        instance;
+    int8_t *      name;         /**< NULL if not open */
+    int64_t       pos;          /**< the position in snk */
+
+    /** the bytes not hashed yet: [hashed, hashed + pend_size) at pend + pend_off */
+    int64_t  hashed;
+    uint8_t *pend;
+    size_t   pend_off, pend_size, pend_buf_size;
+    BOOL     spilled;           /**< pend dropped: the bytes from hashed on are read back at close */
+    BOOL     broken;            /**< a byte hashed already was written again */
+
+    int64_t *holds;             /**< the positions held, unordered */
+    uint32_t hold_num, hold_buf_num;
+    int64_t *marks;             /**< the segment starts not hashed up to yet, in order */
+    uint32_t mark_num, mark_buf_num;
+
+    hash_t   file;
+    hash_t   seg;
+    BOOL     in_seg;
+    uint32_t seg_num;
+    int64_t  seg_offset;
+} bbio_digest_t;
+typedef bbio_digest_t *bbio_digest_handle_t;
+
+static void
+digest_report(bbio_digest_handle_t d, const hash_t *h, uint32_t segment, int64_t offset)
+{
+    digest_t digest;
+
+    if (d->broken || !d->cb)
+    {
+        return;
+    }
+    memset(&digest, 0, sizeof(digest));
+    digest.name    = d->name;
+    digest.segment = segment;
+    digest.offset  = offset;
+    hash_final(h, &digest);
+    d->cb(d->instance, &digest);
+}
+
+/** hashes the bytes at hashed on, starting the segments they cross */
+static void
+digest_feed(bbio_digest_handle_t d, const uint8_t *p, size_t n)
+{
+    while (n || (d->mark_num && d->marks[0] <= d->hashed))
+    {
+        size_t m = n;
+
+        if (d->mark_num && d->marks[0] <= d->hashed)
+        {
+            if (d->in_seg && d->seg.size)
+            {
+                digest_report(d, &d->seg, d->seg_num, d->seg_offset);
+            }
+            if (!d->in_seg || d->seg.size)
+            {
+                d->seg_num++;
+            }
+            hash_init(&d->seg);
+            d->in_seg     = TRUE;
+            d->seg_offset = d->hashed;
+            d->mark_num--;
+            memmove(d->marks, d->marks + 1, d->mark_num*sizeof(int64_t));
+            continue;
+        }
+        if (d->mark_num && d->marks[0] < d->hashed + (int64_t)n)
+        {
+            m = (size_t)(d->marks[0] - d->hashed);
+        }
+        hash_update(&d->file, p, m);
+        if (d->in_seg)
+        {
+            hash_update(&d->seg, p, m);
+        }
+        d->hashed += m;
+        p         += m;
+        n         -= m;
+    }
+}
+
+/** hashes the bytes kept up to the lowest position held */
+static void
+digest_advance(bbio_digest_handle_t d)
+{
+    int64_t  limit = d->hashed + (int64_t)d->pend_size;
+    uint32_t u;
+    size_t   n;
+
+    if (d->spilled)
+    {
+        return;
+    }
+    for (u = 0; u < d->hold_num; u++)
+    {
+        limit = MIN2(limit, d->holds[u]);
+    }
+    if (limit <= d->hashed)
+    {
+        return;
+    }
+    n = (size_t)(limit - d->hashed);
+    digest_feed(d, d->pend + d->pend_off, n);
+    d->pend_off  += n;
+    d->pend_size -= n;
+    if (!d->pend_size)
+    {
+        d->pend_off = 0;
+    }
+}
+
+/** keeps the bytes of a write from hashed on */
+static void
+digest_keep(bbio_digest_handle_t d, int64_t pos, const uint8_t *buf, size_t size)
+{
+    size_t start, end;
+
+    if (pos < d->hashed)
+    {
+        size_t skip = (size_t)MIN2((int64_t)size, d->hashed - pos);
+
+        if (!d->broken)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR: %s: bytes written again after they were hashed: no digests\n", d->name);
+            d->broken = TRUE;
+        }
+        pos  += skip;
+        buf  += skip;
+        size -= skip;
+        if (!size)
+        {
+            return;
+        }
+    }
+    if (d->spilled)
+    {
+        return;
+    }
+
+    start = (size_t)(pos - d->hashed);
+    end   = start + size;
+    if (d->pend_off + end > d->pend_buf_size)
+    {
+        if (d->pend_off)
+        {
+            memmove(d->pend, d->pend + d->pend_off, d->pend_size);
+            d->pend_off = 0;
+        }
+        if (end > d->pend_buf_size)
+        {
+            size_t   buf_size = MAX2(end, 2*d->pend_buf_size);
+            uint8_t *pend     = (uint8_t *)REALLOC_CHK(d->pend, buf_size);
+
+            if (!pend)
+            {
+                msglog(NULL, MSGLOG_ERR, "ERROR: %s: out of memory: no digests\n", d->name);
+                d->broken = TRUE;
+                return;
+            }
+            d->pend          = pend;
+            d->pend_buf_size = buf_size;
+        }
+    }
+    if (start > d->pend_size)
+    {
+        /** a gap reads as zeros */
+        memset(d->pend + d->pend_off + d->pend_size, 0, start - d->pend_size);
+    }
+    memcpy(d->pend + d->pend_off + start, buf, size);
+    d->pend_size = MAX2(d->pend_size, end);
+
+    if (d->pend_size >= DIGEST_FEED_SIZE)
+    {
+        digest_advance(d);
+    }
+    if (d->pend_size > DIGEST_KEEP_MAX && (d->snk->dev_type == 'f' || d->snk->read))
+    {
+        msglog(NULL, MSGLOG_INFO, "%s: bytes from offset %" PRIi64 " on are hashed at close\n", d->name, d->hashed);
+        FREE_CHK(d->pend);
+        d->pend          = NULL;
+        d->pend_off      = 0;
+        d->pend_size     = 0;
+        d->pend_buf_size = 0;
+        d->spilled       = TRUE;
+    }
+}
+
+/** hashes what is left, the bytes which were dropped read back from the file or the sink itself */
+static void
+digest_finish(bbio_digest_handle_t d)
+{
+    if (d->spilled && !d->broken)
+    {
+        bbio_handle_t src = d->snk->dev_type != 'f' ? d->snk : reg_bbio_get('f', 'r');
+        uint8_t *     buf = (uint8_t *)MALLOC_CHK(DIGEST_READ_SIZE);
+        size_t        n;
+
+        if (!src || !buf || (src != d->snk && src->open(src, d->name)) || src->seek(src, d->hashed, SEEK_SET))
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR: %s: can't be read back: no digests\n", d->name);
+            d->broken = TRUE;
+        }
+        else
+        {
+            while ((n = src->read(src, buf, DIGEST_READ_SIZE)) > 0)
+            {
+                digest_feed(d, buf, n);
+            }
+        }
+        if (src && src != d->snk)
+        {
+            src->destroy(src);
+        }
+        FREE_CHK(buf);
+    }
+    else if (!d->spilled)
+    {
+        d->hold_num = 0;
+        digest_advance(d);
+    }
+    digest_feed(d, NULL, 0);
+
+    if (d->in_seg && d->seg.size)
+    {
+        digest_report(d, &d->seg, d->seg_num, d->seg_offset);
+    }
+    digest_report(d, &d->file, 0, 0);
+}
+
+static int32_t
+digest_open(bbio_handle_t bbio, const int8_t *dev_name)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)bbio;
+    int32_t              ret;
+
+    ret = d->snk->open(d->snk, dev_name);
+    if (ret)
+    {
+        return ret;
+    }
+    d->name = STRDUP_CHK(dev_name);
+    if (!d->name)
+    {
+        d->snk->close(d->snk);
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    d->pos       = d->snk->position(d->snk);
+    d->hashed    = d->pos;
+    d->pend_off  = 0;
+    d->pend_size = 0;
+    d->spilled   = FALSE;
+    d->broken    = FALSE;
+    d->hold_num  = 0;
+    d->mark_num  = 0;
+    d->in_seg    = FALSE;
+    d->seg_num   = 0;
+    hash_init(&d->file);
+
+    return ret;
+}
+
+static void
+digest_close(bbio_handle_t bbio)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)bbio;
+
+    if (d->name)
+    {
+        /** the bytes to read back need to be in the file. Other sinks may not keep them once closed */
+        if (d->spilled && d->snk->dev_type == 'f')
+        {
+            d->snk->close(d->snk);
+        }
+        digest_finish(d);
+        FREE_CHK(d->name);
+        d->name = NULL;
+    }
+    d->snk->close(d->snk);
+}
+
+static void
+digest_destroy(bbio_handle_t bbio)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)bbio;
+
+    digest_close(bbio);
+    d->snk->destroy(d->snk);
+    FREE_CHK(d->pend);
+    FREE_CHK(d->holds);
+    FREE_CHK(d->marks);
+    FREE_CHK(d);
+}
+
+static int64_t
+digest_position(bbio_handle_t bbio)
+{
+    return ((bbio_digest_handle_t)bbio)->pos;
+}
+
+static int32_t
+digest_seek(bbio_handle_t bbio, int64_t offset, int32_t origin)
+{
+    bbio_digest_handle_t d   = (bbio_digest_handle_t)bbio;
+    int32_t              ret = d->snk->seek(d->snk, offset, origin);
+
+    d->seek_num++;
+    d->pos = d->snk->position(d->snk);
+    return ret;
+}
+
+static const int8_t *
+digest_get_path(bbio_handle_t bbio)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)bbio;
+
+    return d->snk->get_path ? d->snk->get_path(d->snk) : d->name;
+}
+
+static size_t
+digest_write(bbio_handle_t snk, const uint8_t *buf, size_t size)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)snk;
+    size_t               n = d->snk->write(d->snk, buf, size);
+
+    if (d->name && n)
+    {
+        digest_keep(d, d->pos, buf, n);
+    }
+    d->pos           += n;
+    d->bytes_written += n;
+    return n;
+}
+
+static void
+digest_set_buffer(bbio_handle_t bbio, uint8_t *buf, size_t buf_size, BOOL re_al)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)bbio;
+
+    d->snk->set_buffer(d->snk, buf, buf_size, re_al);
+}
+
+static uint8_t *
+digest_get_buffer(bbio_handle_t bbio, size_t *data_size, size_t *buf_size)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)bbio;
+
+    return d->snk->get_buffer(d->snk, data_size, buf_size);
+}
+
+bbio_handle_t
+digest_sink_create(bbio_handle_t snk, digest_cb_t cb, void *instance)
+{
+    bbio_digest_handle_t d;
+
+    if (!snk)
+    {
+        return NULL;
+    }
+    d = (bbio_digest_handle_t)MALLOC_CHK(sizeof(bbio_digest_t));
+    if (!d)
+    {
+        return NULL;
+    }
+    memset(d, 0, sizeof(bbio_digest_t));
+
+    d->dev_type = 'd';
+    d->io_mode  = 'w';
+    d->destroy  = digest_destroy;
+    d->open     = digest_open;
+    d->close    = digest_close;
+    d->position = digest_position;
+    d->seek     = digest_seek;
+    d->get_path = digest_get_path;
+    d->write    = digest_write;
+    if (snk->set_buffer)
+    {
+        d->set_buffer = digest_set_buffer;
+        d->get_buffer = digest_get_buffer;
+    }
+
+    d->snk      = snk;
+    d->cb       = cb;
+    d->instance = instance;
+
+    return (bbio_handle_t)d;
+}
+
+BOOL
+sink_is_digest(bbio_handle_t sink)
+{
+    return sink && sink->dev_type == 'd';
+}
+
+/** appends val to the array *vals of *num entries, room for *buf_num */
+static BOOL
+digest_append(int64_t **vals, uint32_t *num, uint32_t *buf_num, int64_t val)
+{
+    if (*num == *buf_num)
+    {
+        uint32_t n = (*buf_num) ? 2*(*buf_num) : 16;
+        int64_t *p = (int64_t *)REALLOC_CHK(*vals, n*sizeof(int64_t));
+
+        if (!p)
+        {
+            return FALSE;
+        }
+        *vals    = p;
+        *buf_num = n;
+    }
+    (*vals)[(*num)++] = val;
+    return TRUE;
+}
+
+void
+sink_digest_hold(bbio_handle_t sink, int64_t pos)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)sink;
+
+    if (!sink_is_digest(sink) || !d->name)
+    {
+        return;
+    }
+    if (pos < d->hashed || !digest_append(&d->holds, &d->hold_num, &d->hold_buf_num, pos))
+    {
+        if (!d->broken)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR: %s: can't hold offset %" PRIi64 ": no digests\n", d->name, pos);
+            d->broken = TRUE;
+        }
+    }
+}
+
+void
+sink_digest_release(bbio_handle_t sink, int64_t pos)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)sink;
+    uint32_t             u;
+
+    if (!sink_is_digest(sink) || !d->name)
+    {
+        return;
+    }
+    for (u = 0; u < d->hold_num; u++)
+    {
+        if (d->holds[u] == pos)
+        {
+            d->holds[u] = d->holds[--d->hold_num];
+            digest_advance(d);
+            return;
+        }
+    }
+}
+
+void
+sink_digest_segment(bbio_handle_t sink)
+{
+    bbio_digest_handle_t d = (bbio_digest_handle_t)sink;
+
+    if (!sink_is_digest(sink) || !d->name)
+    {
+        return;
+    }
+    if (!digest_append(&d->marks, &d->mark_num, &d->mark_buf_num, d->pos))
+    {
+        if (!d->broken)
+        {
+            msglog(NULL, MSGLOG_ERR, "ERROR: %s: out of memory: no digests\n", d->name);
+            d->broken = TRUE;
+        }
+    }
+}
+
+int32_t
+src_digest(bbio_handle_t src, int64_t offset, uint64_t size, digest_t *digest)
+{
+    uint8_t *buf = (uint8_t *)MALLOC_CHK(DIGEST_READ_SIZE);
+    hash_t   h;
+    size_t   n;
+    int32_t  ret = EMA_MP4_MUXED_OK;
+
+    if (!buf)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    hash_init(&h);
+    if (src->seek(src, offset, SEEK_SET))
+    {
+        ret = EMA_MP4_MUXED_READ_ERR;
+    }
+    while (ret == EMA_MP4_MUXED_OK && h.size < size)
+    {
+        n = src->read(src, buf, (size_t)MIN2(size - h.size, (uint64_t)DIGEST_READ_SIZE));
+        if (!n)
+        {
+            ret = EMA_MP4_MUXED_READ_ERR;
+            break;
+        }
+        hash_update(&h, buf, n);
+    }
+    FREE_CHK(buf);
+
+    memset(digest, 0, sizeof(digest_t));
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        digest->offset = offset;
+        hash_final(&h, digest);
+    }
+    return ret;
+}
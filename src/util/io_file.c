@@ -61,12 +61,12 @@ file_open(bbio_handle_t bbio, const int8_t *dev_name)
         int wlen = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, dev_name, -1, NULL, 0);
         if (wlen == 0)
             return 1;
-        wfilename = malloc(sizeof(wchar_t) * wlen);
+        wfilename = MALLOC_CHK(sizeof(wchar_t) * wlen);
         if (wfilename == NULL)
             return 1;
         MultiByteToWideChar(CP_UTF8, 0, dev_name, -1, wfilename, wlen);
-        ret = _wfopen_s(&f->fp, wfilename, bbio->io_mode == 'r' ? L"rb" : L"wb");
-        free(wfilename);
+        ret = _wfopen_s(&f->fp, wfilename, bbio->io_mode == 'r' ? L"rb" : (bbio->io_mode == 'w' ? L"wb" : L"r+b"));
+        FREE_CHK(wfilename);
     }
 #else
     OSAL_FOPEN(ret, f->fp, dev_name, bbio->io_mode);
@@ -75,7 +75,7 @@ file_open(bbio_handle_t bbio, const int8_t *dev_name)
     if (!ret) {
         char *pd;
 
-        if (bbio->io_mode == 'r') {
+        if (bbio->io_mode == 'r' || bbio->io_mode == 'e') {
             OSAL_FSEEK(f->fp, 0, SEEK_END);
             f->file_len = OSAL_FTELL(f->fp);
             OSAL_FSEEK(f->fp, 0, SEEK_SET);
@@ -150,6 +150,7 @@ file_position(bbio_handle_t bbio)
 static int32_t
 file_seek(bbio_handle_t bbio, int64_t offset, int32_t origin)
 {
+    bbio->seek_num++;
     return OSAL_FSEEK(((bbio_file_handle_t)bbio)->fp, offset, origin);
 }
 
@@ -163,13 +164,19 @@ file_get_path(bbio_handle_t bbio)
 static size_t
 file_write(bbio_handle_t snk, const uint8_t *buf, size_t size)
 {
-    return OSAL_FWRITE(buf, size, ((bbio_file_handle_t)snk)->fp);
+    size_t n = OSAL_FWRITE(buf, size, ((bbio_file_handle_t)snk)->fp);
+
+    snk->bytes_written += n;
+    return n;
 }
 
 static size_t 
 file_read(bbio_handle_t src, uint8_t *buf, size_t size)
 {
-    return OSAL_FREAD(buf, size, ((bbio_file_handle_t)src)->fp);
+    size_t n = OSAL_FREAD(buf, size, ((bbio_file_handle_t)src)->fp);
+
+    src->bytes_read += n;
+    return n;
 }
 
 /** size of the data file or in buf */  
@@ -208,6 +215,7 @@ file_is_more_byte2(bbio_handle_t bbio)
 static int32_t 
 file_skip_bytes(bbio_handle_t bbio, int64_t byte_num)
 {
+    bbio->seek_num++;
     return OSAL_FSEEK(((bbio_file_handle_t)bbio)->fp, byte_num, SEEK_CUR);
 }
 
@@ -267,5 +275,6 @@ bbio_file_reg(void)
 {
     reg_bbio_set('f', 'w', file_create);
     reg_bbio_set('f', 'r', file_create);
+    reg_bbio_set('f', 'e', file_create);
 }
 
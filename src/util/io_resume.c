@@ -0,0 +1,213 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_resume.c
+    @brief Implements a sink continuing the output an interrupted job left
+*/
+
+#include <stdio.h>       /** SEEK_SET */
+
+#include "io_resume.h"
+#include "utils.h"       /** MAX2() */
+#include "memory_chk.h"  /** MALLOC_CHK() */
+
+typedef struct bbio_resume_t_
+{
+    BBIO;
+
+    bbio_handle_t snk;          /**< the sink written through */
+    int64_t       next_skip;    /**< for the file opened next */
+    int64_t       skip;         /**< the bytes of the file open which are not written again. 0 once past them */
+    BOOL          drop;         /**< the file open is complete: snk isn't open */
+    int64_t       pos;          /**< the position in the file as written */
+    int64_t       end;          /**< its size */
+} bbio_resume_t;
+typedef bbio_resume_t *bbio_resume_handle_t;
+
+static int32_t
+resume_open(bbio_handle_t bbio, const int8_t *dev_name)
+{
+    bbio_resume_handle_t r = (bbio_resume_handle_t)bbio;
+
+    r->skip      = r->next_skip;
+    r->next_skip = 0;
+    r->drop      = (r->skip < 0);
+    r->pos       = 0;
+    r->end       = (r->skip > 0) ? r->skip : 0;
+    if (r->drop)
+    {
+        return 0;
+    }
+    return r->snk->open(r->snk, dev_name);
+}
+
+static void
+resume_close(bbio_handle_t bbio)
+{
+    bbio_resume_handle_t r = (bbio_resume_handle_t)bbio;
+
+    if (!r->drop)
+    {
+        r->snk->close(r->snk);
+    }
+}
+
+static void
+resume_destroy(bbio_handle_t bbio)
+{
+    bbio_resume_handle_t r = (bbio_resume_handle_t)bbio;
+
+    resume_close(bbio);
+    r->snk->destroy(r->snk);
+    FREE_CHK(r);
+}
+
+static int64_t
+resume_position(bbio_handle_t bbio)
+{
+    return ((bbio_resume_handle_t)bbio)->pos;
+}
+
+static int32_t
+resume_seek(bbio_handle_t bbio, int64_t offset, int32_t origin)
+{
+    bbio_resume_handle_t r = (bbio_resume_handle_t)bbio;
+
+    if (origin == SEEK_CUR)
+    {
+        offset += r->pos;
+    }
+    else if (origin == SEEK_END)
+    {
+        offset += r->end;
+    }
+    if (offset < 0)
+    {
+        return -1;
+    }
+
+    r->seek_num++;
+    r->pos = offset;
+    if (r->drop || r->skip)
+    {
+        /** snk is sought to where the writing through starts */
+        return 0;
+    }
+    return r->snk->seek(r->snk, offset, SEEK_SET);
+}
+
+static const int8_t *
+resume_get_path(bbio_handle_t bbio)
+{
+    bbio_resume_handle_t r = (bbio_resume_handle_t)bbio;
+
+    return r->snk->get_path ? r->snk->get_path(r->snk) : NULL;
+}
+
+static size_t
+resume_write(bbio_handle_t snk, const uint8_t *buf, size_t size)
+{
+    bbio_resume_handle_t r    = (bbio_resume_handle_t)snk;
+    size_t               kept = 0;
+    size_t               n;
+
+    if (r->drop || r->pos + (int64_t)size <= r->skip)
+    {
+        r->pos += size;
+        r->end  = MAX2(r->end, r->pos);
+        return size;
+    }
+    if (r->skip)
+    {
+        /** the first write past the bytes in the file: all is written from here on */
+        kept    = (r->pos < r->skip) ? (size_t)(r->skip - r->pos) : 0;
+        r->skip = 0;
+        if (r->snk->seek(r->snk, r->pos + kept, SEEK_SET))
+        {
+            return 0;
+        }
+    }
+
+    n = r->snk->write(r->snk, buf + kept, size - kept);
+    r->pos           += kept + n;
+    r->end            = MAX2(r->end, r->pos);
+    r->bytes_written += n;
+    return kept + n;
+}
+
+bbio_handle_t
+resume_sink_create(bbio_handle_t snk)
+{
+    bbio_resume_handle_t r;
+
+    if (!snk)
+    {
+        return NULL;
+    }
+    r = (bbio_resume_handle_t)MALLOC_CHK(sizeof(bbio_resume_t));
+    if (!r)
+    {
+        return NULL;
+    }
+    memset(r, 0, sizeof(bbio_resume_t));
+
+    r->dev_type = 'k';
+    r->io_mode  = 'w';
+    r->destroy  = resume_destroy;
+    r->open     = resume_open;
+    r->close    = resume_close;
+    r->position = resume_position;
+    r->seek     = resume_seek;
+    r->get_path = resume_get_path;
+    r->write    = resume_write;
+
+    r->snk = snk;
+
+    return (bbio_handle_t)r;
+}
+
+void
+sink_resume_skip(bbio_handle_t sink, int64_t size)
+{
+    if (sink && sink->dev_type == 'k')
+    {
+        ((bbio_resume_handle_t)sink)->next_skip = size;
+    }
+}
+
+int64_t
+sink_resume_dropped(bbio_handle_t sink)
+{
+    bbio_resume_handle_t r = (bbio_resume_handle_t)sink;
+
+    if (!sink || sink->dev_type != 'k')
+    {
+        return 0;
+    }
+    if (r->drop)
+    {
+        return INT64_MAX;
+    }
+    return (r->skip > r->pos) ? r->skip - r->pos : 0;
+}
@@ -0,0 +1,422 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_rope.c
+    @brief Implements a memory sink made of fixed size blocks
+
+    Unlike the buffer sink, growing it never moves what was written: a new block is added
+    instead of reallocating and copying the whole buffer. Any position can still be seeked
+    to and written again, as for size fields and offsets patched later on.
+
+    A rope sink can also hand each file written into it over to a callback when it is
+    closed, the blocks with it: segments go out without being written to files first.
+*/
+
+#include <stdio.h>       /** SEEK_CUR */
+
+#include "io_rope.h"
+#include "registry.h"
+#include "utils.h"       /** MIN2() */
+#include "msg_log.h"     /** msglog() */
+#include "memory_chk.h"  /** MALLOC_CHK() */
+
+#define ROPE_BLOCK_SIZE  (1024*1024)  /**< default size of the blocks */
+
+typedef struct bbio_rope_t_
+{
+    BBIO;
+
+    uint8_t **blocks;      /**< the blocks, allocated as they are written into */
+    size_t    block_num;   /**< number of blocks allocated */
+    size_t    block_max;   /**< number of entries of blocks */
+    size_t    block_size;  /**< size of each block */
+
+    int64_t   data_size;   /**< bytes written so far: up to the highest position written */
+    int64_t   op_offset;   /**< next operation position */
+
+    /** if set, the files written are handed over when closed */
+    segment_cb_t cb;
+    void *       cb_instance;
+    int8_t *     name;      /**< the name of the file open. NULL if none */
+    uint32_t     open_num;  /**< number of files opened so far */
+} bbio_rope_t;
+typedef bbio_rope_t *bbio_rope_handle_t;
+
+static void
+rope_free_blocks(bbio_rope_handle_t r)
+{
+    size_t i;
+
+    for (i = 0; i < r->block_num; i++)
+    {
+        FREE_CHK(r->blocks[i]);
+    }
+    FREE_CHK(r->blocks);
+    r->blocks    = NULL;
+    r->block_num = 0;
+    r->block_max = 0;
+    r->data_size = 0;
+    r->op_offset = 0;
+}
+
+/** Allocates the blocks up to block_num. Returns FALSE if out of memory */
+static BOOL
+rope_grow(bbio_rope_handle_t r, size_t block_num)
+{
+    if (block_num > r->block_max)
+    {
+        /** only the table of blocks is reallocated, not the blocks */
+        size_t    block_max = MAX2(block_num, 2*r->block_max);
+        uint8_t **blocks    = (uint8_t **)REALLOC_CHK(r->blocks, block_max*sizeof(uint8_t *));
+
+        if (!blocks)
+        {
+            return FALSE;
+        }
+        r->blocks    = blocks;
+        r->block_max = block_max;
+    }
+    while (r->block_num < block_num)
+    {
+        r->blocks[r->block_num] = (uint8_t *)MALLOC_CHK(r->block_size);
+        if (!r->blocks[r->block_num])
+        {
+            return FALSE;
+        }
+        r->block_num++;
+    }
+    return TRUE;
+}
+
+/** Copies size bytes of buf, zeros if buf is NULL, to offset. Returns FALSE if out of memory */
+static BOOL
+rope_put(bbio_rope_handle_t r, int64_t offset, const uint8_t *buf, size_t size)
+{
+    while (size)
+    {
+        size_t idx = (size_t)(offset / r->block_size);
+        size_t in  = (size_t)(offset % r->block_size);
+        size_t n   = MIN2(size, r->block_size - in);
+
+        if (idx >= r->block_num && !rope_grow(r, idx + 1))
+        {
+            return FALSE;
+        }
+        if (buf)
+        {
+            memcpy(r->blocks[idx] + in, buf, n);
+            buf += n;
+        }
+        else
+        {
+            memset(r->blocks[idx] + in, 0, n);
+        }
+        offset += n;
+        size   -= n;
+    }
+    return TRUE;
+}
+
+/** Hands the file open over to the callback, the blocks with it, and empties the rope */
+static void
+rope_deliver(bbio_rope_handle_t r)
+{
+    bbio_iovec_t *iov     = NULL;
+    size_t        iov_num = 0;
+
+    if (!r->name)
+    {
+        return;
+    }
+
+    if (r->data_size)
+    {
+        iov = (bbio_iovec_t *)MALLOC_CHK(sink_rope_iovec((bbio_handle_t)r, NULL, 0)*sizeof(bbio_iovec_t));
+    }
+    if (iov)
+    {
+        iov_num = sink_rope_iovec((bbio_handle_t)r, iov, (size_t)(-1));
+        /** the blocks handed over are no longer the rope's, the ones past the data are */
+        memmove(r->blocks, r->blocks + iov_num, (r->block_num - iov_num)*sizeof(uint8_t *));
+        r->block_num -= iov_num;
+    }
+    else if (r->data_size)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: %s: out of memory: not handed over\n", r->name);
+    }
+    rope_free_blocks(r);
+
+    if (iov || !r->data_size)
+    {
+        r->cb(r->cb_instance, r->name, r->open_num - 1, iov, iov_num);
+    }
+    FREE_CHK(r->name);
+    r->name = NULL;
+}
+
+static int
+rope_open(bbio_handle_t bbio, const int8_t *dev_name)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)bbio;
+
+    if (!r->cb)
+    {
+        return EMA_MP4_MUXED_OK;
+    }
+
+    rope_deliver(r);
+    r->name = STRDUP_CHK(dev_name ? dev_name : (const int8_t *)"");
+    if (!r->name)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    r->open_num++;
+
+    return EMA_MP4_MUXED_OK;
+}
+
+static void
+rope_close(bbio_handle_t bbio)
+{
+    rope_deliver((bbio_rope_handle_t)bbio);
+}
+
+static int64_t
+rope_position(bbio_handle_t bbio)
+{
+    return ((bbio_rope_handle_t)bbio)->op_offset;
+}
+
+/** Returns 0 on success. Positions past the data are allowed: the gap reads as zeros once written beyond */
+static int
+rope_seek(bbio_handle_t bbio, int64_t offset, int origin)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)bbio;
+
+    if (origin == SEEK_CUR)
+    {
+        offset += r->op_offset;
+    }
+    else if (origin == SEEK_END)
+    {
+        offset += r->data_size;
+    }
+
+    r->seek_num++;
+    if (offset < 0)
+    {
+        return -1;
+    }
+
+    r->op_offset = offset;
+
+    return 0;
+}
+
+/** Drops what was written. buf_size, if not 0, is the size of the blocks from then on.
+ *  A buf can't be handed over: the rope allocates its blocks itself */
+static void
+rope_set_buffer(bbio_handle_t bbio, uint8_t *buf, size_t buf_size, BOOL re_al)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)bbio;
+
+    rope_free_blocks(r);
+    if (buf_size)
+    {
+        r->block_size = buf_size;
+    }
+    (void)buf;    /** avoid compiler warning */
+    (void)re_al;  /** avoid compiler warning */
+}
+
+/** Returns the data as one buffer, the caller's to free, and empties the rope. Copies it all:
+ *  sink_rope_iovec() does not */
+static uint8_t*
+rope_get_buffer(bbio_handle_t bbio, size_t *data_size, size_t *buf_size)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)bbio;
+    uint8_t *          buf;
+    size_t             size = (size_t)r->data_size;
+    size_t             i;
+
+    buf = (uint8_t *)MALLOC_CHK(size ? size : 1);
+    if (!buf)
+    {
+        *data_size = 0;
+        return NULL;
+    }
+    for (i = 0; i*r->block_size < size; i++)
+    {
+        memcpy(buf + i*r->block_size, r->blocks[i], MIN2(r->block_size, size - i*r->block_size));
+    }
+    rope_free_blocks(r);
+
+    *data_size = size;
+    if (buf_size)
+    {
+        *buf_size = size;
+    }
+    return buf;
+}
+
+static size_t
+rope_write(bbio_handle_t snk, const uint8_t *buf, size_t size)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)snk;
+
+    if (r->op_offset > r->data_size && !rope_put(r, r->data_size, NULL, (size_t)(r->op_offset - r->data_size)))
+    {
+        return 0;  /** EMA_MP4_MUXED_NO_MEM; */
+    }
+    if (!rope_put(r, r->op_offset, buf, size))
+    {
+        return 0;  /** EMA_MP4_MUXED_NO_MEM; */
+    }
+    r->op_offset     += size;
+    r->bytes_written += size;
+    if (r->data_size < r->op_offset)
+    {
+        r->data_size = r->op_offset;
+    }
+    return size;
+}
+
+/** Reads back what was written */
+static size_t
+rope_read(bbio_handle_t src, uint8_t *buf, size_t size)
+{
+    bbio_rope_handle_t r    = (bbio_rope_handle_t)src;
+    size_t             done = 0;
+
+    while (done < size && r->op_offset < r->data_size)
+    {
+        size_t idx = (size_t)(r->op_offset / r->block_size);
+        size_t in  = (size_t)(r->op_offset % r->block_size);
+        size_t n   = MIN2(size - done, r->block_size - in);
+
+        n = (size_t)MIN2((int64_t)n, r->data_size - r->op_offset);
+        memcpy(buf + done, r->blocks[idx] + in, n);
+        done         += n;
+        r->op_offset += n;
+    }
+    r->bytes_read += done;
+    return done;
+}
+
+static int64_t
+rope_data_size(bbio_handle_t bbio)
+{
+    return ((bbio_rope_handle_t)bbio)->data_size;
+}
+
+static void
+rope_destroy(bbio_handle_t bbio)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)bbio;
+
+    rope_deliver(r);
+    rope_free_blocks(r);
+    FREE_CHK(r);
+}
+
+static bbio_handle_t
+rope_create(int8_t io_mode)
+{
+    bbio_rope_handle_t r;
+
+    r = (bbio_rope_handle_t)MALLOC_CHK(sizeof(bbio_rope_t));
+    if (!r)
+    {
+        return 0;
+    }
+    memset(r, 0, (sizeof(bbio_rope_t)));
+
+    r->dev_type   = 'c';
+    r->io_mode    = io_mode;
+    r->destroy    = rope_destroy;
+    r->open       = rope_open;
+    r->close      = rope_close;
+    r->position   = rope_position;
+    r->seek       = rope_seek;
+    r->set_buffer = rope_set_buffer;
+    r->get_buffer = rope_get_buffer;
+    r->write      = rope_write;
+    r->read       = rope_read;
+    r->size       = rope_data_size;
+
+    r->block_size = ROPE_BLOCK_SIZE;
+
+    return (bbio_handle_t)r;
+}
+
+size_t
+sink_rope_iovec(bbio_handle_t sink, bbio_iovec_t *iov, size_t iov_num)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)sink;
+    size_t             run_num;
+    size_t             i;
+
+    if (!sink || sink->dev_type != 'c')
+    {
+        return 0;
+    }
+
+    run_num = (size_t)((r->data_size + r->block_size - 1) / r->block_size);
+    for (i = 0; i < run_num && i < iov_num; i++)
+    {
+        iov[i].base = r->blocks[i];
+        iov[i].len  = (size_t)MIN2((int64_t)r->block_size, r->data_size - (int64_t)(i*r->block_size));
+    }
+    return run_num;
+}
+
+void
+sink_rope_deliver(bbio_handle_t sink, segment_cb_t cb, void *instance)
+{
+    bbio_rope_handle_t r = (bbio_rope_handle_t)sink;
+
+    if (sink && sink->dev_type == 'c')
+    {
+        r->cb          = cb;
+        r->cb_instance = instance;
+    }
+}
+
+void
+sink_rope_free_iovec(bbio_iovec_t *iov, size_t iov_num)
+{
+    size_t i;
+
+    for (i = 0; i < iov_num; i++)
+    {
+        FREE_CHK(iov[i].base);
+    }
+    FREE_CHK(iov);
+}
+
+void
+bbio_rope_reg(void)
+{
+    reg_bbio_set('c', 'w', rope_create);
+}
@@ -0,0 +1,263 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file io_splice.c
+    @brief Implements a source reading part of another with bytes put in
+*/
+
+#include <stdio.h>       /** SEEK_SET */
+
+#include "io_splice.h"
+#include "memory_chk.h"  /** MALLOC_CHK() */
+
+typedef struct bbio_splice_t_
+{
+    BBIO;
+
+    bbio_handle_t src;          /**< read from off on */
+    int64_t       off;
+    uint8_t *     ins;          /**< put in at ins_pos */
+    uint32_t      ins_pos;
+    uint32_t      ins_size;
+    int64_t       data_size;    /**< of what is read */
+    int64_t       pos;          /**< the position in it */
+    int64_t       src_pos;      /**< of src, -1 if to be sought */
+} bbio_splice_t;
+typedef bbio_splice_t *bbio_splice_handle_t;
+
+static int32_t
+splice_open(bbio_handle_t bbio, const int8_t *dev_name)
+{
+    return EMA_MP4_MUXED_OK;
+    (void)bbio;      /** avoid compiler warning */
+    (void)dev_name;  /** avoid compiler warning */
+}
+
+static void
+splice_close(bbio_handle_t bbio)
+{
+    (void)bbio;  /** avoid compiler warning */
+}
+
+static void
+splice_destroy(bbio_handle_t bbio)
+{
+    bbio_splice_handle_t s = (bbio_splice_handle_t)bbio;
+
+    s->src->destroy(s->src);
+    FREE_CHK(s->ins);
+    FREE_CHK(s);
+}
+
+static int64_t
+splice_position(bbio_handle_t bbio)
+{
+    return ((bbio_splice_handle_t)bbio)->pos;
+}
+
+static int32_t
+splice_seek(bbio_handle_t bbio, int64_t offset, int32_t origin)
+{
+    bbio_splice_handle_t s = (bbio_splice_handle_t)bbio;
+
+    if (origin == SEEK_CUR)
+    {
+        offset += s->pos;
+    }
+    else if (origin == SEEK_END)
+    {
+        offset += s->data_size;
+    }
+    /** else offset is the one */
+
+    s->seek_num++;
+    if (offset < 0)
+    {
+        return -1;
+    }
+    s->pos = offset;
+
+    return 0;
+}
+
+static const int8_t *
+splice_get_path(bbio_handle_t bbio)
+{
+    bbio_splice_handle_t s = (bbio_splice_handle_t)bbio;
+
+    return s->src->get_path ? s->src->get_path(s->src) : NULL;
+}
+
+/** reads from src at off + src_off */
+static size_t
+splice_read_src(bbio_splice_handle_t s, int64_t src_off, uint8_t *buf, size_t size)
+{
+    size_t n;
+
+    if (s->src_pos != src_off)
+    {
+        if (s->src->seek(s->src, s->off + src_off, SEEK_SET))
+        {
+            s->src_pos = -1;
+            return 0;
+        }
+    }
+    n          = s->src->read(s->src, buf, size);
+    s->src_pos = src_off + n;
+
+    return n;
+}
+
+static size_t
+splice_read(bbio_handle_t src, uint8_t *buf, size_t size)
+{
+    bbio_splice_handle_t s       = (bbio_splice_handle_t)src;
+    const int64_t        ins_end = (int64_t)s->ins_pos + s->ins_size;
+    size_t               done    = 0;
+
+    if (!buf)
+    {
+        return 0;
+    }
+    while (done < size && s->pos < s->data_size)
+    {
+        size_t want = size - done;
+        size_t n;
+
+        /** no read past the end of src: a buffer source takes that for an error */
+        if ((int64_t)want > s->data_size - s->pos)
+        {
+            want = (size_t)(s->data_size - s->pos);
+        }
+
+        if (s->pos < s->ins_pos)
+        {
+            if ((int64_t)want > s->ins_pos - s->pos)
+            {
+                want = (size_t)(s->ins_pos - s->pos);
+            }
+            n = splice_read_src(s, s->pos, buf + done, want);
+        }
+        else if (s->pos < ins_end)
+        {
+            n = (size_t)(ins_end - s->pos);
+            if (n > want)
+            {
+                n = want;
+            }
+            memcpy(buf + done, s->ins + (s->pos - s->ins_pos), n);
+        }
+        else
+        {
+            n = splice_read_src(s, s->pos - s->ins_size, buf + done, want);
+        }
+        if (!n)
+        {
+            break;
+        }
+        s->pos += n;
+        done   += n;
+    }
+    s->bytes_read += done;
+
+    return done;
+}
+
+static int64_t
+splice_size(bbio_handle_t bbio)
+{
+    return ((bbio_splice_handle_t)bbio)->data_size;
+}
+
+static BOOL
+splice_is_EOD(bbio_handle_t bbio)
+{
+    bbio_splice_handle_t s = (bbio_splice_handle_t)bbio;
+
+    return s->pos >= s->data_size;
+}
+
+/** if whole byte available */
+static BOOL
+splice_is_more_byte(bbio_handle_t bbio)
+{
+    bbio_splice_handle_t s = (bbio_splice_handle_t)bbio;
+
+    return s->data_size - s->pos > 0;
+}
+
+static BOOL
+splice_is_more_byte2(bbio_handle_t bbio)
+{
+    bbio_splice_handle_t s = (bbio_splice_handle_t)bbio;
+
+    return s->data_size - s->pos > 1;
+}
+
+static int32_t
+splice_skip_bytes(bbio_handle_t bbio, int64_t byte_num)
+{
+    return splice_seek(bbio, byte_num, SEEK_CUR);
+}
+
+bbio_handle_t
+splice_src_create(bbio_handle_t src, int64_t off, uint32_t ins_pos, uint8_t *ins, uint32_t ins_size)
+{
+    bbio_splice_handle_t s;
+
+    s = (bbio_splice_handle_t)MALLOC_CHK(sizeof(bbio_splice_t));
+    if (!s)
+    {
+        src->destroy(src);
+        FREE_CHK(ins);
+        return NULL;
+    }
+    memset(s, 0, sizeof(bbio_splice_t));
+
+    s->dev_type   = 's';
+    s->io_mode    = 'r';
+    s->destroy    = splice_destroy;
+    s->open       = splice_open;
+    s->close      = splice_close;
+    s->position   = splice_position;
+    s->seek       = splice_seek;
+    s->get_path   = splice_get_path;
+    s->read       = splice_read;
+    s->size       = splice_size;
+
+    s->is_EOD        = splice_is_EOD;
+    s->is_more_byte  = splice_is_more_byte;
+    s->is_more_byte2 = splice_is_more_byte2;
+    s->skip_bytes    = splice_skip_bytes;
+
+    s->src       = src;
+    s->off       = off;
+    s->ins       = ins;
+    s->ins_pos   = ins_pos;
+    s->ins_size  = ins_size;
+    s->data_size = src->size(src) - off + ins_size;
+    s->src_pos   = -1;
+
+    return (bbio_handle_t)s;
+}
@@ -28,6 +28,7 @@
 
 #include "utils.h"
 #include "list_itr.h"
+#include "boolean.h"
 
 typedef struct entry_t_
 {
@@ -40,6 +41,15 @@ static const int PTR_SIZE = sizeof(entry_t *);
 #define E_2_C_PTR(p_entry)      ((p_entry)->content)
 #define C_2_E_PTR(p_content)    ((uint8_t *)(p_content) - PTR_SIZE)
 
+/** run coded list: the content of an entry is a run. The first content of the run as zero
+ *  padded 64 bit words, the step of each word from one content to the next, the content count */
+#define RUN_FIRST(p_entry)          ((uint64_t *)E_2_C_PTR(p_entry))
+#define RUN_STEP(lst, p_entry)      (RUN_FIRST(p_entry) + (lst)->word_num)
+#define RUN_COUNT(lst, p_entry)     (RUN_FIRST(p_entry)[2*(lst)->word_num])
+
+#define RUN_COPY_NUM    4  /** contents read back from a run coded list valid at once */
+#define IT_COPY_NUM     2  /** the same, per iterator */
+
 struct list_t_
 {
     entry_t *hdr, *tail;
@@ -47,19 +57,151 @@ struct list_t_
     size_t   entry_size;
 
     entry_t *cur, *cur_mark; /** cur to support single thread iteration on list */
+
+    /** run coded list only */
+    BOOL     is_run;
+    size_t   content_size;
+    uint32_t word_num;
+    uint32_t cur_pos, cur_mark_pos; /** content of the run cur, cur_mark is at */
+    uint8_t *copies;                /** RUN_COPY_NUM contents read back, then the one to add */
+    uint32_t copy_idx;
+
+    uint32_t mem_tag;               /** of the entries */
 };
 
 struct it_list_t_
 {
     entry_t *p_entry;
+
+    /** on a run coded list only */
+    list_handle_t lst;
+    uint32_t      pos;
+    uint8_t      *copies;
+    size_t        copies_size;
+    uint32_t      copy_idx;
 };
 
+/** word word_idx of content */
+static uint64_t
+run_word(const list_t *lst, const void *p_content, uint32_t word_idx)
+{
+    uint64_t word = 0;
+    size_t   size = lst->content_size - 8*word_idx;
+
+    memcpy(&word, (const uint8_t *)p_content + 8*word_idx, size < 8 ? size : 8);
+    return word;
+}
+
+/** builds content pos of run p_entry */
+static void *
+run_content(const list_t *lst, const entry_t *p_entry, uint32_t pos, uint8_t *p_content)
+{
+    const uint64_t *first = RUN_FIRST(p_entry);
+    const uint64_t *step  = RUN_STEP(lst, p_entry);
+    uint64_t        word;
+    size_t          size;
+    uint32_t        u;
+
+    for (u = 0; u < lst->word_num; u++)
+    {
+        word = first[u] + pos*step[u];
+        size = lst->content_size - 8*u;
+        memcpy(p_content + 8*u, &word, size < 8 ? size : 8);
+    }
+    return p_content;
+}
+
+static void *
+run_copy(list_handle_t lst, const entry_t *p_entry, uint32_t pos)
+{
+    uint8_t *p_content = lst->copies + lst->copy_idx*lst->content_size;
+
+    lst->copy_idx = (lst->copy_idx + 1) % RUN_COPY_NUM;
+    return run_content(lst, p_entry, pos, p_content);
+}
+
+/** moves (*p_entry, *pos) to the next content */
+static void
+run_next(const list_t *lst, entry_t **p_entry, uint32_t *pos)
+{
+    if (++(*pos) == RUN_COUNT(lst, *p_entry))
+    {
+        *p_entry = (*p_entry)->next;
+        *pos     = 0;
+    }
+}
+
+/** adds the content to the last run if it goes on with its steps, else starts a run */
+static int
+run_add(list_handle_t lst, const void *p_content)
+{
+    entry_t  *p_entry = lst->tail;
+    uint64_t *first, *step;
+    uint64_t  count;
+    uint32_t  u;
+
+    if (p_entry)
+    {
+        first = RUN_FIRST(p_entry);
+        step  = RUN_STEP(lst, p_entry);
+        count = RUN_COUNT(lst, p_entry);
+        for (u = 0; u < lst->word_num; u++)
+        {
+            if (count > 1 && run_word(lst, p_content, u) != first[u] + count*step[u])
+            {
+                break;
+            }
+        }
+        if (u == lst->word_num && count < 0xFFFFFFFF)
+        {
+            if (count == 1)
+            {
+                for (u = 0; u < lst->word_num; u++)
+                {
+                    step[u] = run_word(lst, p_content, u) - first[u];
+                }
+            }
+            RUN_COUNT(lst, p_entry)++;
+            lst->entry_count++;
+            return EMA_MP4_MUXED_OK;
+        }
+    }
+
+    p_entry = (entry_t *)MALLOC_TAG_CHK(lst->mem_tag, lst->entry_size);
+    if (!p_entry)
+    {
+        return EMA_MP4_MUXED_NO_MEM;
+    }
+    first = RUN_FIRST(p_entry);
+    step  = RUN_STEP(lst, p_entry);
+    for (u = 0; u < lst->word_num; u++)
+    {
+        first[u] = run_word(lst, p_content, u);
+        step[u]  = 0;
+    }
+    RUN_COUNT(lst, p_entry) = 1;
+    p_entry->next = 0;
+
+    if (lst->tail)
+    {
+        lst->tail->next = p_entry;
+    }
+    else
+    {
+        lst->hdr = p_entry;
+    }
+    lst->tail = p_entry;
+    lst->entry_count++;
+
+    return EMA_MP4_MUXED_OK;
+}
+
 list_handle_t
 list_create(size_t content_size)
 {
     list_handle_t lst;
 
-    lst = MALLOC_CHK(sizeof(list_t));
+    lst = MALLOC_TAG_CHK(MP4_MEM_LIST, sizeof(list_t));
     if (!lst)
     {
         return NULL;
@@ -69,9 +211,49 @@ list_create(size_t content_size)
     lst->entry_count = 0;
     lst->entry_size  = PTR_SIZE + content_size;
 
+    lst->is_run       = FALSE;
+    lst->content_size = content_size;
+    lst->word_num     = 0;
+    lst->cur_pos      = lst->cur_mark_pos = 0;
+    lst->copies       = NULL;
+    lst->copy_idx     = 0;
+    lst->mem_tag      = MP4_MEM_LIST;
+
+    return lst;
+}
+
+list_handle_t
+list_create_run(size_t content_size)
+{
+    list_handle_t lst = list_create(content_size);
+
+    if (!lst)
+    {
+        return NULL;
+    }
+
+    lst->is_run     = TRUE;
+    lst->word_num   = (uint32_t)((content_size + 7) >> 3);
+    lst->entry_size = PTR_SIZE + (2*lst->word_num + 1)*sizeof(uint64_t);
+    lst->copies     = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_LIST, (RUN_COPY_NUM + 1)*content_size);
+    if (!lst->copies)
+    {
+        FREE_CHK(lst);
+        return NULL;
+    }
+
     return lst;
 }
 
+void
+list_set_mem_tag(list_handle_t lst, uint32_t mem_tag)
+{
+    if (lst)
+    {
+        lst->mem_tag = mem_tag;
+    }
+}
+
 void
 list_destroy(list_handle_t lst)
 {
@@ -87,6 +269,7 @@ list_destroy(list_handle_t lst)
         p = pn;
     }
 
+    FREE_CHK(lst->copies);
     FREE_CHK(lst);
 }
 
@@ -96,7 +279,15 @@ list_alloc_entry(list_handle_t lst)
     entry_t *p_entry;
 
     assert(lst);
-    p_entry = (entry_t *)MALLOC_CHK(lst->entry_size);
+    if (lst->is_run)
+    {
+        /** copied into the list by list_add_entry() */
+        uint8_t *p_content = lst->copies + RUN_COPY_NUM*lst->content_size;
+
+        memset(p_content, 0, lst->content_size);
+        return p_content;
+    }
+    p_entry = (entry_t *)MALLOC_TAG_CHK(lst->mem_tag, lst->entry_size);
     if (p_entry)
     {
         return E_2_C_PTR(p_entry);
@@ -128,6 +319,10 @@ list_add_entry(list_handle_t lst, void *p_content)
     {
         return EMA_MP4_MUXED_BUGGY;
     }
+    if (lst->is_run)
+    {
+        return run_add(lst, p_content);
+    }
 
     p_entry = (entry_t *)C_2_E_PTR(p_content);
     assert(p_entry->content == p_content);
@@ -152,7 +347,7 @@ list_remove_entry(list_handle_t lst, void *p_content)
 {
     entry_t *pre = NULL, *p;
 
-    if (!lst || !lst->hdr || !p_content)
+    if (!lst || !lst->hdr || !p_content || lst->is_run)
     {
         return EMA_MP4_MUXED_BUGGY;
     }
@@ -209,6 +404,10 @@ list_peek_first_entry(list_handle_t lst)
     {
         return NULL;
     }
+    if (lst->is_run)
+    {
+        return run_copy(lst, lst->hdr, 0);
+    }
 
     return E_2_C_PTR(lst->hdr);
 }
@@ -221,6 +420,10 @@ list_peek_last_entry(list_handle_t lst)
     {
         return NULL;
     }
+    if (lst->is_run)
+    {
+        return run_copy(lst, lst->tail, (uint32_t)RUN_COUNT(lst, lst->tail) - 1);
+    }
 
     return E_2_C_PTR(lst->tail);
 }
@@ -236,6 +439,29 @@ list_delete_first_entry(list_handle_t lst)
     }
 
     p_entry = lst->hdr;
+    if (lst->is_run && RUN_COUNT(lst, p_entry) > 1)
+    {
+        /** the run starts one content later */
+        uint64_t *first = RUN_FIRST(p_entry);
+        uint64_t *step  = RUN_STEP(lst, p_entry);
+        uint32_t  u;
+
+        for (u = 0; u < lst->word_num; u++)
+        {
+            first[u] += step[u];
+        }
+        RUN_COUNT(lst, p_entry)--;
+        if (lst->cur == p_entry && lst->cur_pos)
+        {
+            lst->cur_pos--;
+        }
+        if (lst->cur_mark == p_entry && lst->cur_mark_pos)
+        {
+            lst->cur_mark_pos--;
+        }
+        lst->entry_count--;
+        return;
+    }
     /** removed from list */
     lst->hdr = lst->hdr->next;
     if (!lst->hdr)
@@ -244,7 +470,8 @@ list_delete_first_entry(list_handle_t lst)
     }
     if (lst->cur == p_entry)
     {
-        lst->cur = lst->hdr;
+        lst->cur     = lst->hdr;
+        lst->cur_pos = 0;
     }
     lst->entry_count--;
 
@@ -291,6 +518,7 @@ list_it_init(list_handle_t lst)
 {
     lst->cur      = lst->hdr;
     lst->cur_mark = NULL;
+    lst->cur_pos  = 0;
 }
 
 void *
@@ -302,6 +530,13 @@ list_it_get_entry(list_handle_t lst)
     {
         return NULL;
     }
+    if (lst->is_run)
+    {
+        void *p_content = run_copy(lst, lst->cur, lst->cur_pos);
+
+        run_next(lst, &lst->cur, &lst->cur_pos);
+        return p_content;
+    }
 
     p_entry  = lst->cur;
     lst->cur = p_entry->next;
@@ -316,6 +551,10 @@ list_it_peek_entry(list_handle_t lst)
     {
         return NULL;
     }
+    if (lst->is_run)
+    {
+        return run_copy(lst, lst->cur, lst->cur_pos);
+    }
 
     return E_2_C_PTR(lst->cur);
 }
@@ -323,6 +562,14 @@ list_it_peek_entry(list_handle_t lst)
 void *
 list_it_peek2_entry(list_handle_t lst)
 {
+    if (lst && lst->is_run && lst->cur)
+    {
+        if (lst->cur_pos + 1 < RUN_COUNT(lst, lst->cur))
+        {
+            return run_copy(lst, lst->cur, lst->cur_pos + 1);
+        }
+        return lst->cur->next ? run_copy(lst, lst->cur->next, 0) : NULL;
+    }
     if (!lst || !lst->cur || !lst->cur->next)
     {
         return NULL;
@@ -335,7 +582,8 @@ list_it_save_mark(list_handle_t lst)
 {
     assert(lst->cur_mark == NULL); /** support only one mark */
 
-    lst->cur_mark = lst->cur;
+    lst->cur_mark     = lst->cur;
+    lst->cur_mark_pos = lst->cur_pos;
 }
 
 void
@@ -343,7 +591,8 @@ list_it_goto_mark(list_handle_t lst)
 {
     assert(lst->cur_mark != NULL || lst->cur == NULL); /** mark must be well defined */
 
-    lst->cur = lst->cur_mark;
+    lst->cur     = lst->cur_mark;
+    lst->cur_pos = lst->cur_mark_pos;
 
     lst->cur_mark = NULL;
 }
@@ -354,10 +603,15 @@ it_create(void)
 {
     it_list_handle_t it;
 
-    it = (it_list_handle_t)MALLOC_CHK(sizeof(it_list_t));
+    it = (it_list_handle_t)MALLOC_TAG_CHK(MP4_MEM_LIST, sizeof(it_list_t));
     if (it)
     {
-        it->p_entry = NULL;
+        it->p_entry     = NULL;
+        it->lst         = NULL;
+        it->pos         = 0;
+        it->copies      = NULL;
+        it->copies_size = 0;
+        it->copy_idx    = 0;
     }
 
     return it;
@@ -366,19 +620,11 @@ it_create(void)
 it_list_handle_t
 it_create_on(list_handle_t lst)
 {
-    it_list_handle_t it;
+    it_list_handle_t it = it_create();
 
-    it = (it_list_handle_t)MALLOC_CHK(sizeof(it_list_t));
     if (it)
     {
-        if (lst)
-        {
-            it->p_entry = lst->hdr;
-        }
-        else
-        {
-            it->p_entry = NULL;
-        }
+        it_init(it, lst);
     }
 
     return it;
@@ -388,22 +634,42 @@ void
 it_init(it_list_handle_t it, list_handle_t lst)
 {
     assert(it);
-    if (lst)
-    {
-        it->p_entry = lst->hdr;
-    }
-    else
+    it->p_entry = (lst) ? lst->hdr : NULL;
+    it->lst     = NULL;
+    it->pos     = 0;
+    if (lst && lst->is_run)
     {
-        it->p_entry = NULL;
+        if (it->copies_size < IT_COPY_NUM*lst->content_size)
+        {
+            FREE_CHK(it->copies);
+            it->copies_size = 0;
+            it->copies      = (uint8_t *)MALLOC_TAG_CHK(MP4_MEM_LIST, IT_COPY_NUM*lst->content_size);
+            if (!it->copies)
+            {
+                it->p_entry = NULL; /** nothing to iterate on */
+                return;
+            }
+            it->copies_size = IT_COPY_NUM*lst->content_size;
+        }
+        it->lst = lst;
     }
 }
 
+static void *
+it_run_copy(it_list_handle_t it)
+{
+    uint8_t *p_content = it->copies + it->copy_idx*it->lst->content_size;
+
+    it->copy_idx = (it->copy_idx + 1) % IT_COPY_NUM;
+    return run_content(it->lst, it->p_entry, it->pos, p_content);
+}
+
 void *
 it_peek_entry(it_list_handle_t it)
 {
     if (it && it->p_entry)
     {
-        return E_2_C_PTR(it->p_entry);
+        return (it->lst) ? it_run_copy(it) : E_2_C_PTR(it->p_entry);
     }
 
     return NULL;
@@ -416,6 +682,12 @@ it_get_entry(it_list_handle_t it)
 
     if (it && it->p_entry)
     {
+        if (it->lst)
+        {
+            p_content = it_run_copy(it);
+            run_next(it->lst, &it->p_entry, &it->pos);
+            return p_content;
+        }
         p_content   = E_2_C_PTR(it->p_entry);
         it->p_entry = it->p_entry->next;
 
@@ -428,5 +700,9 @@ it_get_entry(it_list_handle_t it)
 void
 it_destroy(it_list_handle_t it)
 {
+    if (it)
+    {
+        FREE_CHK(it->copies);
+    }
     FREE_CHK(it);
 }
@@ -0,0 +1,320 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file memory_chk.c
+    @brief Implements the memory accounting of the ENABLE_MP4_MEMSTAT builds and the allocator hooks
+           of the ENABLE_MP4_ALLOC_HOOKS builds
+*/
+
+#include "memory_chk.h"
+
+#if defined(ENABLE_MP4_MEMSTAT) || defined(ENABLE_MP4_ALLOC_HOOKS)
+
+#include <assert.h>
+#ifdef _MSC_VER
+#include <windows.h>  /** InterlockedExchangeAdd64() */
+#endif
+
+#include "msg_log.h"  /** msglog() */
+
+/** the counters are shared by all threads, the allocator in scope is per thread */
+#ifdef _MSC_VER
+    #define MEM_TLS                  __declspec(thread)
+    #define MEM_ADD(p, v)            (InterlockedExchangeAdd64((volatile LONG64 *)(p), v) + (v))
+    #define MEM_CAS(p, old_v, new_v) InterlockedCompareExchange64((volatile LONG64 *)(p), new_v, old_v)
+#else
+    #define MEM_TLS                  __thread
+    #define MEM_ADD(p, v)            __sync_add_and_fetch(p, v)
+    #define MEM_CAS(p, old_v, new_v) __sync_val_compare_and_swap(p, old_v, new_v)
+#endif
+
+/** in front of each block: keeps the alignment of malloc() on 32 and 64 bit */
+typedef union mem_hdr_t_
+{
+    struct
+    {
+        size_t                 size;
+        uint32_t               tag;
+        const mp4_allocator_t *allocator;  /**< the block came from, NULL for libc */
+    } b;
+    uint64_t align[4];
+} mem_hdr_t;
+
+#ifdef ENABLE_MP4_ALLOC_HOOKS
+/** the allocator of the entry running on the thread */
+static MEM_TLS const mp4_allocator_t *mem_allocator = NULL;
+
+const mp4_allocator_t *
+mp4_mem_allocator_enter(const mp4_allocator_t *allocator)
+{
+    const mp4_allocator_t *prev = mem_allocator;
+
+    if (allocator)
+    {
+        mem_allocator = allocator;
+    }
+    return prev;
+}
+
+void
+mp4_mem_allocator_leave(const mp4_allocator_t *prev)
+{
+    mem_allocator = prev;
+}
+
+const mp4_allocator_t *
+mp4_mem_allocator_get(void)
+{
+    return mem_allocator;
+}
+#else
+static const mp4_allocator_t *const mem_allocator = NULL;
+#endif  /* ENABLE_MP4_ALLOC_HOOKS */
+
+#ifdef ENABLE_MP4_MEMSTAT
+
+static volatile int64_t mem_live[MP4_MEM_TAG_NUM];
+static volatile int64_t mem_peak[MP4_MEM_TAG_NUM];
+static volatile int64_t mem_live_total = 0;
+static volatile int64_t mem_peak_total = 0;
+static volatile int64_t mem_alloc_num  = 0;
+
+static const char *mem_tag_names[MP4_MEM_TAG_NUM] =
+{
+    "other",
+    "list",
+    "nal",
+    "nal_index",
+    "scratch",
+    "dsi",
+    "frag",
+};
+
+static void
+peak_update(volatile int64_t *peak, int64_t live)
+{
+    int64_t old_v = *peak;
+
+    while (live > old_v)
+    {
+        int64_t seen = MEM_CAS(peak, old_v, live);
+
+        if (seen == old_v)
+        {
+            break;
+        }
+        old_v = seen;
+    }
+}
+
+static void
+mem_account(uint32_t tag, int64_t delta)
+{
+    int64_t live = MEM_ADD(&mem_live[tag], delta);
+
+    if (delta > 0)
+    {
+        peak_update(&mem_peak[tag], live);
+        peak_update(&mem_peak_total, MEM_ADD(&mem_live_total, delta));
+    }
+    else
+    {
+        MEM_ADD(&mem_live_total, delta);
+    }
+}
+
+#else
+    #define mem_account(tag, delta)
+#endif  /* ENABLE_MP4_MEMSTAT */
+
+void *
+mp4_mem_alloc(uint32_t tag, size_t size)
+{
+    const mp4_allocator_t *allocator = mem_allocator;
+    mem_hdr_t *            hdr;
+
+    assert(tag < MP4_MEM_TAG_NUM);
+    if (allocator)
+    {
+        hdr = (mem_hdr_t *)allocator->alloc(allocator->ctx, sizeof(mem_hdr_t) + size);
+    }
+    else
+    {
+        hdr = (mem_hdr_t *)malloc(sizeof(mem_hdr_t) + size);
+    }
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->b.size      = size;
+    hdr->b.tag       = tag;
+    hdr->b.allocator = allocator;
+    mem_account(tag, (int64_t)size);
+#ifdef ENABLE_MP4_MEMSTAT
+    MEM_ADD(&mem_alloc_num, 1);
+#endif
+
+    return hdr + 1;
+}
+
+void *
+mp4_mem_realloc(uint32_t tag, void *ptr, size_t size)
+{
+    const mp4_allocator_t *allocator;
+    mem_hdr_t *            hdr;
+    size_t                 old_size;
+
+    if (!ptr)
+    {
+        return mp4_mem_alloc(tag, size);
+    }
+    hdr       = (mem_hdr_t *)ptr - 1;
+    old_size  = hdr->b.size;
+    allocator = hdr->b.allocator;
+    if (allocator)
+    {
+        hdr = (mem_hdr_t *)allocator->realloc(allocator->ctx, hdr, sizeof(mem_hdr_t) + size);
+    }
+    else
+    {
+        hdr = (mem_hdr_t *)realloc(hdr, sizeof(mem_hdr_t) + size);
+    }
+    if (!hdr)
+    {
+        return NULL;
+    }
+    hdr->b.size = size;
+    mem_account(hdr->b.tag, (int64_t)size - (int64_t)old_size);
+    (void)old_size;
+
+    return hdr + 1;
+}
+
+void
+mp4_mem_free(void *ptr)
+{
+    mem_hdr_t *hdr;
+
+    if (!ptr)
+    {
+        return;
+    }
+    hdr = (mem_hdr_t *)ptr - 1;
+    mem_account(hdr->b.tag, -(int64_t)hdr->b.size);
+    if (hdr->b.allocator)
+    {
+        hdr->b.allocator->free(hdr->b.allocator->ctx, hdr);
+    }
+    else
+    {
+        free(hdr);
+    }
+}
+
+char *
+mp4_mem_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char * dup = (char *)mp4_mem_alloc(MP4_MEM_OTHER, len);
+
+    if (dup)
+    {
+        memcpy(dup, str, len);
+    }
+    return dup;
+}
+
+#ifdef ENABLE_MP4_MEMSTAT
+void
+mp4_mem_tag(void *ptr, uint32_t tag)
+{
+    mem_hdr_t *hdr;
+
+    if (!ptr)
+    {
+        return;
+    }
+    assert(tag < MP4_MEM_TAG_NUM);
+    hdr = (mem_hdr_t *)ptr - 1;
+    if (hdr->b.tag != tag)
+    {
+        MEM_ADD(&mem_live[hdr->b.tag], -(int64_t)hdr->b.size);
+        peak_update(&mem_peak[tag], MEM_ADD(&mem_live[tag], (int64_t)hdr->b.size));
+        hdr->b.tag = tag;
+    }
+}
+
+void
+mp4_mem_stats_get(mp4_mem_stats_t *stats)
+{
+    uint32_t tag;
+
+    for (tag = 0; tag < MP4_MEM_TAG_NUM; tag++)
+    {
+        stats->live[tag] = mem_live[tag];
+        stats->peak[tag] = mem_peak[tag];
+    }
+    stats->live_total = mem_live_total;
+    stats->peak_total = mem_peak_total;
+    stats->alloc_num  = mem_alloc_num;
+}
+
+void
+mp4_mem_stats_reset_peaks(void)
+{
+    uint32_t tag;
+
+    for (tag = 0; tag < MP4_MEM_TAG_NUM; tag++)
+    {
+        mem_peak[tag] = mem_live[tag];
+    }
+    mem_peak_total = mem_live_total;
+}
+
+const char *
+mp4_mem_tag_name(uint32_t tag)
+{
+    return (tag < MP4_MEM_TAG_NUM) ? mem_tag_names[tag] : "unknown";
+}
+
+void
+mp4_mem_stats_log(void)
+{
+    mp4_mem_stats_t stats;
+    uint32_t        tag;
+
+    mp4_mem_stats_get(&stats);
+    /** at the level debug builds show by default: the accounting build is made to see it */
+    msglog(NULL, MSGLOG_WARNING, "memory: %" PRIi64 " bytes live, %" PRIi64 " bytes peak, %" PRIi64 " allocations\n",
+           stats.live_total, stats.peak_total, stats.alloc_num);
+    for (tag = 0; tag < MP4_MEM_TAG_NUM; tag++)
+    {
+        msglog(NULL, MSGLOG_WARNING, "  %-10s %12" PRIi64 " live %12" PRIi64 " peak\n",
+               mem_tag_names[tag], stats.live[tag], stats.peak[tag]);
+    }
+}
+
+#endif  /* ENABLE_MP4_MEMSTAT */
+
+#endif  /* ENABLE_MP4_MEMSTAT || ENABLE_MP4_ALLOC_HOOKS */
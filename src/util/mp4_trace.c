@@ -0,0 +1,197 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4_trace.c
+    @brief Implements the timeline tracing of muxing runs
+*/
+
+#include "mp4_trace.h"
+
+#ifdef ENABLE_MP4_TRACE
+
+#include <stdio.h>
+#ifdef _MSC_VER
+#include <windows.h>  /** InterlockedIncrement() */
+#endif
+
+#include "utils.h"       /** time_ns_monotonic() */
+#include "msg_log.h"     /** msglog() */
+#include "memory_chk.h"  /** MALLOC_CHK() */
+
+#ifdef _MSC_VER
+    #define TRACE_TLS                 __declspec(thread)
+    #define TRACE_FETCH_INC(p)        (InterlockedIncrement(p) - 1)
+#else
+    #define TRACE_TLS                 __thread
+    #define TRACE_FETCH_INC(p)        __sync_fetch_and_add(p, 1)
+#endif
+
+typedef struct trace_event_t_
+{
+    const char *name;
+    uint64_t    ts_ns;
+    uint64_t    bytes;
+    uint32_t    track_ID;
+    int8_t      ph;
+} trace_event_t;
+
+typedef struct trace_ring_t_
+{
+    uint64_t      event_num;  /**< recorded since the last dump: the index of the next event is event_num % MP4_TRACE_RING_SIZE */
+    trace_event_t events[MP4_TRACE_RING_SIZE];
+} trace_ring_t;
+
+/** the rings are kept over dumps and handed out again after them */
+static trace_ring_t *trace_rings[MP4_TRACE_THREAD_MAX];
+static volatile long trace_ring_num   = 0;  /**< rings handed out since the last dump */
+static volatile long trace_generation = 1;  /**< dumps so far + 1 */
+static char          trace_fn[1024]   = "mp4_trace.json";
+
+/** the ring of the thread, valid while its generation is the current one */
+static TRACE_TLS trace_ring_t *thread_ring       = NULL;
+static TRACE_TLS long          thread_generation = 0;
+
+static trace_ring_t *
+trace_ring_get(void)
+{
+    long idx;
+
+    if (thread_generation == trace_generation)
+    {
+        return thread_ring;
+    }
+
+    thread_generation = trace_generation;
+    thread_ring       = NULL;
+    idx               = TRACE_FETCH_INC(&trace_ring_num);
+    if (idx >= MP4_TRACE_THREAD_MAX)
+    {
+        /** the events of this thread are dropped */
+        return NULL;
+    }
+    if (!trace_rings[idx])
+    {
+        trace_rings[idx] = (trace_ring_t *)MALLOC_CHK(sizeof(trace_ring_t));
+        if (!trace_rings[idx])
+        {
+            return NULL;
+        }
+    }
+    trace_rings[idx]->event_num = 0;
+    thread_ring                 = trace_rings[idx];
+
+    return thread_ring;
+}
+
+void
+mp4_trace_event(int8_t ph, const char *name, uint32_t track_ID, uint64_t bytes)
+{
+    trace_ring_t * ring = trace_ring_get();
+    trace_event_t *event;
+
+    if (!ring)
+    {
+        return;
+    }
+
+    event           = &ring->events[ring->event_num++ % MP4_TRACE_RING_SIZE];
+    event->name     = name;
+    event->ts_ns    = time_ns_monotonic();
+    event->bytes    = bytes;
+    event->track_ID = track_ID;
+    event->ph       = ph;
+}
+
+void
+mp4_trace_set_file(const char *file_name)
+{
+    OSAL_STRNCPY(trace_fn, sizeof(trace_fn), file_name, sizeof(trace_fn) - 1);
+    trace_fn[sizeof(trace_fn) - 1] = '\0';
+}
+
+int
+mp4_trace_dump(void)
+{
+    FILE *   fp;
+    long     ring_num = MIN2(trace_ring_num, MP4_TRACE_THREAD_MAX);
+    long     idx;
+    uint64_t n;
+    int      pid = (int)OSAL_GETPID();
+
+    fp = fopen(trace_fn, "w");
+    if (!fp)
+    {
+        msglog(NULL, MSGLOG_ERR, "Error: can't open trace file %s\n", trace_fn);
+        return -1;
+    }
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"mp4muxer\"}}", pid);
+    for (idx = 0; idx < ring_num; idx++)
+    {
+        trace_ring_t *ring  = trace_rings[idx];
+        uint32_t      depth = 0;
+
+        if (!ring)
+        {
+            continue;
+        }
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"thread %ld\"}}",
+                pid, idx + 1, idx + 1);
+
+        n = (ring->event_num > MP4_TRACE_RING_SIZE) ? ring->event_num - MP4_TRACE_RING_SIZE : 0;
+        for (; n < ring->event_num; n++)
+        {
+            const trace_event_t *event = &ring->events[n % MP4_TRACE_RING_SIZE];
+
+            if (event->ph == 'E')
+            {
+                if (!depth)
+                {
+                    /** its begin has been overwritten */
+                    continue;
+                }
+                depth--;
+            }
+            else
+            {
+                depth++;
+            }
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03u,\"pid\":%d,\"tid\":%ld,"
+                        "\"args\":{\"track_ID\":%u,\"bytes\":%" PRIu64 "}}",
+                    event->name, event->ph, event->ts_ns/1000, (uint32_t)(event->ts_ns%1000), pid, idx + 1,
+                    event->track_ID, event->bytes);
+        }
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(fp);
+
+    /** hand the rings out again */
+    trace_ring_num = 0;
+    trace_generation++;
+
+    return 0;
+}
+
+#endif  /* ENABLE_MP4_TRACE */
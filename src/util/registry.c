@@ -29,6 +29,7 @@
 
 #include "utils.h"
 #include "registry.h"
+#include "parser.h"     /** parser_handle_t */
 
 /**** I/O = reg_bbio_get('f', 'r'); registry */
 typedef struct reg_bbio_t_ {
@@ -110,6 +111,26 @@ reg_parser_get(const int8_t *parser_name, uint32_t dsi_type)
     return 0;
 }
 
+struct parser_t_ *
+reg_parser_get_ex(const int8_t *parser_name, uint32_t dsi_type, const mp4_allocator_t *allocator)
+{
+    parser_handle_t parser;
+
+#ifndef ENABLE_MP4_ALLOC_HOOKS
+    if (allocator)
+    {
+        msglog(NULL, MSGLOG_ERR, "ERROR: allocator given, but built without ENABLE_MP4_ALLOC_HOOKS\n");
+        return 0;
+    }
+#endif
+    MEM_ALLOC_SCOPE_CHK(allocator, parser = reg_parser_get(parser_name, dsi_type));
+    if (parser)
+    {
+        parser->allocator = allocator;
+    }
+    return parser;
+}
+
 void 
 reg_parser_set(int8_t *parser_name, struct parser_t_ *(*parser_create)(uint32_t dsi_type))
 {
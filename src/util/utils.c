@@ -29,6 +29,7 @@
 
 #ifndef _MSC_VER
 #include <sys/time.h>   /* for gettimeofday() */
+#include <time.h>       /* for clock_gettime() */
 #else
 #include <sys/timeb.h>  /* for _ftime64_s() */
 #include <windows.h>
@@ -70,6 +71,29 @@ utc_sec_since_1970(void)
 #endif
 }
 
+uint64_t
+time_ns_monotonic(void)
+{
+#ifdef _MSC_VER
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER        count;
+
+    if (!freq.QuadPart)
+    {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&count);
+    /** split up not to overflow */
+    return (uint64_t)(count.QuadPart / freq.QuadPart)*1000000000u +
+           (uint64_t)(count.QuadPart % freq.QuadPart)*1000000000u/(uint64_t)freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
 /** dump indicator to show progress */
 
 static void
@@ -0,0 +1,692 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4base_bench.c
+    @brief Measures the throughput of the parsers, the muxer and the sinks
+
+    Each benchmark runs --repeat times, the short ones for 200 ms at least, and the fastest run counts. The results go out as JSON.
+    Given a --baseline, a previous output, each result is compared to it and a result slower by
+    more than --tolerance percent fails the run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"          /** time_ns_monotonic() */
+#include "registry.h"
+#include "io_base.h"
+#include "parser.h"
+#include "mp4_muxer.h"
+#include "memory_chk.h"
+#include "msg_log.h"
+#include "ema_mp4_ifc.h"
+
+#define BENCH_MAX        32
+#define SYNTH_SIZE       (16*1024*1024)  /** of the synthetic buffers */
+#define BENCH_MIN_NS     200000000       /** short benchmarks run at least that long, for stable results */
+#define BENCH_MAX_RUNS   1000
+
+typedef struct bench_result_t_
+{
+    const char *name;
+    uint64_t    bytes;     /**< processed per run */
+    uint64_t    samples;   /**< processed per run: samples, start codes, ... */
+    uint64_t    ns;        /**< of the fastest run */
+    double      mb_s;
+    double      samples_s;
+    BOOL        skipped;
+    double      baseline;  /**< mb_s or, without bytes, samples_s of the baseline. 0: none */
+} bench_result_t;
+
+static bench_result_t results[BENCH_MAX];
+static uint32_t       result_num = 0;
+static uint32_t       repeat     = 5;
+
+/** the ES per parser benchmark: the default file names are in the --signals directory */
+static struct
+{
+    const char *name;
+    const char *parser;
+    const char *fn;
+} es_inputs[] =
+{
+    {"parser_avc",  "avc",  NULL},
+    {"parser_hevc", "hevc", NULL},
+    {"parser_aac",  "aac",  "Blue_Devils_30s.aac"},
+    {"parser_ac3",  "ac3",  "5ch_dd_25fps_channel_id.ac3"},
+    {"parser_ec3",  "ec3",  "7ch_ddp_25fps_channel_id.ec3"},
+    {"parser_ac4",  "ac4",  NULL},
+};
+#define ES_INPUT_NUM (sizeof(es_inputs)/sizeof(es_inputs[0]))
+
+static char *es_fns[ES_INPUT_NUM];
+
+static bench_result_t *
+result_add(const char *name, uint64_t bytes, uint64_t samples, uint64_t ns)
+{
+    bench_result_t *r = &results[result_num++];
+
+    memset(r, 0, sizeof(bench_result_t));
+    r->name    = name;
+    r->bytes   = bytes;
+    r->samples = samples;
+    r->ns      = ns;
+    if (ns)
+    {
+        r->mb_s      = (double)bytes*1000.0/(double)ns;
+        r->samples_s = (double)samples*1e9/(double)ns;
+    }
+    return r;
+}
+
+/** if one more run: --repeat runs at least, more for short ones */
+static BOOL
+run_more(uint32_t run, uint64_t total_ns)
+{
+    return run < repeat || (total_ns < BENCH_MIN_NS && run < BENCH_MAX_RUNS);
+}
+
+static void
+result_skip(const char *name)
+{
+    result_add(name, 0, 0, 0)->skipped = TRUE;
+}
+
+/** Returns: the content of file fn, NULL if it can't be read */
+static uint8_t *
+file_load(const char *fn, size_t *size)
+{
+    FILE *   fp = fopen(fn, "rb");
+    uint8_t *buf;
+    long     len;
+
+    if (!fp)
+    {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf = (len > 0) ? (uint8_t *)MALLOC_CHK((size_t)len) : NULL;
+    if (buf && fread(buf, 1, (size_t)len, fp) != (size_t)len)
+    {
+        FREE_CHK(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    *size = (size_t)len;
+    return buf;
+}
+
+/** the same pseudo random bytes on each call */
+static void
+synth_fill(uint8_t *buf, size_t size, BOOL start_codes)
+{
+    uint32_t lcg = 12345;
+    size_t   i;
+
+    for (i = 0; i < size; i++)
+    {
+        lcg    = lcg*1103515245 + 12345;
+        buf[i] = (uint8_t)(lcg >> 16);
+        /** zero bytes are left out but for start codes, about one per 4 KiB, as in a video ES */
+        if (!buf[i])
+        {
+            buf[i] = 0x80;
+        }
+        if (start_codes && !((lcg >> 8) & 0xfff) && i + 4 < size)
+        {
+            buf[i++] = 0;
+            buf[i++] = 0;
+            buf[i++] = 0;
+            buf[i]   = 1;
+        }
+    }
+}
+
+static bbio_handle_t
+buf_src_create(uint8_t *buf, size_t size)
+{
+    bbio_handle_t src = reg_bbio_get('b', 'r');
+
+    if (src)
+    {
+        src->set_buffer(src, buf, size, FALSE);
+    }
+    return src;
+}
+
+/** get_sample() until the end of the ES in memory */
+static void
+bench_parser(const char *name, const char *parser_name, const char *fn)
+{
+    uint8_t *buf;
+    size_t   size;
+    uint64_t samples = 0, ns_min = 0, ns_total = 0;
+    uint32_t run;
+
+    buf = (fn) ? file_load(fn, &size) : NULL;
+    if (!buf)
+    {
+        result_skip(name);
+        return;
+    }
+
+    for (run = 0; run_more(run, ns_total); run++)
+    {
+        ext_timing_info_t   timing_info;
+        parser_handle_t     parser = reg_parser_get((const int8_t *)parser_name, DSI_TYPE_MP4FF);
+        bbio_handle_t       src    = buf_src_create(buf, size);
+        mp4_sample_handle_t sample = sample_create();
+        uint64_t            t, n = 0;
+        int32_t             ret;
+
+        memset(&timing_info, 0, sizeof(timing_info));
+        if (!parser || !src || !sample || parser->init(parser, &timing_info, 0, src) != EMA_MP4_MUXED_OK)
+        {
+            if (parser)
+            {
+                parser->destroy(parser);
+            }
+            if (src)
+            {
+                src->destroy(src);
+            }
+            if (sample)
+            {
+                sample->destroy(sample);
+            }
+            FREE_CHK(buf);
+            result_skip(name);
+            return;
+        }
+
+        t = time_ns_monotonic();
+        while (!(ret = parser->get_sample(parser, sample)) || ret == EMA_MP4_MUXED_NO_CONFIG_ERR)
+        {
+            n += !ret;
+        }
+        t = time_ns_monotonic() - t;
+
+        if (!run || t < ns_min)
+        {
+            ns_min = t;
+        }
+        ns_total += t;
+        samples   = n;
+        sample->destroy(sample);
+        parser->destroy(parser);
+        src->destroy(src);
+    }
+    result_add(name, size, samples, ns_min);
+    FREE_CHK(buf);
+}
+
+static void
+bench_find_sc_off(void)
+{
+    uint8_t *buf = (uint8_t *)MALLOC_CHK(SYNTH_SIZE);
+    uint64_t ns_min = 0, ns_total = 0, sc_num = 0;
+    uint32_t run;
+
+    if (!buf)
+    {
+        result_skip("find_sc_off");
+        return;
+    }
+    synth_fill(buf, SYNTH_SIZE, TRUE);
+
+    for (run = 0; run_more(run, ns_total); run++)
+    {
+        size_t   off = 0;
+        int32_t  sc_off;
+        uint64_t t, n = 0;
+
+        t = time_ns_monotonic();
+        while ((sc_off = find_sc_off(buf + off, SYNTH_SIZE - off, FALSE)) >= 0)
+        {
+            off += (size_t)sc_off + 3;
+            n++;
+        }
+        t = time_ns_monotonic() - t;
+
+        if (!run || t < ns_min)
+        {
+            ns_min = t;
+        }
+        ns_total += t;
+        sc_num    = n;
+    }
+    result_add("find_sc_off", SYNTH_SIZE, sc_num, ns_min);
+    FREE_CHK(buf);
+}
+
+static void
+bench_bit_reader(void)
+{
+    /** field widths as met in headers */
+    static const uint32_t widths[] = {1, 1, 2, 3, 5, 8, 1, 4, 16, 6, 1, 7, 24, 1, 32, 2};
+    uint8_t *             buf      = (uint8_t *)MALLOC_CHK(SYNTH_SIZE);
+    uint64_t              ns_min   = 0, ns_total = 0, field_num = 0;
+    uint32_t              run;
+
+    if (!buf)
+    {
+        result_skip("bit_reader");
+        return;
+    }
+    synth_fill(buf, SYNTH_SIZE, FALSE);
+
+    for (run = 0; run_more(run, ns_total); run++)
+    {
+        bbio_handle_t     src  = buf_src_create(buf, SYNTH_SIZE);
+        volatile uint32_t sum  = 0;
+        uint64_t          bits = (uint64_t)SYNTH_SIZE*8 - 64;
+        uint64_t          t, n = 0;
+        uint32_t          w    = 0;
+
+        if (!src)
+        {
+            break;
+        }
+        t = time_ns_monotonic();
+        while (bits >= 32)
+        {
+            sum  += src_read_bits(src, widths[w]);
+            bits -= widths[w];
+            w     = (w + 1) & 15;
+            n++;
+        }
+        t = time_ns_monotonic() - t;
+
+        if (!run || t < ns_min)
+        {
+            ns_min = t;
+        }
+        ns_total += t;
+        field_num = n;
+        src->destroy(src);
+    }
+    result_add("bit_reader", SYNTH_SIZE, field_num, ns_min);
+    FREE_CHK(buf);
+}
+
+/** Muxes fn with the mux API. The output goes to a file or into memory.
+ *  Returns: 0 if OK */
+static int
+mux_run(const char *fn, BOOL frag, BOOL buf_out, mp4_metrics_t *metrics, uint64_t *ns, uint64_t *samples, uint64_t *out_bytes)
+{
+    ema_mp4_ctrl_handle_t handle;
+    uint32_t              ret;
+    uint64_t              t;
+    uint32_t              u;
+
+    if (ema_mp4_mux_create(&handle) != EMA_MP4_MUXED_OK)
+    {
+        return -1;
+    }
+    ret = ema_mp4_mux_set_input(handle, (int8_t *)fn, NULL, NULL, 0, 0, 0);
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        ret = ema_mp4_mux_set_output(handle, buf_out, buf_out ? NULL : (const int8_t *)"mp4base_bench.mp4");
+    }
+    if (ret == EMA_MP4_MUXED_OK && frag)
+    {
+        ret = ema_mp4_mux_set_output_format(handle, (const int8_t *)"frag-mp4");
+    }
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        t   = time_ns_monotonic();
+        ret = ema_mp4_mux_start(handle);
+        *ns = time_ns_monotonic() - t;
+    }
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        ret = ema_mp4_mux_get_metrics(handle, metrics);
+    }
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        *samples   = 0;
+        for (u = 0; u < handle->mp4_handle->stream_num; u++)
+        {
+            *samples += handle->mp4_handle->tracks[u]->sample_num;
+        }
+        *out_bytes = metrics->bytes_written;
+    }
+    ema_mp4_mux_destroy(handle);
+    if (!buf_out)
+    {
+        OSAL_DEL_FILE("mp4base_bench.mp4");
+    }
+    return (ret == EMA_MP4_MUXED_OK) ? 0 : -1;
+}
+
+/** mp4_muxer_input_sample() and mp4_muxer_output_tracks(): flat and fragmented, to a file and to memory */
+static void
+bench_muxer(const char *fn)
+{
+    static const struct
+    {
+        const char *name;
+        BOOL        frag;
+        BOOL        buf_out;
+    } outs[] =
+    {
+        {"mux_output_flat_file",   FALSE, FALSE},
+        {"mux_output_frag_file",   TRUE,  FALSE},
+        {"mux_output_flat_buffer", FALSE, TRUE},
+        {"mux_output_frag_buffer", TRUE,  TRUE},
+    };
+    uint64_t    in_samples = 0, in_ns = 0;
+    uint32_t    o, run;
+    osal_stat_t st;
+
+    if (fn && OSAL_STAT(fn, &st))
+    {
+        fn = NULL;
+    }
+
+    for (o = 0; o < sizeof(outs)/sizeof(outs[0]); o++)
+    {
+        uint64_t out_ns = 0, out_bytes = 0, ns_total = 0;
+
+        for (run = 0; fn && run_more(run, ns_total); run++)
+        {
+            mp4_metrics_t metrics;
+            uint64_t      ns, samples, bytes, parse_ns = 0;
+            uint32_t      u;
+
+            if (mux_run(fn, outs[o].frag, outs[o].buf_out, &metrics, &ns, &samples, &bytes))
+            {
+                break;
+            }
+            ns_total += ns;
+            for (u = 0; u < metrics.track_num; u++)
+            {
+                parse_ns += metrics.parse_ns[u];
+            }
+            /** what is neither parsing nor taking the samples is writing the output */
+            ns -= MIN2(ns, parse_ns + metrics.input_sample_ns);
+            if (!out_ns || ns < out_ns)
+            {
+                out_ns = ns;
+            }
+            if (!in_ns || metrics.input_sample_ns < in_ns)
+            {
+                in_ns = metrics.input_sample_ns;
+            }
+            in_samples = samples;
+            out_bytes  = bytes;
+        }
+        if (out_ns)
+        {
+            result_add(outs[o].name, out_bytes, in_samples, out_ns);
+        }
+        else
+        {
+            result_skip(outs[o].name);
+        }
+    }
+    if (in_ns)
+    {
+        result_add("mux_input_sample", (uint64_t)st.st_size, in_samples, in_ns);
+    }
+    else
+    {
+        result_skip("mux_input_sample");
+    }
+}
+
+/** Takes mb_s or samples_s of each benchmark from a previous output. Returns: 0 if OK */
+static int
+baseline_load(const char *fn)
+{
+    size_t   size;
+    char *   text = (char *)file_load(fn, &size);
+    char *   p;
+    uint32_t u;
+
+    if (!text)
+    {
+        return -1;
+    }
+    text = (char *)REALLOC_CHK(text, size + 1);
+    if (!text)
+    {
+        return -1;
+    }
+    text[size] = '\0';
+
+    for (u = 0; u < result_num; u++)
+    {
+        char key[64];
+
+        OSAL_SNPRINTF(key, sizeof(key), "\"name\": \"%s\"", results[u].name);
+        p = strstr(text, key);
+        if (p)
+        {
+            char *q = strstr(p, results[u].bytes ? "\"mb_s\": " : "\"samples_s\": ");
+            char *end = strchr(p, '}');
+
+            if (q && end && q < end)
+            {
+                results[u].baseline = atof(strchr(q, ':') + 1);
+            }
+        }
+    }
+    FREE_CHK(text);
+    return 0;
+}
+
+/** Returns: the number of results slower than the baseline by more than tolerance percent */
+static uint32_t
+results_write(FILE *fp, double tolerance)
+{
+    uint32_t u, slower_num = 0;
+
+    fprintf(fp, "{\n  \"repeat\": %u,\n  \"benchmarks\": [", repeat);
+    for (u = 0; u < result_num; u++)
+    {
+        const bench_result_t *r = &results[u];
+
+        fprintf(fp, "%s\n    { \"name\": \"%s\"", u ? "," : "", r->name);
+        if (r->skipped)
+        {
+            fprintf(fp, ", \"skipped\": true }");
+            continue;
+        }
+        fprintf(fp, ", \"bytes\": %" PRIu64 ", \"samples\": %" PRIu64 ", \"ns\": %" PRIu64
+                    ", \"mb_s\": %.2f, \"samples_s\": %.1f",
+                r->bytes, r->samples, r->ns, r->mb_s, r->samples_s);
+        if (r->baseline > 0)
+        {
+            double now    = r->bytes ? r->mb_s : r->samples_s;
+            double change = (now - r->baseline)*100.0/r->baseline;
+            BOOL   slower = change < -tolerance;
+
+            fprintf(fp, ", \"baseline\": %.2f, \"change_pct\": %.1f, \"regression\": %s",
+                    r->baseline, change, slower ? "true" : "false");
+            slower_num += slower;
+        }
+        fprintf(fp, " }");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    return slower_num;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: mp4base_bench [options]\n"
+            " --signals <dir>     = The directory of the default AAC, AC-3 and E-AC-3 inputs: test/signals.\n"
+            " --avc <file>        = H.264 Annex B input. The parser and muxer benchmarks without input are skipped.\n"
+            " --hevc <file>       = H.265 Annex B input.\n"
+            " --aac <file>        = AAC ADTS input.\n"
+            " --ac3 <file>        = AC-3 input.\n"
+            " --ec3 <file>        = E-AC-3 input.\n"
+            " --ac4 <file>        = AC-4 input.\n"
+            " --mux <file>        = The input of the muxer benchmarks. Default: the first ES given of the above.\n"
+            " --repeat <n>        = Runs per benchmark, the fastest counts. Default: 5.\n"
+            " --output <file>     = Writes the results there instead of stdout.\n"
+            " --baseline <file>   = Compares to the results of a previous run: exits with 1 on a regression.\n"
+            " --tolerance <pct>   = The slowdown taken as noise, in percent. Default: 10.\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *signals   = NULL;
+    const char *mux_fn    = NULL;
+    const char *out_fn    = NULL;
+    const char *base_fn   = NULL;
+    double      tolerance = 10.0;
+    FILE *      fp        = stdout;
+    uint32_t    u, slower_num;
+    int         i;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char *opt = argv[i];
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (!arg)
+        {
+            usage();
+            return 2;
+        }
+        i++;
+        if (!strcmp(opt, "--signals"))
+        {
+            signals = arg;
+        }
+        else if (!strcmp(opt, "--mux"))
+        {
+            mux_fn = arg;
+        }
+        else if (!strcmp(opt, "--repeat"))
+        {
+            repeat = (uint32_t)atoi(arg);
+            repeat = (repeat) ? repeat : 1;
+        }
+        else if (!strcmp(opt, "--output"))
+        {
+            out_fn = arg;
+        }
+        else if (!strcmp(opt, "--baseline"))
+        {
+            base_fn = arg;
+        }
+        else if (!strcmp(opt, "--tolerance"))
+        {
+            tolerance = atof(arg);
+        }
+        else
+        {
+            for (u = 0; u < ES_INPUT_NUM; u++)
+            {
+                if (!strcmp(opt + 2, es_inputs[u].parser))
+                {
+                    es_fns[u] = STRDUP_CHK(arg);
+                    break;
+                }
+            }
+            if (u == ES_INPUT_NUM || strncmp(opt, "--", 2))
+            {
+                usage();
+                return 2;
+            }
+        }
+    }
+    for (u = 0; u < ES_INPUT_NUM; u++)
+    {
+        if (!es_fns[u] && signals && es_inputs[u].fn)
+        {
+            size_t len = strlen(signals) + strlen(es_inputs[u].fn) + 2;
+
+            es_fns[u] = (char *)MALLOC_CHK(len);
+            if (es_fns[u])
+            {
+                OSAL_SNPRINTF(es_fns[u], len, "%s/%s", signals, es_inputs[u].fn);
+            }
+        }
+        if (!mux_fn && es_fns[u])
+        {
+            mux_fn = es_fns[u];
+        }
+    }
+
+    MEM_CHK_INIT();
+    msglog_global_verbosity_set(MSGLOG_QUIET);
+
+    reg_parser_init();
+    parser_hevc_reg();
+    parser_avc_reg();
+    parser_aac_reg();
+    parser_ac3_reg();
+    parser_ec3_reg();
+    parser_ac4_reg();
+    reg_bbio_init();
+    bbio_file_reg();
+    bbio_buf_reg();
+
+    for (u = 0; u < ES_INPUT_NUM; u++)
+    {
+        bench_parser(es_inputs[u].name, es_inputs[u].parser, es_fns[u]);
+    }
+    bench_find_sc_off();
+    bench_bit_reader();
+    bench_muxer(mux_fn);
+
+    if (base_fn && baseline_load(base_fn))
+    {
+        fprintf(stderr, "Error: can't read baseline %s\n", base_fn);
+        return 2;
+    }
+    if (out_fn)
+    {
+        fp = fopen(out_fn, "w");
+        if (!fp)
+        {
+            fprintf(stderr, "Error: can't open %s\n", out_fn);
+            return 2;
+        }
+    }
+    slower_num = results_write(fp, tolerance);
+    if (fp != stdout)
+    {
+        fclose(fp);
+    }
+    if (slower_num)
+    {
+        fprintf(stderr, "%u benchmarks slower than the baseline by more than %.1f%%\n", slower_num, tolerance);
+    }
+
+    for (u = 0; u < ES_INPUT_NUM; u++)
+    {
+        FREE_CHK(es_fns[u]);
+    }
+    return (slower_num) ? 1 : 0;
+}
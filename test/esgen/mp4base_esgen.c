@@ -0,0 +1,1098 @@
+/************************************************************************************************************
+ * Copyright (c) 2017, Dolby Laboratories Inc.
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+ *    and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or
+ *    promote products derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ ************************************************************************************************************/
+/*<
+    @file mp4base_esgen.c
+    @brief Generates synthetic elementary streams of any length for tests
+
+    H.264 and H.265 come out as Annex B with valid parameter sets, access unit delimiters and slice headers for
+    the GOP structure asked for: IDR period, B frames between the anchors, hierarchical (pyramid) or not, and
+    slices per picture. The slice data is filler of the given size. AC-3, E-AC-3, AAC ADTS and AC-4 come out as
+    frames with valid headers and filler payload.
+    The frames are written as generated, so the length is only limited by the disk: hours, or beyond 4 GB with
+    large slices for co64 outputs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c99_inttypes.h"
+#include "boolean.h"
+
+#define BW_SIZE          256           /** of the parameter sets and headers */
+#define BFRAMES_MAX      15
+#define AVC_WIDTH_MB     80            /** 1280x720 */
+#define AVC_HEIGHT_MB    45
+#define HEVC_WIDTH       1280
+#define HEVC_HEIGHT      720
+#define HEVC_CTB_NUM     (40*23)       /** 32x32 CTBs */
+#define HEVC_CTB_BITS    10            /** Ceil(Log2(HEVC_CTB_NUM)) */
+
+/** the bit writer of the parameter sets and headers */
+typedef struct bit_writer_t_
+{
+    uint8_t  buf[BW_SIZE];
+    uint32_t bit_pos;
+} bit_writer_t;
+
+typedef enum pic_type_t_
+{
+    PIC_I,
+    PIC_P,
+    PIC_B
+} pic_type_t;
+
+/** a picture of a GOP in decode order */
+typedef struct pic_t_
+{
+    uint32_t   disp_idx;  /**< output order in the GOP, 0: the IDR */
+    pic_type_t type;
+    BOOL       is_ref;
+} pic_t;
+
+typedef struct esgen_t_
+{
+    FILE *   fp;
+    uint64_t bytes_written;
+    uint32_t rnd;
+
+    /** video */
+    uint32_t fps_num, fps_den;
+    uint32_t gop;            /**< the IDR period in frames */
+    uint32_t bframes;        /**< between the anchors */
+    BOOL     pyramid;
+    uint32_t slices;         /**< per picture */
+    uint32_t nal_size;       /**< slice data bytes of a P picture. I: times 4, B: half */
+    uint32_t nal_var;        /**< random deviation from it, in percent */
+    uint32_t num_reorder;    /**< derived from the GOP structure */
+    uint32_t num_ref;
+
+    uint8_t *nal_buf;        /**< the escaped NAL unit */
+    size_t   nal_buf_size;
+} esgen_t;
+
+/** xorshift32: the same seed gives the same stream on all platforms */
+static uint32_t
+rnd_next(esgen_t *g)
+{
+    g->rnd ^= g->rnd << 13;
+    g->rnd ^= g->rnd >> 17;
+    g->rnd ^= g->rnd << 5;
+    return g->rnd;
+}
+
+/** Returns: size varied by up to var percent */
+static uint32_t
+rnd_size(esgen_t *g, uint32_t size, uint32_t var)
+{
+    uint64_t pct = 100 - var + rnd_next(g) % (2*var + 1);
+
+    size = (uint32_t)(size*pct/100);
+    return (size) ? size : 1;
+}
+
+/** Fills buf with random bytes other than 0 and avoid, which keeps start codes and sync words out of it */
+static void
+rnd_fill(esgen_t *g, uint8_t *buf, size_t size, uint8_t avoid)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        uint8_t b;
+
+        do
+        {
+            b = (uint8_t)rnd_next(g);
+        }
+        while (!b || b == avoid);
+        buf[i] = b;
+    }
+}
+
+static void
+bw_u(bit_writer_t *bw, uint32_t bits, uint32_t val)
+{
+    while (bits--)
+    {
+        uint32_t byte = bw->bit_pos >> 3;
+        uint8_t  mask = (uint8_t)(0x80 >> (bw->bit_pos & 7));
+
+        if (!(bw->bit_pos & 7))
+        {
+            bw->buf[byte] = 0;
+        }
+        if ((val >> bits) & 1)
+        {
+            bw->buf[byte] |= mask;
+        }
+        bw->bit_pos++;
+    }
+}
+
+static void
+bw_ue(bit_writer_t *bw, uint32_t val)
+{
+    uint32_t bits = 0;
+
+    val++;
+    while (val >> (bits + 1))
+    {
+        bits++;
+    }
+    bw_u(bw, bits, 0);
+    bw_u(bw, bits + 1, val);
+}
+
+static void
+bw_se(bit_writer_t *bw, int32_t val)
+{
+    bw_ue(bw, (val > 0) ? (uint32_t)(2*val - 1) : (uint32_t)(-2*val));
+}
+
+/** rbsp_trailing_bits() */
+static void
+bw_trailing(bit_writer_t *bw)
+{
+    bw_u(bw, 1, 1);
+    while (bw->bit_pos & 7)
+    {
+        bw_u(bw, 1, 0);
+    }
+}
+
+static uint32_t
+bw_size(const bit_writer_t *bw)
+{
+    return (bw->bit_pos + 7) >> 3;
+}
+
+static int
+out_write(esgen_t *g, const uint8_t *buf, size_t size)
+{
+    if (fwrite(buf, 1, size, g->fp) != size)
+    {
+        return -1;
+    }
+    g->bytes_written += size;
+    return 0;
+}
+
+/** Writes a NAL unit: start code, the header bytes, the rbsp of bw and the filler, emulation prevention applied.
+ *  Returns: 0 if OK */
+static int
+nal_write(esgen_t *g, BOOL long_sc, const uint8_t *hdr, uint32_t hdr_size, const bit_writer_t *bw, uint32_t filler_size)
+{
+    size_t   need = 4 + hdr_size + 2*(bw_size(bw) + filler_size);
+    uint32_t zeros = 0, u, bw_bytes = bw_size(bw);
+    size_t   pos;
+    uint8_t *filler;
+
+    if (g->nal_buf_size < need)
+    {
+        free(g->nal_buf);
+        g->nal_buf      = (uint8_t *)malloc(need);
+        g->nal_buf_size = (g->nal_buf) ? need : 0;
+        if (!g->nal_buf)
+        {
+            return -1;
+        }
+    }
+    pos = 0;
+    if (long_sc)
+    {
+        g->nal_buf[pos++] = 0;
+    }
+    g->nal_buf[pos++] = 0;
+    g->nal_buf[pos++] = 0;
+    g->nal_buf[pos++] = 1;
+    memcpy(g->nal_buf + pos, hdr, hdr_size);
+    pos += hdr_size;
+
+    for (u = 0; u < bw_bytes; u++)
+    {
+        if (zeros >= 2 && bw->buf[u] <= 3)
+        {
+            g->nal_buf[pos++] = 3;
+            zeros = 0;
+        }
+        g->nal_buf[pos++] = bw->buf[u];
+        zeros = (bw->buf[u]) ? 0 : zeros + 1;
+    }
+    if (filler_size)
+    {
+        /** no zeros in the filler: at most one emulation prevention byte in front of it */
+        filler = g->nal_buf + pos;
+        rnd_fill(g, filler, filler_size, 0);
+        if (zeros >= 2 && filler[0] <= 3)
+        {
+            memmove(filler + 1, filler, filler_size);
+            *filler++ = 3;
+            pos++;
+        }
+        /** the last byte takes the rbsp_stop_one_bit */
+        filler[filler_size - 1] = 0x80;
+        pos += filler_size;
+    }
+    return out_write(g, g->nal_buf, pos);
+}
+
+/** Appends the B pictures between the anchors at display lo and hi in decode order */
+static void
+gop_add_b(pic_t *pics, uint32_t *pic_num, uint32_t lo, uint32_t hi, BOOL pyramid)
+{
+    uint32_t mid;
+
+    if (hi - lo < 2)
+    {
+        return;
+    }
+    if (!pyramid)
+    {
+        for (mid = lo + 1; mid < hi; mid++)
+        {
+            pics[*pic_num].disp_idx = mid;
+            pics[*pic_num].type     = PIC_B;
+            pics[*pic_num].is_ref   = FALSE;
+            (*pic_num)++;
+        }
+        return;
+    }
+    /** the middle one first, referenced by the ones on both sides if there are any */
+    mid = (lo + hi)/2;
+    pics[*pic_num].disp_idx = mid;
+    pics[*pic_num].type     = PIC_B;
+    pics[*pic_num].is_ref   = (hi - lo > 2);
+    (*pic_num)++;
+    gop_add_b(pics, pic_num, lo, mid, pyramid);
+    gop_add_b(pics, pic_num, mid, hi, pyramid);
+}
+
+/** Fills pics with a GOP of frame_num pictures in decode order */
+static void
+gop_build(const esgen_t *g, pic_t *pics, uint32_t frame_num)
+{
+    uint32_t pic_num = 0, anchor = 0, next;
+
+    pics[pic_num].disp_idx = 0;
+    pics[pic_num].type     = PIC_I;
+    pics[pic_num].is_ref   = TRUE;
+    pic_num++;
+    while (anchor + 1 < frame_num)
+    {
+        next = anchor + g->bframes + 1;
+        if (next >= frame_num)
+        {
+            next = frame_num - 1;
+        }
+        pics[pic_num].disp_idx = next;
+        pics[pic_num].type     = PIC_P;
+        pics[pic_num].is_ref   = TRUE;
+        pic_num++;
+        gop_add_b(pics, &pic_num, anchor, next, g->pyramid);
+        anchor = next;
+    }
+}
+
+/** Sets num_reorder and num_ref of the full GOP: the pictures output before one decoded earlier,
+ *  and the references the decoder keeps */
+static void
+gop_analyse(esgen_t *g, const pic_t *pics)
+{
+    uint32_t u, v, ref_b = 0, ref_b_max = 0;
+
+    g->num_reorder = 0;
+    for (u = 0; u < g->gop; u++)
+    {
+        uint32_t reorder = 0;
+
+        for (v = 0; v < u; v++)
+        {
+            reorder += (pics[v].disp_idx > pics[u].disp_idx);
+        }
+        g->num_reorder = (reorder > g->num_reorder) ? reorder : g->num_reorder;
+
+        ref_b = (pics[u].type == PIC_P) ? 0 : ref_b + (pics[u].type == PIC_B && pics[u].is_ref);
+        ref_b_max = (ref_b > ref_b_max) ? ref_b : ref_b_max;
+    }
+    /** the previous anchor, the B references after it, the anchor and the B references of the current
+     *  mini GOP: the sliding window keeps all of them */
+    g->num_ref = 2 + 2*ref_b_max;
+}
+
+/** The reference pictures alive for pics[idx]: the anchor before the current mini GOP, the current anchor
+ *  and the B references decoded after it. Returns: their number */
+static uint32_t
+gop_refs(const pic_t *pics, uint32_t idx, uint32_t *refs)
+{
+    uint32_t ref_num = 0, u, start = idx;
+
+    if (pics[idx].type == PIC_I)
+    {
+        return 0;
+    }
+    /** back to the anchor of the mini GOP */
+    while (pics[start].type == PIC_B)
+    {
+        start--;
+    }
+    /** the anchor before: the I or the P anchor before start */
+    for (u = start; u-- > 0;)
+    {
+        if (pics[u].type != PIC_B)
+        {
+            refs[ref_num++] = pics[u].disp_idx;
+            break;
+        }
+    }
+    for (u = start; u < idx; u++)
+    {
+        if (pics[u].is_ref)
+        {
+            refs[ref_num++] = pics[u].disp_idx;
+        }
+    }
+    return ref_num;
+}
+
+/***** H.264 */
+
+static void
+avc_sps(const esgen_t *g, bit_writer_t *bw)
+{
+    bw->bit_pos = 0;
+    bw_u(bw, 8, 77);               /** profile_idc: Main */
+    bw_u(bw, 8, 0x40);             /** constraint_set1_flag */
+    bw_u(bw, 8, 40);               /** level_idc */
+    bw_ue(bw, 0);                  /** seq_parameter_set_id */
+    bw_ue(bw, 4);                  /** log2_max_frame_num_minus4 */
+    bw_ue(bw, 0);                  /** pic_order_cnt_type */
+    bw_ue(bw, 4);                  /** log2_max_pic_order_cnt_lsb_minus4 */
+    bw_ue(bw, g->num_ref);         /** max_num_ref_frames */
+    bw_u(bw, 1, 0);                /** gaps_in_frame_num_value_allowed_flag */
+    bw_ue(bw, AVC_WIDTH_MB - 1);
+    bw_ue(bw, AVC_HEIGHT_MB - 1);
+    bw_u(bw, 1, 1);                /** frame_mbs_only_flag */
+    bw_u(bw, 1, 1);                /** direct_8x8_inference_flag */
+    bw_u(bw, 1, 0);                /** frame_cropping_flag */
+    bw_u(bw, 1, 1);                /** vui_parameters_present_flag */
+    bw_u(bw, 4, 0);                /** aspect ratio, overscan, video signal, chroma loc info */
+    bw_u(bw, 1, 1);                /** timing_info_present_flag */
+    bw_u(bw, 32, g->fps_den);
+    bw_u(bw, 32, 2*g->fps_num);
+    bw_u(bw, 1, 1);                /** fixed_frame_rate_flag */
+    bw_u(bw, 3, 0);                /** nal, vcl hrd, pic_struct_present_flag */
+    bw_u(bw, 1, 1);                /** bitstream_restriction_flag */
+    bw_u(bw, 1, 1);                /** motion_vectors_over_pic_boundaries_flag */
+    bw_ue(bw, 2);                  /** max_bytes_per_pic_denom */
+    bw_ue(bw, 1);                  /** max_bits_per_mb_denom */
+    bw_ue(bw, 16);                 /** log2_max_mv_length_horizontal */
+    bw_ue(bw, 16);                 /** log2_max_mv_length_vertical */
+    bw_ue(bw, g->num_reorder);     /** max_num_reorder_frames */
+    bw_ue(bw, g->num_ref);         /** max_dec_frame_buffering */
+    bw_trailing(bw);
+}
+
+static void
+avc_pps(bit_writer_t *bw)
+{
+    bw->bit_pos = 0;
+    bw_ue(bw, 0);                  /** pic_parameter_set_id */
+    bw_ue(bw, 0);                  /** seq_parameter_set_id */
+    bw_u(bw, 1, 0);                /** entropy_coding_mode_flag: CAVLC */
+    bw_u(bw, 1, 0);                /** bottom_field_pic_order_in_frame_present_flag */
+    bw_ue(bw, 0);                  /** num_slice_groups_minus1 */
+    bw_ue(bw, 0);                  /** num_ref_idx_l0_default_active_minus1 */
+    bw_ue(bw, 0);                  /** num_ref_idx_l1_default_active_minus1 */
+    bw_u(bw, 1, 0);                /** weighted_pred_flag */
+    bw_u(bw, 2, 0);                /** weighted_bipred_idc */
+    bw_se(bw, 0);                  /** pic_init_qp_minus26 */
+    bw_se(bw, 0);                  /** pic_init_qs_minus26 */
+    bw_se(bw, 0);                  /** chroma_qp_index_offset */
+    bw_u(bw, 1, 1);                /** deblocking_filter_control_present_flag */
+    bw_u(bw, 1, 0);                /** constrained_intra_pred_flag */
+    bw_u(bw, 1, 0);                /** redundant_pic_cnt_present_flag */
+    bw_trailing(bw);
+}
+
+/** Writes the access unit of pic. *frame_num: that of the previous reference picture */
+static int
+avc_au_write(esgen_t *g, const pic_t *pic, uint32_t *frame_num, uint32_t idr_pic_id)
+{
+    static const uint8_t aud[] = {0x09, 0xF0};  /** primary_pic_type 7 */
+    static const uint8_t slice_types[] = {7, 5, 6};
+    bit_writer_t bw;
+    uint8_t      hdr;
+    uint32_t     sl, fn;
+
+    bw.bit_pos = 0;
+    if (nal_write(g, TRUE, aud, sizeof(aud), &bw, 0))
+    {
+        return -1;
+    }
+    if (pic->type == PIC_I)
+    {
+        hdr = 0x67;
+        avc_sps(g, &bw);
+        if (nal_write(g, TRUE, &hdr, 1, &bw, 0))
+        {
+            return -1;
+        }
+        hdr = 0x68;
+        avc_pps(&bw);
+        if (nal_write(g, TRUE, &hdr, 1, &bw, 0))
+        {
+            return -1;
+        }
+        *frame_num = 0;
+        fn = 0;
+    }
+    else
+    {
+        fn = (*frame_num + 1) & 0xFF;
+        if (pic->is_ref)
+        {
+            *frame_num = fn;
+        }
+    }
+    hdr = (pic->type == PIC_I) ? 0x65 : (pic->is_ref) ? 0x41 : 0x01;
+
+    for (sl = 0; sl < g->slices; sl++)
+    {
+        uint32_t size = (pic->type == PIC_I) ? 4*g->nal_size : (pic->type == PIC_P) ? g->nal_size : g->nal_size/2;
+
+        bw.bit_pos = 0;
+        bw_ue(&bw, sl*AVC_WIDTH_MB*AVC_HEIGHT_MB/g->slices);  /** first_mb_in_slice */
+        bw_ue(&bw, slice_types[pic->type]);
+        bw_ue(&bw, 0);                                         /** pic_parameter_set_id */
+        bw_u(&bw, 8, fn);
+        if (pic->type == PIC_I)
+        {
+            bw_ue(&bw, idr_pic_id);
+        }
+        bw_u(&bw, 8, (2*pic->disp_idx) & 0xFF);                /** pic_order_cnt_lsb */
+        if (pic->type == PIC_B)
+        {
+            bw_u(&bw, 1, 1);                                   /** direct_spatial_mv_pred_flag */
+        }
+        if (pic->type != PIC_I)
+        {
+            bw_u(&bw, 1, 0);                                   /** num_ref_idx_active_override_flag */
+            bw_u(&bw, 1, 0);                                   /** ref_pic_list_modification_flag_l0 */
+            if (pic->type == PIC_B)
+            {
+                bw_u(&bw, 1, 0);                               /** ref_pic_list_modification_flag_l1 */
+            }
+        }
+        if (pic->type == PIC_I)
+        {
+            bw_u(&bw, 2, 0);                                   /** no_output_of_prior_pics, long_term_reference */
+        }
+        else if (pic->is_ref)
+        {
+            bw_u(&bw, 1, 0);                                   /** adaptive_ref_pic_marking_mode_flag */
+        }
+        bw_se(&bw, 0);                                         /** slice_qp_delta */
+        bw_ue(&bw, 1);                                         /** disable_deblocking_filter_idc */
+        if (nal_write(g, (sl == 0), &hdr, 1, &bw, rnd_size(g, size, g->nal_var)))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/***** H.265 */
+
+static void
+hevc_ptl(bit_writer_t *bw)
+{
+    bw_u(bw, 2, 0);                /** general_profile_space */
+    bw_u(bw, 1, 0);                /** general_tier_flag */
+    bw_u(bw, 5, 1);                /** general_profile_idc: Main */
+    bw_u(bw, 32, 0x60000000);      /** general_profile_compatibility_flags */
+    bw_u(bw, 4, 0x9);              /** progressive_source, interlaced, non_packed, frame_only_constraint */
+    bw_u(bw, 32, 0);               /** reserved */
+    bw_u(bw, 11, 0);
+    bw_u(bw, 1, 0);                /** general_inbld_flag */
+    bw_u(bw, 8, 120);              /** general_level_idc: 4 */
+}
+
+static void
+hevc_vps(const esgen_t *g, bit_writer_t *bw)
+{
+    bw->bit_pos = 0;
+    bw_u(bw, 4, 0);                /** vps_video_parameter_set_id */
+    bw_u(bw, 2, 3);                /** vps_base_layer_internal_flag, vps_base_layer_available_flag */
+    bw_u(bw, 6, 0);                /** vps_max_layers_minus1 */
+    bw_u(bw, 3, 0);                /** vps_max_sub_layers_minus1 */
+    bw_u(bw, 1, 1);                /** vps_temporal_id_nesting_flag */
+    bw_u(bw, 16, 0xFFFF);
+    hevc_ptl(bw);
+    bw_u(bw, 1, 1);                /** vps_sub_layer_ordering_info_present_flag */
+    bw_ue(bw, g->num_ref + g->num_reorder);
+    bw_ue(bw, g->num_reorder);
+    bw_ue(bw, 0);                  /** vps_max_latency_increase_plus1 */
+    bw_u(bw, 6, 0);                /** vps_max_layer_id */
+    bw_ue(bw, 0);                  /** vps_num_layer_sets_minus1 */
+    bw_u(bw, 1, 0);                /** vps_timing_info_present_flag */
+    bw_u(bw, 1, 0);                /** vps_extension_flag */
+    bw_trailing(bw);
+}
+
+static void
+hevc_sps(const esgen_t *g, bit_writer_t *bw)
+{
+    bw->bit_pos = 0;
+    bw_u(bw, 4, 0);                /** sps_video_parameter_set_id */
+    bw_u(bw, 3, 0);                /** sps_max_sub_layers_minus1 */
+    bw_u(bw, 1, 1);                /** sps_temporal_id_nesting_flag */
+    hevc_ptl(bw);
+    bw_ue(bw, 0);                  /** sps_seq_parameter_set_id */
+    bw_ue(bw, 1);                  /** chroma_format_idc */
+    bw_ue(bw, HEVC_WIDTH);
+    bw_ue(bw, HEVC_HEIGHT);
+    bw_u(bw, 1, 0);                /** conformance_window_flag */
+    bw_ue(bw, 0);                  /** bit_depth_luma_minus8 */
+    bw_ue(bw, 0);                  /** bit_depth_chroma_minus8 */
+    bw_ue(bw, 4);                  /** log2_max_pic_order_cnt_lsb_minus4 */
+    bw_u(bw, 1, 1);                /** sps_sub_layer_ordering_info_present_flag */
+    bw_ue(bw, g->num_ref + g->num_reorder);
+    bw_ue(bw, g->num_reorder);
+    bw_ue(bw, 0);                  /** sps_max_latency_increase_plus1 */
+    bw_ue(bw, 0);                  /** log2_min_luma_coding_block_size_minus3 */
+    bw_ue(bw, 2);                  /** log2_diff_max_min_luma_coding_block_size: 32x32 CTBs */
+    bw_ue(bw, 0);                  /** log2_min_luma_transform_block_size_minus2 */
+    bw_ue(bw, 3);                  /** log2_diff_max_min_luma_transform_block_size */
+    bw_ue(bw, 0);                  /** max_transform_hierarchy_depth_inter */
+    bw_ue(bw, 0);                  /** max_transform_hierarchy_depth_intra */
+    bw_u(bw, 4, 0);                /** scaling_list, amp, sample_adaptive_offset, pcm */
+    bw_ue(bw, 0);                  /** num_short_term_ref_pic_sets: in the slice headers */
+    bw_u(bw, 1, 0);                /** long_term_ref_pics_present_flag */
+    bw_u(bw, 1, 0);                /** sps_temporal_mvp_enabled_flag */
+    bw_u(bw, 1, 0);                /** strong_intra_smoothing_enabled_flag */
+    bw_u(bw, 1, 1);                /** vui_parameters_present_flag */
+    bw_u(bw, 8, 0);                /** aspect ratio ... default display window */
+    bw_u(bw, 1, 1);                /** vui_timing_info_present_flag */
+    bw_u(bw, 32, g->fps_den);
+    bw_u(bw, 32, g->fps_num);
+    bw_u(bw, 1, 0);                /** vui_poc_proportional_to_timing_flag */
+    bw_u(bw, 1, 0);                /** vui_hrd_parameters_present_flag */
+    bw_u(bw, 1, 0);                /** bitstream_restriction_flag */
+    bw_u(bw, 1, 0);                /** sps_extension_present_flag */
+    bw_trailing(bw);
+}
+
+static void
+hevc_pps(bit_writer_t *bw)
+{
+    bw->bit_pos = 0;
+    bw_ue(bw, 0);                  /** pps_pic_parameter_set_id */
+    bw_ue(bw, 0);                  /** pps_seq_parameter_set_id */
+    bw_u(bw, 2, 0);                /** dependent_slice_segments_enabled, output_flag_present */
+    bw_u(bw, 3, 0);                /** num_extra_slice_header_bits */
+    bw_u(bw, 2, 0);                /** sign_data_hiding_enabled, cabac_init_present */
+    bw_ue(bw, 0);                  /** num_ref_idx_l0_default_active_minus1 */
+    bw_ue(bw, 0);                  /** num_ref_idx_l1_default_active_minus1 */
+    bw_se(bw, 0);                  /** init_qp_minus26 */
+    bw_u(bw, 3, 0);                /** constrained_intra_pred, transform_skip, cu_qp_delta_enabled */
+    bw_se(bw, 0);                  /** pps_cb_qp_offset */
+    bw_se(bw, 0);                  /** pps_cr_qp_offset */
+    bw_u(bw, 10, 0);               /** chroma qp offsets present ... scaling_list_data_present */
+    bw_u(bw, 1, 0);                /** lists_modification_present_flag */
+    bw_ue(bw, 0);                  /** log2_parallel_merge_level_minus2 */
+    bw_u(bw, 2, 0);                /** slice_segment_header_extension_present, pps_extension_present */
+    bw_trailing(bw);
+}
+
+/** st_ref_pic_set() of the slice header: refs are the display indices of the references */
+static void
+hevc_rps(bit_writer_t *bw, uint32_t disp_idx, const uint32_t *refs, uint32_t ref_num)
+{
+    uint32_t neg[BFRAMES_MAX + 2], pos[BFRAMES_MAX + 2];
+    uint32_t neg_num = 0, pos_num = 0, u, v, prev;
+
+    /** sorted by the distance to disp_idx */
+    for (u = 0; u < ref_num; u++)
+    {
+        uint32_t *list = (refs[u] < disp_idx) ? neg : pos;
+        uint32_t *num  = (refs[u] < disp_idx) ? &neg_num : &pos_num;
+        uint32_t  dist = (refs[u] < disp_idx) ? disp_idx - refs[u] : refs[u] - disp_idx;
+
+        for (v = (*num)++; v > 0 && list[v - 1] > dist; v--)
+        {
+            list[v] = list[v - 1];
+        }
+        list[v] = dist;
+    }
+    bw_ue(bw, neg_num);
+    bw_ue(bw, pos_num);
+    for (u = 0, prev = 0; u < neg_num; prev = neg[u++])
+    {
+        bw_ue(bw, neg[u] - prev - 1);   /** delta_poc_s0_minus1 */
+        bw_u(bw, 1, 1);                 /** used_by_curr_pic_s0_flag */
+    }
+    for (u = 0, prev = 0; u < pos_num; prev = pos[u++])
+    {
+        bw_ue(bw, pos[u] - prev - 1);   /** delta_poc_s1_minus1 */
+        bw_u(bw, 1, 1);                 /** used_by_curr_pic_s1_flag */
+    }
+}
+
+static int
+hevc_au_write(esgen_t *g, const pic_t *pics, uint32_t idx)
+{
+    static const uint8_t aud[] = {35 << 1, 1, 0x50};  /** pic_type 2 */
+    static const uint8_t slice_types[] = {2, 1, 0};
+    const pic_t *pic = pics + idx;
+    bit_writer_t bw;
+    uint8_t      hdr[2];
+    uint32_t     refs[BFRAMES_MAX + 2], ref_num, sl;
+
+    bw.bit_pos = 0;
+    if (nal_write(g, TRUE, aud, sizeof(aud), &bw, 0))
+    {
+        return -1;
+    }
+    hdr[1] = 1;
+    if (pic->type == PIC_I)
+    {
+        hdr[0] = 32 << 1;
+        hevc_vps(g, &bw);
+        if (nal_write(g, TRUE, hdr, 2, &bw, 0))
+        {
+            return -1;
+        }
+        hdr[0] = 33 << 1;
+        hevc_sps(g, &bw);
+        if (nal_write(g, TRUE, hdr, 2, &bw, 0))
+        {
+            return -1;
+        }
+        hdr[0] = 34 << 1;
+        hevc_pps(&bw);
+        if (nal_write(g, TRUE, hdr, 2, &bw, 0))
+        {
+            return -1;
+        }
+    }
+    /** IDR_N_LP: the B pictures follow the IDR in output order. TRAIL_R, TRAIL_N */
+    hdr[0] = (uint8_t)(((pic->type == PIC_I) ? 20 : (pic->is_ref) ? 1 : 0) << 1);
+    ref_num = gop_refs(pics, idx, refs);
+
+    for (sl = 0; sl < g->slices; sl++)
+    {
+        uint32_t size = (pic->type == PIC_I) ? 4*g->nal_size : (pic->type == PIC_P) ? g->nal_size : g->nal_size/2;
+
+        bw.bit_pos = 0;
+        bw_u(&bw, 1, (sl == 0));                               /** first_slice_segment_in_pic_flag */
+        if (pic->type == PIC_I)
+        {
+            bw_u(&bw, 1, 0);                                   /** no_output_of_prior_pics_flag */
+        }
+        bw_ue(&bw, 0);                                         /** slice_pic_parameter_set_id */
+        if (sl)
+        {
+            bw_u(&bw, HEVC_CTB_BITS, sl*HEVC_CTB_NUM/g->slices);  /** slice_segment_address */
+        }
+        bw_ue(&bw, slice_types[pic->type]);
+        if (pic->type != PIC_I)
+        {
+            bw_u(&bw, 8, pic->disp_idx & 0xFF);                /** slice_pic_order_cnt_lsb */
+            bw_u(&bw, 1, 0);                                   /** short_term_ref_pic_set_sps_flag */
+            hevc_rps(&bw, pic->disp_idx, refs, ref_num);
+            bw_u(&bw, 1, 0);                                   /** num_ref_idx_active_override_flag */
+            if (pic->type == PIC_B)
+            {
+                bw_u(&bw, 1, 0);                               /** mvd_l1_zero_flag */
+            }
+            bw_ue(&bw, 0);                                     /** five_minus_max_num_merge_cand */
+        }
+        bw_se(&bw, 0);                                         /** slice_qp_delta */
+        bw_u(&bw, 1, 1);                                       /** byte_alignment() */
+        while (bw.bit_pos & 7)
+        {
+            bw_u(&bw, 1, 0);
+        }
+        if (nal_write(g, (sl == 0), hdr, 2, &bw, rnd_size(g, size, g->nal_var)))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+video_write(esgen_t *g, BOOL hevc, uint64_t frame_num)
+{
+    pic_t *  pics = (pic_t *)malloc(g->gop*sizeof(pic_t));
+    uint64_t done = 0;
+    uint32_t idr_pic_id = 0, frame_num_ref = 0, u;
+    int      ret = 0;
+
+    if (!pics)
+    {
+        return -1;
+    }
+    gop_build(g, pics, g->gop);
+    gop_analyse(g, pics);
+
+    while (!ret && done < frame_num)
+    {
+        uint32_t gop_frames = (frame_num - done < g->gop) ? (uint32_t)(frame_num - done) : g->gop;
+
+        /** the last GOP is cut short */
+        gop_build(g, pics, gop_frames);
+        for (u = 0; !ret && u < gop_frames; u++)
+        {
+            ret = (hevc) ? hevc_au_write(g, pics, u) : avc_au_write(g, pics + u, &frame_num_ref, idr_pic_id);
+        }
+        idr_pic_id = (idr_pic_id + 1) & 0xFFFF;
+        done      += gop_frames;
+    }
+    free(pics);
+    return ret;
+}
+
+/***** audio */
+
+/** AC-3 at 48 kHz, 384 kbps, 3/2 with LFE */
+static int
+ac3_frame_write(esgen_t *g, uint8_t *frame)
+{
+    bit_writer_t bw;
+
+    bw.bit_pos = 0;
+    bw_u(&bw, 16, 0x0B77);
+    bw_u(&bw, 16, 0);              /** crc1 */
+    bw_u(&bw, 2, 0);               /** fscod: 48 kHz */
+    bw_u(&bw, 6, 28);              /** frmsizecod: 384 kbps */
+    bw_u(&bw, 5, 8);               /** bsid */
+    bw_u(&bw, 3, 0);               /** bsmod */
+    bw_u(&bw, 3, 7);               /** acmod: 3/2 */
+    bw_u(&bw, 2, 1);               /** cmixlev */
+    bw_u(&bw, 2, 1);               /** surmixlev */
+    bw_u(&bw, 1, 1);               /** lfeon */
+    bw_u(&bw, 5, 27);              /** dialnorm */
+    bw_u(&bw, 3, 0);               /** compre, langcode, audprodie */
+    bw_u(&bw, 2, 1);               /** copyrightb, origbs */
+    bw_u(&bw, 3, 0);               /** timecod1e, timecod2e, addbsie */
+    memcpy(frame, bw.buf, bw_size(&bw));
+    rnd_fill(g, frame + bw_size(&bw), 1536 - bw_size(&bw), 0x0B);
+    return out_write(g, frame, 1536);
+}
+
+/** E-AC-3 at 48 kHz, 256 kbps, 6 blocks, 3/2 with LFE */
+static int
+ec3_frame_write(esgen_t *g, uint8_t *frame)
+{
+    bit_writer_t bw;
+
+    bw.bit_pos = 0;
+    bw_u(&bw, 16, 0x0B77);
+    bw_u(&bw, 2, 0);               /** strmtyp: independent */
+    bw_u(&bw, 3, 0);               /** substreamid */
+    bw_u(&bw, 11, 1024/2 - 1);     /** frmsiz */
+    bw_u(&bw, 2, 0);               /** fscod: 48 kHz */
+    bw_u(&bw, 2, 3);               /** numblkscod: 6 blocks */
+    bw_u(&bw, 3, 7);               /** acmod: 3/2 */
+    bw_u(&bw, 1, 1);               /** lfeon */
+    bw_u(&bw, 5, 16);              /** bsid */
+    bw_u(&bw, 5, 27);              /** dialnorm */
+    bw_u(&bw, 4, 0);               /** compre, mixmdate, infomdate, addbsie */
+    memcpy(frame, bw.buf, bw_size(&bw));
+    rnd_fill(g, frame + bw_size(&bw), 1024 - bw_size(&bw), 0x0B);
+    return out_write(g, frame, 1024);
+}
+
+/** AAC LC ADTS at 48 kHz, stereo, about 128 kbps */
+static int
+aac_frame_write(esgen_t *g, uint8_t *frame)
+{
+    uint32_t     size = 7 + rnd_size(g, 334, 10);
+    bit_writer_t bw;
+
+    bw.bit_pos = 0;
+    bw_u(&bw, 12, 0xFFF);
+    bw_u(&bw, 1, 0);               /** ID: MPEG-4 */
+    bw_u(&bw, 2, 0);               /** layer */
+    bw_u(&bw, 1, 1);               /** protection_absent */
+    bw_u(&bw, 2, 1);               /** profile_ObjectType: LC */
+    bw_u(&bw, 4, 3);               /** sampling_frequency_index: 48 kHz */
+    bw_u(&bw, 1, 0);               /** private_bit */
+    bw_u(&bw, 3, 2);               /** channel_configuration */
+    bw_u(&bw, 4, 0);               /** original_copy, home, copyright_identification_bit, _start */
+    bw_u(&bw, 13, size);           /** aac_frame_length */
+    bw_u(&bw, 11, 0x7FF);          /** adts_buffer_fullness: VBR */
+    bw_u(&bw, 2, 0);               /** number_of_raw_data_blocks_in_frame */
+    memcpy(frame, bw.buf, 7);
+    rnd_fill(g, frame + 7, size - 7, 0xFF);
+    return out_write(g, frame, size);
+}
+
+/** AC-4 at 48 kHz, 25 fps, a single stereo presentation, about 64 kbps */
+static int
+ac4_frame_write(esgen_t *g, uint8_t *frame, uint32_t seq)
+{
+    uint32_t     body = rnd_size(g, 320, 10);
+    bit_writer_t bw;
+
+    bw.bit_pos = 0;
+    bw_u(&bw, 16, 0xAC40);         /** sync_word: no CRC */
+    bw_u(&bw, 16, body);           /** frame_size */
+    bw_u(&bw, 2, 2);               /** bitstream_version */
+    bw_u(&bw, 10, seq & 0x3FF);    /** sequence_counter */
+    bw_u(&bw, 1, 0);               /** b_wait_frames */
+    bw_u(&bw, 1, 1);               /** fs_index: 48 kHz */
+    bw_u(&bw, 4, 2);               /** frame_rate_index: 25 fps */
+    bw_u(&bw, 1, 1);               /** b_iframe_global */
+    bw_u(&bw, 1, 1);               /** b_single_presentation */
+    bw_u(&bw, 1, 0);               /** b_payload_base */
+    bw_u(&bw, 1, 0);               /** b_program_id */
+    /** ac4_presentation_v1_info() */
+    bw_u(&bw, 1, 1);               /** b_single_substream_group */
+    bw_u(&bw, 2, 2);               /** presentation_version: 1 */
+    bw_u(&bw, 3, 0);               /** mdcompat */
+    bw_u(&bw, 1, 0);               /** b_presentation_id */
+    bw_u(&bw, 1, 0);               /** b_multiplier */
+    bw_u(&bw, 2, 0);               /** emdf_info(): emdf_version */
+    bw_u(&bw, 3, 0);               /** key_id */
+    bw_u(&bw, 1, 0);               /** b_emdf_payloads_substream_info */
+    bw_u(&bw, 2, 1);               /** emdf_protection(): protection_length_primary 8 bits */
+    bw_u(&bw, 2, 0);               /** protection_length_secondary */
+    bw_u(&bw, 8, 0x5A);            /** protection_bits_primary */
+    bw_u(&bw, 1, 0);               /** b_presentation_filter */
+    bw_u(&bw, 3, 0);               /** group_index */
+    bw_u(&bw, 1, 0);               /** b_pre_virtualized */
+    bw_u(&bw, 1, 0);               /** b_add_emdf_substreams */
+    bw_u(&bw, 1, 0);               /** ac4_presentation_substream_info(): b_alternative */
+    bw_u(&bw, 1, 0);               /** b_pres_ndot */
+    bw_u(&bw, 2, 0);               /** substream_index */
+    /** ac4_substream_group_info() */
+    bw_u(&bw, 1, 1);               /** b_substreams_present */
+    bw_u(&bw, 1, 0);               /** b_hsf_ext */
+    bw_u(&bw, 1, 1);               /** b_single_substream */
+    bw_u(&bw, 1, 1);               /** b_channel_coded */
+    bw_u(&bw, 2, 2);               /** channel_mode: stereo */
+    bw_u(&bw, 1, 0);               /** b_sf_multiplier */
+    bw_u(&bw, 1, 0);               /** b_bitrate_info */
+    bw_u(&bw, 1, 0);               /** b_ajoc ... b_substream_ndot */
+    bw_u(&bw, 2, 0);               /** substream_index */
+    bw_u(&bw, 1, 0);               /** b_content_type */
+    while (bw.bit_pos & 7)
+    {
+        bw_u(&bw, 1, 0);
+    }
+    memcpy(frame, bw.buf, bw_size(&bw));
+    rnd_fill(g, frame + bw_size(&bw), body + 4 - bw_size(&bw), 0xAC);
+    return out_write(g, frame, body + 4);
+}
+
+static const struct
+{
+    const char *type;
+    double      frame_rate;  /**< of the audio frames */
+} es_types[] =
+{
+    {"avc",  0},
+    {"hevc", 0},
+    {"ac3",  48000.0/1536},
+    {"ec3",  48000.0/1536},
+    {"aac",  48000.0/1024},
+    {"ac4",  25},
+};
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: mp4base_esgen --type <type> --output <file> [options]\n"
+            " --type <type>        = avc, hevc: 1280x720 Annex B. ac3, ec3: 48 kHz 5.1. aac: ADTS 48 kHz stereo.\n"
+            "                        ac4: 48 kHz stereo at 25 fps.\n"
+            " --output <file>      = The elementary stream written.\n"
+            " --frames <n>         = The length in frames. Default: 250.\n"
+            " --duration <s>       = The length in seconds, instead of --frames.\n"
+            " --seed <n>           = Of the filler and sizes: the same seed gives the same stream. Default: 1.\n"
+            "Video options:\n"
+            " --fps <num>[/<den>]  = The frame rate. Default: 25.\n"
+            " --gop <n>            = The IDR period in frames. Default: 50.\n"
+            " --bframes <n>        = B frames between the anchors, up to %u. Default: 0.\n"
+            " --pyramid <0|1>      = Hierarchical B frames, the middle ones referenced. Default: 1.\n"
+            " --slices <n>         = Slices per picture. Default: 1.\n"
+            " --nal-size <bytes>   = Slice data of a P picture. I pictures get 4 times, B pictures half of it.\n"
+            "                        Default: 2000.\n"
+            " --nal-var <pct>      = The random deviation from it, in percent. Default: 25.\n",
+            BFRAMES_MAX);
+}
+
+int
+main(int argc, char **argv)
+{
+    esgen_t     g;
+    const char *type     = NULL;
+    const char *out_fn   = NULL;
+    uint64_t    frames   = 250;
+    double      duration = 0;
+    uint32_t    t, seq;
+    int         i, ret = 0;
+
+    memset(&g, 0, sizeof(g));
+    g.rnd      = 1;
+    g.fps_num  = 25;
+    g.fps_den  = 1;
+    g.gop      = 50;
+    g.pyramid  = TRUE;
+    g.slices   = 1;
+    g.nal_size = 2000;
+    g.nal_var  = 25;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char *opt = argv[i];
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (!arg)
+        {
+            usage();
+            return 2;
+        }
+        i++;
+        if (!strcmp(opt, "--type"))
+        {
+            type = arg;
+        }
+        else if (!strcmp(opt, "--output"))
+        {
+            out_fn = arg;
+        }
+        else if (!strcmp(opt, "--frames"))
+        {
+            frames = strtoul(arg, NULL, 10);
+        }
+        else if (!strcmp(opt, "--duration"))
+        {
+            duration = atof(arg);
+        }
+        else if (!strcmp(opt, "--seed"))
+        {
+            g.rnd = (uint32_t)strtoul(arg, NULL, 10);
+            g.rnd = (g.rnd) ? g.rnd : 1;  /** xorshift stays at 0 */
+        }
+        else if (!strcmp(opt, "--fps"))
+        {
+            const char *den = strchr(arg, '/');
+
+            g.fps_num = (uint32_t)atoi(arg);
+            g.fps_den = (den) ? (uint32_t)atoi(den + 1) : 1;
+        }
+        else if (!strcmp(opt, "--gop"))
+        {
+            g.gop = (uint32_t)atoi(arg);
+        }
+        else if (!strcmp(opt, "--bframes"))
+        {
+            g.bframes = (uint32_t)atoi(arg);
+        }
+        else if (!strcmp(opt, "--pyramid"))
+        {
+            g.pyramid = (atoi(arg) != 0);
+        }
+        else if (!strcmp(opt, "--slices"))
+        {
+            g.slices = (uint32_t)atoi(arg);
+        }
+        else if (!strcmp(opt, "--nal-size"))
+        {
+            g.nal_size = (uint32_t)atoi(arg);
+        }
+        else if (!strcmp(opt, "--nal-var"))
+        {
+            g.nal_var = (uint32_t)atoi(arg);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    for (t = 0; type && t < sizeof(es_types)/sizeof(es_types[0]); t++)
+    {
+        if (!strcmp(type, es_types[t].type))
+        {
+            break;
+        }
+    }
+    if (!type || !out_fn || t == sizeof(es_types)/sizeof(es_types[0]) ||
+        !g.fps_num || !g.fps_den || !g.gop || g.bframes > BFRAMES_MAX || !g.slices || g.slices > 64 ||
+        g.nal_size < 2 || g.nal_var > 99)
+    {
+        usage();
+        return 2;
+    }
+    if (duration > 0)
+    {
+        double rate = (es_types[t].frame_rate) ? es_types[t].frame_rate : (double)g.fps_num/g.fps_den;
+
+        frames = (uint64_t)(duration*rate + 0.999);
+    }
+
+    g.fp = fopen(out_fn, "wb");
+    if (!g.fp)
+    {
+        fprintf(stderr, "Error: can't open %s\n", out_fn);
+        return 1;
+    }
+    if (t <= 1)
+    {
+        ret = video_write(&g, (t == 1), frames);
+    }
+    else
+    {
+        uint8_t frame[1536];
+        uint64_t f;
+
+        for (f = 0, seq = 0; !ret && f < frames; f++, seq++)
+        {
+            switch (t)
+            {
+            case 2:  ret = ac3_frame_write(&g, frame); break;
+            case 3:  ret = ec3_frame_write(&g, frame); break;
+            case 4:  ret = aac_frame_write(&g, frame); break;
+            default: ret = ac4_frame_write(&g, frame, seq); break;
+            }
+        }
+    }
+    if (fclose(g.fp))
+    {
+        ret = -1;
+    }
+    free(g.nal_buf);
+    if (ret)
+    {
+        fprintf(stderr, "Error: writing %s failed\n", out_fn);
+        return 1;
+    }
+    fprintf(stderr, "%s: %" PRIu64 " frames, %" PRIu64 " bytes\n", out_fn, frames, g.bytes_written);
+    return 0;
+}
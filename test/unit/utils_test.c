@@ -13,9 +13,25 @@
 */
 
 #include <utils.h>
+#include <nal_index.h>
+#include <ps_cache.h>
+#include <list_itr.h>
+#include <io_digest.h>
+#include <io_rope.h>
+#include <registry.h>
+#include <parser.h>
+#include <memory_chk.h>
+#include <mp4_demux.h>
+#include <mp4_extract.h>
+#include <ema_mp4_ifc.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <test_util.h>
 
+/* from make/utils_test/<platform>, unless given on the command line */
+static const char *signals_dir = "../../../test/signals";
+
 void
 static test_BE()
 {
@@ -41,9 +57,552 @@ static test_BE()
     assure( get_BE_u64(bytes) == r );
 }
 
-int main(void)
+void
+static test_nal_index()
+{
+    nal_index_handle_t idx = nal_index_create();
+    nal_index_handle_t copy, load;
+    bbio_handle_t      snk, src;
+    const uint8_t      emb[3] = {0x09, 0xf0, 0x55};
+    int64_t            pos[2], cpos[2], off, base;
+    uint32_t           nal_num, size, au;
+    uint8_t            sc_size, buf[3];
+    uint8_t *          data;
+    size_t             data_size;
+
+    assure( idx != NULL );
+
+    /* enough AUs to span several blocks */
+    for (au = 0; au < 20000; au++)
+    {
+        if (au < 2)
+        {
+            pos[au] = nal_index_position(idx);
+        }
+        nal_index_add_au(idx, 3);
+        nal_index_add_nal(idx, -1, sizeof(emb), 4, emb);
+        nal_index_add_nal(idx, 1000 + au*100, 20, 4, NULL);
+        nal_index_add_nal(idx, 1000 + au*100 + 23, 50, 3, NULL);
+    }
+
+    /* random access to the second AU, embedded body skipped */
+    assure( nal_index_read_au(idx, pos[1], &nal_num) == 0 && nal_num == 3 );
+    assure( nal_index_read_nal(idx, &off, &size, &sc_size) == 0 && off == -1 && size == 3 );
+    assure( nal_index_read_nal(idx, &off, &size, &sc_size) == 0 && off == 1100 && size == 20 && sc_size == 4 );
+    assure( nal_index_read_nal(idx, &off, &size, &sc_size) == 0 && off == 1123 && size == 50 && sc_size == 3 );
+
+    /* first AU, embedded body read */
+    assure( nal_index_read_au(idx, pos[0], &nal_num) == 0 && nal_num == 3 );
+    assure( nal_index_read_nal(idx, &off, &size, &sc_size) == 0 && off == -1 );
+    assure( nal_index_read_emb(idx, buf, NULL) == 0 && memcmp(buf, emb, sizeof(emb)) == 0 );
+
+    /* AUs copied, saved and loaded behind another AU read the same */
+    copy = nal_index_create();
+    nal_index_add_au(copy, 1);
+    nal_index_add_nal(copy, 7, 10, 4, NULL);
+    assure( nal_index_copy_au(copy, idx, pos[0], &cpos[0]) == 0 && nal_index_copy_au(copy, idx, pos[1], &cpos[1]) == 0 );
+    assure( nal_index_read_au(copy, cpos[1], &nal_num) == 0 && nal_num == 3 );
+    assure( nal_index_read_nal(copy, &off, &size, &sc_size) == 0 && off == -1 );
+    assure( nal_index_read_nal(copy, &off, &size, &sc_size) == 0 && off == 1100 && size == 20 );
+
+    snk = reg_bbio_get('b', 'w');
+    snk->set_buffer(snk, NULL, 64, TRUE);
+    assure( nal_index_save(copy, snk) == 0 );
+    data = snk->get_buffer(snk, &data_size, NULL);
+    assure( (int64_t)data_size == nal_index_position(copy) );
+
+    src = reg_bbio_get('b', 'r');
+    src->set_buffer(src, data, data_size, TRUE);
+    load = nal_index_create();
+    nal_index_add_au(load, 1);
+    nal_index_add_nal(load, 5, 10, 4, NULL);
+    base = nal_index_position(load);
+    assure( nal_index_load(load, src, (int64_t)data_size) == 0 );
+    assure( nal_index_read_au(load, base + cpos[0], &nal_num) == 0 && nal_num == 3 );
+    assure( nal_index_read_nal(load, &off, &size, &sc_size) == 0 && off == -1 );
+    assure( nal_index_read_emb(load, buf, NULL) == 0 && memcmp(buf, emb, sizeof(emb)) == 0 );
+    assure( nal_index_read_nal(load, &off, &size, &sc_size) == 0 && off == 1000 && size == 20 );
+    assure( nal_index_read_au(load, base + cpos[1], &nal_num) == 0 && nal_num == 3 );
+    assure( nal_index_read_nal(load, &off, &size, &sc_size) == 0 && off == -1 );
+    assure( nal_index_read_nal(load, &off, &size, &sc_size) == 0 && off == 1100 && size == 20 );
+    assure( nal_index_read_nal(load, &off, &size, &sc_size) == 0 && off == 1123 && size == 50 );
+    src->destroy(src);
+    snk->destroy(snk);
+    nal_index_destroy(load);
+    nal_index_destroy(copy);
+
+    /* released blocks can no longer be read */
+    nal_index_release(idx, 3*NAL_INDEX_BLOCK_SIZE);
+    assure( nal_index_read_au(idx, pos[0], &nal_num) != 0 );
+
+    nal_index_destroy(idx);
+}
+
+void
+static test_ps_cache()
+{
+    ps_cache_handle_t cache = ps_cache_create();
+    list_handle_t     lst   = list_create(sizeof(buf_entry_t));
+    uint8_t           sps[4] = {0x67, 0x42, 0x00, 0x1e};
+    buf_entry_t *     entry;
+    BOOL              same;
+
+    assure( cache != NULL && lst != NULL );
+    assure( ps_cache_lookup(cache, lst, 0, sps, sizeof(sps), &same) == NULL && !same );
+
+    entry       = list_alloc_entry(lst);
+    entry->id   = 0;
+    entry->size = sizeof(sps);
+    entry->data = (uint8_t *)malloc(sizeof(sps));
+    memcpy(entry->data, sps, sizeof(sps));
+    list_add_entry(lst, entry);
+    ps_cache_update(cache, lst, entry);
+    assure( ps_cache_lookup(cache, lst, 0, sps, sizeof(sps), &same) == entry && same );
+
+    /* same id, other content; then the entry takes it over */
+    sps[3] = 0x1f;
+    assure( ps_cache_lookup(cache, lst, 0, sps, sizeof(sps), &same) == entry && !same );
+    memcpy(entry->data, sps, sizeof(sps));
+    ps_cache_update(cache, lst, entry);
+    assure( ps_cache_lookup(cache, lst, 0, sps, sizeof(sps), &same) == entry && same );
+    assure( ps_cache_lookup(cache, lst, 0, sps, sizeof(sps) - 1, &same) == entry && !same );
+
+    /* a hash hit is checked on the bytes; a forgotten list is indexed again */
+    entry->data[0] = 0x27;
+    assure( ps_cache_lookup(cache, lst, 0, sps, sizeof(sps), &same) == entry && !same );
+    ps_cache_forget(cache, lst);
+    assure( ps_cache_lookup(cache, lst, 0, entry->data, sizeof(sps), &same) == entry && same );
+
+    free(entry->data);
+    list_destroy(lst);
+    ps_cache_destroy(cache);
+}
+
+void
+static test_list_run()
+{
+    typedef struct
+    {
+        uint32_t idx;
+        uint64_t dts;
+    } idx_dts;
+
+    list_handle_t    lst = list_create_run(sizeof(idx_dts));
+    it_list_handle_t it  = it_create();
+    idx_dts *        e;
+    uint32_t         u;
+
+    assure( lst != NULL && it != NULL );
+
+    /* two runs: dts step 1024, then 1000 */
+    for (u = 0; u < 1000; u++)
+    {
+        e      = list_alloc_entry(lst);
+        e->idx = u;
+        e->dts = (u < 600) ? u*1024 : 600*1024 + (u - 600)*1000;
+        list_add_entry(lst, e);
+    }
+    assure( list_get_entry_num(lst) == 1000 );
+    assure( ((idx_dts *)list_peek_last_entry(lst))->dts == 600*1024 + 399*1000 );
+
+    /* list iteration with a mark across the run change */
+    list_it_init(lst);
+    for (u = 0; u < 599; u++)
+    {
+        list_it_get_entry(lst);
+    }
+    list_it_save_mark(lst);
+    assure( ((idx_dts *)list_it_get_entry(lst))->dts == 599*1024 );
+    assure( ((idx_dts *)list_it_peek2_entry(lst))->dts == 600*1024 + 1000 );
+    list_it_goto_mark(lst);
+    assure( ((idx_dts *)list_it_peek_entry(lst))->idx == 599 );
+
+    /* iterator copies stay valid past the next get */
+    it_init(it, lst);
+    e = it_get_entry(it);
+    assure( e->idx == 0 && ((idx_dts *)it_get_entry(it))->dts == 1024 && e->dts == 0 );
+
+    list_delete_first_entry(lst);
+    assure( list_get_entry_num(lst) == 999 && ((idx_dts *)list_peek_first_entry(lst))->idx == 1 );
+
+    it_destroy(it);
+    list_destroy(lst);
+}
+
+static void
+digest_test_cb(void *instance, const digest_t *digest)
+{
+    ((digest_t *)instance)[digest->segment] = *digest;
+}
+
+void
+static test_digest()
+{
+    /* MD5 and SHA-256 of "abc" */
+    static const uint8_t md5_abc[16] =
+        { 0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0, 0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 };
+    static const uint8_t sha256_abc[32] =
+        { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+          0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad };
+    digest_t      digests[3];
+    bbio_handle_t snk;
+    uint8_t *     buf;
+    size_t        data_size;
+
+    memset(digests, 0, sizeof(digests));
+    snk = digest_sink_create(reg_bbio_get('b', 'w'), digest_test_cb, digests);
+    assure( snk != NULL && sink_is_digest(snk) );
+    assure( snk->open(snk, (const int8_t *)"abc") == 0 );
+    snk->set_buffer(snk, NULL, 64, TRUE);
+
+    /* a header, its first byte written again while held, then two segments "abc" */
+    sink_digest_hold(snk, 0);
+    snk->write(snk, (const uint8_t *)"xdr", 3);
+    sink_digest_segment(snk);
+    snk->write(snk, (const uint8_t *)"abc", 3);
+    sink_digest_segment(snk);
+    snk->write(snk, (const uint8_t *)"abc", 3);
+    snk->seek(snk, 0, SEEK_SET);
+    snk->write(snk, (const uint8_t *)"h", 1);
+    snk->seek(snk, 0, SEEK_END);
+    sink_digest_release(snk, 0);
+    snk->close(snk);
+
+    assure( digests[0].size == 9 );
+    assure( digests[1].offset == 3 && digests[1].size == 3 && digests[2].offset == 6 && digests[2].size == 3 );
+    assure( !memcmp(digests[1].md5, md5_abc, 16) && !memcmp(digests[1].sha256, sha256_abc, 32) );
+    assure( !memcmp(digests[2].md5, md5_abc, 16) && !memcmp(digests[2].sha256, sha256_abc, 32) );
+
+    buf = snk->get_buffer(snk, &data_size, NULL);
+    assure( data_size == 9 && !memcmp(buf, "hdrabcabc", 9) );
+    FREE_CHK(buf);
+    snk->destroy(snk);
+}
+
+static void
+rope_test_cb(void *instance, const int8_t *name, uint32_t number, bbio_iovec_t *iov, size_t iov_num)
+{
+    uint32_t *delivered = (uint32_t *)instance;
+
+    assure( number == *delivered );
+    assure( number != 0 || (!strcmp((const char *)name, "init") && iov_num == 1 && !memcmp(iov[0].base, "ftyp", 4)) );
+    assure( number != 1 || (iov_num == 2 && iov[1].len == 2 && !memcmp(iov[1].base, "at", 2)) );
+    sink_rope_free_iovec(iov, iov_num);
+    (*delivered)++;
+}
+
+void
+static test_rope()
+{
+    bbio_handle_t snk;
+    bbio_iovec_t  iov[4];
+    uint8_t       buf[12];
+    uint8_t *     flat;
+    size_t        data_size;
+    uint32_t      delivered = 0;
+
+    bbio_rope_reg();
+    snk = reg_bbio_get('c', 'w');
+    assure( snk != NULL && snk->open(snk, NULL) == 0 );
+    snk->set_buffer(snk, NULL, 4, TRUE);
+
+    /* across blocks, patched back, then beyond the end: the gap reads as zeros */
+    snk->write(snk, (const uint8_t *)"xxxxabcdef", 10);
+    snk->seek(snk, 2, SEEK_SET);
+    snk->write(snk, (const uint8_t *)"hdrx", 4);
+    snk->seek(snk, 11, SEEK_SET);
+    snk->write(snk, (const uint8_t *)"z", 1);
+    assure( snk->position(snk) == 12 && snk->size(snk) == 12 );
+
+    assure( sink_rope_iovec(snk, iov, 2) == 3 );
+    assure( sink_rope_iovec(snk, iov, 4) == 3 );
+    assure( iov[0].len == 4 && iov[1].len == 4 && iov[2].len == 4 );
+    assure( !memcmp(iov[0].base, "xxhd", 4) && !memcmp(iov[1].base, "rxcd", 4) && !memcmp(iov[2].base, "ef\0z", 4) );
+
+    snk->seek(snk, 1, SEEK_SET);
+    assure( snk->read(snk, buf, sizeof(buf)) == 11 && !memcmp(buf, "xhdrxcdef\0z", 11) );
+
+    flat = snk->get_buffer(snk, &data_size, NULL);
+    assure( data_size == 12 && !memcmp(flat, "xxhdrxcdef\0z", 12) );
+    assure( sink_rope_iovec(snk, iov, 4) == 0 );
+    FREE_CHK(flat);
+
+    /* files handed over as the next one is opened, or when closed */
+    sink_rope_deliver(snk, rope_test_cb, &delivered);
+    snk->open(snk, (const int8_t *)"init");
+    snk->write(snk, (const uint8_t *)"ftyp", 4);
+    snk->open(snk, (const int8_t *)"init_1.mp4");
+    assure( delivered == 1 );
+    snk->write(snk, (const uint8_t *)"moofat", 6);
+    snk->close(snk);
+    assure( delivered == 2 && sink_rope_iovec(snk, iov, 4) == 0 );
+    snk->destroy(snk);
+}
+
+/* Muxes the signal file fn to utils_test.mp4, from start_ms to end_ms if end_ms.
+   Returns: the mp4 file, which must be FREE_CHK()ed by the caller. NULL if that failed */
+static uint8_t *
+mux_signal(const char *fn, uint32_t start_ms, uint32_t end_ms, BOOL hvc1, size_t *size)
+{
+    ema_mp4_ctrl_handle_t handle;
+    char                  path[512];
+    uint8_t *             buf = NULL;
+    FILE *                fp;
+    long                  len;
+    uint32_t              ret;
+
+    *size = 0;
+    OSAL_SNPRINTF(path, sizeof(path), "%s/%s", signals_dir, fn);
+    if (ema_mp4_mux_create(&handle) != EMA_MP4_MUXED_OK)
+    {
+        return NULL;
+    }
+    ret = ema_mp4_mux_set_input(handle, (int8_t *)path, NULL, NULL, 0, 0, 0);
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        ret = ema_mp4_mux_set_output(handle, 0, (const int8_t *)"utils_test.mp4");
+    }
+    if (ret == EMA_MP4_MUXED_OK && end_ms)
+    {
+        ret = ema_mp4_mux_set_time_range(handle, start_ms, end_ms);
+    }
+    if (ret == EMA_MP4_MUXED_OK && hvc1)
+    {
+        ret = ema_mp4_mux_set_sampleentry_hvc1(handle, 0);
+    }
+    if (ret == EMA_MP4_MUXED_OK)
+    {
+        ret = ema_mp4_mux_start(handle);
+    }
+    ema_mp4_mux_destroy(handle);
+
+    fp = (ret == EMA_MP4_MUXED_OK) ? fopen("utils_test.mp4", "rb") : NULL;
+    if (fp)
+    {
+        fseek(fp, 0, SEEK_END);
+        len = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        buf = (len > 0) ? (uint8_t *)MALLOC_CHK((size_t)len) : NULL;
+        if (buf && fread(buf, 1, (size_t)len, fp) == (size_t)len)
+        {
+            *size = (size_t)len;
+        }
+        fclose(fp);
+    }
+    if (!*size)
+    {
+        printf("%s could not be muxed\n", path);
+        FREE_CHK(buf);
+        buf = NULL;
+    }
+    return buf;
+}
+
+/* The payload of the box at the path of box types, each one a child of the one before */
+static const uint8_t *
+box_find(const uint8_t *buf, size_t size, const char *path[], size_t *payload_size)
+{
+    *payload_size = size;
+    for (; buf && *path; path++)
+    {
+        buf = mp4_demux_find_box(buf, *payload_size, (const int8_t *)*path, payload_size);
+    }
+    return buf;
+}
+
+void
+static test_clip_audio()
+{
+    /* every frame is a sync frame: the one the range starts in is the first one kept */
+    static const char *fns[] =
+        { "5ch_dd_25fps_channel_id.ac3", "7ch_ddp_25fps_channel_id.ec3", "Blue_Devils_30s.aac" };
+    static const char *stsd_path[] = { "moov", "trak", "mdia", "minf", "stbl", "stsd", NULL };
+    static const char *stts_path[] = { "moov", "trak", "mdia", "minf", "stbl", "stts", NULL };
+    static const char *mdhd_path[] = { "moov", "trak", "mdia", "mdhd", NULL };
+    static const char *elst_path[] = { "moov", "trak", "edts", "elst", NULL };
+    uint32_t u;
+
+    for (u = 0; u < sizeof(fns)/sizeof(fns[0]); u++)
+    {
+        size_t         size, stsd_size, stts_size, mdhd_size, elst_size;
+        uint8_t *      mp4 = mux_signal(fns[u], 3100, 7000, FALSE, &size);
+        const uint8_t *stsd = box_find(mp4, size, stsd_path, &stsd_size);
+        const uint8_t *stts = box_find(mp4, size, stts_path, &stts_size);
+        const uint8_t *mdhd = box_find(mp4, size, mdhd_path, &mdhd_size);
+        const uint8_t *elst = box_find(mp4, size, elst_path, &elst_size);
+
+        printf("Clipping %s\n", fns[u]);
+        assure( stsd != NULL && stsd_size >= 16 && get_BE_u32(stsd + 4) == 1 );
+        assure( stts != NULL && stts_size >= 16 && mdhd != NULL && mdhd_size >= 24 && mdhd[0] == 0 );
+        assure( elst != NULL && elst_size >= 16 && elst[0] == 0 && get_BE_u32(elst + 4) == 1 );
+        if (stts && mdhd && elst)
+        {
+            uint64_t start = 3100ULL*get_BE_u32(mdhd + 12)/1000;
+
+            /* the media time of the range start in the first frame kept */
+            assure( get_BE_u32(elst + 12) == start % get_BE_u32(stts + 12) );
+        }
+        FREE_CHK(mp4);
+    }
+    OSAL_DEL_FILE("utils_test.mp4");
+}
+
+/* Returns: the number of the first nal_num NAL types of the Annex B es found */
+static uint32_t
+es_nal_types(const uint8_t *es, size_t size, BOOL hevc, uint8_t *types, uint32_t nal_num)
+{
+    uint32_t n = 0;
+    size_t   u;
+
+    for (u = 0; u + 3 < size && n < nal_num; u++)
+    {
+        if (es[u] == 0 && es[u + 1] == 0 && es[u + 2] == 1)
+        {
+            types[n++] = hevc ? (es[u + 3] >> 1) & 0x3F : es[u + 3] & 0x1F;
+            u += 2;
+        }
+    }
+    return n;
+}
+
+void
+static test_extract_ps_order()
+{
+    /* AUD, then the parameter sets put back from the sample entry, then the IDR slice */
+    static const uint8_t avc_types[4]  = { 9, 7, 8, 5 };
+    static const uint8_t hevc_types[5] = { 35, 32, 33, 34, 20 };
+    uint32_t hevc;
+
+    for (hevc = 0; hevc < 2; hevc++)
+    {
+        size_t            size, es_size = 0;
+        uint8_t *         mp4 = mux_signal(hevc ? "720p_25fps_6f.h265" : "720p_25fps_6f.h264", 0, 0, hevc, &size);
+        bbio_handle_t     src = NULL;
+        bbio_handle_t     snk = reg_bbio_get('b', 'w');
+        mp4_ctrl_handle_t demuxer = NULL;
+        uint8_t *         es = NULL;
+        uint8_t           types[5];
+
+        assure( mp4 != NULL && snk != NULL );
+        if (mp4)
+        {
+            src = reg_bbio_get('b', 'r');
+            src->set_buffer(src, mp4, size, FALSE);
+            demuxer = mp4_demux_create(src);
+        }
+        assure( demuxer != NULL && demuxer->stream_num == 1 );
+        if (demuxer && snk)
+        {
+            snk->set_buffer(snk, NULL, 4096, TRUE);
+            assure( mp4_extract_es(1, demuxer->tracks, &snk) == EMA_MP4_MUXED_OK );
+            es = snk->get_buffer(snk, &es_size, NULL);
+        }
+        if (hevc)
+        {
+            assure( es_nal_types(es, es_size, TRUE, types, 5) == 5 && !memcmp(types, hevc_types, 5) );
+        }
+        else
+        {
+            assure( es_nal_types(es, es_size, FALSE, types, 4) == 4 && !memcmp(types, avc_types, 4) );
+        }
+
+        FREE_CHK(es);
+        if (demuxer)
+        {
+            mp4_demux_destroy(demuxer);
+        }
+        if (src)
+        {
+            src->destroy(src);
+        }
+        if (snk)
+        {
+            snk->destroy(snk);
+        }
+        FREE_CHK(mp4);
+    }
+    OSAL_DEL_FILE("utils_test.mp4");
+}
+
+#ifdef ENABLE_MP4_ALLOC_HOOKS
+typedef struct
+{
+    uint32_t alloc_num;
+    uint32_t free_num;
+} alloc_count_t;
+
+static void *
+count_alloc(void *ctx, size_t size)
+{
+    ((alloc_count_t *)ctx)->alloc_num++;
+    return malloc(size);
+}
+
+static void *
+count_realloc(void *ctx, void *ptr, size_t size)
+{
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+static void
+count_free(void *ctx, void *ptr)
+{
+    ((alloc_count_t *)ctx)->free_num++;
+    free(ptr);
+}
+
+void
+static test_allocator()
+{
+    alloc_count_t   count     = { 0, 0 };
+    mp4_allocator_t allocator = { count_alloc, count_realloc, count_free, &count };
+    list_handle_t   lst;
+    uint64_t *      e;
+    parser_handle_t parser;
+
+    /* blocks go back to the allocator they came from, whichever is in scope */
+    MEM_ALLOC_SCOPE_CHK(&allocator, lst = list_create(sizeof(uint64_t)));
+    assure( lst != NULL && count.alloc_num > 0 && MEM_ALLOC_GET_CHK() == NULL );
+    count.alloc_num = 0;
+    e = list_alloc_entry(lst);
+    assure( e != NULL && count.alloc_num == 0 );
+    list_add_entry(lst, e);
+    MEM_ALLOC_SCOPE_CHK(&allocator, e = list_alloc_entry(lst));
+    list_add_entry(lst, e);
+    assure( count.alloc_num == 1 );
+    list_destroy(lst);
+    assure( count.free_num == 2 );
+
+    /* a parser allocates from its own one */
+    count.alloc_num = count.free_num = 0;
+    reg_parser_init();
+    parser_avc_reg();
+    parser = reg_parser_get_ex((const int8_t *)"h264", DSI_TYPE_MP4FF, &allocator);
+    assure( parser != NULL && parser->allocator == &allocator && count.alloc_num > 0 );
+    parser_call_destroy(parser);
+    assure( count.free_num == count.alloc_num );
+}
+#endif
+
+int main(int argc, char **argv)
 {
+    if (argc > 1)
+    {
+        signals_dir = argv[1];
+    }
+    bbio_buf_reg();
     test_BE();
+    test_nal_index();
+    test_ps_cache();
+    test_list_run();
+    test_digest();
+    test_rope();
+    test_clip_audio();
+    test_extract_ps_order();
+#ifdef ENABLE_MP4_ALLOC_HOOKS
+    test_allocator();
+#endif
 
     return 0;
 }